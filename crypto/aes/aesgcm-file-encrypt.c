@@ -31,10 +31,25 @@
 #include <wolfssl/wolfcrypt/memory.h>
 
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#if defined(__linux__) && !defined(NO_AESGCM_URING)
+    #include <sys/syscall.h>
+    #include <linux/io_uring.h>
+    #define AESGCM_HAVE_URING
+    #ifndef __NR_io_uring_setup
+        #define __NR_io_uring_setup     425
+    #endif
+    #ifndef __NR_io_uring_enter
+        #define __NR_io_uring_enter     426
+    #endif
+#endif
+
 #ifdef WOLFSSL_AESGCM_STREAM
 
 #ifdef OPENSSL_EXTRA
@@ -70,6 +85,31 @@ memory alignments, leverage cache speedup, and minimize OS overhead.
     #define AESGCM_TAG_SIZE AES_BLOCK_SIZE
 #endif
 
+#ifndef AESGCM_URING_CHUNK_SIZE
+    /* Use 1 MByte reads and writes with the io_uring engine */
+    #define AESGCM_URING_CHUNK_SIZE (1 << 20)
+#endif
+
+#ifndef AESGCM_MMAP_CHUNK_SIZE
+    /* Largest update on the mappings of the mmap engine */
+    #define AESGCM_MMAP_CHUNK_SIZE (1 << 30)
+#endif
+
+#ifndef AESGCM_SEGMENT_SIZE
+    /* Use 1 MByte of plain text per segment in the segmented format */
+    #define AESGCM_SEGMENT_SIZE (1 << 20)
+#endif
+
+#ifndef AESGCM_SEG_MAX_THREADS
+    #define AESGCM_SEG_MAX_THREADS 64
+#endif
+
+#define WOLFCRYPT_SEG_MAGIC "WOLFSEG"
+#define AESGCM_SEG_PREFIX_SIZE 7
+#define AESGCM_SEG_NONCE_SIZE  GCM_NONCE_MID_SZ
+#define AESGCM_SEG_HEADER_SIZE (sizeof(WOLFCRYPT_SEG_MAGIC) - 1 + 4 + \
+                                AESGCM_SEG_PREFIX_SIZE + 8)
+
 static size_t get_block_sz(int fd)
 {
     struct stat st;
@@ -151,6 +191,437 @@ static int check_file_permission(const char *fileName, uid_t owner, gid_t group)
         return 0;
     }
 }
+/* Each of the I/O engines streams the rest of in_fd, from its current
+ * offset, through the GCM update function into out_fd at its current offset:
+ *   IO_ENGINE_RW    read() into in_buf, update into out_buf, write()
+ *   IO_ENGINE_MMAP  update straight from the input mapping into the pre-sized
+ *                   output mapping - no copies through user space buffers
+ *   IO_ENGINE_URING reads and writes are queued on an io_uring with two
+ *                   halves of the buffers, so the next chunk is read and the
+ *                   previous one written while the current one is encrypted
+ */
+typedef enum {
+    IO_ENGINE_RW,
+    IO_ENGINE_MMAP,
+    IO_ENGINE_URING
+} io_engine;
+
+typedef int (*gcm_update_cb)(Aes* aes, byte* out, const byte* in, word32 sz,
+                             const byte* authIn, word32 authInSz);
+
+static int stream_rw(Aes* gcm, gcm_update_cb update, int in_fd, int out_fd,
+                     byte* in_buf, byte* out_buf, size_t buffer_size)
+{
+    int read_size;
+    int ret = 0;
+
+    while (ret == 0) {
+         read_size = read(in_fd, in_buf, buffer_size);
+         if (read_size <= 0)
+             break;
+
+         ret = update(gcm, out_buf, in_buf, read_size, NULL, 0);
+         if (ret == 0) {
+             if (write(out_fd, out_buf, read_size) != read_size) {
+                 perror("write");
+                 ret = -1;
+             }
+         }
+     }
+    return ret;
+}
+
+static int stream_mmap(Aes* gcm, gcm_update_cb update, int in_fd, int out_fd)
+{
+    off_t in_off = lseek(in_fd, 0, SEEK_CUR);
+    off_t out_off = lseek(out_fd, 0, SEEK_CUR);
+    byte* in_map;
+    byte* out_map;
+    size_t len;
+    size_t done;
+    word32 n;
+    int ret = 0;
+
+    if (in_off == -1 || out_off == -1) {
+        perror("lseek");
+        return -1;
+    }
+    len = get_file_sz(in_fd) - in_off;
+    if (len == 0)
+        return 0;
+
+    /* Mappings start at offset 0 as the headers aren't page aligned */
+    if (ftruncate(out_fd, out_off + len) != 0) {
+        perror("ftruncate");
+        return -1;
+    }
+    in_map = mmap(NULL, in_off + len, PROT_READ, MAP_SHARED, in_fd, 0);
+    if (in_map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    out_map = mmap(NULL, out_off + len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   out_fd, 0);
+    if (out_map == MAP_FAILED) {
+        perror("mmap");
+        munmap(in_map, in_off + len);
+        return -1;
+    }
+    madvise(in_map, in_off + len, MADV_SEQUENTIAL);
+    madvise(out_map, out_off + len, MADV_SEQUENTIAL);
+
+    for (done = 0; ret == 0 && done < len; done += n) {
+        n = (len - done > AESGCM_MMAP_CHUNK_SIZE) ? AESGCM_MMAP_CHUNK_SIZE :
+                                                    (word32)(len - done);
+        ret = update(gcm, out_map + out_off + done, in_map + in_off + done,
+                     n, NULL, 0);
+    }
+
+    munmap(in_map, in_off + len);
+    if (munmap(out_map, out_off + len) != 0) {
+        perror("munmap");
+        ret = -1;
+    }
+    if (ret == 0 && lseek(out_fd, out_off + len, SEEK_SET) == -1) {
+        perror("lseek");
+        ret = -1;
+    }
+    return ret;
+}
+
+#ifdef AESGCM_HAVE_URING
+/* A minimal io_uring - talks to the kernel with system calls so liburing is
+ * not required */
+typedef struct {
+    int fd;
+    void* sq_ring;
+    size_t sq_ring_sz;
+    unsigned* sq_head;
+    unsigned* sq_ktail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    unsigned sq_tail;
+    unsigned inflight;    /* SQEs queued whose CQE hasn't been reaped */
+    struct io_uring_sqe* sqes;
+    size_t sqes_sz;
+    void* cq_ring;
+    size_t cq_ring_sz;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+} file_uring;
+
+/* A read or write on the io_uring, resubmitted until all of it is done */
+typedef struct {
+    int op;
+    int fd;
+    byte* buf;
+    size_t len;
+    off_t off;
+    int busy;
+} uring_io;
+
+/* Two reads and two writes are in flight at most */
+#define URING_ENTRIES 4
+/* user_data of the cancels queued when draining the ring */
+#define URING_CANCEL  URING_ENTRIES
+
+static void uring_free(file_uring* ring)
+{
+    if (ring->fd != -1)
+        close(ring->fd);
+    if (ring->sq_ring != NULL)
+        munmap(ring->sq_ring, ring->sq_ring_sz);
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_sz);
+    if (ring->cq_ring != NULL)
+        munmap(ring->cq_ring, ring->cq_ring_sz);
+}
+
+static int uring_init(file_uring* ring)
+{
+    struct io_uring_params params;
+    byte* p;
+
+    XMEMSET(ring, 0, sizeof(*ring));
+    XMEMSET(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd < 0)
+        return -1;
+
+    ring->sq_ring_sz = params.sq_off.array +
+                       params.sq_entries * sizeof(unsigned);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    ring->cq_ring_sz = params.cq_off.cqes +
+                       params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+    if (ring->sq_ring == MAP_FAILED || ring->sqes == MAP_FAILED ||
+        ring->cq_ring == MAP_FAILED) {
+        if (ring->sq_ring == MAP_FAILED)
+            ring->sq_ring = NULL;
+        if (ring->sqes == MAP_FAILED)
+            ring->sqes = NULL;
+        if (ring->cq_ring == MAP_FAILED)
+            ring->cq_ring = NULL;
+        uring_free(ring);
+        return -1;
+    }
+
+    p = ring->sq_ring;
+    ring->sq_head = (unsigned*)(p + params.sq_off.head);
+    ring->sq_ktail = (unsigned*)(p + params.sq_off.tail);
+    ring->sq_mask = *(unsigned*)(p + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(p + params.sq_off.array);
+    ring->sq_tail = *ring->sq_ktail;
+    p = ring->cq_ring;
+    ring->cq_head = (unsigned*)(p + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(p + params.cq_off.tail);
+    ring->cq_mask = *(unsigned*)(p + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(p + params.cq_off.cqes);
+    return 0;
+}
+
+static int uring_enter(file_uring* ring, unsigned to_submit, int wait)
+{
+    int ret;
+
+    do {
+        ret = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit,
+                           wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0,
+                           NULL, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0)
+        perror("io_uring_enter");
+    return ret < 0 ? -1 : 0;
+}
+
+static struct io_uring_sqe* uring_get_sqe(file_uring* ring)
+{
+    unsigned slot = ring->sq_tail & ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[slot];
+
+    XMEMSET(sqe, 0, sizeof(*sqe));
+    ring->sq_array[slot] = slot;
+    return sqe;
+}
+
+/* Queue the SQE from uring_get_sqe. It counts as in flight from here on:
+ * if io_uring_enter fails it is still in the ring and goes with the next
+ * submit. */
+static void uring_queue(file_uring* ring)
+{
+    ring->sq_tail++;
+    ring->inflight++;
+    __atomic_store_n(ring->sq_ktail, ring->sq_tail, __ATOMIC_RELEASE);
+}
+
+/* SQEs queued that the kernel hasn't taken yet */
+static unsigned uring_unsubmitted(file_uring* ring)
+{
+    return ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static int uring_submit(file_uring* ring, uring_io* ios, int idx)
+{
+    struct io_uring_sqe* sqe = uring_get_sqe(ring);
+
+    sqe->opcode = (byte)ios[idx].op;
+    sqe->fd = ios[idx].fd;
+    sqe->addr = (unsigned long)ios[idx].buf;
+    sqe->len = (word32)ios[idx].len;
+    sqe->off = ios[idx].off;
+    sqe->user_data = idx;
+    uring_queue(ring);
+    ios[idx].busy = 1;
+    return uring_enter(ring, uring_unsubmitted(ring), 0);
+}
+
+/* Take the next CQE off the ring, waiting for one if need be */
+static int uring_reap(file_uring* ring, struct io_uring_cqe* out)
+{
+    unsigned head = *ring->cq_head;
+
+    while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (uring_enter(ring, uring_unsubmitted(ring), 1) != 0)
+            return -1;
+    }
+    *out = ring->cqes[head & ring->cq_mask];
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    ring->inflight--;
+    return 0;
+}
+
+/* Cancel the reads and writes still in flight and reap every CQE, so the
+ * kernel is done with the buffers before they are freed. Closing the ring
+ * doesn't wait for them. */
+static void uring_drain(file_uring* ring, uring_io* ios)
+{
+    struct io_uring_sqe* sqe;
+    struct io_uring_cqe cqe;
+    int i;
+
+    for (i = 0; i < URING_ENTRIES; i++) {
+        /* a cancel is only to hurry things along, skip it if the SQ is full */
+        if (!ios[i].busy || uring_unsubmitted(ring) > ring->sq_mask)
+            continue;
+        sqe = uring_get_sqe(ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = i;
+        sqe->user_data = URING_CANCEL;
+        uring_queue(ring);
+    }
+    while (ring->inflight > 0) {
+        if (uring_reap(ring, &cqe) != 0) {
+            /* the kernel may still write into the buffers */
+            fprintf(stderr, "Unable to reap io_uring requests\n");
+            abort();
+        }
+        if (cqe.user_data != URING_CANCEL)
+            ios[cqe.user_data].busy = 0;
+    }
+}
+
+/* Reap completions until ios[idx] is done. Short transfers are resubmitted
+ * for the rest. */
+static int uring_wait(file_uring* ring, uring_io* ios, int idx)
+{
+    while (ios[idx].busy) {
+        struct io_uring_cqe cqe;
+        uring_io* io;
+
+        if (uring_reap(ring, &cqe) != 0)
+            return -1;
+        io = &ios[cqe.user_data];
+        io->busy = 0;
+        if (cqe.res <= 0) {
+            fprintf(stderr, "io_uring %s failed: %s\n",
+                    io->op == IORING_OP_READ ? "read" : "write",
+                    cqe.res < 0 ? strerror(-cqe.res) : "end of file");
+            return -1;
+        }
+        io->buf += cqe.res;
+        io->len -= cqe.res;
+        io->off += cqe.res;
+        if (io->len > 0 && uring_submit(ring, ios, (int)(io - ios)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int stream_uring(Aes* gcm, gcm_update_cb update, int in_fd, int out_fd,
+                        byte* in_buf, byte* out_buf, size_t buffer_size)
+{
+    file_uring ring;
+    /* reads into the in_buf halves are 0 and 1, writes from out_buf 2 and 3 */
+    uring_io ios[URING_ENTRIES];
+    size_t chunk = buffer_size / 2;
+    size_t chunk_len[2];
+    off_t in_off = lseek(in_fd, 0, SEEK_CUR);
+    off_t out_off = lseek(out_fd, 0, SEEK_CUR);
+    size_t to_read;
+    size_t to_encrypt;
+    int cur = 0;
+    int ret = 0;
+    int i;
+
+    if (in_off == -1 || out_off == -1) {
+        perror("lseek");
+        return -1;
+    }
+    if (uring_init(&ring) != 0) {
+        fprintf(stderr, "io_uring isn't available, using read/write\n");
+        return stream_rw(gcm, update, in_fd, out_fd, in_buf, out_buf,
+                         buffer_size);
+    }
+    XMEMSET(ios, 0, sizeof(ios));
+    to_read = to_encrypt = get_file_sz(in_fd) - in_off;
+
+    for (i = 0; ret == 0 && i < 2 && to_read > 0; i++) {
+        chunk_len[i] = to_read < chunk ? to_read : chunk;
+        ios[i].op = IORING_OP_READ;
+        ios[i].fd = in_fd;
+        ios[i].buf = in_buf + i * chunk;
+        ios[i].len = chunk_len[i];
+        ios[i].off = in_off;
+        in_off += chunk_len[i];
+        to_read -= chunk_len[i];
+        ret = uring_submit(&ring, ios, i);
+    }
+
+    while (ret == 0 && to_encrypt > 0) {
+        size_t n = chunk_len[cur];
+
+        /* the chunk to encrypt and the last write from this out_buf half */
+        ret = uring_wait(&ring, ios, cur);
+        if (ret == 0)
+            ret = uring_wait(&ring, ios, 2 + cur);
+        if (ret == 0)
+            ret = update(gcm, out_buf + cur * chunk, in_buf + cur * chunk,
+                         (word32)n, NULL, 0);
+        if (ret == 0) {
+            ios[2 + cur].op = IORING_OP_WRITE;
+            ios[2 + cur].fd = out_fd;
+            ios[2 + cur].buf = out_buf + cur * chunk;
+            ios[2 + cur].len = n;
+            ios[2 + cur].off = out_off;
+            out_off += n;
+            to_encrypt -= n;
+            ret = uring_submit(&ring, ios, 2 + cur);
+        }
+        /* this in_buf half is free again - read ahead into it */
+        if (ret == 0 && to_read > 0) {
+            chunk_len[cur] = to_read < chunk ? to_read : chunk;
+            ios[cur].buf = in_buf + cur * chunk;
+            ios[cur].len = chunk_len[cur];
+            ios[cur].off = in_off;
+            in_off += chunk_len[cur];
+            to_read -= chunk_len[cur];
+            ret = uring_submit(&ring, ios, cur);
+        }
+        cur ^= 1;
+    }
+    for (i = 2; ret == 0 && i < URING_ENTRIES; i++)
+        ret = uring_wait(&ring, ios, i);
+
+    /* After an error reads and writes may still be in flight. They must be
+     * reaped before the caller frees the buffers. */
+    uring_drain(&ring, ios);
+    uring_free(&ring);
+    if (ret == 0 && lseek(out_fd, out_off, SEEK_SET) == -1) {
+        perror("lseek");
+        ret = -1;
+    }
+    return ret;
+}
+#endif /* AESGCM_HAVE_URING */
+
+static int stream_file_AesGCM(Aes* gcm, gcm_update_cb update, io_engine engine,
+                              int in_fd, int out_fd, byte* in_buf,
+                              byte* out_buf, size_t buffer_size)
+{
+    switch (engine) {
+    case IO_ENGINE_MMAP:
+        return stream_mmap(gcm, update, in_fd, out_fd);
+#ifdef AESGCM_HAVE_URING
+    case IO_ENGINE_URING:
+        return stream_uring(gcm, update, in_fd, out_fd, in_buf, out_buf,
+                            buffer_size);
+#endif
+    default:
+        return stream_rw(gcm, update, in_fd, out_fd, in_buf, out_buf,
+                         buffer_size);
+    }
+}
+
 /*!
     \ingroup AES
     \brief This function encrypts the input file containing plain text
@@ -164,15 +635,16 @@ static int check_file_permission(const char *fileName, uid_t owner, gid_t group)
     \param out_file file name to hold the cipher text
     \param key_str key must be 32 Bytes
     \param iv_str IV length must be 16 Bytes
+    \param engine I/O engine to read and write the files with
 */
 int encrypt_file_AesGCM(const char *in_file, const char *out_file,
-                        const char *key_str, const char *iv_str)
+                        const char *key_str, const char *iv_str,
+                        io_engine engine)
 {
     byte* in_buf;
     byte* out_buf;
     int in_fd;
     int out_fd;
-    int read_size;
     int ret = 0;
     size_t buffer_size;
     size_t memory_size;
@@ -200,7 +672,8 @@ int encrypt_file_AesGCM(const char *in_file, const char *out_file,
         return -1;
     }
 
-    out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    /* The mmap engine maps the output file, which needs read access */
+    out_fd = open(out_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
 
     if (out_fd == -1) {
         perror("open");
@@ -213,6 +686,14 @@ int encrypt_file_AesGCM(const char *in_file, const char *out_file,
     if (buffer_size < MIN_BUFFER_SIZE) {
         buffer_size = MIN_BUFFER_SIZE;
     }
+    /* mmap doesn't copy through the buffers and io_uring uses two halves */
+    if (engine == IO_ENGINE_MMAP) {
+        buffer_size = MIN_BUFFER_SIZE;
+    }
+    else if (engine == IO_ENGINE_URING &&
+             buffer_size > 2 * AESGCM_URING_CHUNK_SIZE) {
+        buffer_size = 2 * AESGCM_URING_CHUNK_SIZE;
+    }
 
     in_buf = XMALLOC(buffer_size, NULL, DYNAMIC_TYPE_TMP_BUFFER);
     if (in_buf == NULL) {
@@ -267,20 +748,10 @@ int encrypt_file_AesGCM(const char *in_file, const char *out_file,
         }
     }
 
-    while (ret == 0) {
-         read_size = read(in_fd, in_buf, buffer_size);
-         if (read_size <= 0)
-             break;
-
-         ret = wc_AesGcmEncryptUpdate(&gcm, out_buf, in_buf, read_size, NULL, 0);
-         if (ret == 0) {
-             if (write(out_fd, out_buf, read_size) != read_size) {
-                 perror("write");
-                 ret = -1;
-                 goto exit;
-             }
-         }
-     }
+    if (ret == 0) {
+        ret = stream_file_AesGCM(&gcm, wc_AesGcmEncryptUpdate, engine, in_fd,
+                                 out_fd, in_buf, out_buf, buffer_size);
+    }
 
     if (ret == 0) {
         ret = wc_AesGcmEncryptFinal(&gcm, tag_enc, AESGCM_TAG_SIZE);
@@ -340,9 +811,10 @@ exit:
     \param in_file filename with the cipher text
     \param out_file file name to hold plain text
     \param key_str key must be 32 Bytes
+    \param engine I/O engine to read and write the files with
 */
 int decrypt_file_AesGCM(const char *in_file, const char *out_file,
-                        const char *key_str)
+                        const char *key_str, io_engine engine)
 {
     byte* in_buf;
     byte* out_buf;
@@ -378,7 +850,8 @@ int decrypt_file_AesGCM(const char *in_file, const char *out_file,
         return -1;
     }
 
-    out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    /* The mmap engine maps the output file, which needs read access */
+    out_fd = open(out_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
 
     if (out_fd == -1) {
         perror("open");
@@ -391,6 +864,14 @@ int decrypt_file_AesGCM(const char *in_file, const char *out_file,
     if (buffer_size < MIN_BUFFER_SIZE) {
         buffer_size = MIN_BUFFER_SIZE;
     }
+    /* mmap doesn't copy through the buffers and io_uring uses two halves */
+    if (engine == IO_ENGINE_MMAP) {
+        buffer_size = MIN_BUFFER_SIZE;
+    }
+    else if (engine == IO_ENGINE_URING &&
+             buffer_size > 2 * AESGCM_URING_CHUNK_SIZE) {
+        buffer_size = 2 * AESGCM_URING_CHUNK_SIZE;
+    }
 
     in_buf = XMALLOC(buffer_size, NULL, DYNAMIC_TYPE_TMP_BUFFER);
     if (in_buf == NULL) {
@@ -450,20 +931,10 @@ int decrypt_file_AesGCM(const char *in_file, const char *out_file,
 
     ret = wc_AesGcmDecryptInit(&gcm, key, AES_KEY_SIZE, iv, AES_IV_SIZE);
 
-    while (ret == 0) {
-         read_size = read(in_fd, in_buf, buffer_size);
-         if (read_size <= 0)
-             break;
-
-         ret = wc_AesGcmDecryptUpdate(&gcm, out_buf, in_buf, read_size, NULL, 0);
-         if (ret == 0) {
-             if (write(out_fd, out_buf, read_size) != read_size) {
-                 perror("write");
-                 ret = -1;
-                 goto exit;
-             }
-         }
-     }
+    if (ret == 0) {
+        ret = stream_file_AesGCM(&gcm, wc_AesGcmDecryptUpdate, engine, in_fd,
+                                 out_fd, in_buf, out_buf, buffer_size);
+    }
 
     if (ret == 0) {
         /* The tag param is used to compare to the
@@ -500,6 +971,477 @@ exit:
     return ret;
 }
 
+/* Segmented format: header | segment 0 | segment 1 | ...
+ * header:  WOLFCRYPT_SEG_MAGIC | segment size (4) | nonce prefix (7) |
+ *          plain text size (8), big endian
+ * segment: cipher text (segment size, less for the final one) | TAG
+ * Every segment has its own nonce: nonce prefix | segment index (4) | final
+ * flag (1). The whole header is the additional authenticated data of every
+ * segment, so segments can't be moved, dropped, or mixed between files. */
+static void seg_put_be(byte* out, word64 val, int len)
+{
+    while (len-- > 0) {
+        out[len] = (byte)val;
+        val >>= 8;
+    }
+}
+
+static word64 seg_get_be(const byte* in, int len)
+{
+    word64 val = 0;
+    int i;
+
+    for (i = 0; i < len; i++)
+        val = (val << 8) | in[i];
+    return val;
+}
+
+static int seg_pread_full(int fd, byte* buf, size_t len, off_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int seg_pwrite_full(int fd, const byte* buf, size_t len, off_t offset)
+{
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static word64 seg_count(word64 plain_size, word32 seg_size)
+{
+    /* An empty file still has one (empty) final segment */
+    if (plain_size == 0)
+        return 1;
+    return (plain_size + seg_size - 1) / seg_size;
+}
+
+static off_t seg_cipher_offset(word64 seg, word32 seg_size)
+{
+    return AESGCM_SEG_HEADER_SIZE + seg * ((word64)seg_size + AESGCM_TAG_SIZE);
+}
+
+static word64 seg_cipher_size(word64 plain_size, word32 seg_size)
+{
+    return AESGCM_SEG_HEADER_SIZE + plain_size +
+           seg_count(plain_size, seg_size) * AESGCM_TAG_SIZE;
+}
+
+/* Work shared by the threads that encrypt or decrypt the segments */
+typedef struct {
+    int in_fd;
+    int out_fd;
+    int decrypt;
+    byte key[AES_KEY_SIZE];
+    byte header[AESGCM_SEG_HEADER_SIZE];
+    word32 seg_size;
+    word64 plain_size;
+    word64 num_segs;
+    word64 end_seg;     /* one past the last segment to handle */
+    word64 range_start; /* plain text range written out when decrypting */
+    word64 range_end;
+    word64 next_seg;    /* next segment to handle, taken atomically */
+    int ret;            /* first error of any thread */
+} seg_job;
+
+static int seg_process(seg_job* job, Aes* gcm, word64 seg, byte* in_buf,
+                       byte* out_buf)
+{
+    byte nonce[AESGCM_SEG_NONCE_SIZE];
+    word64 plain_off = seg * job->seg_size;
+    word32 len = job->seg_size;
+    off_t cipher_off = seg_cipher_offset(seg, job->seg_size);
+    int ret;
+
+    if (plain_off + len > job->plain_size)
+        len = (word32)(job->plain_size - plain_off);
+
+    XMEMCPY(nonce, job->header + sizeof(WOLFCRYPT_SEG_MAGIC) - 1 + 4,
+            AESGCM_SEG_PREFIX_SIZE);
+    seg_put_be(nonce + AESGCM_SEG_PREFIX_SIZE, seg, 4);
+    nonce[AESGCM_SEG_NONCE_SIZE - 1] = (seg == job->num_segs - 1);
+
+    if (!job->decrypt) {
+        if (seg_pread_full(job->in_fd, in_buf, len, plain_off) != 0) {
+            perror("pread");
+            return -1;
+        }
+        ret = wc_AesGcmEncrypt(gcm, out_buf, in_buf, len, nonce,
+                               AESGCM_SEG_NONCE_SIZE, out_buf + len,
+                               AESGCM_TAG_SIZE, job->header,
+                               AESGCM_SEG_HEADER_SIZE);
+        if (ret == 0 && seg_pwrite_full(job->out_fd, out_buf,
+                                        len + AESGCM_TAG_SIZE,
+                                        cipher_off) != 0) {
+            perror("pwrite");
+            ret = -1;
+        }
+    }
+    else {
+        word64 start = plain_off;
+        word64 end = plain_off + len;
+
+        if (seg_pread_full(job->in_fd, in_buf, len + AESGCM_TAG_SIZE,
+                           cipher_off) != 0) {
+            perror("pread");
+            return -1;
+        }
+        ret = wc_AesGcmDecrypt(gcm, out_buf, in_buf, len, nonce,
+                               AESGCM_SEG_NONCE_SIZE, in_buf + len,
+                               AESGCM_TAG_SIZE, job->header,
+                               AESGCM_SEG_HEADER_SIZE);
+        if (ret != 0) {
+            fprintf(stderr, "Authentication of segment %llu failed\n",
+                    (unsigned long long)seg);
+            return ret;
+        }
+        /* Only write the part of the segment inside the requested range */
+        if (start < job->range_start)
+            start = job->range_start;
+        if (end > job->range_end)
+            end = job->range_end;
+        if (start < end && seg_pwrite_full(job->out_fd,
+                                           out_buf + (start - plain_off),
+                                           end - start,
+                                           start - job->range_start) != 0) {
+            perror("pwrite");
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+static void* seg_worker(void* arg)
+{
+    seg_job* job = (seg_job*)arg;
+    size_t buf_size = (size_t)job->seg_size + AESGCM_TAG_SIZE;
+    byte* in_buf;
+    byte* out_buf;
+    Aes gcm;
+    int aes_initialized = 0;
+    int expected = 0;
+    int ret;
+
+    in_buf = XMALLOC(buf_size, NULL, DYNAMIC_TYPE_TMP_BUFFER);
+    out_buf = XMALLOC(buf_size, NULL, DYNAMIC_TYPE_TMP_BUFFER);
+    if (in_buf == NULL || out_buf == NULL) {
+        perror("malloc");
+        ret = MEMORY_E;
+        goto exit;
+    }
+
+    /* Each thread has its own key schedule - an Aes object isn't shared */
+    ret = wc_AesInit(&gcm, NULL, INVALID_DEVID);
+    if (ret != 0) {
+        printf("AesInit returned: %d\n", ret);
+        goto exit;
+    }
+    aes_initialized = 1;
+    ret = wc_AesGcmSetKey(&gcm, job->key, AES_KEY_SIZE);
+
+    while (ret == 0 && __atomic_load_n(&job->ret, __ATOMIC_RELAXED) == 0) {
+        word64 seg = __atomic_fetch_add(&job->next_seg, 1, __ATOMIC_RELAXED);
+        if (seg >= job->end_seg)
+            break;
+        ret = seg_process(job, &gcm, seg, in_buf, out_buf);
+    }
+
+exit:
+    if (ret != 0) {
+        __atomic_compare_exchange_n(&job->ret, &expected, ret, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+    if (aes_initialized) {
+        wc_AesFree(&gcm);
+    }
+    if (in_buf != NULL)
+        wc_ForceZero(in_buf, buf_size);
+    if (out_buf != NULL)
+        wc_ForceZero(out_buf, buf_size);
+    XFREE(in_buf, NULL, DYNAMIC_TYPE_TMP_BUFFER);
+    XFREE(out_buf, NULL, DYNAMIC_TYPE_TMP_BUFFER);
+    return NULL;
+}
+
+static int seg_run(seg_job* job, word64 first_seg, int threads)
+{
+    pthread_t tid[AESGCM_SEG_MAX_THREADS];
+    int started;
+    int i;
+
+    job->next_seg = first_seg;
+    if ((word64)threads > job->end_seg - first_seg)
+        threads = (int)(job->end_seg - first_seg);
+
+    /* The calling thread is one of the workers */
+    for (started = 0; started < threads - 1; started++) {
+        if (pthread_create(&tid[started], NULL, seg_worker, job) != 0) {
+            perror("pthread_create");
+            break;
+        }
+    }
+    seg_worker(job);
+    for (i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    return job->ret;
+}
+
+static int seg_threads(int threads)
+{
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > AESGCM_SEG_MAX_THREADS)
+        threads = AESGCM_SEG_MAX_THREADS;
+    return threads;
+}
+
+/*!
+    \ingroup AES
+    \brief This function encrypts the input file containing plain text
+     into the segmented cipher file format. The plain text is cut into
+     segments of seg_size bytes that are encrypted in parallel, each with
+     its own nonce and authentication tag (TAG).
+
+    \return 0 on successfully encrypting the file
+
+    \param in_file filename with the plain text
+    \param out_file file name to hold the cipher text
+    \param key_str key must be 32 Bytes
+    \param iv_str IV length must be 16 Bytes, the first 7 are the nonce prefix
+    \param seg_size plain text bytes in each segment
+    \param threads number of threads, 0 for one per CPU
+*/
+int encrypt_file_AesGCM_segmented(const char *in_file, const char *out_file,
+                                  const char *key_str, const char *iv_str,
+                                  word32 seg_size, int threads)
+{
+    seg_job job;
+    int ret = 0;
+
+    if (!in_file || !out_file || !key_str || !iv_str) {
+        return BAD_FUNC_ARG;
+    }
+
+    if (strlen(key_str) < AES_KEY_SIZE || strlen(iv_str) < AES_IV_SIZE) {
+        return BAD_LENGTH_E;
+    }
+
+    if (seg_size == 0 || seg_size > MAX_BUFFER_SIZE) {
+        return BAD_FUNC_ARG;
+    }
+
+    if (check_file_permission(in_file, getuid(), getgid()) == -1) {
+        return -1;
+    }
+
+    XMEMSET(&job, 0, sizeof(job));
+    job.in_fd  = open(in_file, O_RDONLY);
+    if (job.in_fd == -1) {
+        perror("open");
+        return -1;
+    }
+
+    job.out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (job.out_fd == -1) {
+        perror("open");
+        close(job.in_fd);
+        return -1;
+    }
+
+    strncpy((char *)job.key, key_str, AES_KEY_SIZE);
+    job.seg_size = seg_size;
+    job.plain_size = get_file_sz(job.in_fd);
+    job.num_segs = seg_count(job.plain_size, seg_size);
+    job.end_seg = job.num_segs;
+    if (job.num_segs > 0xFFFFFFFF) {
+        fprintf(stderr, "Too many segments, use a larger segment size\n");
+        ret = BAD_FUNC_ARG;
+        goto exit;
+    }
+
+    XMEMCPY(job.header, WOLFCRYPT_SEG_MAGIC, sizeof(WOLFCRYPT_SEG_MAGIC) - 1);
+    seg_put_be(job.header + sizeof(WOLFCRYPT_SEG_MAGIC) - 1, seg_size, 4);
+    XMEMCPY(job.header + sizeof(WOLFCRYPT_SEG_MAGIC) - 1 + 4, iv_str,
+            AESGCM_SEG_PREFIX_SIZE);
+    seg_put_be(job.header + AESGCM_SEG_HEADER_SIZE - 8, job.plain_size, 8);
+
+    /* Size the cipher file up front so the segments can be written in any
+     * order */
+    if (seg_pwrite_full(job.out_fd, job.header, AESGCM_SEG_HEADER_SIZE,
+                        0) != 0 ||
+        ftruncate(job.out_fd, seg_cipher_size(job.plain_size, seg_size)) != 0) {
+        perror("write");
+        ret = -1;
+        goto exit;
+    }
+
+    threads = seg_threads(threads);
+    ret = seg_run(&job, 0, threads);
+    if (ret == 0) {
+        printf("File encryption with segmented AES GCM complete "
+               "(%llu segments, %d threads).\n",
+               (unsigned long long)job.num_segs, threads);
+    }
+exit:
+    wc_ForceZero(job.key, AES_KEY_SIZE);
+    close(job.in_fd);
+    close(job.out_fd);
+    if (ret != 0) {
+        unlink(out_file);
+    }
+
+    return ret;
+}
+
+/*!
+    \ingroup AES
+    \brief This function decrypts a file in the segmented cipher file format
+     and stores the plain text from offset to offset + length in the output
+     file. Only the segments holding that range are read and authenticated,
+     in parallel.
+
+    \return 0 on successfully decrypting the range
+    \return negative number on error
+
+    \param in_file filename with the cipher text
+    \param out_file file name to hold plain text
+    \param key_str key must be 32 Bytes
+    \param offset first plain text byte to decrypt
+    \param length number of plain text bytes to decrypt, clipped to the end
+     of the file
+    \param threads number of threads, 0 for one per CPU
+*/
+int decrypt_file_AesGCM_segmented(const char *in_file, const char *out_file,
+                                  const char *key_str, word64 offset,
+                                  word64 length, int threads)
+{
+    seg_job job;
+    word64 first_seg;
+    int ret = 0;
+
+    if (!in_file || !out_file || !key_str) {
+        return BAD_FUNC_ARG;
+    }
+
+    if (strlen(key_str) < AES_KEY_SIZE) {
+        return BAD_LENGTH_E;
+    }
+
+    if (check_file_permission(in_file, getuid(), getgid()) == -1) {
+        return -1;
+    }
+
+    XMEMSET(&job, 0, sizeof(job));
+    job.decrypt = 1;
+    job.in_fd  = open(in_file, O_RDONLY);
+    if (job.in_fd == -1) {
+        perror("open");
+        return -1;
+    }
+
+    job.out_fd = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (job.out_fd == -1) {
+        perror("open");
+        close(job.in_fd);
+        return -1;
+    }
+
+    strncpy((char *)job.key, key_str, AES_KEY_SIZE);
+
+    if (seg_pread_full(job.in_fd, job.header, AESGCM_SEG_HEADER_SIZE,
+                       0) != 0) {
+        perror("read");
+        ret = -1;
+        goto exit;
+    }
+    if (memcmp(job.header, WOLFCRYPT_SEG_MAGIC,
+               sizeof(WOLFCRYPT_SEG_MAGIC) - 1) != 0) {
+        fprintf(stderr, "WOLFCRYPT_SEG_MAGIC didn't match\n");
+        ret = AES_GCM_AUTH_E;
+        goto exit;
+    }
+    job.seg_size = (word32)seg_get_be(job.header +
+                                      sizeof(WOLFCRYPT_SEG_MAGIC) - 1, 4);
+    job.plain_size = seg_get_be(job.header + AESGCM_SEG_HEADER_SIZE - 8, 8);
+    if (job.seg_size == 0 || job.seg_size > MAX_BUFFER_SIZE) {
+        fprintf(stderr, "Bad segment size in header\n");
+        ret = AES_GCM_AUTH_E;
+        goto exit;
+    }
+    job.num_segs = seg_count(job.plain_size, job.seg_size);
+    /* Catches truncated or extended files before reading any segment. A
+     * forged plain text size fails the authentication of every segment. */
+    if ((word64)get_file_sz(job.in_fd) !=
+        seg_cipher_size(job.plain_size, job.seg_size)) {
+        fprintf(stderr, "Cipher file size doesn't match its header\n");
+        ret = AES_GCM_AUTH_E;
+        goto exit;
+    }
+
+    if (offset > job.plain_size)
+        offset = job.plain_size;
+    if (length > job.plain_size - offset)
+        length = job.plain_size - offset;
+    job.range_start = offset;
+    job.range_end = offset + length;
+
+    /* An empty range still authenticates the segment it points into */
+    first_seg = offset / job.seg_size;
+    job.end_seg = (job.range_end + job.seg_size - 1) / job.seg_size;
+    if (job.end_seg <= first_seg)
+        job.end_seg = first_seg + 1;
+    if (job.end_seg > job.num_segs) {
+        first_seg = job.num_segs - 1;
+        job.end_seg = job.num_segs;
+    }
+
+    if (ftruncate(job.out_fd, length) != 0) {
+        perror("ftruncate");
+        ret = -1;
+        goto exit;
+    }
+
+    threads = seg_threads(threads);
+    ret = seg_run(&job, first_seg, threads);
+    if (ret != 0) {
+        /* Don't leave unauthenticated plain text on disk */
+        fprintf(stderr,
+            "Decryption failed, removing unverified output file\n");
+    }
+exit:
+    wc_ForceZero(job.key, AES_KEY_SIZE);
+    close(job.in_fd);
+    close(job.out_fd);
+    if (ret != 0) {
+        unlink(out_file);
+    }
+
+    printf("File decryption with segmented AES GCM complete.\n");
+    return ret;
+}
+
 #ifdef OPENSSL_EXTRA
 int encrypt_file(const char *in_file, const char *out_file,
                  const char *key_str, const char *iv_str)
@@ -835,6 +1777,82 @@ text.bin", (file_sz/1024)+1, file_sz);
     }
     pclose(pipe);
 
+    /* The other I/O engines must give the same cipher text and plain text */
+    const char *engines[] = { "mmap", "uring" };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        sprintf(buffer, "./aesgcm-file-encrypt -e 256 -m 1 -x %s \
+-k 77CF00EC060192530B5D06B6B426799B -v 77CF00EC060192530B5D06B6B426799B \
+-i text.bin -o text2cipher.%s.bin && \
+./aesgcm-file-encrypt -d 256 -m 1 -x %s -k 77CF00EC060192530B5D06B6B426799B \
+-i text2cipher.%s.bin -o text2cipher2text.%s.bin && \
+cmp -s text2cipher.bin text2cipher.%s.bin && \
+cmp -s text.bin text2cipher2text.%s.bin", engines[i], engines[i],
+                engines[i], engines[i], engines[i], engines[i], engines[i]);
+        if (system(buffer) != 0) {
+            printf("Error: The %s engine files are different.\n", engines[i]);
+            return -1;
+        }
+        printf("Pass: The %s engine files are identical.\n", engines[i]);
+    }
+
+    /* Segmented format with small segments so there are several of them */
+    const char *cmd_enc_seg ="./aesgcm-file-encrypt -e 256 -m 3 -s 64 -j 4 \
+                   -k 77CF00EC060192530B5D06B6B426799B \
+                   -v 77CF00EC060192530B5D06B6B426799B \
+                   -i text.bin -o text2cipher.seg.bin";
+    const char *cmd_dec_seg ="./aesgcm-file-encrypt -d 256 -m 3 -j 4 \
+                   -k 77CF00EC060192530B5D06B6B426799B \
+                   -i text2cipher.seg.bin -o text2cipher2text.seg.bin";
+    const char *cmd_diff_seg = "diff -q text.bin text2cipher2text.seg.bin";
+    const char *cmd_diff_range = "diff -q text.range.bin \
+                                  text2cipher2text.range.bin";
+
+    if (system(cmd_enc_seg) != 0 || system(cmd_dec_seg) != 0) {
+        perror("system command");
+        return -1;
+    }
+
+    pipe = popen(cmd_diff_seg, "r");
+    if (!pipe) {
+        perror("system command");
+        return -1;
+    }
+    if (fgets(buffer, sizeof(buffer), pipe)) {
+        printf("Error: The segmented files are different.\n");
+        return -1;
+    }
+    else {
+        printf("Pass: The segmented files are identical.\n");
+    }
+    pclose(pipe);
+
+    /* Decrypt a range that starts and ends inside segments */
+    sprintf(buffer, "./aesgcm-file-encrypt -d 256 -m 3 -r %d:%d \
+-k 77CF00EC060192530B5D06B6B426799B \
+-i text2cipher.seg.bin -o text2cipher2text.range.bin && \
+tail -c +%d text.bin | head -c %d > text.range.bin",
+            file_sz / 3, file_sz / 2, file_sz / 3 + 1, file_sz / 2);
+    if (system(buffer) != 0) {
+        perror("system command");
+        return -1;
+    }
+
+    pipe = popen(cmd_diff_range, "r");
+    if (!pipe) {
+        perror("system command");
+        return -1;
+    }
+    if (fgets(buffer, sizeof(buffer), pipe)) {
+        printf("Error: The decrypted range is different.\n");
+        return -1;
+    }
+    else {
+        printf("Pass: The decrypted range is identical.\n");
+    }
+    pclose(pipe);
+
 #ifdef OPENSSL_EXTRA
     const char *cmd_enc_evp ="./aesgcm-file-encrypt -e 256 -m 2 \
                               -k 77CF00EC060192530B5D06B6B426799B \
@@ -896,9 +1914,14 @@ void help(char *prog_name) {
     printf("This program accepts several switches:\n");
     printf("  -e <num>   encryption. 256, 192, 128 \n");
     printf("  -d <num>   decryption. 256, 192, 128\n");
-    printf("  -m <num>   method to use.  GCM(1), EVP GCM (2), \n");
+    printf("  -m <num>   method to use.  GCM(1), EVP GCM (2), segmented GCM (3)\n");
     printf("  -i <file>  Set the input filename to 'file'\n");
     printf("  -o <file>  Set the output filename to 'file'\n");
+    printf("  -x <name>  GCM: I/O engine to use. rw (default), mmap, uring\n");
+    printf("  -j <num>   segmented GCM: threads to use, default one per CPU\n");
+    printf("  -s <num>   segmented GCM: segment size in Bytes, default %d\n",
+           AESGCM_SEGMENT_SIZE);
+    printf("  -r <off>:<len>  segmented GCM: only decrypt len Bytes at off\n");
 #if defined(__linux__)
     printf("  -t <num>   Sanity test with the given file size in Bytes. The \
 test will create three files:text.bin, cipher, decrypted plain. \n");
@@ -917,10 +1940,16 @@ int main(int argc, char** argv)
     int    file_sz = 0;
     int    key_sz = 0;
     int    method = 0;
+    int    threads = 0;
+    io_engine engine = IO_ENGINE_RW;
+    word32 seg_size = AESGCM_SEGMENT_SIZE;
+    word64 range_off = 0;
+    word64 range_len = (word64)-1;
+    char*  end;
     int    option;    /* options of how to run the program */
     char   choice = 'n';
 
-    while ((option = getopt(argc, argv, "e:d:i:o:m:t:k:v:h")) != -1 && choice != 't') {
+    while ((option = getopt(argc, argv, "e:d:i:o:m:t:k:v:j:s:r:x:h")) != -1 && choice != 't') {
         switch (option) {
             case 'e': /* encrypt */
                 choice = 'e';
@@ -946,8 +1975,9 @@ int main(int argc, char** argv)
                 break;
             case 'm': /* options to do enc/dec */
                 method = atoi(optarg);
-                if (method < 1 || method > 2) {
-                    perror("Wrong AES choice: use EVP (1), GCM(2)\n");
+                if (method < 1 || method > 3) {
+                    perror("Wrong AES choice: use GCM (1), EVP (2), "
+                           "segmented GCM (3)\n");
                     usage(argv[0]);
                 }
                 break;
@@ -965,6 +1995,36 @@ int main(int argc, char** argv)
                     usage(argv[0]);
                 }
                 break;
+            case 'j': /* segmented GCM threads */
+                threads = atoi(optarg);
+                break;
+            case 's': /* segmented GCM segment size */
+                seg_size = (word32)strtoul(optarg, NULL, 0);
+                if (seg_size == 0 || seg_size > MAX_BUFFER_SIZE) {
+                    perror("Wrong segment size\n");
+                    usage(argv[0]);
+                }
+                break;
+            case 'r': /* segmented GCM range to decrypt */
+                range_off = strtoull(optarg, &end, 0);
+                if (*end != ':') {
+                    perror("Wrong range: use <offset>:<length>\n");
+                    usage(argv[0]);
+                }
+                range_len = strtoull(end + 1, NULL, 0);
+                break;
+            case 'x': /* I/O engine of GCM */
+                if (strcmp(optarg, "rw") == 0)
+                    engine = IO_ENGINE_RW;
+                else if (strcmp(optarg, "mmap") == 0)
+                    engine = IO_ENGINE_MMAP;
+                else if (strcmp(optarg, "uring") == 0)
+                    engine = IO_ENGINE_URING;
+                else {
+                    perror("Wrong I/O engine: use rw, mmap or uring\n");
+                    usage(argv[0]);
+                }
+                break;
             case 't': /* sanity test */
                 choice = 't';
                 file_sz = atoi(optarg);
@@ -991,12 +2051,13 @@ int main(int argc, char** argv)
         switch (method) {
         case 1:
             if (choice == 'e') {
-                if (encrypt_file_AesGCM(inFile, outFile, keyStr, ivStr) != 0) {
+                if (encrypt_file_AesGCM(inFile, outFile, keyStr, ivStr,
+                                        engine) != 0) {
                     perror("Error: encrypt_file_AesGCM\n");
                 }
             }
             else if (choice == 'd') {
-                if (decrypt_file_AesGCM(inFile, outFile, keyStr) != 0) {
+                if (decrypt_file_AesGCM(inFile, outFile, keyStr, engine) != 0) {
                     perror("Error: decrypt_file_AesGCM\n");
                 }
                 else
@@ -1022,6 +2083,22 @@ int main(int argc, char** argv)
                 }
                 break;
 #endif
+            case 3:
+                if (choice == 'e') {
+                    if (encrypt_file_AesGCM_segmented(inFile, outFile, keyStr,
+                            ivStr, seg_size, threads) != 0) {
+                        perror("Error: encrypt_file_AesGCM_segmented\n");
+                    }
+                }
+                else if (choice == 'd') {
+                    if (decrypt_file_AesGCM_segmented(inFile, outFile, keyStr,
+                            range_off, range_len, threads) != 0) {
+                        perror("Error: decrypt_file_AesGCM_segmented\n");
+                    }
+                    else
+                        printf("Passed: decrypt_file_AesGCM_segmented\n");
+                }
+                break;
             default:
                 abort();
         }
@@ -5,6 +5,7 @@
 echo "aesgcm-file-encrypt tests"
 echo "./aesgcm-file-encrypt -b to run benchmark after building wolfSSL with"
 echo "./configure --enable-aesgcm-stream && sudo make install"
+echo "./aesgcm-file-encrypt.sh -x to compare the I/O engines (rw, mmap, uring)"
 
 # Define the output CSV file
 output_file="aesgcm_times.csv"
@@ -64,6 +65,51 @@ if [[ "$1" == "-b" ]] || [[ "$1" == "--bench" ]]; then
       rm text*
     done
   done
+elif [[ "$1" == "-x" ]] || [[ "$1" == "--engines" ]]; then
+  # Throughput of each I/O engine, plotted by plot_data.gp into engines.png
+  engines_file="aesgcm_engines.csv"
+  engines=("rw" "mmap" "uring")
+
+  rm aesgcm-file-encrypt text*
+  make clean
+  make aesgcm-file-encrypt
+
+  header="File-size"
+  for engine in "${engines[@]}"
+  do
+    header="$header,$engine-enc,$engine-dec"
+  done
+  echo "$header" > "$engines_file"
+
+  file_sizes=("10M" "50M" "100M" "500M" "1G")
+
+  for size in "${file_sizes[@]}"
+  do
+    text_file=text_"$size".bin
+    dd if=/dev/urandom of=$text_file bs=$size count=1 conv=fsync
+    bytes=$(stat -c %s $text_file)
+    line="$size"
+
+    for engine in "${engines[@]}"
+    do
+      t_aesgcm_e="$( TIMEFORMAT="%R";time (./aesgcm-file-encrypt -e 256 -m 1 -x $engine -k $keyStr -v $ivStr -i $text_file -o text2cipher.bin > /dev/null 2>&1) 2>&1 )"
+      t_aesgcm_d="$( TIMEFORMAT="%R";time (./aesgcm-file-encrypt -d 256 -m 1 -x $engine -k $keyStr -v $ivStr -i text2cipher.bin -o text2cipher2text.bin > /dev/null 2>&1) 2>&1 )"
+
+      diff -s $text_file text2cipher2text.bin > /dev/null
+      if [ $? -eq 0 ]; then
+        echo "Passed $engine $t_aesgcm_e $t_aesgcm_d"
+      else
+        echo "Failed $engine"
+      fi
+      # GB/s of the encryption and the decryption
+      line="$line,$(awk -v b=$bytes -v e=$t_aesgcm_e -v d=$t_aesgcm_d 'BEGIN { printf "%.3f,%.3f", (e > 0) ? b / e / 1e9 : 0, (d > 0) ? b / d / 1e9 : 0 }')"
+    done
+    echo "$line" >> "$engines_file"
+    rm text*
+  done
+
+  gnuplot -e "engines=1" plot_data.gp
+  exit 0
 else
     rm aesgcm-file-encrypt text*
     make clean
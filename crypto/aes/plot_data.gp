@@ -1,5 +1,23 @@
 #!/usr/bin/gnuplot
 
+# Throughput per I/O engine from aesgcm-file-encrypt.sh -x:
+#   gnuplot -e "engines=1" plot_data.gp
+if (exists("engines")) {
+    set term png
+    set output "engines.png"
+    set title "wolfSSL AES-256-GCM throughput per I/O engine"
+    set datafile separator ","
+    set style fill solid 1.00 border lt -1
+    set style histogram clustered gap 2 title textcolor lt -1
+    set style data histograms
+    set key autotitle columnhead noenhanced
+    set grid y
+    set xlabel "File size"
+    set ylabel "Throughput (GB/s)"
+    plot for [col=2:*] "aesgcm_engines.csv" using col:xticlabels(1)
+    exit
+}
+
 # Function to get the number of lines in the file
 filelines(file) = system(sprintf("awk 'END {print NR}' %s", file))
 
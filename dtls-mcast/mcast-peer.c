@@ -26,6 +26,12 @@
  * Usage: ./mcast-peer <node_id>
  *   where node_id is 0, 1, or 2
  *
+ * Benchmark: ./mcast-peer -b <peers> [-n msgs] [-s size] [-r rate]
+ *                         [-l loss%] [-o reorder%] [-p replay%] [-v]
+ *   Simulated peers in this process send to one receiver over a simulated
+ *   network, showing how per-peer state lookup and MAC verification scale
+ *   with the size of the group.
+ *
  * Requires wolfSSL built with: ./configure --enable-dtls --enable-mcast
  */
 
@@ -187,6 +193,482 @@ static int setup_rx_socket(void)
     return sd;
 }
 
+/* Benchmark mode: simulated peers sending to one receiver in this process */
+#define BENCH_MAX_PEERS     255     /* Member IDs are 8 bits */
+#define BENCH_MAX_MSG       1400
+#define BENCH_HOLD          16      /* Datagrams the network can delay */
+
+/*
+ * Benchmark settings from the command line
+ */
+typedef struct {
+    int peers;              /* Number of simulated sending peers */
+    int count;              /* Messages sent by each peer */
+    int size;               /* Message size in bytes */
+    long rate;              /* Messages per second from all peers, 0 = max */
+    double loss;            /* Percent of datagrams dropped */
+    double reorder;         /* Percent of datagrams delayed */
+    double replay;          /* Percent of datagrams delivered again later */
+    int verbose;            /* Print statistics for every peer */
+} bench_opts;
+
+/*
+ * Receive statistics for one sending peer
+ */
+typedef struct {
+    unsigned long sent;         /* Messages written by the peer */
+    unsigned long dropped;      /* Datagrams lost by the network */
+    unsigned long replayed;     /* Copies of datagrams sent again */
+    unsigned long arrived;      /* Datagrams given to the receiver */
+    unsigned long delivered;    /* New messages read */
+    unsigned long reordered;    /* New messages older than one already read */
+    unsigned long rejected;     /* Datagrams the receiver discarded */
+    unsigned long dupDelivered; /* Messages read twice - replay missed */
+    long maxSeq;                /* Highest sequence number read */
+    unsigned char* seen;        /* Bit per sequence number read */
+} peer_stats;
+
+/*
+ * Datagram on the simulated network
+ */
+typedef struct {
+    unsigned char buf[BENCH_MAX_MSG + 100];
+    int sz;
+    int peer;
+    int delay;                  /* Datagrams sent before this one arrives */
+} sim_dgram;
+
+static bench_opts benchOpts;
+static peer_stats* benchStats;
+static sim_dgram benchHeld[BENCH_HOLD];
+static sim_dgram* benchRx;          /* Datagram being read by receiver */
+static WOLFSSL* benchSslRx;
+static unsigned int benchRand = 1;
+static double benchRxTime;          /* Seconds spent reading datagrams */
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Returns 1 with the given percent chance (xorshift - repeatable runs)
+ */
+static int bench_chance(double percent)
+{
+    benchRand ^= benchRand << 13;
+    benchRand ^= benchRand >> 17;
+    benchRand ^= benchRand << 5;
+    return (benchRand % 1000000) < (unsigned int)(percent * 10000);
+}
+
+/*
+ * IO receive callback for the receiver - returns the arriving datagram once
+ */
+static int bench_recv(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    (void)ssl;
+    (void)ctx;
+    if (benchRx == NULL) {
+        return WOLFSSL_CBIO_ERR_WANT_READ;
+    }
+    if (sz > benchRx->sz) {
+        sz = benchRx->sz;
+    }
+    memcpy(buf, benchRx->buf, sz);
+    benchRx = NULL;
+    return sz;
+}
+
+/*
+ * Have the receiver read a datagram and record what happened to it
+ */
+static void bench_deliver(sim_dgram* d)
+{
+    peer_stats* st = &benchStats[d->peer];
+    unsigned char buf[BENCH_MAX_MSG];
+    unsigned short peerId = 0;
+    double start;
+    long seq;
+    int ret;
+
+    st->arrived++;
+    benchRx = d;
+    start = bench_now();
+    ret = wolfSSL_mcast_read(benchSslRx, &peerId, buf, sizeof(buf));
+    benchRxTime += bench_now() - start;
+    benchRx = NULL;
+
+    if (ret < 4 || peerId != d->peer) {
+        /* Failed the replay window or MAC check */
+        st->rejected++;
+        return;
+    }
+    seq = ((long)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+    if (st->seen[seq / 8] & (1 << (seq % 8))) {
+        st->dupDelivered++;
+        return;
+    }
+    st->seen[seq / 8] |= 1 << (seq % 8);
+    st->delivered++;
+    if (seq < st->maxSeq) {
+        st->reordered++;
+    }
+    else {
+        st->maxSeq = seq;
+    }
+}
+
+/*
+ * Hold a copy of a datagram back for a random number of datagrams
+ */
+static void bench_hold(const unsigned char* buf, int sz, int peer)
+{
+    int i;
+
+    for (i = 0; i < BENCH_HOLD; i++) {
+        if (benchHeld[i].sz == 0) {
+            memcpy(benchHeld[i].buf, buf, sz);
+            benchHeld[i].sz = sz;
+            benchHeld[i].peer = peer;
+            benchHeld[i].delay = 1 + (int)(benchRand % BENCH_HOLD);
+            return;
+        }
+    }
+    /* Network queue full - lost */
+    benchStats[peer].dropped++;
+}
+
+/*
+ * Deliver held datagrams that are due, or all of them when flushing
+ */
+static void bench_release(int flush)
+{
+    int i;
+
+    for (i = 0; i < BENCH_HOLD; i++) {
+        if (benchHeld[i].sz != 0 && (flush || --benchHeld[i].delay <= 0)) {
+            bench_deliver(&benchHeld[i]);
+            benchHeld[i].sz = 0;
+        }
+    }
+}
+
+/*
+ * IO send callback for the sending peers - the simulated network
+ */
+static int bench_send(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    int peer = (int)(size_t)ctx;
+    peer_stats* st = &benchStats[peer];
+    sim_dgram d;
+
+    (void)ssl;
+    if (sz > (int)sizeof(d.buf)) {
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    }
+    if (bench_chance(benchOpts.loss)) {
+        st->dropped++;
+    }
+    else if (bench_chance(benchOpts.reorder)) {
+        bench_hold((unsigned char*)buf, sz, peer);
+    }
+    else {
+        memcpy(d.buf, buf, sz);
+        d.sz = sz;
+        d.peer = peer;
+        bench_deliver(&d);
+    }
+    if (bench_chance(benchOpts.replay)) {
+        st->replayed++;
+        bench_hold((unsigned char*)buf, sz, peer);
+    }
+    bench_release(0);
+    return sz;
+}
+
+static void bench_usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s -b <peers> [-n <msgs>] [-s <size>] "
+            "[-r <rate>] [-l <loss%%>] [-o <reorder%%>] [-p <replay%%>] "
+            "[-v]\n", prog);
+    fprintf(stderr, "  -b <peers>    Simulated sending peers (1-%d)\n",
+            BENCH_MAX_PEERS);
+    fprintf(stderr, "  -n <msgs>     Messages per peer (default 1000)\n");
+    fprintf(stderr, "  -s <size>     Message size in bytes (default 100)\n");
+    fprintf(stderr, "  -r <rate>     Messages per second, all peers "
+            "(default 0 = as fast as possible)\n");
+    fprintf(stderr, "  -l <loss%%>    Datagrams dropped by the network\n");
+    fprintf(stderr, "  -o <reorder%%> Datagrams delayed by the network\n");
+    fprintf(stderr, "  -p <replay%%>  Datagrams delivered again later\n");
+    fprintf(stderr, "  -v            Print statistics for every peer\n");
+}
+
+/*
+ * Print one row of receive statistics
+ */
+static void bench_print_row(const char* name, const peer_stats* st)
+{
+    printf("%-6s %8lu %8lu %8lu %9lu %8lu %9lu %8lu %8lu %8lu\n", name,
+           st->sent, st->dropped, st->arrived, st->delivered,
+           st->sent - st->delivered, st->reordered, st->replayed,
+           st->rejected, st->dupDelivered);
+}
+
+/*
+ * Run the multicast benchmark.
+ *
+ * Simulated peers, each with its own member ID, send to one receiver that
+ * tracks all of them. The datagrams go through a simulated network that can
+ * drop, reorder and replay them. Reports how fast the receiver looks up
+ * each peer's state and verifies the MAC as the group grows, and the
+ * receive statistics of each peer.
+ */
+static int run_benchmark(int argc, char** argv)
+{
+    WOLFSSL_CTX* ctx = NULL;
+    WOLFSSL** sslTx = NULL;
+    peer_stats total;
+    unsigned char pms[PMS_SIZE];
+    unsigned char clientRandom[RANDOM_SIZE];
+    unsigned char serverRandom[RANDOM_SIZE];
+    unsigned char suite[2] = { 0x00, 0xFE };
+    unsigned char msg[BENCH_MAX_MSG];
+    WC_RNG rng;
+    double start;
+    double elapsed;
+    long sentAll = 0;
+    int ret = 1;
+    int i;
+    int n;
+
+    memset(&benchOpts, 0, sizeof(benchOpts));
+    benchOpts.count = 1000;
+    benchOpts.size = 100;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            benchOpts.verbose = 1;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-b") == 0) {
+            benchOpts.peers = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+            benchOpts.count = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0) {
+            benchOpts.size = atoi(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-r") == 0) {
+            benchOpts.rate = atol(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-l") == 0) {
+            benchOpts.loss = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-o") == 0) {
+            benchOpts.reorder = atof(argv[++i]);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-p") == 0) {
+            benchOpts.replay = atof(argv[++i]);
+        }
+        else {
+            bench_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (benchOpts.peers < 1 || benchOpts.peers > BENCH_MAX_PEERS ||
+            benchOpts.count < 1 || benchOpts.size < 4 ||
+            benchOpts.size > BENCH_MAX_MSG || benchOpts.rate < 0) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+
+    /* Random secret - all the peers are in this process */
+    if (wc_InitRng(&rng) != 0) {
+        fprintf(stderr, "Error: wc_InitRng failed\n");
+        return 1;
+    }
+    ret = wc_RNG_GenerateBlock(&rng, pms, sizeof(pms));
+    if (ret == 0)
+        ret = wc_RNG_GenerateBlock(&rng, clientRandom, sizeof(clientRandom));
+    if (ret == 0)
+        ret = wc_RNG_GenerateBlock(&rng, serverRandom, sizeof(serverRandom));
+    wc_FreeRng(&rng);
+    if (ret != 0) {
+        fprintf(stderr, "Error: Failed to generate secret: %d\n", ret);
+        ret = 1;
+        goto cleanup;
+    }
+    ret = 1;
+
+    if (wolfSSL_Init() != WOLFSSL_SUCCESS) {
+        fprintf(stderr, "Error: wolfSSL_Init failed\n");
+        goto cleanup;
+    }
+    if (benchOpts.peers > wolfSSL_mcast_get_max_peers()) {
+        fprintf(stderr, "Error: wolfSSL tracks at most %d peers, build it "
+                "with -DWOLFSSL_MULTICAST_PEERS=%d\n",
+                wolfSSL_mcast_get_max_peers(), benchOpts.peers);
+        goto cleanup;
+    }
+
+    benchStats = (peer_stats*)calloc(benchOpts.peers, sizeof(peer_stats));
+    sslTx = (WOLFSSL**)calloc(benchOpts.peers, sizeof(WOLFSSL*));
+    if (benchStats == NULL || sslTx == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        goto cleanup;
+    }
+    for (i = 0; i < benchOpts.peers; i++) {
+        benchStats[i].maxSeq = -1;
+        benchStats[i].seen = (unsigned char*)calloc(
+                (benchOpts.count + 7) / 8, 1);
+        if (benchStats[i].seen == NULL) {
+            fprintf(stderr, "Error: Out of memory\n");
+            goto cleanup;
+        }
+    }
+
+    ctx = wolfSSL_CTX_new(wolfDTLSv1_2_client_method());
+    if (ctx == NULL) {
+        fprintf(stderr, "Error: wolfSSL_CTX_new failed\n");
+        goto cleanup;
+    }
+    if (wolfSSL_CTX_set_cipher_list(ctx, "WDM-NULL-SHA256") !=
+            WOLFSSL_SUCCESS) {
+        fprintf(stderr, "Error: wolfSSL_CTX_set_cipher_list failed\n");
+        goto cleanup;
+    }
+
+    /* The member ID is taken from the context when an SSL is created */
+    for (i = 0; i < benchOpts.peers; i++) {
+        if (wolfSSL_CTX_mcast_set_member_id(ctx, (unsigned short)i) !=
+                WOLFSSL_SUCCESS ||
+                (sslTx[i] = wolfSSL_new(ctx)) == NULL) {
+            fprintf(stderr, "Error: Failed to create peer %d\n", i);
+            goto cleanup;
+        }
+        wolfSSL_SSLSetIOSend(sslTx[i], bench_send);
+        wolfSSL_SetIOWriteCtx(sslTx[i], (void*)(size_t)i);
+        if (wolfSSL_set_secret(sslTx[i], MCAST_EPOCH, pms, sizeof(pms),
+                clientRandom, serverRandom, suite) != WOLFSSL_SUCCESS) {
+            fprintf(stderr, "Error: wolfSSL_set_secret (peer %d) failed\n",
+                    i);
+            goto cleanup;
+        }
+    }
+
+    benchSslRx = wolfSSL_new(ctx);
+    if (benchSslRx == NULL) {
+        fprintf(stderr, "Error: wolfSSL_new (rx) failed\n");
+        goto cleanup;
+    }
+    wolfSSL_SSLSetIORecv(benchSslRx, bench_recv);
+    wolfSSL_dtls_set_using_nonblock(benchSslRx, 1);
+    for (i = 0; i < benchOpts.peers; i++) {
+        if (wolfSSL_mcast_peer_add(benchSslRx, (unsigned short)i, 0) !=
+                WOLFSSL_SUCCESS) {
+            fprintf(stderr, "Error: wolfSSL_mcast_peer_add(%d) failed\n", i);
+            goto cleanup;
+        }
+    }
+    if (wolfSSL_set_secret(benchSslRx, MCAST_EPOCH, pms, sizeof(pms),
+            clientRandom, serverRandom, suite) != WOLFSSL_SUCCESS) {
+        fprintf(stderr, "Error: wolfSSL_set_secret (rx) failed\n");
+        goto cleanup;
+    }
+
+    printf("Peers: %d  messages/peer: %d  size: %d  rate: %ld/s  "
+           "loss: %.1f%%  reorder: %.1f%%  replay: %.1f%%\n",
+           benchOpts.peers, benchOpts.count, benchOpts.size, benchOpts.rate,
+           benchOpts.loss, benchOpts.reorder, benchOpts.replay);
+
+    /* Peers take turns to send */
+    memset(msg, 0, sizeof(msg));
+    start = bench_now();
+    for (n = 0; n < benchOpts.count && running; n++) {
+        msg[0] = (unsigned char)(n >> 24);
+        msg[1] = (unsigned char)(n >> 16);
+        msg[2] = (unsigned char)(n >> 8);
+        msg[3] = (unsigned char)n;
+        for (i = 0; i < benchOpts.peers; i++) {
+            if (benchOpts.rate > 0) {
+                /* Wait until this message is due */
+                double due = start + (double)sentAll / benchOpts.rate;
+                double now = bench_now();
+                if (due > now) {
+                    usleep((useconds_t)((due - now) * 1e6));
+                }
+            }
+            if (wolfSSL_write(sslTx[i], msg, benchOpts.size) !=
+                    benchOpts.size) {
+                fprintf(stderr, "Error: wolfSSL_write (peer %d) failed\n", i);
+                goto cleanup;
+            }
+            benchStats[i].sent++;
+            sentAll++;
+        }
+    }
+    bench_release(1);
+    elapsed = bench_now() - start;
+
+    memset(&total, 0, sizeof(total));
+    for (i = 0; i < benchOpts.peers; i++) {
+        total.sent += benchStats[i].sent;
+        total.dropped += benchStats[i].dropped;
+        total.arrived += benchStats[i].arrived;
+        total.delivered += benchStats[i].delivered;
+        total.reordered += benchStats[i].reordered;
+        total.replayed += benchStats[i].replayed;
+        total.rejected += benchStats[i].rejected;
+        total.dupDelivered += benchStats[i].dupDelivered;
+    }
+
+    printf("Sent %lu messages in %.2f s, receiver read %lu datagrams at "
+           "%.0f/s (%.2f us each)\n\n", total.sent, elapsed, total.arrived,
+           benchRxTime > 0 ? total.arrived / benchRxTime : 0,
+           total.arrived ? benchRxTime * 1e6 / total.arrived : 0);
+    printf("%-6s %8s %8s %8s %9s %8s %9s %8s %8s %8s\n", "peer", "sent",
+           "dropped", "arrived", "delivered", "lost", "reordered",
+           "replayed", "rejected", "dup-read");
+    if (benchOpts.verbose) {
+        for (i = 0; i < benchOpts.peers; i++) {
+            char name[8];
+            snprintf(name, sizeof(name), "%d", i);
+            bench_print_row(name, &benchStats[i]);
+        }
+    }
+    bench_print_row("total", &total);
+    ret = 0;
+
+cleanup:
+    wc_ForceZero(pms, sizeof(pms));
+    wc_ForceZero(clientRandom, sizeof(clientRandom));
+    wc_ForceZero(serverRandom, sizeof(serverRandom));
+    if (benchSslRx != NULL) {
+        wolfSSL_free(benchSslRx);
+    }
+    if (sslTx != NULL) {
+        for (i = 0; i < benchOpts.peers; i++) {
+            if (sslTx[i] != NULL) {
+                wolfSSL_free(sslTx[i]);
+            }
+        }
+        free(sslTx);
+    }
+    if (benchStats != NULL) {
+        for (i = 0; i < benchOpts.peers; i++) {
+            free(benchStats[i].seen);
+        }
+        free(benchStats);
+    }
+    if (ctx != NULL) {
+        wolfSSL_CTX_free(ctx);
+    }
+    wolfSSL_Cleanup();
+    return ret;
+}
+
 int main(int argc, char** argv)
 {
     int ret;
@@ -209,10 +691,20 @@ int main(int argc, char** argv)
     time_t lastSend = 0;
     int msgCount = 0;
 
+    /* Setup signal handler */
+    signal(SIGINT, sig_handler);
+    signal(SIGTERM, sig_handler);
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        return run_benchmark(argc, argv);
+    }
+
     /* Parse arguments */
     if (argc != 2) {
         fprintf(stderr, "Usage: %s <node_id>\n", argv[0]);
         fprintf(stderr, "  node_id: 0, 1, or 2\n");
+        fprintf(stderr, "   or: %s -b <peers> ... for the benchmark\n",
+                argv[0]);
         return 1;
     }
 
@@ -222,10 +714,6 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    /* Setup signal handler */
-    signal(SIGINT, sig_handler);
-    signal(SIGTERM, sig_handler);
-
     printf("=== DTLS Multicast Peer - Node %d ===\n", myId);
 
     /* Enable debug output if built with --enable-debug */
@@ -0,0 +1,464 @@
+/* memory-ring-dtls.c
+ *
+ * Copyright (C) 2006-2025 wolfSSL Inc.
+ *
+ * This file is part of wolfSSL. (formerly known as CyaSSL)
+ *
+ * wolfSSL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+
+/* in memory DTLS connection over lock-free ring buffers, no sockets
+ *
+ * Each direction is a single producer, single consumer ring of datagram
+ * slots. The IO callbacks copy wolfSSL's output straight into the next free
+ * slot and its input straight out of the next full one, so there is no
+ * buffer in between and one slot holds one datagram, keeping DTLS record
+ * boundaries. No lock is taken so the client and server run at the same
+ * time, unlike memory-bio-dtls.c where every wolfSSL call on either side
+ * holds one semaphore.
+ *
+ * Run with -b to benchmark tunnel throughput over the rings against memory
+ * BIOs at record sizes from 64 B to 16 KB. Memory BIOs need OPENSSL_EXTRA.
+ *
+./configure --enable-opensslall --enable-dtls --enable-dtls13
+make
+sudo make install
+
+gcc -o memory-ring-dtls -Wall memory-ring-dtls.c  -lwolfssl -lpthread
+*/
+
+
+#ifndef WOLFSSL_USER_SETTINGS
+#include <wolfssl/options.h>
+#endif
+
+#include <wolfssl/ssl.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+
+
+static void err_sys(const char* msg)
+{
+    printf("wolfSSL error: %s\n", msg);
+    exit(1);
+}
+
+#ifndef NO_RSA
+#define CERT_FILE   "../certs/server-cert.pem"
+#define KEY_FILE    "../certs/server-key.pem"
+#define CA_FILE     "../certs/ca-cert.pem"
+#else
+#define CERT_FILE   "../certs/server-ecc.pem"
+#define KEY_FILE    "../certs/ecc-key.pem"
+#define CA_FILE     "../certs/ca-ecc-cert.pem"
+#endif
+
+#define RING_SLOTS      64                  /* power of 2 */
+#define RING_SLOT_SZ    (16384 + 1024)      /* largest DTLS datagram */
+#define CACHE_LINE      64
+
+#define BENCH_BYTES     (16 * 1024 * 1024)  /* sent per benchmark run */
+#define BENCH_MIN_RECS  2000
+
+
+/* one datagram */
+typedef struct RING_SLOT {
+    int sz;
+    unsigned char data[RING_SLOT_SZ];
+} RING_SLOT;
+
+/* single producer, single consumer ring of datagrams
+ * head and tail only ever increase, on their own cache lines so the two
+ * threads don't share one */
+typedef struct RING {
+    unsigned int head __attribute__((aligned(CACHE_LINE))); /* producer */
+    unsigned int tail __attribute__((aligned(CACHE_LINE))); /* consumer */
+    RING_SLOT slot[RING_SLOTS] __attribute__((aligned(CACHE_LINE)));
+} RING;
+
+/* transport between the client and server */
+typedef struct TUNNEL {
+    int useBio;
+    RING* toServer;
+    RING* toClient;
+#ifdef OPENSSL_EXTRA
+    WOLFSSL_BIO* rbio;
+    WOLFSSL_BIO* wbio;
+#endif
+    sem_t bioSem;
+    int recordSz;       /* bytes per wolfSSL_write, 0 for hello only */
+    long records;       /* records to send */
+} TUNNEL;
+
+enum {
+    TUNNEL_CONNECT,
+    TUNNEL_ACCEPT,
+    TUNNEL_READ,
+    TUNNEL_WRITE
+};
+
+
+/* ring send callback, ctx is the ring to the peer */
+static int RingSend(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    RING* ring = (RING*)ctx;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    RING_SLOT* slot;
+
+    (void)ssl;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SLOTS)
+        return WOLFSSL_CBIO_ERR_WANT_WRITE;
+    if (sz > RING_SLOT_SZ)
+        return WOLFSSL_CBIO_ERR_GENERAL;
+
+    slot = &ring->slot[head & (RING_SLOTS - 1)];
+    memcpy(slot->data, buf, sz);
+    slot->sz = sz;
+    /* publish the datagram */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    return sz;
+}
+
+
+/* ring recv callback, ctx is the ring from the peer */
+static int RingRecv(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    RING* ring = (RING*)ctx;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    RING_SLOT* slot;
+
+    (void)ssl;
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+        return WOLFSSL_CBIO_ERR_WANT_READ;
+
+    slot = &ring->slot[tail & (RING_SLOTS - 1)];
+    /* a datagram too big for the buffer is truncated, as with a socket */
+    if (sz > slot->sz)
+        sz = slot->sz;
+    memcpy(buf, slot->data, sz);
+    /* give the slot back */
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return sz;
+}
+
+
+/* set up the transport for one side of the tunnel */
+static void tunnel_attach(TUNNEL* t, WOLFSSL* ssl, int server)
+{
+    if (t->useBio) {
+#ifdef OPENSSL_EXTRA
+        if (server)
+            wolfSSL_set_bio(ssl, t->rbio, t->wbio);
+        else
+            wolfSSL_set_bio(ssl, t->wbio, t->rbio);
+#endif
+    }
+    else {
+        wolfSSL_SSLSetIOSend(ssl, RingSend);
+        wolfSSL_SSLSetIORecv(ssl, RingRecv);
+        wolfSSL_SetIOWriteCtx(ssl, server ? t->toClient : t->toServer);
+        wolfSSL_SetIOReadCtx(ssl, server ? t->toServer : t->toClient);
+    }
+    wolfSSL_dtls_set_using_nonblock(ssl, 1);
+#ifdef WOLFSSL_DTLS_MTU
+    /* no network in the way, allow full sized records */
+    wolfSSL_dtls_set_mtu(ssl, 16384);
+#endif
+}
+
+
+/* do a wolfSSL call until it is not waiting on the peer
+ * memory BIOs are not thread safe so the call holds the semaphore */
+static int tunnel_io(TUNNEL* t, WOLFSSL* ssl, int op, void* buf, int sz)
+{
+    int ret, err;
+
+    do {
+        if (t->useBio)
+            sem_wait(&t->bioSem);
+        switch (op) {
+            case TUNNEL_CONNECT: ret = wolfSSL_connect(ssl); break;
+            case TUNNEL_ACCEPT:  ret = wolfSSL_accept(ssl); break;
+            case TUNNEL_READ:    ret = wolfSSL_read(ssl, buf, sz); break;
+            default:             ret = wolfSSL_write(ssl, buf, sz); break;
+        }
+        if (t->useBio)
+            sem_post(&t->bioSem);
+        err = wolfSSL_get_error(ssl, ret);
+        if (ret <= 0 && (err == WOLFSSL_ERROR_WANT_READ ||
+                         err == WOLFSSL_ERROR_WANT_WRITE)) {
+            /* let the peer run */
+            sched_yield();
+            continue;
+        }
+        break;
+    } while (1);
+
+    return ret;
+}
+
+
+static void* client_thread(void* args)
+{
+    TUNNEL* t = (TUNNEL*)args;
+    WOLFSSL_CTX* cli_ctx = NULL;
+    WOLFSSL* cli_ssl     = NULL;
+    unsigned char* msg;
+    long i;
+    int ret;
+
+    /* set up client */
+    cli_ctx = wolfSSL_CTX_new(
+#ifdef WOLFSSL_DTLS13
+        wolfDTLSv1_3_client_method()
+#else
+        wolfDTLSv1_2_client_method()
+#endif
+    );
+    if (cli_ctx == NULL) {
+        err_sys("bad client ctx new");
+    }
+
+    ret = wolfSSL_CTX_load_verify_locations(cli_ctx, CA_FILE, NULL);
+    if (ret != WOLFSSL_SUCCESS) {
+        err_sys("bad ca load");
+    }
+
+    cli_ssl = wolfSSL_new(cli_ctx);
+    if (cli_ssl == NULL) {
+        err_sys("bad client new");
+    }
+    tunnel_attach(t, cli_ssl, 0);
+
+    ret = tunnel_io(t, cli_ssl, TUNNEL_CONNECT, NULL, 0);
+    if (ret != WOLFSSL_SUCCESS) err_sys("bad client dtls connect");
+
+    if (t->recordSz == 0) {
+        printf("wolfSSL client success!\n");
+        tunnel_io(t, cli_ssl, TUNNEL_WRITE, "hello memory wolfSSL!", 21);
+    }
+    else {
+        /* DTLS can't split a write over records, without WOLFSSL_DTLS_MTU
+         * the largest is limited by the default MTU */
+        int maxOut = wolfSSL_GetMaxOutputSize(cli_ssl);
+        int off, sz;
+
+        if (maxOut <= 0) err_sys("bad max output size");
+        msg = (unsigned char*)calloc(1, t->recordSz);
+        if (msg == NULL) err_sys("out of memory");
+        for (i = 0; i < t->records; i++) {
+            for (off = 0; off < t->recordSz; off += sz) {
+                sz = t->recordSz - off;
+                if (sz > maxOut)
+                    sz = maxOut;
+                if (tunnel_io(t, cli_ssl, TUNNEL_WRITE, msg + off, sz) != sz)
+                    err_sys("bad client write");
+            }
+        }
+        free(msg);
+    }
+
+    if (t->useBio) {
+#ifdef OPENSSL_EXTRA
+        /* drops this thread's BIO references; srv_ssl still holds its own */
+        wolfSSL_set_bio(cli_ssl, NULL, NULL);
+#endif
+    }
+    wolfSSL_free(cli_ssl);
+    wolfSSL_CTX_free(cli_ctx);
+
+    return NULL;
+}
+
+
+/* run the server side of a tunnel with the client on another thread
+ * returns seconds taken to receive the records after the handshake */
+static double run_tunnel(TUNNEL* t, int verbose)
+{
+    WOLFSSL_CTX* srv_ctx = NULL;
+    WOLFSSL* srv_ssl     = NULL;
+    WOLFSSL_CIPHER* cipher;
+    unsigned char* buf;
+    const char *name;
+    struct timespec start, end;
+    long total = (long)t->recordSz * t->records;
+    long got = 0;
+    int bufSz = t->recordSz > 80 ? t->recordSz : 80;
+    pthread_t tid;
+    int ret;
+
+    if (t->useBio) {
+#ifdef OPENSSL_EXTRA
+        t->rbio = wolfSSL_BIO_new(wolfSSL_BIO_s_mem());
+        t->wbio = wolfSSL_BIO_new(wolfSSL_BIO_s_mem());
+        /* cli_ssl and srv_ssl both use these */
+        wolfSSL_BIO_up_ref(t->rbio);
+        wolfSSL_BIO_up_ref(t->wbio);
+#else
+        err_sys("memory BIOs need OPENSSL_EXTRA");
+#endif
+    }
+    else {
+        t->toServer = (RING*)aligned_alloc(CACHE_LINE, sizeof(RING));
+        t->toClient = (RING*)aligned_alloc(CACHE_LINE, sizeof(RING));
+        if (t->toServer == NULL || t->toClient == NULL)
+            err_sys("out of memory");
+        t->toServer->head = t->toServer->tail = 0;
+        t->toClient->head = t->toClient->tail = 0;
+    }
+    sem_init(&t->bioSem, 0, 1);
+
+    /* set up server */
+    srv_ctx = wolfSSL_CTX_new(
+    #ifdef WOLFSSL_DTLS13
+        wolfDTLSv1_3_server_method()
+    #else
+        wolfDTLSv1_2_server_method()
+    #endif
+    );
+    if (srv_ctx == NULL) err_sys("bad server ctx new");
+
+    ret = wolfSSL_CTX_use_PrivateKey_file(srv_ctx, KEY_FILE, WOLFSSL_FILETYPE_PEM);
+    if (ret != WOLFSSL_SUCCESS) {
+        err_sys("bad server key file load");
+    }
+
+    ret = wolfSSL_CTX_use_certificate_file(srv_ctx, CERT_FILE, WOLFSSL_FILETYPE_PEM);
+    if (ret != WOLFSSL_SUCCESS) {
+        err_sys("bad server cert file load");
+    }
+
+    srv_ssl = wolfSSL_new(srv_ctx);
+    if (srv_ssl == NULL) {
+        err_sys("bad server new");
+    }
+    tunnel_attach(t, srv_ssl, 1);
+
+    buf = (unsigned char*)malloc(bufSz);
+    if (buf == NULL) err_sys("out of memory");
+
+    /* start client thread */
+    pthread_create(&tid, 0, client_thread, (void*)t);
+
+    /* accept dtls connection without udp sockets */
+    ret = tunnel_io(t, srv_ssl, TUNNEL_ACCEPT, NULL, 0);
+    if (ret != WOLFSSL_SUCCESS) err_sys("bad server dtls accept");
+
+    if (verbose) {
+        printf("wolfSSL accept success!\n");
+        printf("Version: %s\n", wolfSSL_get_version(srv_ssl));
+        cipher = wolfSSL_get_current_cipher(srv_ssl);
+        printf("Cipher Suite: %s\n", wolfSSL_CIPHER_get_name(cipher));
+        if ((name = wolfSSL_get_curve_name(srv_ssl)) != NULL)
+            printf("Curve: %s\n", name);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (t->recordSz == 0) {
+        /* read msg post handshake from client */
+        memset(buf, 0, bufSz);
+        ret = tunnel_io(t, srv_ssl, TUNNEL_READ, buf, bufSz - 1);
+        if (ret >= 0) {
+            printf("client msg = %s\n", buf);
+        }
+    }
+    else {
+        while (got < total) {
+            ret = tunnel_io(t, srv_ssl, TUNNEL_READ, buf, bufSz);
+            if (ret <= 0) err_sys("bad server read");
+            got += ret;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_join(tid, NULL);
+
+    /* clean up */
+    sem_destroy(&t->bioSem);
+    free(buf);
+    wolfSSL_free(srv_ssl); /* This also does free on rbio and wbio */
+    wolfSSL_CTX_free(srv_ctx);
+    if (!t->useBio) {
+        free(t->toServer);
+        free(t->toClient);
+    }
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+
+/* tunnel throughput over memory BIOs and rings at each record size */
+static void benchmark(void)
+{
+    static const int sizes[] = { 64, 256, 1024, 4096, 16384 };
+    static const char* names[] = { "ring", "memory BIO" };
+    TUNNEL t;
+    double secs;
+    int i, useBio;
+
+    printf("%-10s %8s %10s %12s\n", "transport", "record", "MB/s",
+           "records/s");
+    for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); i++) {
+        for (useBio = 1; useBio >= 0; useBio--) {
+#ifndef OPENSSL_EXTRA
+            if (useBio)
+                continue;
+#endif
+            memset(&t, 0, sizeof(t));
+            t.useBio = useBio;
+            t.recordSz = sizes[i];
+            t.records = BENCH_BYTES / sizes[i];
+            if (t.records < BENCH_MIN_RECS)
+                t.records = BENCH_MIN_RECS;
+            secs = run_tunnel(&t, 0);
+            printf("%-10s %8d %10.1f %12.0f\n", names[useBio], sizes[i],
+                   t.records * (double)sizes[i] / secs / (1024 * 1024),
+                   t.records / secs);
+        }
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    TUNNEL t;
+
+#if 0
+    wolfSSL_Debugging_ON();
+#endif
+    wolfSSL_Init();
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        benchmark();
+    }
+    else {
+        memset(&t, 0, sizeof(t));
+        run_tunnel(&t, 1);
+    }
+
+    wolfSSL_Cleanup();
+
+    return 0;
+}
@@ -25,6 +25,10 @@
  * on any event libraries.
  */
 
+/* Needed for recvmmsg() and sendmmsg(). */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
 #include <wolfssl/options.h>
 #include <wolfssl/ssl.h>
 #include <stdio.h>                  /* standard in/out procedures */
@@ -33,19 +37,46 @@
 #include <netdb.h>
 #include <sys/socket.h>             /* used for all socket calls */
 #include <netinet/in.h>             /* used for sockaddr_in */
+#include <netinet/udp.h>            /* UDP_SEGMENT for GSO */
 #include <arpa/inet.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/resource.h>
 
 #include "dtls-common.h"
 
 /* We need a constant CID size because the CID field in the record header doesn't have a length field */
 #define CID_SIZE 8
-
-static int intCalled = 0;
+/* Initial number of slots in each connection hash table. Must be a power of 2. */
+#define CONN_HASH_INIT 64
+/* Marks a slot whose connection was removed so that probing continues past it. */
+#define CONN_HASH_DELETED ((struct ConnList*)-1)
+/* Resolution of the timer wheel in milliseconds */
+#define TIMER_TICK_MS 10
+/* Number of slots in the timer wheel. Must be a multiple of 64. Timeouts further out than one
+ * revolution share a slot with nearer ones and are skipped until their tick comes around. */
+#define TIMER_WHEEL_SLOTS 1024
+/* Most datagrams read or written with one system call */
+#define DGRAM_BATCH 32
+/* Largest datagram we handle */
+#define DGRAM_MAX 2000
+/* Most datagrams the kernel will split one UDP GSO write into */
+#define GSO_MAX_SEGS 64
+/* Most worker threads. The worker index is the first byte of the CIDs it hands out. */
+#define MAX_WORKERS 64
+/* Most datagrams waiting to be forwarded to a worker. More are dropped as if lost. */
+#define MAX_FORWARDS 1024
+
+static volatile int intCalled = 0; /* also tells the workers to stop */
+static int stressMode = 0; /* measure migrations and don't print app data */
 
 /**
  * \brief Signal handler for teardown.
@@ -63,25 +94,140 @@ static void teardown(int signum)
                           * important to check because we want to limit the ability for malicious clients
                           * to stall and use up server resources. */
 
+/** Kinds of timeout a connection can have pending. */
+enum {
+    TIMEOUT_RTX, /**< Handshake retransmission, or waiting on app data after the handshake */
+    TIMEOUT_HS_LIMIT /**< Handshake has run longer than MAX_HS_TIME */
+};
+
+/**
+ * \struct DtlsTimeout
+ * \brief Structure to hold timeout information. Embedded in the connection so it can be cancelled
+ *        without searching for it.
+ */
+struct DtlsTimeout {
+    uint64_t expires; /**< Tick when the timeout should occur */
+    struct ConnList* conn; /**< Pointer to the connection associated with the timeout */
+    int kind; /**< TIMEOUT_RTX or TIMEOUT_HS_LIMIT */
+    int armed; /**< Whether the timeout is in the timer wheel */
+    struct DtlsTimeout* prev; /**< Pointer to the previous timeout in the slot */
+    struct DtlsTimeout* next; /**< Pointer to the next timeout in the slot */
+};
+
+/**
+ * \struct TimerWheel
+ * \brief Hashed timing wheel of timeouts. Slot is the expiry tick modulo the number of slots.
+ */
+struct TimerWheel {
+    struct DtlsTimeout* slots[TIMER_WHEEL_SLOTS]; /**< Unordered list of timeouts in each slot */
+    uint64_t used[TIMER_WHEEL_SLOTS / 64]; /**< Bit set for each slot that is not empty */
+    uint64_t cursor; /**< Next tick to check for expired timeouts */
+    int cnt; /**< Number of armed timeouts */
+};
+
 /**
  * \struct ConnList
  * \brief Structure to hold connection information.
  */
 struct ConnList {
     WOLFSSL* ssl; /**< WOLFSSL object for the connection */
-    time_t t_started; /**< Time when the connection started */
+    struct DtlsTimeout rtx; /**< Retransmission or app data timeout */
+    struct DtlsTimeout hsLimit; /**< Timeout for the whole handshake */
     int id; /**< ID number of the connection */
+    byte cid[CID_SIZE]; /**< CID the peer puts in records to us - hash table key */
+    int hasCid; /**< Whether the connection is in the CID hash table */
+    struct sockaddr peer; /**< Peer address - hash table key */
+    socklen_t peerSz; /**< Length of the peer address */
     struct ConnList* next; /**< Pointer to the next connection in the list */
 };
 
 /**
- * \struct DtlsTimeout
- * \brief Structure to hold timeout information.
+ * \struct ConnHash
+ * \brief Open-addressing hash table of connections with linear probing.
  */
-struct DtlsTimeout {
-    struct timespec ts; /**< Time when the timeout should occur */
-    struct ConnList* conn; /**< Pointer to the connection associated with the timeout */
-    struct DtlsTimeout* next; /**< Pointer to the next timeout in the list */
+struct ConnHash {
+    struct ConnList** slots; /**< NULL when empty, CONN_HASH_DELETED when removed */
+    size_t cap; /**< Number of slots - a power of 2 */
+    size_t used; /**< Number of slots not empty, including removed */
+    size_t cnt; /**< Number of connections in the table */
+    int byCid; /**< Keyed on the CID when set, otherwise on the peer address */
+};
+
+/**
+ * \struct ConnIndex
+ * \brief Hash tables to find the connection that a datagram is for.
+ */
+struct ConnIndex {
+    struct ConnHash cid; /**< Connections keyed on the 8-byte CID */
+    struct ConnHash peer; /**< Connections keyed on the peer address */
+};
+
+/**
+ * \struct DgramIO
+ * \brief Datagrams read with one recvmmsg() and datagrams queued to be written with one sendmmsg().
+ *        Shared by all the WOLFSSL objects through their IO callbacks.
+ */
+struct DgramIO {
+    int fd; /**< Socket that all connections use */
+    int gso; /**< Write datagrams to the same peer as one UDP GSO message when set */
+    int inCnt; /**< Number of datagrams read by the last recvmmsg() */
+    int outCnt; /**< Number of datagrams waiting to be written */
+    const byte* rx; /**< Datagram for the WOLFSSL object currently being dispatched to */
+    int rxSz; /**< Length of rx - 0 once it has been read */
+    struct mmsghdr inMsgs[DGRAM_BATCH]; /**< Headers for recvmmsg() */
+    struct iovec inIovs[DGRAM_BATCH]; /**< One buffer per datagram read */
+    struct sockaddr_storage inAddrs[DGRAM_BATCH]; /**< Address each datagram came from */
+    byte inBufs[DGRAM_BATCH][DGRAM_MAX]; /**< Datagrams read */
+    struct mmsghdr outMsgs[DGRAM_BATCH]; /**< Headers for sendmmsg() - built when flushing */
+    struct iovec outIovs[DGRAM_BATCH]; /**< One buffer per datagram to write */
+    struct sockaddr_storage outAddrs[DGRAM_BATCH]; /**< Address to send each datagram to */
+    socklen_t outAddrSz[DGRAM_BATCH]; /**< Length of each address */
+    byte outBufs[DGRAM_BATCH][DGRAM_MAX]; /**< Datagrams to write */
+    char outCtrl[DGRAM_BATCH][CMSG_SPACE(sizeof(uint16_t))]; /**< GSO segment size of each message */
+};
+
+/**
+ * \struct Forward
+ * \brief Datagram read by one worker for a connection owned by another.
+ */
+struct Forward {
+    struct Forward* next; /**< Pointer to the next forwarded datagram */
+    struct sockaddr_storage peer; /**< Address the datagram came from */
+    socklen_t peerSz; /**< Length of the address */
+    ssize_t sz; /**< Length of the datagram */
+    byte msg[DGRAM_MAX]; /**< The datagram */
+};
+
+/**
+ * \struct Worker
+ * \brief A worker thread. Owns a SO_REUSEPORT socket and the connections whose handshake arrived
+ *        on it. Other workers only touch the forward queue.
+ */
+struct Worker {
+    int id; /**< Index of the worker - first byte of the CIDs it hands out */
+    pthread_t tid; /**< Thread running the worker */
+    WOLFSSL_CTX* ctx; /**< Shared by all workers */
+    WC_RNG* rng; /**< Random number generator of this worker */
+    int fd; /**< Our SO_REUSEPORT socket */
+    struct DgramIO* io; /**< Batches the datagrams read and written on our socket */
+    WOLFSSL* listenSSL; /**< The stateless listening WOLFSSL object */
+    struct ConnList* connList; /**< List of active or handshaking connections */
+    struct ConnIndex idx; /**< Hash tables to find the connection of a datagram */
+    struct TimerWheel timeouts; /**< Pending timeouts of all connections */
+    int efd; /**< eventfd signalled when datagrams are forwarded to us */
+    pthread_mutex_t fwdLock; /**< Protects the forward queue */
+    struct Forward* fwdHead; /**< First datagram forwarded to us */
+    struct Forward* fwdTail; /**< Last datagram forwarded to us */
+    int fwdCnt; /**< Number of datagrams in the forward queue */
+    unsigned long numDgrams; /**< Number of datagrams handled */
+    unsigned long numHelloGood; /**< Number of ClientHellos with a valid cookie */
+    unsigned long numForwarded; /**< Number of datagrams forwarded to other workers */
+    unsigned long numConns; /**< Number of connections created */
+    unsigned long numMigrated; /**< Number of datagrams that moved a connection to a new address */
+    unsigned long numSteady; /**< Number of datagrams for a connection at its known address */
+    uint64_t migratedNs; /**< CPU time handling datagrams that moved a connection */
+    uint64_t steadyNs; /**< CPU time handling datagrams for a connection at its known address */
+    int exitVal; /**< 0 when the worker stopped without error */
 };
 
 /**
@@ -95,44 +241,59 @@ WOLFSSL_CTX* newCTX(void);
  * \brief Create a new WOLFSSL object.
  *
  * \param ctx Pointer to the WOLFSSL_CTX object.
- * \param fd File descriptor for the socket.
+ * \param io Pointer to the batched datagram IO of the socket.
  * \param rng Pointer to the random number generator.
- * \param connList Pointer to the list of connections.
+ * \param idx Pointer to the connection hash tables.
+ * \param workerId Index of the worker that will own the connection.
  *
  * \return Pointer to the new WOLFSSL object, or NULL on error.
  */
-WOLFSSL* newSSL(WOLFSSL_CTX* ctx, int fd, WC_RNG* rng, struct ConnList* connList);
+WOLFSSL* newSSL(WOLFSSL_CTX* ctx, struct DgramIO* io, WC_RNG* rng, struct ConnIndex* idx,
+                byte workerId);
 
 /**
- * \brief Create a new socket.
+ * \brief Create a new socket. Each worker has its own socket bound to the same port.
  *
  * \return File descriptor for the new socket, or INVALID_SOCKET on error.
  */
 int newFD(void);
 
 /**
- * \brief Create a new connection and add it to the connection list.
+ * \brief Create a new connection and add it to the connection list and hash tables.
  *
  * \param ssl Pointer to the WOLFSSL object.
  * \param connList Pointer to the list of connections.
+ * \param idx Pointer to the connection hash tables.
  *
  * \return Pointer to the new connection, or NULL on error.
  */
-struct ConnList* newConn(WOLFSSL* ssl, struct ConnList** connList);
+struct ConnList* newConn(WOLFSSL* ssl, struct ConnList** connList, struct ConnIndex* idx);
 
 /**
- * \brief Free a connection and remove it from the connection list.
+ * \brief Free a connection and remove it from the connection list and hash tables.
  *
  * \param connList Pointer to the list of connections.
  * \param conn Pointer to the connection to be freed.
- * \param tList Pointer to the list of timeouts.
+ * \param wheel Pointer to the timer wheel.
+ * \param idx Pointer to the connection hash tables.
  */
-void freeConn(struct ConnList** connList, struct ConnList* conn, struct DtlsTimeout** tList);
+void freeConn(struct ConnList** connList, struct ConnList* conn, struct TimerWheel* wheel,
+              struct ConnIndex* idx);
 
 /**
- * \brief Find a connection in the connection list based on the connection ID or peer address
+ * \brief Update the peer hash table when a connection has migrated to a new address.
  *
- * \param connList Pointer to the list of connections.
+ * \param idx Pointer to the connection hash tables.
+ * \param conn Pointer to the connection.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int updateConnPeer(struct ConnIndex* idx, struct ConnList* conn);
+
+/**
+ * \brief Find a connection based on the connection ID or peer address
+ *
+ * \param idx Pointer to the connection hash tables.
  * \param msg Pointer to the message.
  * \param sz Size of the message.
  * \param peerAddr Pointer to the peer address.
@@ -140,7 +301,7 @@ void freeConn(struct ConnList** connList, struct ConnList* conn, struct DtlsTime
  *
  * \return Pointer to the matching connection, or NULL if not found.
  */
-struct ConnList* findConn(struct ConnList* connList, byte* msg, ssize_t sz, struct sockaddr* peerAddr, socklen_t peerAddrLen);
+struct ConnList* findConn(struct ConnIndex* idx, byte* msg, ssize_t sz, struct sockaddr* peerAddr, socklen_t peerAddrLen);
 
 /**
  * \brief Handle an existing connection.
@@ -155,122 +316,1445 @@ struct ConnList* findConn(struct ConnList* connList, byte* msg, ssize_t sz, stru
  */
 int dispatchExistingConnection(struct ConnList* conn, byte* msg, ssize_t msgSz, struct sockaddr* peerAddr, socklen_t peerAddrLen);
 
-/**
- * \brief Handle a new connection.
- *
- * \param ssl Pointer to the WOLFSSL object.
- * \param msg Pointer to the message.
- * \param msgSz Size of the message.
- * \param peerAddr Pointer to the peer address.
- * \param peerAddrLen Length of the peer address.
- *
- * \return WOLFSSL_SUCCESS on success, WOLFSSL_FATAL_ERROR on error.
- */
-int dispatchNewConnection(WOLFSSL* ssl, byte* msg, ssize_t msgSz, struct sockaddr* peerAddr, socklen_t peerAddrLen);
+/**
+ * \brief Handle a new connection.
+ *
+ * \param ssl Pointer to the WOLFSSL object.
+ * \param msg Pointer to the message.
+ * \param msgSz Size of the message.
+ * \param peerAddr Pointer to the peer address.
+ * \param peerAddrLen Length of the peer address.
+ *
+ * \return WOLFSSL_SUCCESS on success, WOLFSSL_FATAL_ERROR on error.
+ */
+int dispatchNewConnection(WOLFSSL* ssl, byte* msg, ssize_t msgSz, struct sockaddr* peerAddr, socklen_t peerAddrLen);
+
+/**
+ * \brief Initialize an empty timer wheel.
+ *
+ * \param wheel Pointer to the timer wheel.
+ */
+void initTimeouts(struct TimerWheel* wheel);
+
+/**
+ * \brief Return the time until the next timeout in milliseconds.
+ *
+ * \param wheel Pointer to the timer wheel.
+ *
+ * \return Next timeout in milliseconds, or -1 if no timeout set.
+ */
+int getNextTimeout(struct TimerWheel* wheel);
+
+/**
+ * \brief Remove the next expired timeout from the timer wheel.
+ *
+ * Call until NULL is returned to handle all timeouts that expired while polling.
+ *
+ * \param wheel Pointer to the timer wheel.
+ *
+ * \return Pointer to the expired timeout, or NULL if none have expired.
+ */
+struct DtlsTimeout* popTimeout(struct TimerWheel* wheel);
+
+/**
+ * \brief Register the next timeout for a connection.
+ *
+ * Also arms the handshake time limit on the first call and cancels it once the handshake is done.
+ *
+ * \param wheel Pointer to the timer wheel.
+ * \param conn Pointer to the connection.
+ *
+ * \return 1 on success, 0 on error.
+ */
+int registerTimeout(struct TimerWheel* wheel, struct ConnList* conn);
+
+/**
+ * \brief Cancel any timeouts associated with a connection.
+ *
+ * \param wheel Pointer to the timer wheel.
+ * \param conn Pointer to the connection.
+ */
+void freeTimeouts(struct TimerWheel* wheel, struct ConnList* conn);
+
+/**
+ * \brief Handle a timeout that occurred for a connection.
+ *
+ * \param t Pointer to the expired timeout.
+ *
+ * \return WOLFSSL_SUCCESS on success, -1 on error.
+ */
+int handleTimeout(struct DtlsTimeout* t);
+
+/**
+ * \brief Hash a key with FNV-1a.
+ *
+ * \param key Pointer to the key.
+ * \param keySz Length of the key.
+ *
+ * \return Hash of the key.
+ */
+static word32 connHashKey(const byte* key, size_t keySz)
+{
+    word32 h = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < keySz; i++) {
+        h ^= key[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+/**
+ * \brief Get the key that a hash table indexes a connection by.
+ *
+ * \param table Pointer to the hash table.
+ * \param conn Pointer to the connection.
+ * \param keySz Set to the length of the key.
+ *
+ * \return Pointer to the key.
+ */
+static const byte* connHashConnKey(struct ConnHash* table, struct ConnList* conn, size_t* keySz)
+{
+    if (table->byCid) {
+        *keySz = CID_SIZE;
+        return conn->cid;
+    }
+    *keySz = conn->peerSz;
+    return (const byte*)&conn->peer;
+}
+
+/**
+ * \brief Initialize an empty connection hash table.
+ *
+ * \param table Pointer to the hash table.
+ * \param byCid Key the table on the CID when set, otherwise on the peer address.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int connHashInit(struct ConnHash* table, int byCid)
+{
+    table->slots = (struct ConnList**)calloc(CONN_HASH_INIT, sizeof(*table->slots));
+    if (table->slots == NULL)
+        return 0;
+    table->cap = CONN_HASH_INIT;
+    table->used = 0;
+    table->cnt = 0;
+    table->byCid = byCid;
+    return 1;
+}
+
+/**
+ * \brief Free the slots of a connection hash table. The connections are not freed.
+ *
+ * \param table Pointer to the hash table.
+ */
+static void connHashFree(struct ConnHash* table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->cap = table->used = table->cnt = 0;
+}
+
+/**
+ * \brief Find the connection with the key in a hash table.
+ *
+ * \param table Pointer to the hash table.
+ * \param key Pointer to the key.
+ * \param keySz Length of the key.
+ *
+ * \return Pointer to the matching connection, or NULL if not found.
+ */
+static struct ConnList* connHashFind(struct ConnHash* table, const byte* key, size_t keySz)
+{
+    size_t mask = table->cap - 1;
+    size_t i = connHashKey(key, keySz) & mask;
+
+    for (; table->slots[i] != NULL; i = (i + 1) & mask) {
+        struct ConnList* conn = table->slots[i];
+        const byte* connKey;
+        size_t connKeySz;
+
+        if (conn == CONN_HASH_DELETED)
+            continue;
+        connKey = connHashConnKey(table, conn, &connKeySz);
+        if (connKeySz == keySz && memcmp(connKey, key, keySz) == 0)
+            return conn;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Put a connection into the first free slot for its key.
+ *
+ * \param table Pointer to the hash table. Must have a free slot.
+ * \param conn Pointer to the connection.
+ */
+static void connHashPlace(struct ConnHash* table, struct ConnList* conn)
+{
+    size_t mask = table->cap - 1;
+    size_t keySz;
+    const byte* key = connHashConnKey(table, conn, &keySz);
+    size_t i = connHashKey(key, keySz) & mask;
+
+    while (table->slots[i] != NULL && table->slots[i] != CONN_HASH_DELETED)
+        i = (i + 1) & mask;
+    if (table->slots[i] == NULL)
+        table->used++;
+    table->slots[i] = conn;
+    table->cnt++;
+}
+
+/**
+ * \brief Add a connection to a hash table, growing it to keep the probes short.
+ *
+ * \param table Pointer to the hash table.
+ * \param conn Pointer to the connection.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int connHashAdd(struct ConnHash* table, struct ConnList* conn)
+{
+    /* Keep at most 3/4 of the slots in use, counting removed ones. */
+    if ((table->used + 1) * 4 > table->cap * 3) {
+        struct ConnList** old = table->slots;
+        size_t oldCap = table->cap;
+        size_t cap = oldCap;
+        size_t i;
+
+        /* Only grow when the live connections need it - else drop removed slots. */
+        if ((table->cnt + 1) * 2 > oldCap)
+            cap *= 2;
+        table->slots = (struct ConnList**)calloc(cap, sizeof(*table->slots));
+        if (table->slots == NULL) {
+            table->slots = old;
+            return 0;
+        }
+        table->cap = cap;
+        table->used = 0;
+        table->cnt = 0;
+        for (i = 0; i < oldCap; i++) {
+            if (old[i] != NULL && old[i] != CONN_HASH_DELETED)
+                connHashPlace(table, old[i]);
+        }
+        free(old);
+    }
+    connHashPlace(table, conn);
+    return 1;
+}
+
+/**
+ * \brief Remove a connection from a hash table.
+ *
+ * \param table Pointer to the hash table.
+ * \param conn Pointer to the connection.
+ */
+static void connHashRemove(struct ConnHash* table, struct ConnList* conn)
+{
+    size_t mask = table->cap - 1;
+    size_t keySz;
+    const byte* key = connHashConnKey(table, conn, &keySz);
+    size_t i = connHashKey(key, keySz) & mask;
+
+    for (; table->slots[i] != NULL; i = (i + 1) & mask) {
+        if (table->slots[i] == conn) {
+            table->slots[i] = CONN_HASH_DELETED;
+            table->cnt--;
+            return;
+        }
+    }
+}
+
+/**
+ * \brief Create the batched datagram IO for a socket.
+ *
+ * \param fd File descriptor for the socket.
+ *
+ * \return Pointer to the new batched datagram IO, or NULL on error.
+ */
+static struct DgramIO* dgramNew(int fd)
+{
+    struct DgramIO* io = (struct DgramIO*)calloc(1, sizeof(struct DgramIO));
+    int i;
+
+    if (io == NULL)
+        return NULL;
+    io->fd = fd;
+#ifdef UDP_SEGMENT
+    io->gso = 1;
+#endif
+    for (i = 0; i < DGRAM_BATCH; i++) {
+        io->inIovs[i].iov_base = io->inBufs[i];
+        io->inIovs[i].iov_len = DGRAM_MAX;
+        io->inMsgs[i].msg_hdr.msg_iov = &io->inIovs[i];
+        io->inMsgs[i].msg_hdr.msg_iovlen = 1;
+        io->inMsgs[i].msg_hdr.msg_name = &io->inAddrs[i];
+        io->outIovs[i].iov_base = io->outBufs[i];
+    }
+    return io;
+}
+
+/**
+ * \brief Read all the datagrams waiting on the socket, up to DGRAM_BATCH.
+ *
+ * \param io Pointer to the batched datagram IO.
+ *
+ * \return Number of datagrams read, or -1 on error.
+ */
+static int dgramRecv(struct DgramIO* io)
+{
+    int i;
+    int n;
+
+    for (i = 0; i < DGRAM_BATCH; i++)
+        io->inMsgs[i].msg_hdr.msg_namelen = sizeof(io->inAddrs[i]);
+    do {
+        /* Don't wait for more than what is already there */
+        n = recvmmsg(io->fd, io->inMsgs, DGRAM_BATCH, MSG_DONTWAIT, NULL);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("recvmmsg");
+            io->inCnt = 0;
+            return -1;
+        }
+        n = 0;
+    }
+    io->inCnt = n;
+    return n;
+}
+
+/**
+ * \brief Write all queued datagrams.
+ *
+ * Consecutive datagrams to the same peer are written as one UDP GSO message when all but the
+ * last are the same size. A datagram that can't be written is dropped as if lost on the network.
+ *
+ * \param io Pointer to the batched datagram IO.
+ */
+static void dgramFlush(struct DgramIO* io)
+{
+    int cnt = 0; /* number of messages */
+    int sent = 0;
+    int i = 0;
+    int j;
+
+    while (i < io->outCnt) {
+        struct msghdr* hdr = &io->outMsgs[cnt].msg_hdr;
+        size_t segSz = io->outIovs[i].iov_len;
+        size_t total = segSz;
+
+        j = i + 1;
+#ifdef UDP_SEGMENT
+        while (io->gso && j < io->outCnt && j - i < GSO_MAX_SEGS &&
+                io->outIovs[j - 1].iov_len == segSz && io->outIovs[j].iov_len <= segSz &&
+                total + io->outIovs[j].iov_len <= 0xFFFF - 8 &&
+                io->outAddrSz[j] == io->outAddrSz[i] &&
+                memcmp(&io->outAddrs[j], &io->outAddrs[i], io->outAddrSz[i]) == 0) {
+            total += io->outIovs[j].iov_len;
+            j++;
+        }
+#endif
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name = &io->outAddrs[i];
+        hdr->msg_namelen = io->outAddrSz[i];
+        hdr->msg_iov = &io->outIovs[i];
+        hdr->msg_iovlen = j - i;
+#ifdef UDP_SEGMENT
+        if (j - i > 1) {
+            struct cmsghdr* cm;
+            hdr->msg_control = io->outCtrl[cnt];
+            hdr->msg_controllen = sizeof(io->outCtrl[cnt]);
+            cm = CMSG_FIRSTHDR(hdr);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            *(uint16_t*)CMSG_DATA(cm) = (uint16_t)segSz;
+        }
+#endif
+        cnt++;
+        i = j;
+    }
+    io->outCnt = 0;
+
+    while (sent < cnt) {
+        struct msghdr* hdr = &io->outMsgs[sent].msg_hdr;
+        int n = sendmmsg(io->fd, &io->outMsgs[sent], cnt - sent, 0);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (hdr->msg_controllen != 0 && (errno == EIO || errno == EINVAL)) {
+            /* GSO not usable on this path - write the segments one at a time from now on */
+            size_t k;
+            io->gso = 0;
+            for (k = 0; k < hdr->msg_iovlen; k++) {
+                if (sendto(io->fd, hdr->msg_iov[k].iov_base, hdr->msg_iov[k].iov_len, 0,
+                        (struct sockaddr*)hdr->msg_name, hdr->msg_namelen) < 0)
+                    perror("sendto");
+            }
+        }
+        else {
+            perror("sendmmsg");
+        }
+        sent++;
+    }
+}
+
+/**
+ * \brief Queue a datagram to be written by the next flush.
+ *
+ * \param io Pointer to the batched datagram IO.
+ * \param buf Pointer to the datagram.
+ * \param sz Length of the datagram.
+ * \param peer Pointer to the address to send to.
+ * \param peerSz Length of the address.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int dgramQueue(struct DgramIO* io, const byte* buf, int sz, const void* peer, socklen_t peerSz)
+{
+    int i;
+
+    if (sz > DGRAM_MAX || peerSz > sizeof(io->outAddrs[0]))
+        return 0;
+    if (io->outCnt == DGRAM_BATCH)
+        dgramFlush(io);
+    i = io->outCnt++;
+    memcpy(io->outBufs[i], buf, sz);
+    io->outIovs[i].iov_len = sz;
+    memcpy(&io->outAddrs[i], peer, peerSz);
+    io->outAddrSz[i] = peerSz;
+    return 1;
+}
+
+/**
+ * \brief Give a WOLFSSL object the datagram that was read for it.
+ *
+ * \param ssl Pointer to the WOLFSSL object.
+ * \param msg Pointer to the datagram.
+ * \param msgSz Length of the datagram.
+ *
+ * \return WOLFSSL_SUCCESS on success, WOLFSSL_FATAL_ERROR on error.
+ */
+static int dgramInject(WOLFSSL* ssl, const byte* msg, ssize_t msgSz)
+{
+    struct DgramIO* io = (struct DgramIO*)wolfSSL_GetIOReadCtx(ssl);
+
+    if (io == NULL)
+        return WOLFSSL_FATAL_ERROR;
+    io->rx = msg;
+    io->rxSz = (int)msgSz;
+    return WOLFSSL_SUCCESS;
+}
+
+/**
+ * \brief IO receive callback. Hands over the datagram set with dgramInject().
+ *
+ * \param ssl Pointer to the WOLFSSL object.
+ * \param buf Buffer to copy the datagram into.
+ * \param sz Size of the buffer.
+ * \param ctx Pointer to the batched datagram IO.
+ *
+ * \return Length of the datagram, or WOLFSSL_CBIO_ERR_WANT_READ when there is none.
+ */
+static int dgramIORecv(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    struct DgramIO* io = (struct DgramIO*)ctx;
+
+    (void)ssl;
+    if (io->rxSz == 0)
+        return WOLFSSL_CBIO_ERR_WANT_READ;
+    /* Truncate like recvfrom() would */
+    if (sz > io->rxSz)
+        sz = io->rxSz;
+    memcpy(buf, io->rx, sz);
+    io->rxSz = 0;
+    return sz;
+}
+
+/**
+ * \brief IO send callback. Queues the datagram for the peer to be written at the end of the loop.
+ *
+ * \param ssl Pointer to the WOLFSSL object.
+ * \param buf Pointer to the datagram.
+ * \param sz Length of the datagram.
+ * \param ctx Pointer to the batched datagram IO.
+ *
+ * \return Length of the datagram, or WOLFSSL_CBIO_ERR_GENERAL on error.
+ */
+static int dgramIOSend(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    struct DgramIO* io = (struct DgramIO*)ctx;
+    const void* peer = NULL;
+    unsigned int peerSz = 0;
+
+    if (wolfSSL_dtls_get0_peer(ssl, &peer, &peerSz) != WOLFSSL_SUCCESS ||
+            !dgramQueue(io, (const byte*)buf, sz, peer, peerSz))
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    return sz;
+}
+
+/**
+ * \brief Handle application data received from a peer.
+ *
+ * \param ssl Pointer to the WOLFSSL object.
+ * \param appData Pointer to the application data.
+ * \param appDataSz Size of the application data.
+ * \param id ID number of the connection.
+ *
+ * \return Number of bytes written, or a negative value on error.
+ */
+static int handleApplicationData(WOLFSSL* ssl, byte* appData, int appDataSz, int id)
+{
+    /* Process app data from peer. For this example just echo it */
+    const void* peer = NULL;
+    unsigned int peerSz = 0;
+    char* peerName = NULL;
+    uint16_t peerPort = 0;
+    if (wolfSSL_dtls_get0_peer(ssl, &peer, &peerSz) == WOLFSSL_SUCCESS) {
+        peerName = inet_ntoa(((struct sockaddr_in *)peer)->sin_addr);
+        peerPort = ntohs(((struct sockaddr_in *)peer)->sin_port);
+    }
+    if (!stressMode)
+        printf("(#%d) from %s:%d wrote: %.*s\n", id, peerName, peerPort, appDataSz, appData);
+    return wolfSSL_write(ssl, appData, appDataSz);
+}
+
+/**
+ * \brief Get the current time in nanoseconds.
+ *
+ * \return Monotonic time in nanoseconds.
+ */
+static double benchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * \brief Get the CPU time used by the calling thread.
+ *
+ * \return CPU time in nanoseconds.
+ */
+static uint64_t threadCpuNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * \brief Benchmark finding connections as the number of peers grows.
+ *
+ * Fills the hash tables with fake connections and times lookups by CID and by
+ * peer address. The cost of walking a list, as done before the hash tables,
+ * is shown for comparison - it doesn't even include the two wolfSSL calls
+ * made per list entry.
+ *
+ * \param rng Pointer to the random number generator.
+ *
+ * \return 0 on success, 1 on error.
+ */
+static int benchFindConn(WC_RNG* rng)
+{
+    static const int peerCounts[] = { 100, 1000, 10000, 100000 };
+    const int lookups = 1000000;
+    const int listLookups = 1000;
+    size_t n;
+    int ret = 0;
+
+    printf("%8s %12s %12s %12s\n", "peers", "cid ns", "peer ns", "list ns");
+    for (n = 0; ret == 0 && n < sizeof(peerCounts) / sizeof(*peerCounts); n++) {
+        int cnt = peerCounts[n];
+        struct ConnIndex idx;
+        struct ConnList* conns;
+        struct ConnList* conn;
+        double start, cidNs, peerNs, listNs;
+        int i;
+        int pick = 0; /* steps through the connections in a scattered order */
+        int found = 0;
+
+        memset(&idx, 0, sizeof(idx));
+        conns = (struct ConnList*)calloc(cnt, sizeof(*conns));
+        if (conns == NULL || !connHashInit(&idx.cid, 1) || !connHashInit(&idx.peer, 0)) {
+            fprintf(stderr, "benchmark setup error.\n");
+            ret = 1;
+            goto cleanup;
+        }
+        for (i = 0; i < cnt; i++) {
+            struct sockaddr_in* addr = (struct sockaddr_in*)&conns[i].peer;
+            if (wc_RNG_GenerateBlock(rng, conns[i].cid, CID_SIZE) != 0) {
+                fprintf(stderr, "wc_RNG_GenerateBlock error.\n");
+                ret = 1;
+                goto cleanup;
+            }
+            addr->sin_family = AF_INET;
+            addr->sin_addr.s_addr = htonl(0x0a000000 + i);
+            addr->sin_port = htons(SERV_PORT);
+            conns[i].peerSz = sizeof(*addr);
+            conns[i].next = (i + 1 < cnt) ? &conns[i + 1] : NULL;
+            if (!connHashAdd(&idx.cid, &conns[i]) || !connHashAdd(&idx.peer, &conns[i])) {
+                fprintf(stderr, "connHashAdd error.\n");
+                ret = 1;
+                goto cleanup;
+            }
+        }
+
+        start = benchNow();
+        for (i = 0; i < lookups; i++) {
+            pick = (pick + 7919) % cnt;
+            found += connHashFind(&idx.cid, conns[pick].cid, CID_SIZE) != NULL;
+        }
+        cidNs = (benchNow() - start) / lookups;
+
+        start = benchNow();
+        for (i = 0; i < lookups; i++) {
+            pick = (pick + 7919) % cnt;
+            conn = &conns[pick];
+            found += connHashFind(&idx.peer, (const byte*)&conn->peer, conn->peerSz) != NULL;
+        }
+        peerNs = (benchNow() - start) / lookups;
+
+        start = benchNow();
+        for (i = 0; i < listLookups; i++) {
+            const byte* cid;
+            pick = (pick + 7919) % cnt;
+            cid = conns[pick].cid;
+            for (conn = conns; conn != NULL; conn = conn->next) {
+                if (memcmp(conn->cid, cid, CID_SIZE) == 0)
+                    break;
+            }
+            found += conn != NULL;
+        }
+        listNs = (benchNow() - start) / listLookups;
+
+        printf("%8d %12.1f %12.1f %12.1f\n", cnt, cidNs, peerNs, listNs);
+        if (found != 2 * lookups + listLookups)
+            fprintf(stderr, "benchmark lookup failed.\n");
+
+cleanup:
+        connHashFree(&idx.cid);
+        connHashFree(&idx.peer);
+        free(conns);
+    }
+    return ret;
+}
+
+/**
+ * \brief Time reading bursts of small datagrams off a loopback socket.
+ *
+ * \param tx Socket to write the bursts from.
+ * \param to Address of the socket of io.
+ * \param io Pointer to the batched datagram IO to read with.
+ * \param batched Read with recvmmsg() when set, otherwise with recvfrom().
+ *
+ * \return Datagrams read per second.
+ */
+static double benchDgramRecv(int tx, struct sockaddr_in* to, struct DgramIO* io, int batched)
+{
+    const int rounds = 2000;
+    const int burst = 4 * DGRAM_BATCH;
+    byte payload[100];
+    double elapsed = 0;
+    long got = 0;
+    int r, i;
+
+    memset(payload, 0, sizeof(payload));
+    for (r = 0; r < rounds; r++) {
+        double start;
+        for (i = 0; i < burst; i++)
+            (void)sendto(tx, payload, sizeof(payload), 0, (struct sockaddr*)to, sizeof(*to));
+        start = benchNow();
+        for (;;) {
+            if (batched) {
+                int n = dgramRecv(io);
+                if (n <= 0)
+                    break;
+                got += n;
+            }
+            else {
+                struct sockaddr_storage from;
+                socklen_t fromSz = sizeof(from);
+                if (recvfrom(io->fd, io->inBufs[0], DGRAM_MAX, MSG_DONTWAIT,
+                        (struct sockaddr*)&from, &fromSz) < 0)
+                    break;
+                got++;
+            }
+        }
+        elapsed += benchNow() - start;
+    }
+    return got / (elapsed / 1e9);
+}
+
+/**
+ * \brief Time writing MTU sized datagrams to a loopback socket.
+ *
+ * \param to Address to write to.
+ * \param io Pointer to the batched datagram IO to write with.
+ * \param batched Write with sendmmsg() when set, otherwise with sendto().
+ *
+ * \return Datagrams written per second.
+ */
+static double benchDgramSend(struct sockaddr_in* to, struct DgramIO* io, int batched)
+{
+    const int cnt = 200000;
+    byte payload[1200];
+    double start;
+    int i;
+
+    memset(payload, 0, sizeof(payload));
+    start = benchNow();
+    for (i = 0; i < cnt; i++) {
+        if (batched)
+            (void)dgramQueue(io, payload, sizeof(payload), to, sizeof(*to));
+        else
+            (void)sendto(io->fd, payload, sizeof(payload), 0, (struct sockaddr*)to, sizeof(*to));
+    }
+    dgramFlush(io);
+    return cnt / ((benchNow() - start) / 1e9);
+}
+
+/**
+ * \brief Benchmark reading and writing datagrams one per system call against in batches.
+ *
+ * Uses a pair of loopback sockets so only the cost of the system calls is measured.
+ *
+ * \return 0 on success, 1 on error.
+ */
+static int benchDgramIO(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrSz = sizeof(addr);
+    struct DgramIO* io = NULL;
+    int rx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int tx = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    int ret = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (rx < 0 || tx < 0 || bind(rx, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+            getsockname(rx, (struct sockaddr*)&addr, &addrSz) < 0) {
+        perror("benchmark socket");
+        goto cleanup;
+    }
+    if ((io = dgramNew(rx)) == NULL) {
+        fprintf(stderr, "dgramNew error.\n");
+        goto cleanup;
+    }
+
+    printf("%-20s %14s\n", "path", "datagrams/sec");
+    printf("%-20s %14.0f\n", "recvfrom", benchDgramRecv(tx, &addr, io, 0));
+    printf("%-20s %14.0f\n", "recvmmsg", benchDgramRecv(tx, &addr, io, 1));
+    io->fd = tx;
+    io->gso = 0;
+    printf("%-20s %14.0f\n", "sendto", benchDgramSend(&addr, io, 0));
+    printf("%-20s %14.0f\n", "sendmmsg", benchDgramSend(&addr, io, 1));
+#ifdef UDP_SEGMENT
+    io->gso = 1;
+    printf("%-20s %14.0f\n", "sendmmsg + UDP GSO", benchDgramSend(&addr, io, 1));
+#endif
+    ret = 0;
+cleanup:
+    free(io);
+    if (rx >= 0)
+        close(rx);
+    if (tx >= 0)
+        close(tx);
+    return ret;
+}
+
+/* All workers. Only the forward queues are touched by more than one thread. */
+static struct Worker workers[MAX_WORKERS];
+static int numWorkers = 1;
+
+/**
+ * \brief Called when a ClientHello has a valid cookie - the peer owns its address.
+ *
+ * \param ssl Pointer to the WOLFSSL object.
+ * \param arg Pointer to the worker.
+ *
+ * \return 0 to continue the handshake.
+ */
+static int chGoodCb(WOLFSSL* ssl, void* arg)
+{
+    struct Worker* w = (struct Worker*)arg;
+
+    (void)ssl;
+    w->numHelloGood++;
+    return 0;
+}
+
+/**
+ * \brief Create the stateless listening WOLFSSL object of a worker.
+ *
+ * \param w Pointer to the worker.
+ *
+ * \return Pointer to the new WOLFSSL object, or NULL on error.
+ */
+static WOLFSSL* newListenSSL(struct Worker* w)
+{
+    WOLFSSL* ssl = newSSL(w->ctx, w->io, w->rng, &w->idx, (byte)w->id);
+
+    if (ssl == NULL)
+        return NULL;
+    if (wolfDTLS_SetChGoodCb(ssl, chGoodCb, w) != WOLFSSL_SUCCESS) {
+        fprintf(stderr, "wolfDTLS_SetChGoodCb error.\n");
+        wolfSSL_free(ssl);
+        return NULL;
+    }
+    return ssl;
+}
+
+/**
+ * \brief Queue a datagram for the worker that owns its connection and wake the worker.
+ *
+ * \param w Pointer to the owning worker.
+ * \param msg Pointer to the datagram.
+ * \param sz Length of the datagram.
+ * \param peerAddr Pointer to the peer address.
+ * \param peerAddrLen Length of the peer address.
+ */
+static void forwardDatagram(struct Worker* w, const byte* msg, ssize_t sz,
+                            const struct sockaddr* peerAddr, socklen_t peerAddrLen)
+{
+    struct Forward* fwd;
+    int wake;
+    uint64_t one = 1;
+
+    if (sz > DGRAM_MAX || peerAddrLen > sizeof(fwd->peer))
+        return;
+    if ((fwd = (struct Forward*)malloc(sizeof(struct Forward))) == NULL)
+        return;
+    memcpy(fwd->msg, msg, sz);
+    fwd->sz = sz;
+    memcpy(&fwd->peer, peerAddr, peerAddrLen);
+    fwd->peerSz = peerAddrLen;
+    fwd->next = NULL;
+
+    pthread_mutex_lock(&w->fwdLock);
+    if (w->fwdCnt == MAX_FORWARDS) {
+        pthread_mutex_unlock(&w->fwdLock);
+        free(fwd);
+        return;
+    }
+    /* Only wake the worker when it may have already emptied the queue */
+    wake = w->fwdHead == NULL;
+    if (w->fwdTail != NULL)
+        w->fwdTail->next = fwd;
+    else
+        w->fwdHead = fwd;
+    w->fwdTail = fwd;
+    w->fwdCnt++;
+    pthread_mutex_unlock(&w->fwdLock);
+
+    if (wake && write(w->efd, &one, sizeof(one)) != sizeof(one))
+        perror("write(eventfd)");
+}
+
+/**
+ * \brief Find the connection of a datagram and hand it over, or start a new connection.
+ *
+ * Datagrams with a CID handed out by another worker are forwarded to that worker. This happens
+ * when the peer's address changed and the kernel picked our socket for the new one.
+ *
+ * \param w Pointer to the worker.
+ * \param msg Pointer to the datagram.
+ * \param sz Length of the datagram.
+ * \param peerAddr Pointer to the peer address.
+ * \param peerAddrLen Length of the peer address.
+ *
+ * \return 1 on success, 0 on a fatal error.
+ */
+static int handleDatagram(struct Worker* w, byte* msg, ssize_t sz, struct sockaddr* peerAddr,
+                          socklen_t peerAddrLen)
+{
+    const unsigned char* msgCid;
+    struct ConnList *conn = NULL;
+    int ret;
+
+    w->numDgrams++;
+    msgCid = wolfSSL_dtls_cid_parse(msg, sz, CID_SIZE);
+    if (msgCid != NULL && msgCid[0] != w->id && msgCid[0] < numWorkers) {
+        forwardDatagram(&workers[msgCid[0]], msg, sz, peerAddr, peerAddrLen);
+        w->numForwarded++;
+        return 1;
+    }
+
+    /* find ssl object */
+    conn = findConn(&w->idx, msg, sz, peerAddr, peerAddrLen);
+    if (conn != NULL) {
+        /* found an existing connection - by CID when the address is not the one we know */
+        int moved = conn->peerSz != peerAddrLen || memcmp(&conn->peer, peerAddr, peerAddrLen) != 0;
+        /* only measure application data, not the handshake */
+        int measure = stressMode && wolfSSL_is_init_finished(conn->ssl);
+        uint64_t cpu = measure ? threadCpuNs() : 0;
+        if (!dispatchExistingConnection(conn, msg, sz, peerAddr, peerAddrLen) ||
+                !updateConnPeer(&w->idx, conn)) {
+            /* cleanup on error */
+            freeConn(&w->connList, conn, &w->timeouts, &w->idx);
+            conn = NULL;
+        }
+        else if (measure) {
+            cpu = threadCpuNs() - cpu;
+            /* wolfSSL only takes the new address once the record is authenticated */
+            if (moved && conn->peerSz == peerAddrLen &&
+                    memcmp(&conn->peer, peerAddr, peerAddrLen) == 0) {
+                w->numMigrated++;
+                w->migratedNs += cpu;
+            }
+            else if (!moved) {
+                w->numSteady++;
+                w->steadyNs += cpu;
+            }
+        }
+    }
+    else {
+        ret = dispatchNewConnection(w->listenSSL, msg, sz, peerAddr, peerAddrLen);
+        if (ret == WOLFSSL_SUCCESS) {
+            /* Setup new listening object */
+            if ((conn = newConn(w->listenSSL, &w->connList, &w->idx)) == NULL) {
+                fprintf(stderr, "newConn error.\n");
+                return 0;
+            }
+            w->numConns++;
+            if ((w->listenSSL = newListenSSL(w)) == NULL) {
+                fprintf(stderr, "newSSL error.\n");
+                return 0;
+            }
+        }
+        else if (ret == WOLFSSL_FATAL_ERROR) {
+            /* clean up the connection */
+            wolfSSL_free(w->listenSSL);
+            if ((w->listenSSL = newListenSSL(w)) == NULL) {
+                fprintf(stderr, "newSSL error.\n");
+                return 0;
+            }
+        }
+    }
+    /* drop anything the WOLFSSL object didn't read */
+    w->io->rxSz = 0;
+    /* register timeout */
+    if (conn != NULL && !registerTimeout(&w->timeouts, conn))
+        return 0;
+    return 1;
+}
+
+/**
+ * \brief Handle the datagrams other workers forwarded to us.
+ *
+ * \param w Pointer to the worker.
+ *
+ * \return 1 on success, 0 on a fatal error.
+ */
+static int handleForwarded(struct Worker* w)
+{
+    struct Forward* fwd;
+    uint64_t cnt;
+    int ret = 1;
+
+    if (read(w->efd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        perror("read(eventfd)");
+
+    pthread_mutex_lock(&w->fwdLock);
+    fwd = w->fwdHead;
+    w->fwdHead = w->fwdTail = NULL;
+    w->fwdCnt = 0;
+    pthread_mutex_unlock(&w->fwdLock);
+
+    while (fwd != NULL) {
+        struct Forward* next = fwd->next;
+        if (ret)
+            ret = handleDatagram(w, fwd->msg, fwd->sz, (struct sockaddr*)&fwd->peer, fwd->peerSz);
+        free(fwd);
+        fwd = next;
+    }
+    return ret;
+}
+
+/**
+ * \brief Wake all workers so that they see they have to stop.
+ */
+static void stopWorkers(void)
+{
+    uint64_t one = 1;
+    int i;
+
+    intCalled = 1;
+    for (i = 0; i < numWorkers; i++) {
+        if (workers[i].efd >= 0 && write(workers[i].efd, &one, sizeof(one)) != sizeof(one))
+            perror("write(eventfd)");
+    }
+}
+
+/**
+ * \brief Set up a worker's socket, connection tables and listening WOLFSSL object.
+ *
+ * All workers are set up before any runs so that every socket is in the SO_REUSEPORT group
+ * before peers are assigned to one.
+ *
+ * \param w Pointer to the worker.
+ * \param ctx Pointer to the WOLFSSL_CTX object shared by the workers.
+ * \param id Index of the worker.
+ *
+ * \return 1 on success, 0 on error.
+ */
+static int initWorker(struct Worker* w, WOLFSSL_CTX* ctx, int id)
+{
+    memset(w, 0, sizeof(*w));
+    w->id = id;
+    w->ctx = ctx;
+    w->fd = INVALID_SOCKET;
+    w->exitVal = 1;
+    initTimeouts(&w->timeouts);
+    pthread_mutex_init(&w->fwdLock, NULL);
+
+    if ((w->efd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        perror("eventfd");
+        return 0;
+    }
+    if ((w->rng = wc_rng_new(NULL, 0, NULL)) == NULL) {
+        fprintf(stderr, "wc_rng_new error.\n");
+        return 0;
+    }
+    if (!connHashInit(&w->idx.cid, 1) || !connHashInit(&w->idx.peer, 0)) {
+        fprintf(stderr, "connHashInit error.\n");
+        return 0;
+    }
+    if ((w->fd = newFD()) == INVALID_SOCKET) {
+        fprintf(stderr, "newFD error.\n");
+        return 0;
+    }
+    if ((w->io = dgramNew(w->fd)) == NULL) {
+        fprintf(stderr, "dgramNew error.\n");
+        return 0;
+    }
+    if ((w->listenSSL = newListenSSL(w)) == NULL) {
+        fprintf(stderr, "newSSL error.\n");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \brief Free everything a worker owns. Safe on a partly set up worker.
+ *
+ * \param w Pointer to the worker.
+ */
+static void freeWorker(struct Worker* w)
+{
+    while (w->connList != NULL) {
+        struct ConnList* c = w->connList;
+        w->connList = w->connList->next;
+        wolfSSL_free(c->ssl);
+        free(c);
+    }
+    while (w->fwdHead != NULL) {
+        struct Forward* fwd = w->fwdHead;
+        w->fwdHead = fwd->next;
+        free(fwd);
+    }
+    connHashFree(&w->idx.cid);
+    connHashFree(&w->idx.peer);
+    wolfSSL_free(w->listenSSL);
+    free(w->io);
+    wc_rng_free(w->rng);
+    if (w->fd != INVALID_SOCKET)
+        close(w->fd);
+    if (w->efd >= 0)
+        close(w->efd);
+    pthread_mutex_destroy(&w->fwdLock);
+}
+
+/**
+ * \brief Event loop of a worker. Stops all workers when it stops.
+ *
+ * \param arg Pointer to the worker.
+ *
+ * \return NULL
+ */
+static void* workerMain(void* arg)
+{
+    struct Worker* w = (struct Worker*)arg;
+    struct DtlsTimeout* t;
+    /* Our socket and the eventfd for forwarded datagrams */
+    struct pollfd fds[2];
+    int ret;
+
+    memset(fds, 0, sizeof(fds));
+    fds[0].fd = w->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = w->efd;
+    fds[1].events = POLLIN;
+
+    /* main loop */
+    while (!intCalled) {
+        ret = poll(fds, 2, getNextTimeout(&w->timeouts));
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            goto cleanup;
+        }
+
+        /* handle every timeout that expired while we were waiting */
+        while ((t = popTimeout(&w->timeouts)) != NULL) {
+            struct ConnList* conn = t->conn;
+            if (handleTimeout(t) == WOLFSSL_SUCCESS) {
+                /* register new timeout */
+                if (!registerTimeout(&w->timeouts, conn))
+                    goto cleanup;
+            }
+            else {
+                /* error occurred, clean up the connection */
+                freeConn(&w->connList, conn, &w->timeouts, &w->idx);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            if (!handleForwarded(w))
+                goto cleanup;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            /* read every datagram that is waiting */
+            int n = dgramRecv(w->io);
+            int i;
+            if (n < 0)
+                goto cleanup;
+
+            for (i = 0; i < n; i++) {
+                if (w->io->inMsgs[i].msg_len == 0)
+                    continue;
+                if (!handleDatagram(w, w->io->inBufs[i], w->io->inMsgs[i].msg_len,
+                        (struct sockaddr*)&w->io->inAddrs[i],
+                        w->io->inMsgs[i].msg_hdr.msg_namelen))
+                    goto cleanup;
+            }
+        }
+
+        /* write out everything queued by the timeouts and datagrams handled above */
+        dgramFlush(w->io);
+    }
+
+    w->exitVal = 0;
+cleanup:
+    stopWorkers();
+    return NULL;
+}
+
+/** Settings and client side results of the migration stress test */
+struct StressTest {
+    int clients;          /**< Number of clients */
+    int rounds;           /**< Number of messages each client sends */
+    int migratePct;       /**< Chance in percent that a client rebinds before a message */
+    int handshakes;       /**< Number of clients that completed the handshake */
+    int noCid;            /**< Number of clients that did not negotiate a connection ID */
+    unsigned long sent[2]; /**< Messages sent from the known [0] and from a new [1] address */
+    unsigned long lost[2]; /**< Messages that got no echo */
+    double rttNs[2];      /**< Total round trip time of the echoed messages */
+};
+
+/** A client of the migration stress test */
+struct StressClient {
+    WOLFSSL* ssl; /**< The client's session */
+    int fd;       /**< The socket - replaced whenever the client rebinds */
+};
+
+/** How long a stress test client waits for an echo */
+#define STRESS_WAIT_MS 1000
 
-/**
- * \brief Return the next timeout in milliseconds.
- *
- * \param t Pointer to the list of timeouts.
- *
- * \return Next timeout in milliseconds, or -1 if no timeout set.
- */
-int getNextTimeout(struct DtlsTimeout* t);
+static struct StressTest stress = { 0, 10, 20, 0, 0, { 0, 0 }, { 0, 0 }, { 0, 0 } };
 
 /**
- * \brief Register the next timeout for a connection.
+ * \brief Move a stress test client to a new source port, like a NAT rebinding.
  *
- * \param out Pointer to the list of timeouts.
- * \param conn Pointer to the connection.
+ * The session keeps its keys and connection ID. Only the socket is replaced.
+ *
+ * \param c Pointer to the client.
+ * \param nonBlock 1 to make the new socket non-blocking.
  *
  * \return 1 on success, 0 on error.
  */
-int registerTimeout(struct DtlsTimeout** out, struct ConnList* conn);
+static int stressRebind(struct StressClient* c, int nonBlock)
+{
+    int fd;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        perror("socket()");
+        return 0;
+    }
+    if (nonBlock && fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+        perror("fcntl()");
+        close(fd);
+        return 0;
+    }
+    if (wolfSSL_set_fd(c->ssl, fd) != WOLFSSL_SUCCESS) {
+        fprintf(stderr, "wolfSSL_set_fd error.\n");
+        close(fd);
+        return 0;
+    }
+    if (c->fd >= 0)
+        close(c->fd);
+    c->fd = fd;
+    return 1;
+}
 
 /**
- * \brief Free any timeouts associated with a connection.
+ * \brief Send one message from a stress test client and wait for the server's echo.
  *
- * \param out Pointer to the list of timeouts.
- * \param conn Pointer to the connection.
+ * \param c Pointer to the client.
+ * \param msg Message to send.
+ * \param msgSz Size of the message.
+ *
+ * \return 1 when the echo arrived, 0 otherwise.
  */
-void freeTimeouts(struct DtlsTimeout** out, struct ConnList* conn);
+static int stressExchange(struct StressClient* c, const char* msg, int msgSz)
+{
+    char buf[64];
+    struct pollfd pfd;
+    int ret;
+
+    if (wolfSSL_write(c->ssl, msg, msgSz) != msgSz)
+        return 0;
+    pfd.fd = c->fd;
+    pfd.events = POLLIN;
+    /* ACKs and post-handshake messages may arrive before the echo */
+    do {
+        if (poll(&pfd, 1, STRESS_WAIT_MS) <= 0)
+            return 0;
+        ret = wolfSSL_read(c->ssl, buf, sizeof(buf));
+    } while (ret <= 0 && wolfSSL_get_error(c->ssl, ret) == WOLFSSL_ERROR_WANT_READ);
+    return ret == msgSz && memcmp(buf, msg, msgSz) == 0;
+}
 
 /**
- * \brief Handle a timeout that occurred for a connection.
+ * \brief Drive the DTLS 1.3 clients of the migration stress test. Stops the workers when done.
  *
- * \param conn Pointer to the connection.
+ * Every client does a full handshake with a connection ID. Then each round every client
+ * sends one message and waits for the echo. Before a message a client moves to a new source
+ * port with a chance of stress.migratePct percent, so the server only finds it by its
+ * connection ID.
  *
- * \return WOLFSSL_SUCCESS on success, -1 on error.
+ * \param arg Unused.
+ *
+ * \return NULL
  */
-int handleTimeout(struct ConnList* conn);
+static void* stressMain(void* arg)
+{
+#if defined(WOLFSSL_DTLS13) && defined(WOLFSSL_DTLS_CID)
+    WOLFSSL_CTX* ctx = NULL;
+    struct StressClient* clients = NULL;
+    struct sockaddr_in servAddr;
+    unsigned int seed = (unsigned int)time(NULL);
+    char msg[32];
+    int msgSz;
+    int r;
+    int i;
+
+    memset(&servAddr, 0, sizeof(servAddr));
+    servAddr.sin_family = AF_INET;
+    servAddr.sin_port = htons(SERV_PORT);
+    servAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if ((ctx = wolfSSL_CTX_new(wolfDTLSv1_3_client_method())) == NULL) {
+        fprintf(stderr, "wolfSSL_CTX_new error.\n");
+        goto cleanup;
+    }
+    if (wolfSSL_CTX_load_verify_locations(ctx, caCertLoc, 0) != WOLFSSL_SUCCESS) {
+        fprintf(stderr, "Error loading %s, please check the file.\n", caCertLoc);
+        goto cleanup;
+    }
+    if ((clients = (struct StressClient*)calloc(stress.clients, sizeof(*clients))) == NULL) {
+        fprintf(stderr, "calloc error.\n");
+        goto cleanup;
+    }
+    for (i = 0; i < stress.clients; i++)
+        clients[i].fd = INVALID_SOCKET;
+
+    for (i = 0; i < stress.clients && !intCalled; i++) {
+        struct StressClient* c = &clients[i];
+        if ((c->ssl = wolfSSL_new(ctx)) == NULL) {
+            fprintf(stderr, "wolfSSL_new error.\n");
+            goto cleanup;
+        }
+        if (wolfSSL_dtls_cid_use(c->ssl) != WOLFSSL_SUCCESS ||
+                wolfSSL_dtls_set_peer(c->ssl, &servAddr, sizeof(servAddr)) != WOLFSSL_SUCCESS ||
+                !stressRebind(c, 0)) {
+            fprintf(stderr, "client setup error.\n");
+            goto cleanup;
+        }
+        /* The handshake uses a blocking socket so that wolfSSL does the retransmits */
+        if (wolfSSL_connect(c->ssl) != WOLFSSL_SUCCESS) {
+            wolfSSL_free(c->ssl);
+            c->ssl = NULL;
+            continue;
+        }
+        stress.handshakes++;
+        if (!wolfSSL_dtls_cid_is_enabled(c->ssl))
+            stress.noCid++;
+        if (fcntl(c->fd, F_SETFL, O_NONBLOCK) < 0) {
+            perror("fcntl()");
+            goto cleanup;
+        }
+        wolfSSL_dtls_set_using_nonblock(c->ssl, 1);
+    }
+    printf("%d of %d clients connected, %d without a connection ID\n",
+           stress.handshakes, stress.clients, stress.noCid);
+
+    for (r = 0; r < stress.rounds && !intCalled; r++) {
+        for (i = 0; i < stress.clients && !intCalled; i++) {
+            struct StressClient* c = &clients[i];
+            int moved = (int)(rand_r(&seed) % 100) < stress.migratePct;
+            double start;
+            if (c->ssl == NULL)
+                continue;
+            if (moved && !stressRebind(c, 1))
+                goto cleanup;
+            msgSz = snprintf(msg, sizeof(msg), "client %d round %d", i, r);
+            start = benchNow();
+            stress.sent[moved]++;
+            if (stressExchange(c, msg, msgSz))
+                stress.rttNs[moved] += benchNow() - start;
+            else
+                stress.lost[moved]++;
+        }
+    }
+
+cleanup:
+    for (i = 0; clients != NULL && i < stress.clients; i++) {
+        wolfSSL_free(clients[i].ssl);
+        if (clients[i].fd != INVALID_SOCKET)
+            close(clients[i].fd);
+    }
+    free(clients);
+    wolfSSL_CTX_free(ctx);
+#else
+    fprintf(stderr, "The migration stress test needs wolfSSL built with DTLS 1.3 and "
+                    "connection ID support.\n");
+#endif
+    (void)arg;
+    stopWorkers();
+    return NULL;
+}
 
 /**
- * \brief Handle application data received from a peer.
- *
- * \param ssl Pointer to the WOLFSSL object.
- * \param appData Pointer to the application data.
- * \param appDataSz Size of the application data.
- * \param id ID number of the connection.
+ * \brief Print the results of the migration stress test.
  *
- * \return Number of bytes written, or a negative value on error.
+ * Every migrated message that got its echo was re-associated by connection ID. Server
+ * connections beyond the client handshakes would mean a client had to renegotiate.
  */
-static int handleApplicationData(WOLFSSL* ssl, byte* appData, int appDataSz, int id)
+static void stressReport(void)
 {
-    /* Process app data from peer. For this example just echo it */
-    const void* peer = NULL;
-    unsigned int peerSz = 0;
-    char* peerName = NULL;
-    uint16_t peerPort = 0;
-    if (wolfSSL_dtls_get0_peer(ssl, &peer, &peerSz) == WOLFSSL_SUCCESS) {
-        peerName = inet_ntoa(((struct sockaddr_in *)peer)->sin_addr);
-        peerPort = ntohs(((struct sockaddr_in *)peer)->sin_port);
+    unsigned long conns = 0, migrated = 0, steady = 0;
+    uint64_t migratedNs = 0, steadyNs = 0;
+    double cpuSteady, cpuMigrated;
+    int i;
+
+    for (i = 0; i < numWorkers; i++) {
+        conns += workers[i].numConns;
+        migrated += workers[i].numMigrated;
+        steady += workers[i].numSteady;
+        migratedNs += workers[i].migratedNs;
+        steadyNs += workers[i].steadyNs;
     }
-    printf("(#%d) from %s:%d wrote: %.*s\n", id, peerName, peerPort, appDataSz, appData);
-    return wolfSSL_write(ssl, appData, appDataSz);
+    cpuSteady = steady ? (double)steadyNs / steady : 0;
+    cpuMigrated = migrated ? (double)migratedNs / migrated : 0;
+
+    printf("%-10s %10s %10s %12s\n", "messages", "sent", "lost", "rtt (us)");
+    printf("%-10s %10lu %10lu %12.1f\n", "steady", stress.sent[0], stress.lost[0],
+           stress.sent[0] > stress.lost[0] ?
+               stress.rttNs[0] / (stress.sent[0] - stress.lost[0]) / 1e3 : 0);
+    printf("%-10s %10lu %10lu %12.1f\n", "migrated", stress.sent[1], stress.lost[1],
+           stress.sent[1] > stress.lost[1] ?
+               stress.rttNs[1] / (stress.sent[1] - stress.lost[1]) / 1e3 : 0);
+    printf("server: %lu datagrams re-associated by connection ID, %ld renegotiations\n",
+           migrated, (long)conns - stress.handshakes);
+    printf("server cpu per datagram: steady %.0f ns, migrated %.0f ns (%+.0f ns)\n",
+           cpuSteady, cpuMigrated, cpuMigrated - cpuSteady);
 }
 
 /**
  * \brief Main function for the DTLS server.
  *
+ * Pass -t <n> to run n worker threads, each with its own socket on the server port.
+ * Pass -b to benchmark finding connections instead of running the server.
+ * Pass -u to benchmark reading and writing datagrams instead of running the server.
+ * Pass -m <clients> [rounds] [percent] to stress connection ID migration: the server runs
+ * against DTLS 1.3 clients in this process that move to a new source port before a message
+ * with the given chance, and reports the extra latency and server CPU per migrated datagram.
+ *
  * \return 0 on success, non-zero on error.
  */
-int main(void)
+int main(int argc, char** argv)
 {
     int exitVal = 1;
     WOLFSSL_CTX*  ctx = NULL;
-    /* List of active or handshaking connections */
-    struct ConnList* connList = NULL;
-    /* An ordered list of timeouts */
-    struct DtlsTimeout* timeouts = NULL;
-    /* The stateless listening WOLFSSL object */
-    WOLFSSL* listenSSL = NULL;
-    int ret = 0;
-    /* Our one socket that we read from and send to. We do the demultiplexing ourselves. */
-    struct pollfd listenfd;
     WC_RNG* rng = NULL;
+    sigset_t sigs;
+    int started = 0;
+    int ready = 0;
+    pthread_t stressTid;
+    int stressStarted = 0;
+    struct rlimit lim;
+    int i;
 
     signal(SIGINT, teardown);
-    memset(&listenfd, 0, sizeof(listenfd));
-    listenfd.fd = INVALID_SOCKET;
-    listenfd.events = POLLIN;
 
     /* Uncomment if you want debugging. */
     // wolfSSL_Debugging_ON();
 
-    if ((rng = wc_rng_new(NULL, 0, NULL)) == NULL) {
-        fprintf(stderr, "wc_rng_new error.\n");
-        goto cleanup;
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        if ((rng = wc_rng_new(NULL, 0, NULL)) == NULL) {
+            fprintf(stderr, "wc_rng_new error.\n");
+            return 1;
+        }
+        exitVal = benchFindConn(rng);
+        wc_rng_free(rng);
+        return exitVal;
+    }
+    if (argc > 1 && strcmp(argv[1], "-u") == 0)
+        return benchDgramIO();
+    for (i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "-t") == 0) {
+            numWorkers = atoi(argv[++i]);
+            if (numWorkers < 1 || numWorkers > MAX_WORKERS) {
+                fprintf(stderr, "Number of workers must be 1 to %d.\n", MAX_WORKERS);
+                return 1;
+            }
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-m") == 0) {
+            stressMode = 1;
+            stress.clients = atoi(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                stress.rounds = atoi(argv[++i]);
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                stress.migratePct = atoi(argv[++i]);
+            if (stress.clients < 1 || stress.rounds < 1 ||
+                    stress.migratePct < 0 || stress.migratePct > 100) {
+                fprintf(stderr, "Usage: -m <clients> [rounds] [percent]\n");
+                return 1;
+            }
+        }
+    }
+
+    if (stressMode && getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+        /* every client holds a socket */
+        lim.rlim_cur = lim.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &lim) != 0 ||
+                lim.rlim_cur < (rlim_t)stress.clients + 64)
+            fprintf(stderr, "warning: %lu open files may be too few for %d clients\n",
+                    (unsigned long)lim.rlim_cur, stress.clients);
     }
 
     /* Initialize wolfSSL */
     if (wolfSSL_Init() != WOLFSSL_SUCCESS) {
         fprintf(stderr, "wolfSSL_Init error.\n");
-        goto cleanup;
-    }
-
-    if ((listenfd.fd = newFD()) == INVALID_SOCKET) {
-        fprintf(stderr, "newFD error.\n");
-        goto cleanup;
+        return 1;
     }
 
     if ((ctx = newCTX()) == NULL) {
@@ -278,104 +1762,57 @@ int main(void)
         goto cleanup;
     }
 
-    if ((listenSSL = newSSL(ctx, listenfd.fd, rng, connList)) == NULL) {
-        fprintf(stderr, "newSSL error.\n");
-        goto cleanup;
-    }
-
-    /* main loop */
-    while (!intCalled) {
-        ret = poll(&listenfd, 1, getNextTimeout(timeouts));
-        if (ret < 0) {
-            perror("poll");
+    /* The cookie secret is made by the first newSSL() call - before any thread starts */
+    for (ready = 0; ready < numWorkers; ready++) {
+        if (!initWorker(&workers[ready], ctx, ready)) {
+            ready++;
             goto cleanup;
         }
+    }
 
-        if (ret == 0) {
-            /* got timeout */
-            if (timeouts == NULL)
-                goto cleanup;
-            /* timeouts is ordered so the first element is the one we need to trigger */
-            if (handleTimeout(timeouts->conn) == WOLFSSL_SUCCESS) {
-                /* register new timeout */
-                if (!registerTimeout(&timeouts, timeouts->conn))
-                    goto cleanup;
-            }
-            else {
-                /* error occurred, clean up the connection */
-                freeConn(&connList, timeouts->conn, &timeouts);
-            }
+    /* Only the main thread, which runs worker 0, handles SIGINT */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    for (started = 1; started < numWorkers; started++) {
+        if (pthread_create(&workers[started].tid, NULL, workerMain, &workers[started]) != 0) {
+            fprintf(stderr, "pthread_create error.\n");
+            break;
         }
-        else {
-            /* data to read */
-            byte readBuf[2000];
-            ssize_t sz = 0;
-            /* peer's address */
-            struct sockaddr peerAddr;
-            socklen_t peerAddrLen = sizeof(peerAddr);
-            struct ConnList *conn = NULL;
-
-            sz = recvfrom(listenfd.fd, readBuf, sizeof(readBuf), 0, &peerAddr, &peerAddrLen);
-            if (sz <= 0)
-                goto cleanup;
-
-            /* find ssl object */
-            conn = findConn(connList, readBuf, sz, &peerAddr, peerAddrLen);
-            if (conn != NULL) {
-                /* found an existing connection */
-                if (!dispatchExistingConnection(conn, readBuf, sz, &peerAddr, peerAddrLen)) {
-                    /* cleanup on error */
-                    freeConn(&connList, conn, &timeouts);
-                    conn = NULL;
-                }
-            }
-            else {
-                ret = dispatchNewConnection(listenSSL, readBuf, sz, &peerAddr, peerAddrLen);
-                if (ret == WOLFSSL_SUCCESS) {
-                    /* Setup new listening object */
-                    if ((conn = newConn(listenSSL, &connList)) == NULL) {
-                        fprintf(stderr, "newConn error.\n");
-                        goto cleanup;
-                    }
-                    if ((listenSSL = newSSL(ctx, listenfd.fd, rng, connList)) == NULL) {
-                        fprintf(stderr, "newSSL error.\n");
-                        goto cleanup;
-                    }
-                }
-                else if (ret == WOLFSSL_FATAL_ERROR) {
-                    /* clean up the connection */
-                    wolfSSL_free(listenSSL);
-                    if ((listenSSL = newSSL(ctx, listenfd.fd, rng, connList)) == NULL) {
-                        fprintf(stderr, "newSSL error.\n");
-                        goto cleanup;
-                    }
-                }
-            }
-            /* register timeout */
-            if (conn != NULL && !registerTimeout(&timeouts, conn))
-                goto cleanup;
+    }
+    if (stressMode && started == numWorkers) {
+        if (pthread_create(&stressTid, NULL, stressMain, NULL) != 0) {
+            fprintf(stderr, "pthread_create error.\n");
+            stopWorkers();
         }
+        else
+            stressStarted = 1;
+    }
+    pthread_sigmask(SIG_UNBLOCK, &sigs, NULL);
+    if (started == numWorkers)
+        workerMain(&workers[0]);
+    else
+        stopWorkers();
+    for (i = 1; i < started; i++)
+        pthread_join(workers[i].tid, NULL);
+    if (stressStarted) {
+        pthread_join(stressTid, NULL);
+        stressReport();
     }
 
     exitVal = 0;
-cleanup:
-    while (timeouts != NULL) {
-        struct DtlsTimeout* t = timeouts;
-        timeouts = timeouts->next;
-        free(t);
-    }
-    while (connList != NULL) {
-        struct ConnList* c = connList;
-        connList = connList->next;
-        wolfSSL_free(c->ssl);
-        free(c);
+    for (i = 0; i < started; i++) {
+        printf("worker %d: %lu datagrams, %lu good ClientHellos, %lu forwarded\n", i,
+               workers[i].numDgrams, workers[i].numHelloGood, workers[i].numForwarded);
+        if (workers[i].exitVal != 0)
+            exitVal = 1;
     }
-    wc_rng_free(rng);
+cleanup:
+    for (i = 0; i < ready; i++)
+        freeWorker(&workers[i]);
     wolfSSL_CTX_free(ctx);
-    wolfSSL_free(listenSSL);
-    if (listenfd.fd != INVALID_SOCKET)
-        close(listenfd.fd);
-    return intCalled ? 0 : exitVal;
+    wolfSSL_Cleanup();
+    return exitVal;
 }
 
 WOLFSSL_CTX* newCTX(void)
@@ -420,7 +1857,8 @@ WOLFSSL_CTX* newCTX(void)
 static byte cookieSecret[32];
 static int cookieSecretSet = 0;
 
-WOLFSSL* newSSL(WOLFSSL_CTX* ctx, int fd, WC_RNG* rng, struct ConnList* connList)
+WOLFSSL* newSSL(WOLFSSL_CTX* ctx, struct DgramIO* io, WC_RNG* rng, struct ConnIndex* idx,
+                byte workerId)
 {
     WOLFSSL* ssl = NULL;
     byte newCid[CID_SIZE];
@@ -457,35 +1895,24 @@ WOLFSSL* newSSL(WOLFSSL_CTX* ctx, int fd, WC_RNG* rng, struct ConnList* connList
         wolfSSL_free(ssl);
         return NULL;
     }
-    if (wolfSSL_set_write_fd(ssl, fd) != WOLFSSL_SUCCESS) {
-        fprintf(stderr, "wolfSSL_set_write_fd error.\n");
-        wolfSSL_free(ssl);
-        return NULL;
-    }
+    /* All reads and writes go through the batched datagram IO */
+    wolfSSL_SSLSetIORecv(ssl, dgramIORecv);
+    wolfSSL_SSLSetIOSend(ssl, dgramIOSend);
+    wolfSSL_SetIOReadCtx(ssl, io);
+    wolfSSL_SetIOWriteCtx(ssl, io);
 
 #ifdef WOLFSSL_DTLS_CID
-    while (1) {
-        struct ConnList* conn = NULL;
-        int found = 0;
+    do {
         /* Generate CID */
         if (wc_RNG_GenerateBlock(rng, newCid, sizeof(newCid)) != 0) {
             fprintf(stderr, "wc_RNG_GenerateBlock error.\n");
             wolfSSL_free(ssl);
             return NULL;
         }
+        /* Records with this CID are steered to the worker that owns the connection */
+        newCid[0] = workerId;
         /* Check that the CID is not in use */
-        for (conn = connList; conn != NULL; conn = conn->next) {
-            byte* cid = NULL;
-            if (wolfSSL_dtls_cid_get0_rx(conn->ssl, &cid) == WOLFSSL_SUCCESS &&
-                    cid != NULL && memcmp(newCid, cid, CID_SIZE) == 0) {
-                found = 1;
-                break;
-            }
-        }
-        if (found)
-            continue;
-        break;
-    }
+    } while (connHashFind(&idx->cid, newCid, CID_SIZE) != NULL);
     if (wolfSSL_dtls_cid_use(ssl) != WOLFSSL_SUCCESS) {
         fprintf(stderr, "wolfSSL_dtls_cid_use error.\n");
         wolfSSL_free(ssl);
@@ -497,7 +1924,6 @@ WOLFSSL* newSSL(WOLFSSL_CTX* ctx, int fd, WC_RNG* rng, struct ConnList* connList
         return NULL;
     }
 #endif
-    wolfSSL_SSLDisableRead(ssl);
 
     return ssl;
 }
@@ -505,6 +1931,7 @@ WOLFSSL* newSSL(WOLFSSL_CTX* ctx, int fd, WC_RNG* rng, struct ConnList* connList
 int newFD(void)
 {
     int fd;
+    int on = 1;
     struct sockaddr_in servAddr;        /* our server's address */
 
     /* Create a UDP/IP socket */
@@ -519,8 +1946,17 @@ int newFD(void)
     servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
     servAddr.sin_port        = htons(SERV_PORT);
 
-    /* We don't set non-blocking because we always poll before reading and we
-     * disable reading in the WOLFSSL objects. */
+    /* We don't set non-blocking because we always poll before reading, read
+     * with MSG_DONTWAIT and the WOLFSSL objects only read the datagrams we
+     * hand them. */
+
+    /* Let every worker bind a socket to the port. The kernel spreads peers
+     * across the sockets by address. */
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(fd);
+        return INVALID_SOCKET;
+    }
 
     /* Bind Socket */
     if (bind(fd, (struct sockaddr*)&servAddr, sizeof(servAddr)) < 0) {
@@ -531,26 +1967,59 @@ int newFD(void)
     return fd;
 }
 
-struct ConnList* newConn(WOLFSSL* ssl, struct ConnList** connList)
+struct ConnList* newConn(WOLFSSL* ssl, struct ConnList** connList, struct ConnIndex* idx)
 {
     struct ConnList* conn = (struct ConnList*)malloc(sizeof(struct ConnList));
-    static int id = 0;
+    static int id = 0; /* shared by the workers */
+    unsigned char* cid = NULL;
+    const void* peer = NULL;
+    unsigned int peerSz = 0;
     if (conn == NULL)
         return NULL;
+    memset(conn, 0, sizeof(*conn));
     conn->ssl = ssl;
-    conn->t_started = time(NULL);
+    conn->rtx.conn = conn;
+    conn->rtx.kind = TIMEOUT_RTX;
+    conn->hsLimit.conn = conn;
+    conn->hsLimit.kind = TIMEOUT_HS_LIMIT;
+
+    /* Index the connection by the CID we chose and the address it came from */
+    if (wolfSSL_dtls_cid_get0_rx(ssl, &cid) == WOLFSSL_SUCCESS && cid != NULL) {
+        memcpy(conn->cid, cid, CID_SIZE);
+        if (!connHashAdd(&idx->cid, conn)) {
+            free(conn);
+            return NULL;
+        }
+        conn->hasCid = 1;
+    }
+    if (wolfSSL_dtls_get0_peer(ssl, &peer, &peerSz) == WOLFSSL_SUCCESS &&
+            peerSz <= sizeof(conn->peer)) {
+        memcpy(&conn->peer, peer, peerSz);
+        conn->peerSz = peerSz;
+    }
+    if (!connHashAdd(&idx->peer, conn)) {
+        if (conn->hasCid)
+            connHashRemove(&idx->cid, conn);
+        free(conn);
+        return NULL;
+    }
+
     conn->next = *connList;
-    conn->id = id++;
+    conn->id = __atomic_fetch_add(&id, 1, __ATOMIC_RELAXED);
     *connList = conn;
     return conn;
 }
 
-void freeConn(struct ConnList** connList, struct ConnList* conn, struct DtlsTimeout** tList)
+void freeConn(struct ConnList** connList, struct ConnList* conn, struct TimerWheel* wheel,
+              struct ConnIndex* idx)
 {
     struct ConnList* it = *connList; /* iterator */
     struct ConnList** prev = connList;
 
-    freeTimeouts(tList, conn);
+    freeTimeouts(wheel, conn);
+    if (conn->hasCid)
+        connHashRemove(&idx->cid, conn);
+    connHashRemove(&idx->peer, conn);
 
     /* Find conn in connList */
     while (it != conn) {
@@ -568,38 +2037,44 @@ void freeConn(struct ConnList** connList, struct ConnList* conn, struct DtlsTime
     free(conn);
 }
 
-struct ConnList* findConn(struct ConnList* connList, byte* msg, ssize_t sz, struct sockaddr* peerAddr, socklen_t peerAddrLen)
+int updateConnPeer(struct ConnIndex* idx, struct ConnList* conn)
+{
+    const void* peer = NULL;
+    unsigned int peerSz = 0;
+
+    if (wolfSSL_dtls_get0_peer(conn->ssl, &peer, &peerSz) != WOLFSSL_SUCCESS ||
+            peerSz > sizeof(conn->peer))
+        return 1;
+    if (peerSz == conn->peerSz && memcmp(peer, &conn->peer, peerSz) == 0)
+        return 1;
+
+    /* The peer moved to a new address - re-key the connection */
+    connHashRemove(&idx->peer, conn);
+    memcpy(&conn->peer, peer, peerSz);
+    conn->peerSz = peerSz;
+    return connHashAdd(&idx->peer, conn);
+}
+
+struct ConnList* findConn(struct ConnIndex* idx, byte* msg, ssize_t sz, struct sockaddr* peerAddr, socklen_t peerAddrLen)
 {
     const unsigned char* msgCid = NULL;
+    struct ConnList* conn = NULL;
     msgCid = wolfSSL_dtls_cid_parse(msg, sz, CID_SIZE);
-    for (; connList != NULL; connList = connList->next) {
-        const void* peer = NULL;
-        unsigned int peerSz = 0;
-        if (msgCid != NULL) {
-            /* try to match on msgCid */
-            unsigned char* connCid = NULL;
-            (void)wolfSSL_dtls_cid_get0_rx(connList->ssl, &connCid);
-            if (connCid != NULL && memcmp(connCid, msgCid, CID_SIZE) == 0) {
-                /* found matching connection */
-                break;
-            }
-        }
-        if (wolfSSL_dtls_get0_peer(connList->ssl, &peer, &peerSz) != WOLFSSL_SUCCESS)
-            continue;
-        if (peerAddrLen == peerSz && memcmp(peer, peerAddr, peerSz) == 0) {
-            /* found matching connection */
-            break;
-        }
+    if (msgCid != NULL) {
+        /* try to match on msgCid */
+        conn = connHashFind(&idx->cid, msgCid, CID_SIZE);
     }
-    return connList;
+    if (conn == NULL)
+        conn = connHashFind(&idx->peer, (const byte*)peerAddr, peerAddrLen);
+    return conn;
 }
 
 int dispatchExistingConnection(struct ConnList* conn, byte* msg, ssize_t msgSz, struct sockaddr* peerAddr,
                                socklen_t peerAddrLen)
 {
     int ret;
-    if (wolfSSL_inject(conn->ssl, msg, msgSz) != WOLFSSL_SUCCESS) {
-        fprintf(stderr, "wolfSSL_inject error.\n");
+    if (dgramInject(conn->ssl, msg, msgSz) != WOLFSSL_SUCCESS) {
+        fprintf(stderr, "dgramInject error.\n");
         return 0;
     }
     /* set the peer for sending */
@@ -630,8 +2105,8 @@ int dispatchExistingConnection(struct ConnList* conn, byte* msg, ssize_t msgSz,
 int dispatchNewConnection(WOLFSSL* ssl, byte* msg, ssize_t msgSz, struct sockaddr* peerAddr, socklen_t peerAddrLen)
 {
     /* connection not found, continuing with new connection */
-    if (wolfSSL_inject(ssl, msg, msgSz) != WOLFSSL_SUCCESS) {
-        fprintf(stderr, "wolfSSL_inject error.\n");
+    if (dgramInject(ssl, msg, msgSz) != WOLFSSL_SUCCESS) {
+        fprintf(stderr, "dgramInject error.\n");
         return WOLFSSL_FATAL_ERROR;
     }
     /* set the peer for cookie calculation and sending */
@@ -642,16 +2117,17 @@ int dispatchNewConnection(WOLFSSL* ssl, byte* msg, ssize_t msgSz, struct sockadd
     return wolfDTLS_accept_stateless(ssl);
 }
 
-int handleTimeout(struct ConnList* conn)
+int handleTimeout(struct DtlsTimeout* t)
 {
+    struct ConnList* conn = t->conn;
     int ret;
+    if (t->kind == TIMEOUT_HS_LIMIT) {
+        /* Handshake is taking too long. Kill it and let peer try again. */
+        /* Try sending an alert. This is just a courtesy to the peer. We don't care if it succeeds. */
+        (void)wolfSSL_SendUserCanceled(conn->ssl);
+        return -1;
+    }
     if (!wolfSSL_is_init_finished(conn->ssl)) {
-        if (time(NULL) - conn->t_started > MAX_HS_TIME) {
-            /* Handshake is taking too long. Kill it and let peer try again. */
-            /* Try sending an alert. This is just a courtesy to the peer. We don't care if it succeeds. */
-            (void)wolfSSL_SendUserCanceled(conn->ssl);
-            return -1;
-        }
         ret = wolfSSL_dtls_got_timeout(conn->ssl);
     }
     else {
@@ -665,126 +2141,191 @@ int handleTimeout(struct ConnList* conn)
     return ret;
 }
 
-int getNextTimeout(struct DtlsTimeout* t)
+/**
+ * \brief Get the current monotonic time.
+ *
+ * \return Time in milliseconds.
+ */
+static uint64_t timerNowMs(void)
 {
     struct timespec ts;
-    int ms;
-
-    if (t == NULL)
-        return -1;
 
     /* use clock_gettime to get ms resolution */
     if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
         perror("clock_gettime");
         return 0;
     }
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    if (ts.tv_sec > t->ts.tv_sec ||
-            (ts.tv_sec == t->ts.tv_sec && ts.tv_nsec > t->ts.tv_nsec)) {
-        /* timeout already should have occurred */
-        return 0;
+/**
+ * \brief Put a timeout in the timer wheel.
+ *
+ * \param wheel Pointer to the timer wheel.
+ * \param t Pointer to the timeout. Must not already be armed.
+ * \param ms Milliseconds from now when the timeout should occur.
+ */
+static void armTimeout(struct TimerWheel* wheel, struct DtlsTimeout* t, long ms)
+{
+    uint64_t expires = (timerNowMs() + ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    size_t slot;
+
+    /* Ticks before the cursor won't be looked at again until the wheel comes around */
+    if (expires < wheel->cursor)
+        expires = wheel->cursor;
+    slot = expires % TIMER_WHEEL_SLOTS;
+
+    t->expires = expires;
+    t->prev = NULL;
+    t->next = wheel->slots[slot];
+    if (t->next != NULL)
+        t->next->prev = t;
+    wheel->slots[slot] = t;
+    wheel->used[slot / 64] |= (uint64_t)1 << (slot % 64);
+    t->armed = 1;
+    wheel->cnt++;
+}
+
+/**
+ * \brief Take a timeout out of the timer wheel. Does nothing if not armed.
+ *
+ * \param wheel Pointer to the timer wheel.
+ * \param t Pointer to the timeout.
+ */
+static void cancelTimeout(struct TimerWheel* wheel, struct DtlsTimeout* t)
+{
+    size_t slot = t->expires % TIMER_WHEEL_SLOTS;
+
+    if (!t->armed)
+        return;
+    if (t->prev != NULL)
+        t->prev->next = t->next;
+    else
+        wheel->slots[slot] = t->next;
+    if (t->next != NULL)
+        t->next->prev = t->prev;
+    if (wheel->slots[slot] == NULL)
+        wheel->used[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+    t->prev = t->next = NULL;
+    t->armed = 0;
+    wheel->cnt--;
+}
+
+void initTimeouts(struct TimerWheel* wheel)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->cursor = timerNowMs() / TIMER_TICK_MS;
+}
+
+int getNextTimeout(struct TimerWheel* wheel)
+{
+    size_t start = wheel->cursor % TIMER_WHEEL_SLOTS;
+    size_t words = TIMER_WHEEL_SLOTS / 64;
+    size_t i;
+    uint64_t now;
+    uint64_t due;
+
+    if (wheel->cnt == 0)
+        return -1;
+
+    /* Find the first slot at or after the cursor with a timeout in it. Look at the first word
+     * again at the end to catch the slots before the cursor. */
+    for (i = 0; i <= words; i++) {
+        size_t w = (start / 64 + i) % words;
+        uint64_t bits = wheel->used[w];
+        if (i == 0)
+            bits &= ~(uint64_t)0 << (start % 64);
+        if (bits != 0) {
+            size_t slot = w * 64 + __builtin_ctzll(bits);
+            due = wheel->cursor + (slot + TIMER_WHEEL_SLOTS - start) % TIMER_WHEEL_SLOTS;
+            break;
+        }
     }
+    if (i > words)
+        return -1;
+
+    /* The slot may only hold timeouts for a later revolution. Then we wake up early, find
+     * nothing expired, and wait again. */
+    now = timerNowMs();
+    if (due * TIMER_TICK_MS <= now)
+        return 0;
+    if (due * TIMER_TICK_MS - now > INT_MAX)
+        return INT_MAX;
+    return (int)(due * TIMER_TICK_MS - now);
+}
+
+struct DtlsTimeout* popTimeout(struct TimerWheel* wheel)
+{
+    uint64_t now = timerNowMs() / TIMER_TICK_MS;
 
-    ms = (t->ts.tv_sec - ts.tv_sec) * 1000;
-    if (ts.tv_nsec <= t->ts.tv_nsec) {
-        ms += (t->ts.tv_nsec - ts.tv_nsec) / 1000000;
+    if (wheel->cnt == 0) {
+        wheel->cursor = now + 1;
+        return NULL;
     }
-    else {
-        ms += (t->ts.tv_nsec + 1000000000 - ts.tv_nsec) / 1000000;
-        ms -= 1000;
+    /* All slots are visited in one revolution, no need to go around more than once */
+    if (now >= wheel->cursor + TIMER_WHEEL_SLOTS)
+        wheel->cursor = now - TIMER_WHEEL_SLOTS + 1;
+
+    for (; wheel->cursor <= now; wheel->cursor++) {
+        struct DtlsTimeout* t = wheel->slots[wheel->cursor % TIMER_WHEEL_SLOTS];
+        for (; t != NULL; t = t->next) {
+            if (t->expires <= now) {
+                /* Leave the cursor here as the slot may have more expired timeouts */
+                cancelTimeout(wheel, t);
+                return t;
+            }
+        }
     }
-    return ms;
+    return NULL;
 }
 
-static void addTimeSpec(struct timespec* ts, WOLFSSL* ssl)
+/**
+ * \brief Get how long until a connection's next retransmission or app data timeout.
+ *
+ * \param ssl Pointer to the WOLFSSL object.
+ *
+ * \return Timeout in milliseconds.
+ */
+static long nextTimeoutMs(WOLFSSL* ssl)
 {
-    long ns;
-    long rem; /* remainder */
+    long ms;
 
     if (!wolfSSL_is_init_finished(ssl)) {
-        ns = wolfSSL_dtls_get_current_timeout(ssl) * 1000000000;
+        ms = wolfSSL_dtls_get_current_timeout(ssl) * 1000L;
 #ifdef WOLFSSL_DTLS13
         if (wolfSSL_version(ssl) == DTLS1_3_VERSION && wolfSSL_dtls13_use_quick_timeout(ssl))
-            ns /= QUICK_DIV;
+            ms /= QUICK_DIV;
 #endif
     }
     else {
         /* waiting on app data */
-        ns = (long)APP_DATA_WAIT * 1000000000;
-    }
-    rem         = ns % 1000000000;
-    ts->tv_sec += ns / 1000000000;
-    if (ts->tv_nsec + rem > 999999999) {
-        /* does not fit in tv_nsec member */
-        ts->tv_sec++;
-        ts->tv_nsec = ts->tv_nsec + rem - 1000000000;
-    }
-    else {
-        ts->tv_nsec += rem;
+        ms = APP_DATA_WAIT * 1000L;
     }
+    return ms;
 }
 
-int registerTimeout(struct DtlsTimeout** out, struct ConnList* conn)
+int registerTimeout(struct TimerWheel* wheel, struct ConnList* conn)
 {
-    struct DtlsTimeout* t;
-    struct DtlsTimeout* it; /* iterator */
-    struct DtlsTimeout** prev;
-    struct timespec ts;
-
-    /* clear existing timeouts */
-    freeTimeouts(out, conn);
+    /* clear existing timeout */
+    cancelTimeout(wheel, &conn->rtx);
 
     if (wolfSSL_dtls_get_current_timeout(conn->ssl) == 0)
         return 0;
 
-    /* use clock_gettime to get ms resolution */
-    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
-        perror("clock_gettime");
-        return 0;
-    }
-    addTimeSpec(&ts, conn->ssl);
-
-    t = (struct DtlsTimeout*)malloc(sizeof(struct DtlsTimeout));
-    if (t == NULL)
-        return 0;
-
-    /* time when timeout should occur */
-    t->ts = ts;
-    t->conn = conn;
-    t->next = NULL;
-
-    if (*out == NULL) {
-        /* Empty list */
-        *out = t;
-        return 1;
+    if (!wolfSSL_is_init_finished(conn->ssl)) {
+        /* Start the clock on the handshake the first time round */
+        if (!conn->hsLimit.armed)
+            armTimeout(wheel, &conn->hsLimit, MAX_HS_TIME * 1000L);
     }
-    /* Find the correct spot for the timeout */
-    for (prev = out, it = *out; it != NULL; prev = &it->next, it = it->next) {
-        if (t->ts.tv_sec < it->ts.tv_sec)
-            break;
-        else if (t->ts.tv_sec == it->ts.tv_sec && t->ts.tv_nsec < it->ts.tv_nsec)
-            break;
+    else {
+        cancelTimeout(wheel, &conn->hsLimit);
     }
-    /* Place it in the correct order in the list */
-    *prev = t;
-    t->next = it;
+    armTimeout(wheel, &conn->rtx, nextTimeoutMs(conn->ssl));
     return 1;
 }
 
-void freeTimeouts(struct DtlsTimeout** out, struct ConnList* conn)
+void freeTimeouts(struct TimerWheel* wheel, struct ConnList* conn)
 {
-    struct DtlsTimeout* it = *out; /* iterator */
-    struct DtlsTimeout** prev = out;
-
-    while (it != NULL) {
-        if (it->conn == conn) {
-            *prev = it->next;
-            free(it);
-            it = *prev;
-        }
-        else {
-            prev = &it->next;
-            it = it->next;
-        }
-    }
+    cancelTimeout(wheel, &conn->rtx);
+    cancelTimeout(wheel, &conn->hsLimit);
 }
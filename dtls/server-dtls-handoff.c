@@ -0,0 +1,1128 @@
+/* server-dtls-handoff.c
+ *
+ * Copyright (C) 2006-2025 wolfSSL Inc.
+ *
+ * This file is part of wolfSSL. (formerly known as CyaSSL)
+ *
+ * wolfSSL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ *=============================================================================
+ *
+ * DTLS server that hands all of its live sessions, and its UDP socket, to a
+ * replacement server process so it can be restarted without clients noticing.
+ *
+ * The sessions are exported into one memory-mapped snapshot (a sealed memfd)
+ * which is passed, along with the UDP socket, over a UNIX socket with
+ * SCM_RIGHTS. The replacement imports the sessions in parallel and carries
+ * on reading the same UDP socket, so datagrams that arrive during the hand
+ * off wait in the socket's receive buffer instead of being lost. The
+ * snapshot is never written to disk and so is not encrypted.
+ *
+ * Only sessions that have finished their handshake are handed off. Clients
+ * in the middle of a handshake retransmit and start again.
+ *
+ * Requires wolfSSL compiled with:
+ *   ./configure --enable-dtls --enable-sessionexport
+ *
+ * Usage:
+ *   ./server-dtls-handoff [-r] [-t <threads>] [-p <path>] [-b <sessions>]
+ *   -r             Take over from the server listening on the UNIX socket.
+ *   -t <threads>   Threads to export and import sessions with (default 4).
+ *   -p <path>      UNIX socket to hand off on (default HANDOFF_PATH).
+ *   -b <sessions>  Benchmark handing off this many sessions.
+ */
+
+#define _GNU_SOURCE
+#include "dtls-export-common.h"
+#include <unistd.h>
+#include <netdb.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <errno.h>
+
+#define SERV_PORT       11111
+#define MSGLEN          4096
+#define HANDOFF_PATH    "/tmp/dtls-handoff.sock"
+#define HANDOFF_MAGIC   0x44544853      /* "DTHS" */
+#define SESSION_BUCKETS 4096
+#define MAX_THREADS     64
+
+/* A DTLS session and the datagram waiting to be read by it. */
+typedef struct Session {
+    WOLFSSL*                ssl;
+    struct sockaddr_in      peer;
+    const unsigned char*    rx;
+    int                     rxSz;
+    struct Session*         next;
+} Session;
+
+/* Start of a snapshot. Also sent as the hand off message. */
+typedef struct {
+    uint32_t magic;
+    uint32_t count;             /* Number of sessions. */
+    uint32_t stride;            /* Space for each exported session. */
+    uint32_t pad;
+    uint64_t size;              /* Size of the snapshot in bytes. */
+} SnapHeader;
+
+/* Exported session in a snapshot. Exported data is at the entry's index
+ * times the stride from the end of the entries. */
+typedef struct {
+    uint32_t            len;
+    uint32_t            pad;
+    struct sockaddr_in  peer;
+} SnapEntry;
+
+/* Part of a snapshot for a thread to export or import. */
+typedef struct {
+    WOLFSSL_CTX*    ctx;
+    unsigned char*  snap;
+    Session**       sessions;
+    uint32_t        start;
+    uint32_t        end;
+    uint32_t        failed;
+    pthread_t       tid;
+    int             started;
+} SnapJob;
+
+static volatile int cleanup = 0;
+static int udpFd = -1;
+static Session* buckets[SESSION_BUCKETS];
+static uint32_t sessionCnt = 0;
+
+static void sig_handler(int sig)
+{
+    (void)sig;
+    cleanup = 1;
+}
+
+static void Usage(const char* progName)
+{
+    XPRINTF("Usage: %s [-r] [-t <threads>] [-p <path>] [-b <sessions>]\n",
+           progName);
+    XPRINTF("  -r             Take over from the server on the UNIX socket\n");
+    XPRINTF("  -t <threads>   Threads to export and import with (default 4)\n");
+    XPRINTF("  -p <path>      UNIX socket to hand off on (default %s)\n",
+           HANDOFF_PATH);
+    XPRINTF("  -b <sessions>  Benchmark handing off this many sessions\n");
+}
+
+static double NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static Session** Bucket(const struct sockaddr_in* peer)
+{
+    uint32_t h = peer->sin_addr.s_addr * 2654435761u ^ peer->sin_port;
+    return &buckets[(h ^ (h >> 16)) % SESSION_BUCKETS];
+}
+
+static Session* FindSession(const struct sockaddr_in* peer)
+{
+    Session* s;
+
+    for (s = *Bucket(peer); s != NULL; s = s->next) {
+        if (s->peer.sin_addr.s_addr == peer->sin_addr.s_addr &&
+                s->peer.sin_port == peer->sin_port) {
+            break;
+        }
+    }
+    return s;
+}
+
+static void AddSession(Session* s)
+{
+    Session** b = Bucket(&s->peer);
+
+    s->next = *b;
+    *b = s;
+    sessionCnt++;
+}
+
+static void FreeSession(Session* s)
+{
+    if (s->ssl != NULL) {
+        wolfSSL_free(s->ssl);
+    }
+    free(s);
+}
+
+static void RemoveSession(Session* s)
+{
+    Session** p;
+
+    for (p = Bucket(&s->peer); *p != NULL; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            sessionCnt--;
+            break;
+        }
+    }
+    FreeSession(s);
+}
+
+/* Give wolfSSL the datagram received for the session. */
+static int IORecv(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    Session* s = (Session*)ctx;
+
+    (void)ssl;
+    if (s->rxSz == 0) {
+        return WOLFSSL_CBIO_ERR_WANT_READ;
+    }
+    if (sz > s->rxSz) {
+        sz = s->rxSz;
+    }
+    memcpy(buf, s->rx, sz);
+    s->rxSz = 0;
+    return sz;
+}
+
+/* Send a datagram to the session's peer on the shared UDP socket. */
+static int IOSend(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    Session* s = (Session*)ctx;
+    ssize_t ret;
+
+    (void)ssl;
+    ret = sendto(udpFd, buf, sz, 0, (struct sockaddr*)&s->peer,
+                 sizeof(s->peer));
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return WOLFSSL_CBIO_ERR_WANT_WRITE;
+        }
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    }
+    return (int)ret;
+}
+
+/* Create a session, not yet in the table, for a peer. */
+static Session* NewSession(WOLFSSL_CTX* ctx, const struct sockaddr_in* peer)
+{
+    Session* s = (Session*)calloc(1, sizeof(Session));
+
+    if (s == NULL) {
+        return NULL;
+    }
+    s->ssl = wolfSSL_new(ctx);
+    if (s->ssl == NULL) {
+        free(s);
+        return NULL;
+    }
+    s->peer = *peer;
+    wolfSSL_SSLSetIORecv(s->ssl, IORecv);
+    wolfSSL_SSLSetIOSend(s->ssl, IOSend);
+    wolfSSL_SetIOReadCtx(s->ssl, s);
+    wolfSSL_SetIOWriteCtx(s->ssl, s);
+    wolfSSL_dtls_set_using_nonblock(s->ssl, 1);
+    return s;
+}
+
+static size_t SnapDataOffset(uint32_t count)
+{
+    return sizeof(SnapHeader) + (size_t)count * sizeof(SnapEntry);
+}
+
+/* Export a range of sessions into their places in the snapshot. */
+static void* ExportRange(void* arg)
+{
+    SnapJob* job = (SnapJob*)arg;
+    SnapHeader* hdr = (SnapHeader*)job->snap;
+    SnapEntry* entry = (SnapEntry*)(job->snap + sizeof(SnapHeader));
+    unsigned char* data = job->snap + SnapDataOffset(hdr->count);
+    uint32_t i;
+
+    for (i = job->start; i < job->end; i++) {
+        unsigned int sz = hdr->stride;
+        int ret = wolfSSL_dtls_export(job->sessions[i]->ssl,
+                                      data + (size_t)i * hdr->stride, &sz);
+        /* A zero length entry is skipped by the importer. */
+        entry[i].len = (ret > 0) ? (uint32_t)ret : 0;
+        entry[i].peer = job->sessions[i]->peer;
+        if (ret <= 0) {
+            job->failed++;
+        }
+    }
+    return NULL;
+}
+
+/* Import a range of sessions from the snapshot into new sessions. */
+static void* ImportRange(void* arg)
+{
+    SnapJob* job = (SnapJob*)arg;
+    SnapHeader* hdr = (SnapHeader*)job->snap;
+    SnapEntry* entry = (SnapEntry*)(job->snap + sizeof(SnapHeader));
+    unsigned char* data = job->snap + SnapDataOffset(hdr->count);
+    uint32_t i;
+
+    for (i = job->start; i < job->end; i++) {
+        Session* s = NULL;
+
+        if (entry[i].len > 0 && entry[i].len <= hdr->stride) {
+            s = NewSession(job->ctx, &entry[i].peer);
+        }
+        if (s != NULL && wolfSSL_dtls_import(s->ssl,
+                data + (size_t)i * hdr->stride, entry[i].len) < 0) {
+            FreeSession(s);
+            s = NULL;
+        }
+        if (s == NULL) {
+            job->failed++;
+        }
+        job->sessions[i] = s;
+    }
+    return NULL;
+}
+
+/* Run a job over all the sessions of a snapshot split between threads.
+ * The calling thread does the first part.
+ *
+ * returns the number of sessions that failed.
+ */
+static uint32_t RunJobs(void* (*fn)(void*), WOLFSSL_CTX* ctx,
+                        unsigned char* snap, Session** sessions,
+                        uint32_t count, int threads)
+{
+    SnapJob jobs[MAX_THREADS];
+    uint32_t failed = 0;
+    int i;
+
+    for (i = 0; i < threads; i++) {
+        jobs[i].ctx = ctx;
+        jobs[i].snap = snap;
+        jobs[i].sessions = sessions;
+        jobs[i].start = (uint32_t)((uint64_t)count * i / threads);
+        jobs[i].end = (uint32_t)((uint64_t)count * (i + 1) / threads);
+        jobs[i].failed = 0;
+        jobs[i].started = (i > 0 &&
+                           pthread_create(&jobs[i].tid, NULL, fn, &jobs[i]) == 0);
+        if (i > 0 && !jobs[i].started) {
+            /* Do it on this thread instead. */
+            fn(&jobs[i]);
+        }
+    }
+    fn(&jobs[0]);
+    for (i = 0; i < threads; i++) {
+        if (jobs[i].started) {
+            pthread_join(jobs[i].tid, NULL);
+        }
+        failed += jobs[i].failed;
+    }
+    return failed;
+}
+
+/* Export sessions into a new sealed memfd.
+ *
+ * sessions  Sessions that have finished their handshake.
+ * count     Number of sessions.
+ * threads   Number of threads to export with.
+ * hdr       Header of the snapshot, to send with it.
+ * returns the memfd on success and -1 on error.
+ */
+static int ExportSnapshot(Session** sessions, uint32_t count, int threads,
+                          SnapHeader* hdr)
+{
+    unsigned int stride = 0;
+    unsigned char* snap;
+    int fd;
+
+    /* Passing NULL gives the largest size an export can be. */
+    if (count > 0 && (wolfSSL_dtls_export(sessions[0]->ssl, NULL,
+            &stride) < 0 || stride == 0)) {
+        XFPRINTF(stderr, "Error: Can't get session export size\n");
+        return -1;
+    }
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->magic = HANDOFF_MAGIC;
+    hdr->count = count;
+    hdr->stride = stride;
+    hdr->size = SnapDataOffset(count) + (uint64_t)count * stride;
+
+    fd = memfd_create("dtls-handoff", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        XFPRINTF(stderr, "Error: memfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)hdr->size) != 0) {
+        XFPRINTF(stderr, "Error: ftruncate failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    snap = (unsigned char*)mmap(NULL, hdr->size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    if (snap == MAP_FAILED) {
+        XFPRINTF(stderr, "Error: mmap failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    memcpy(snap, hdr, sizeof(*hdr));
+    if (RunJobs(ExportRange, NULL, snap, sessions, count, threads) > 0) {
+        XFPRINTF(stderr, "Warning: Not all sessions could be exported\n");
+    }
+    munmap(snap, hdr->size);
+
+    /* The replacement can trust the snapshot not to change under it. */
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE |
+            F_SEAL_SEAL) != 0) {
+        XFPRINTF(stderr, "Warning: Can't seal snapshot: %s\n", strerror(errno));
+    }
+    return fd;
+}
+
+/* Import all the sessions of a snapshot and add them to the table.
+ *
+ * ctx      Server context to create sessions with.
+ * fd       File descriptor of the snapshot.
+ * threads  Number of threads to import with.
+ * failed   Number of sessions that could not be imported.
+ * returns the number of sessions imported, or -1 on error.
+ */
+static int ImportSnapshot(WOLFSSL_CTX* ctx, int fd, int threads,
+                          uint32_t* failed)
+{
+    struct stat st;
+    SnapHeader hdr;
+    Session** sessions;
+    unsigned char* snap;
+    uint32_t i;
+    int imported = 0;
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(hdr) ||
+            pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+        XFPRINTF(stderr, "Error: Can't read snapshot header\n");
+        return -1;
+    }
+    if (hdr.magic != HANDOFF_MAGIC || hdr.size != (uint64_t)st.st_size ||
+            SnapDataOffset(hdr.count) + (uint64_t)hdr.count * hdr.stride >
+            hdr.size) {
+        XFPRINTF(stderr, "Error: Snapshot is not valid\n");
+        return -1;
+    }
+    if (hdr.count == 0) {
+        *failed = 0;
+        return 0;
+    }
+
+    sessions = (Session**)calloc(hdr.count, sizeof(Session*));
+    if (sessions == NULL) {
+        return -1;
+    }
+    snap = (unsigned char*)mmap(NULL, hdr.size, PROT_READ, MAP_SHARED, fd, 0);
+    if (snap == MAP_FAILED) {
+        XFPRINTF(stderr, "Error: mmap failed: %s\n", strerror(errno));
+        free(sessions);
+        return -1;
+    }
+    *failed = RunJobs(ImportRange, ctx, snap, sessions, hdr.count, threads);
+    munmap(snap, hdr.size);
+
+    for (i = 0; i < hdr.count; i++) {
+        if (sessions[i] != NULL) {
+            AddSession(sessions[i]);
+            imported++;
+        }
+    }
+    free(sessions);
+    return imported;
+}
+
+/* Send the snapshot header with the UDP socket and snapshot descriptors. */
+static int SendHandoff(int fd, const SnapHeader* hdr, int sockFd, int snapFd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    int fds[2] = { sockFd, snapFd };
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&ctrl, 0, sizeof(ctrl));
+    iov.iov_base = (void*)hdr;
+    iov.iov_len = sizeof(*hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    return (sendmsg(fd, &msg, 0) == (ssize_t)sizeof(*hdr)) ? 0 : -1;
+}
+
+/* Receive the snapshot header with the UDP socket and snapshot descriptors.
+ */
+static int RecvHandoff(int fd, SnapHeader* hdr, int* sockFd, int* snapFd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+    int fds[2];
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = hdr;
+    iov.iov_len = sizeof(*hdr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+    if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(*hdr)) {
+        return -1;
+    }
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    *sockFd = fds[0];
+    *snapFd = fds[1];
+    return 0;
+}
+
+/* Listen on a UNIX socket for a replacement server.
+ * The socket is created accessible to this user only as the sessions handed
+ * off on it hold their keys.
+ */
+static int ListenHandoff(const char* path)
+{
+    struct sockaddr_un addr;
+    mode_t mask;
+    int fd;
+    int ret;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    mask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (ret != 0 || listen(fd, 1) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Check that the process at the other end of a UNIX socket is run by the
+ * same user as this one.
+ *
+ * fd  Connected UNIX socket.
+ * returns 1 when the same user and 0 otherwise.
+ */
+static int PeerIsSameUser(int fd)
+{
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+            len != sizeof(cred)) {
+        return 0;
+    }
+    return cred.uid == geteuid();
+}
+
+/* Hand all finished sessions and the UDP socket to a replacement server.
+ *
+ * handoffFd  UNIX socket the replacement has connected to.
+ * threads    Number of threads to export with.
+ * returns 0 on success and -1 on error.
+ */
+static int HandOff(int handoffFd, int threads)
+{
+    Session** sessions;
+    Session* s;
+    SnapHeader hdr;
+    uint32_t count = 0;
+    double start = NowMs();
+    double exported;
+    int snapFd;
+    int ret;
+    int i;
+
+    sessions = (Session**)calloc(sessionCnt + 1, sizeof(Session*));
+    if (sessions == NULL) {
+        return -1;
+    }
+    for (i = 0; i < SESSION_BUCKETS; i++) {
+        for (s = buckets[i]; s != NULL; s = s->next) {
+            if (wolfSSL_is_init_finished(s->ssl)) {
+                sessions[count++] = s;
+            }
+        }
+    }
+
+    snapFd = ExportSnapshot(sessions, count, threads, &hdr);
+    free(sessions);
+    if (snapFd < 0) {
+        return -1;
+    }
+    exported = NowMs();
+    ret = SendHandoff(handoffFd, &hdr, udpFd, snapFd);
+    close(snapFd);
+    if (ret != 0) {
+        XFPRINTF(stderr, "Error: Failed to send hand off: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    XPRINTF("Handed off %u sessions (%lu bytes): export %.2f ms, "
+           "send %.2f ms\n", count, (unsigned long)hdr.size,
+           exported - start, NowMs() - exported);
+    return 0;
+}
+
+/* Take over the UDP socket and sessions of the server on the UNIX socket.
+ *
+ * ctx      Server context to create sessions with.
+ * path     UNIX socket the running server is listening on.
+ * threads  Number of threads to import with.
+ * returns 0 on success and -1 on error.
+ */
+static int TakeOver(WOLFSSL_CTX* ctx, const char* path, int threads)
+{
+    struct sockaddr_un addr;
+    SnapHeader hdr;
+    uint32_t failed = 0;
+    double start = NowMs();
+    double received;
+    int snapFd;
+    int fd;
+    int imported;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+            !PeerIsSameUser(fd) ||
+            RecvHandoff(fd, &hdr, &udpFd, &snapFd) != 0) {
+        XFPRINTF(stderr, "Error: No hand off from server on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    received = NowMs();
+
+    imported = ImportSnapshot(ctx, snapFd, threads, &failed);
+    close(snapFd);
+    if (imported < 0) {
+        return -1;
+    }
+    XPRINTF("Took over %d sessions (%u failed) with %d threads: receive "
+           "%.2f ms, import %.2f ms\n", imported, failed, threads,
+           received - start, NowMs() - received);
+    return 0;
+}
+
+/* Process a datagram from a peer, starting a new session if needed. */
+static void HandleDatagram(WOLFSSL_CTX* ctx, const unsigned char* buf,
+                           int sz, const struct sockaddr_in* peer)
+{
+    char ack[] = "I hear you fashizzle!\n";
+    char msg[MSGLEN];
+    Session* s = FindSession(peer);
+    int ret;
+    int err;
+
+    if (s == NULL) {
+        s = NewSession(ctx, peer);
+        if (s == NULL) {
+            return;
+        }
+        AddSession(s);
+    }
+    s->rx = buf;
+    s->rxSz = sz;
+
+    if (!wolfSSL_is_init_finished(s->ssl)) {
+        ret = wolfSSL_accept(s->ssl);
+        if (ret == SSL_SUCCESS) {
+            XPRINTF("Handshake done with %s:%d\n", inet_ntoa(peer->sin_addr),
+                   ntohs(peer->sin_port));
+        }
+    }
+    else {
+        ret = wolfSSL_read(s->ssl, msg, sizeof(msg) - 1);
+        if (ret > 0) {
+            msg[ret] = '\0';
+            XPRINTF("Received from %s:%d: %s", inet_ntoa(peer->sin_addr),
+                   ntohs(peer->sin_port), msg);
+            ret = wolfSSL_write(s->ssl, ack, (int)strlen(ack));
+        }
+    }
+    if (ret <= 0) {
+        err = wolfSSL_get_error(s->ssl, ret);
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+            if (err != WOLFSSL_ERROR_ZERO_RETURN) {
+                XFPRINTF(stderr, "Error with %s:%d: %d (%s)\n",
+                        inet_ntoa(peer->sin_addr), ntohs(peer->sin_port),
+                        err, wolfSSL_ERR_reason_error_string(err));
+            }
+            RemoveSession(s);
+        }
+    }
+}
+
+#define MEM_DGRAMS 16
+
+/* Memory IO for the benchmark handshake: a queue of datagrams each way. */
+typedef struct {
+    unsigned char buf[MEM_DGRAMS][MSGLEN];
+    int sz[MEM_DGRAMS];
+    int head;
+    int cnt;
+} MemDgram;
+
+static MemDgram toServer;
+static MemDgram toClient;
+
+static int MemRecv(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    MemDgram* d = (MemDgram*)ctx;
+
+    (void)ssl;
+    if (d->cnt == 0) {
+        return WOLFSSL_CBIO_ERR_WANT_READ;
+    }
+    if (sz > d->sz[d->head]) {
+        sz = d->sz[d->head];
+    }
+    memcpy(buf, d->buf[d->head], sz);
+    d->head = (d->head + 1) % MEM_DGRAMS;
+    d->cnt--;
+    return sz;
+}
+
+static int MemSend(WOLFSSL* ssl, char* buf, int sz, void* ctx)
+{
+    MemDgram* d = (MemDgram*)ctx;
+
+    int tail;
+
+    (void)ssl;
+    /* Dropped like a full socket buffer would - DTLS retransmits. */
+    if (d->cnt == MEM_DGRAMS || sz > MSGLEN) {
+        return sz;
+    }
+    tail = (d->head + d->cnt) % MEM_DGRAMS;
+    memcpy(d->buf[tail], buf, sz);
+    d->sz[tail] = sz;
+    d->cnt++;
+    return sz;
+}
+
+/* Benchmark handing off sessions to a replacement server.
+ *
+ * One session is made with an in-memory handshake and imported as many
+ * sessions. These are then exported, passed over a UNIX socket pair and
+ * imported again with 1, 2, 4 and 8 threads.
+ *
+ * ctx    Server context.
+ * count  Number of sessions to hand off.
+ * returns 0 on success and 1 on error.
+ */
+static int Benchmark(WOLFSSL_CTX* ctx, uint32_t count)
+{
+    WOLFSSL_CTX* cliCtx = NULL;
+    WOLFSSL* cli = NULL;
+    WOLFSSL* srv = NULL;
+    Session** sessions = NULL;
+    SnapHeader hdr;
+    struct sockaddr_in peer;
+    unsigned char* blob = NULL;
+    unsigned int blobSz = 0;
+    uint32_t i;
+    int interval;
+    int threads;
+    int pair[2] = { -1, -1 };
+    int ret = 1;
+
+    cliCtx = wolfSSL_CTX_new(wolfDTLSv1_2_client_method());
+    if (cliCtx == NULL) {
+        goto cleanup;
+    }
+    wolfSSL_CTX_set_verify(cliCtx, WOLFSSL_VERIFY_NONE, NULL);
+    cli = wolfSSL_new(cliCtx);
+    srv = wolfSSL_new(ctx);
+    if (cli == NULL || srv == NULL) {
+        goto cleanup;
+    }
+    wolfSSL_SSLSetIORecv(cli, MemRecv);
+    wolfSSL_SSLSetIOSend(cli, MemSend);
+    wolfSSL_SetIOReadCtx(cli, &toClient);
+    wolfSSL_SetIOWriteCtx(cli, &toServer);
+    wolfSSL_SSLSetIORecv(srv, MemRecv);
+    wolfSSL_SSLSetIOSend(srv, MemSend);
+    wolfSSL_SetIOReadCtx(srv, &toServer);
+    wolfSSL_SetIOWriteCtx(srv, &toClient);
+    wolfSSL_dtls_set_using_nonblock(cli, 1);
+    wolfSSL_dtls_set_using_nonblock(srv, 1);
+    for (i = 0; i < 1000 && !(wolfSSL_is_init_finished(cli) &&
+            wolfSSL_is_init_finished(srv)); i++) {
+        wolfSSL_connect(cli);
+        wolfSSL_accept(srv);
+        if (toServer.cnt == 0 && toClient.cnt == 0) {
+            /* Both waiting - a datagram was dropped. */
+            wolfSSL_dtls_got_timeout(cli);
+        }
+    }
+    if (!wolfSSL_is_init_finished(srv)) {
+        XFPRINTF(stderr, "Error: Benchmark handshake failed\n");
+        goto cleanup;
+    }
+    /* The retransmit interval a peer waits before resending a flight. */
+    interval = wolfSSL_dtls_get_current_timeout(srv);
+
+    /* Make the sessions to hand off from the one exported session. */
+    if (wolfSSL_dtls_export(srv, NULL, &blobSz) < 0 ||
+            (blob = (unsigned char*)malloc(blobSz)) == NULL ||
+            (ret = wolfSSL_dtls_export(srv, blob, &blobSz)) <= 0) {
+        XFPRINTF(stderr, "Error: Benchmark export failed\n");
+        ret = 1;
+        goto cleanup;
+    }
+    blobSz = (unsigned int)ret;
+    ret = 1;
+    sessions = (Session**)calloc(count, sizeof(Session*));
+    if (sessions == NULL) {
+        goto cleanup;
+    }
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (i = 0; i < count; i++) {
+        peer.sin_port = htons((uint16_t)(1024 + i % 60000));
+        sessions[i] = NewSession(ctx, &peer);
+        if (sessions[i] == NULL ||
+                wolfSSL_dtls_import(sessions[i]->ssl, blob, blobSz) < 0) {
+            XFPRINTF(stderr, "Error: Benchmark import failed\n");
+            goto cleanup;
+        }
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+        goto cleanup;
+    }
+
+    XPRINTF("Handing off %u sessions, retransmit interval %d s\n", count,
+           interval);
+    XPRINTF("%8s %10s %10s %10s %10s %16s\n", "threads", "export ms",
+           "pass ms", "import ms", "total ms", "sessions/rtx");
+    for (threads = 1; threads <= 8; threads *= 2) {
+        double t0, t1, t2, t3;
+        int snapFd;
+        int sockFd = -1;
+        int gotFd = -1;
+        int imported;
+        uint32_t failed;
+
+        t0 = NowMs();
+        snapFd = ExportSnapshot(sessions, count, threads, &hdr);
+        if (snapFd < 0) {
+            goto cleanup;
+        }
+        t1 = NowMs();
+        if (SendHandoff(pair[0], &hdr, pair[0], snapFd) != 0 ||
+                RecvHandoff(pair[1], &hdr, &sockFd, &gotFd) != 0) {
+            close(snapFd);
+            goto cleanup;
+        }
+        close(snapFd);
+        close(sockFd);
+        t2 = NowMs();
+        imported = ImportSnapshot(ctx, gotFd, threads, &failed);
+        t3 = NowMs();
+        close(gotFd);
+        if (imported != (int)count) {
+            XFPRINTF(stderr, "Error: Imported %d of %u sessions\n", imported,
+                    count);
+            goto cleanup;
+        }
+        XPRINTF("%8d %10.2f %10.2f %10.2f %10.2f %16.0f\n", threads, t1 - t0,
+               t2 - t1, t3 - t2, t3 - t0, count * interval * 1000.0 /
+               (t3 - t0));
+
+        /* Free the imported sessions for the next run. */
+        for (i = 0; i < SESSION_BUCKETS; i++) {
+            while (buckets[i] != NULL) {
+                RemoveSession(buckets[i]);
+            }
+        }
+    }
+    ret = 0;
+
+cleanup:
+    if (pair[0] >= 0) {
+        close(pair[0]);
+        close(pair[1]);
+    }
+    if (sessions != NULL) {
+        for (i = 0; i < count; i++) {
+            if (sessions[i] != NULL) {
+                FreeSession(sessions[i]);
+            }
+        }
+        free(sessions);
+    }
+    if (blob != NULL) {
+        wc_ForceZero(blob, blobSz);
+        free(blob);
+    }
+    if (cli != NULL) wolfSSL_free(cli);
+    if (srv != NULL) wolfSSL_free(srv);
+    if (cliCtx != NULL) wolfSSL_CTX_free(cliCtx);
+    return ret;
+}
+
+int main(int argc, char** argv)
+{
+    char            caCertLoc[] = "../certs/ca-cert.pem";
+    char            servCertLoc[] = "../certs/server-cert.pem";
+    char            servKeyLoc[] = "../certs/server-key.pem";
+    const char*     path = HANDOFF_PATH;
+    int             takeOver = 0;
+    int             threads = 4;
+    long            benchCount = 0;
+    int             ret = 0;
+    int             on = 1;
+    int             handoffFd = -1;
+    int             handedOff = 0;
+    int             i;
+    WOLFSSL_CTX*    ctx = NULL;
+    struct sockaddr_in servAddr;
+    struct sockaddr_in cliAddr;
+    socklen_t       cliLen;
+    unsigned char   buf[MSGLEN];
+    struct pollfd   fds[2];
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            takeOver = 1;
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            benchCount = atol(argv[++i]);
+        }
+        else {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1 || threads > MAX_THREADS || benchCount < 0) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    /* Set up signal handler for clean shutdown */
+    signal(SIGINT, sig_handler);
+    /* A replacement going away mid hand off must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Initialize wolfSSL */
+    wolfSSL_Init();
+
+    /* Create DTLS 1.2 context */
+    ctx = wolfSSL_CTX_new(wolfDTLSv1_2_server_method());
+    if (ctx == NULL) {
+        XFPRINTF(stderr, "Error: wolfSSL_CTX_new failed\n");
+        ret = 1;
+        goto cleanup;
+    }
+
+    /* Load CA certificates */
+    ret = wolfSSL_CTX_load_verify_locations(ctx, caCertLoc, NULL);
+    if (ret != SSL_SUCCESS) {
+        XFPRINTF(stderr, "Error: Failed to load CA cert %s\n", caCertLoc);
+        ret = 1;
+        goto cleanup;
+    }
+
+    /* Load server certificate */
+    ret = wolfSSL_CTX_use_certificate_file(ctx, servCertLoc, SSL_FILETYPE_PEM);
+    if (ret != SSL_SUCCESS) {
+        XFPRINTF(stderr, "Error: Failed to load server cert %s\n", servCertLoc);
+        ret = 1;
+        goto cleanup;
+    }
+
+    /* Load server private key */
+    ret = wolfSSL_CTX_use_PrivateKey_file(ctx, servKeyLoc, SSL_FILETYPE_PEM);
+    if (ret != SSL_SUCCESS) {
+        XFPRINTF(stderr, "Error: Failed to load server key %s\n", servKeyLoc);
+        ret = 1;
+        goto cleanup;
+    }
+    ret = 0;
+
+    if (benchCount > 0) {
+        ret = Benchmark(ctx, (uint32_t)benchCount);
+        goto cleanup;
+    }
+
+    if (takeOver) {
+        /* Get the UDP socket and sessions from the running server */
+        if (TakeOver(ctx, path, threads) != 0) {
+            ret = 1;
+            goto cleanup;
+        }
+    }
+    else {
+        /* Create UDP socket */
+        udpFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (udpFd < 0) {
+            XFPRINTF(stderr, "Error: Cannot create socket\n");
+            ret = 1;
+            goto cleanup;
+        }
+
+        /* Set socket options */
+        if (setsockopt(udpFd, SOL_SOCKET, SO_REUSEADDR, &on,
+                       sizeof(on)) < 0) {
+            XFPRINTF(stderr, "Error: setsockopt SO_REUSEADDR failed\n");
+            ret = 1;
+            goto cleanup;
+        }
+
+        /* Setup server address */
+        memset(&servAddr, 0, sizeof(servAddr));
+        servAddr.sin_family = AF_INET;
+        servAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+        servAddr.sin_port = htons(SERV_PORT);
+
+        /* Bind socket */
+        if (bind(udpFd, (struct sockaddr*)&servAddr, sizeof(servAddr)) < 0) {
+            XFPRINTF(stderr, "Error: bind failed\n");
+            ret = 1;
+            goto cleanup;
+        }
+    }
+
+    /* Wait for the next replacement */
+    handoffFd = ListenHandoff(path);
+    if (handoffFd < 0) {
+        XFPRINTF(stderr, "Error: Cannot listen on %s\n", path);
+        ret = 1;
+        goto cleanup;
+    }
+
+    XPRINTF("DTLS server listening on port %d\n", SERV_PORT);
+    XPRINTF("Start \"%s -r\" to hand off to a new server\n\n", argv[0]);
+
+    fds[0].fd = udpFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = handoffFd;
+    fds[1].events = POLLIN;
+    while (!cleanup) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            XFPRINTF(stderr, "Error: poll failed\n");
+            ret = 1;
+            break;
+        }
+        if (fds[1].revents & POLLIN) {
+            int fd = accept(handoffFd, NULL, NULL);
+            if (fd >= 0) {
+                if (PeerIsSameUser(fd)) {
+                    handedOff = (HandOff(fd, threads) == 0);
+                }
+                else {
+                    XFPRINTF(stderr, "Error: Hand off refused - replacement "
+                                     "run by another user\n");
+                }
+                close(fd);
+                if (handedOff) {
+                    break;
+                }
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            int recvLen;
+
+            cliLen = sizeof(cliAddr);
+            recvLen = (int)recvfrom(udpFd, buf, sizeof(buf), MSG_DONTWAIT,
+                                    (struct sockaddr*)&cliAddr, &cliLen);
+            if (recvLen > 0) {
+                HandleDatagram(ctx, buf, recvLen, &cliAddr);
+            }
+        }
+    }
+
+cleanup:
+    if (handoffFd >= 0) {
+        close(handoffFd);
+        /* The replacement has its own socket at the path now */
+        if (!handedOff) {
+            unlink(path);
+        }
+    }
+    for (i = 0; i < SESSION_BUCKETS; i++) {
+        while (buckets[i] != NULL) {
+            Session* s = buckets[i];
+            /* Handed off sessions live on - don't send close_notify */
+            if (!handedOff) {
+                wolfSSL_shutdown(s->ssl);
+            }
+            RemoveSession(s);
+        }
+    }
+    if (udpFd >= 0) close(udpFd);
+    if (ctx != NULL) wolfSSL_CTX_free(ctx);
+    wolfSSL_Cleanup();
+
+    return ret;
+}
@@ -24,6 +24,12 @@
  * Utilizes DTLS 1.2.
  * Compile wolfSSL with WOLFSSL_THREADED_CRYPT to have encryption of application
  * packets done in threads.
+ *
+ * Options:
+ *   -s <spins>  Encrypt threads poll this many times before sleeping. Only
+ *               worth it with a spare core per encrypt thread.
+ *   -b          Benchmark handing records to encrypt threads instead of
+ *               running the server.
  */
 
 #include <wolfssl/options.h>
@@ -35,19 +41,98 @@
 #include <netinet/in.h>             /* used for sockaddr_in */
 #include <arpa/inet.h>
 #include <wolfssl/ssl.h>
+#include <wolfssl/wolfcrypt/aes.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #define SERV_PORT   11111           /* define our server port number */
 #define MSGLEN      4096            /* length of read buffer */
 
+/* Hint to the CPU that we are spinning. */
+#if defined(__x86_64__) || defined(__i386__)
+    #define CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+    #define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+    #define CPU_RELAX() do { } while (0)
+#endif
+
 struct sockaddr_in servAddr;        /* our server's address */
 struct sockaddr_in cliaddr;         /* the client's address */
 
 void sig_handler(const int sig);
 
+/* Number of times an encrypt thread polls for work before sleeping. */
+static int encSpins = 0;
+
+/* Wakes one consumer thread from one producer without locks.
+ *
+ * The producer bumps seq for every item it hands over. The consumer remembers
+ * the last seq it saw and sleeps on the futex only when nothing new has
+ * arrived, so the producer makes a system call only when the consumer is
+ * asleep.
+ */
+typedef struct {
+    unsigned int seq;           /* Futex word - count of items handed over. */
+    int sleeping;               /* Set while the consumer may be in futex wait. */
+    int spins;                  /* Polls before the consumer sleeps. */
+} encDoorbell;
+
+/* Tell the consumer there is another item.
+ *
+ * bell  Doorbell of the consumer.
+ */
+static void doorbell_ring(encDoorbell* bell)
+{
+    __atomic_fetch_add(&bell->seq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&bell->sleeping, __ATOMIC_SEQ_CST)) {
+        syscall(SYS_futex, &bell->seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+/* Wait for items past the last seen.
+ *
+ * The store of sleeping and the load of seq pair with the increment of seq
+ * and the load of sleeping in doorbell_ring() so that a wake up is never
+ * missed.
+ *
+ * bell  Doorbell of the consumer.
+ * seen  Value of seq last returned.
+ * returns the new value of seq.
+ */
+static unsigned int doorbell_wait(encDoorbell* bell, unsigned int seen)
+{
+    unsigned int seq;
+    int i;
+
+    for (i = 0; i < bell->spins; i++) {
+        seq = __atomic_load_n(&bell->seq, __ATOMIC_ACQUIRE);
+        if (seq != seen) {
+            return seq;
+        }
+        CPU_RELAX();
+    }
+    for (;;) {
+        __atomic_store_n(&bell->sleeping, 1, __ATOMIC_SEQ_CST);
+        seq = __atomic_load_n(&bell->seq, __ATOMIC_SEQ_CST);
+        if (seq != seen) {
+            break;
+        }
+        /* Returns straight away if seq has changed since the load. */
+        syscall(SYS_futex, &bell->seq, FUTEX_WAIT_PRIVATE, seen, NULL, NULL,
+            0);
+    }
+    __atomic_store_n(&bell->sleeping, 0, __ATOMIC_RELAXED);
+    return seq;
+}
+
 /* Read/write thread arguments. */
 typedef struct {
     WOLFSSL* ssl;   /* SSL object to read/write with. */
@@ -59,67 +144,66 @@ typedef struct {
 typedef struct {
     int idx;                    /* Index of worker. */
     WOLFSSL* ssl;               /* SSL object to encrypt data in. */
-    pthread_mutex_t mutex;      /* Mutex for conditional wait. */
-    pthread_cond_t cond;        /* Conditional variable. */
-    pthread_mutex_t mutex_ssl;  /* Mutex indicating using SSL object. */
+    encDoorbell bell;           /* Rung when the buffer at idx is ready. */
+    int busy;                   /* Set while the thread is using ssl. */
 } encArgs;
 
 /* Thread to perform encryption of packets.
  *
- * If asynchronous encryption isn't read and not stopped, wait on conditional
- * variable to be signaled. When ready, encrypt the buffer at the index.
+ * Wait for the doorbell to be rung. When the buffer at the index is ready,
+ * encrypt it.
  */
 void* thread_do_encrypt(void* args)
 {
     encArgs* data = (encArgs*)args;
     int idx = data->idx;
+    unsigned int seen = 0;
+    WOLFSSL* ssl;
 
     /* Thread doesn't need to be joined. */
     pthread_detach(pthread_self());
 
-    /* Lock mutex for condtional variable. */
-    pthread_mutex_lock(&data->mutex);
-
-    /* Keep going while not in cleanup. */
     while (1) {
-        /* Check whether there is data to encrypt. */
-        if (!wolfSSL_AsyncEncryptReady(data->ssl, idx)) {
-            /* Unlock mutex for use of SSL. */
-            pthread_mutex_unlock(&data->mutex_ssl);
-            /* Wait for conditional variable to be signaled. */
-            pthread_cond_wait(&data->cond, &data->mutex);
-        }
-        /* Lock mutex for use of SSL. */
-        pthread_mutex_lock(&data->mutex_ssl);
+        /* Wait for a buffer to be handed over. */
+        seen = doorbell_wait(&data->bell, seen);
+
+        /* Mark SSL in use before looking at it so that it isn't freed while
+         * we encrypt - see enc_set_ssl(). */
+        __atomic_store_n(&data->busy, 1, __ATOMIC_SEQ_CST);
+        ssl = __atomic_load_n(&data->ssl, __ATOMIC_SEQ_CST);
         /* Check we are ready to encrypt. */
-        if (wolfSSL_AsyncEncryptReady(data->ssl, idx)) {
-            wolfSSL_AsyncEncrypt(data->ssl, idx);
+        if (ssl != NULL && wolfSSL_AsyncEncryptReady(ssl, idx)) {
+            wolfSSL_AsyncEncrypt(ssl, idx);
         }
+        __atomic_store_n(&data->busy, 0, __ATOMIC_RELEASE);
     }
 
-    /* Unlock mutex. */
-    pthread_mutex_unlock(&data->mutex);
-    pthread_mutex_unlock(&data->mutex_ssl);
-
-    /* Destroy mutex and conditional variable. */
-    pthread_mutex_destroy(&data->mutex);
-    pthread_cond_destroy(&data->cond);
-    pthread_mutex_destroy(&data->mutex_ssl);
-
     pthread_exit(NULL);
 }
 
+/* Change the SSL object an encryption thread works on.
+ *
+ * Returns once the thread is no longer using the old SSL object.
+ */
+static void enc_set_ssl(encArgs* data, WOLFSSL* ssl)
+{
+    __atomic_store_n(&data->ssl, ssl, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&data->busy, __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+}
+
 /* Callback for encryption thread.
  *
- * Signals to encryption thread that the buffer is ready for them
- * to work on.
+ * Rings the encryption thread's doorbell to say that the buffer is ready for
+ * them to work on.
  */
 void thread_enc_signal(void* ctx, WOLFSSL* ssl)
 {
     /* Get encryption thread arguments. */
     encArgs* data = (encArgs*)ctx;
-    /* Signal conditional veriable to wake up thread. */
-    pthread_cond_signal(&data->cond);
+
+    doorbell_ring(&data->bell);
 
     (void)ssl;
 }
@@ -218,6 +302,201 @@ void* Writer(void* openSock)
     return NULL;
 }
 
+/* Ways of handing records to encrypt threads compared by the benchmark. */
+enum {
+    HANDOFF_CONDVAR,            /* Mutex and condition variable per thread. */
+    HANDOFF_FUTEX,              /* Doorbell, sleep straight away. */
+    HANDOFF_SPIN                /* Doorbell, poll before sleeping. */
+};
+
+#define BENCH_RECORDS   100000  /* Records handed over per run. */
+#define BENCH_REC_SZ    64      /* Small record - where hand off costs most. */
+#define BENCH_SPINS     20000   /* Polls before sleeping when spinning. */
+
+/* One encrypt thread in the benchmark. */
+typedef struct {
+    int mode;                   /* HANDOFF_* */
+    encDoorbell bell;           /* Used with HANDOFF_FUTEX and HANDOFF_SPIN. */
+    pthread_mutex_t mutex;      /* Used with HANDOFF_CONDVAR. */
+    pthread_cond_t cond;        /* Used with HANDOFF_CONDVAR. */
+    int pending;                /* Record waiting - HANDOFF_CONDVAR. */
+    int stop;                   /* Thread to exit. */
+    int done;                   /* Thread finished with the last record. */
+    double posted;              /* Time the last record was handed over. */
+    double latency;             /* Sum of hand over to encrypted times. */
+    byte rec[BENCH_REC_SZ];     /* Record to encrypt. */
+#ifdef HAVE_AESGCM
+    Aes aes;
+#endif
+} benchEnc;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Encrypt thread of the benchmark. Encrypts each record handed over. */
+static void* bench_encrypt(void* args)
+{
+    benchEnc* enc = (benchEnc*)args;
+    unsigned int seen = 0;
+    byte out[BENCH_REC_SZ];
+    byte tag[16];
+    byte iv[12];
+
+    memset(iv, 0, sizeof(iv));
+    while (1) {
+        if (enc->mode == HANDOFF_CONDVAR) {
+            pthread_mutex_lock(&enc->mutex);
+            while (!enc->pending && !enc->stop) {
+                pthread_cond_wait(&enc->cond, &enc->mutex);
+            }
+            enc->pending = 0;
+            pthread_mutex_unlock(&enc->mutex);
+        }
+        else {
+            seen = doorbell_wait(&enc->bell, seen);
+        }
+        if (__atomic_load_n(&enc->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+#ifdef HAVE_AESGCM
+        wc_AesGcmEncrypt(&enc->aes, out, enc->rec, sizeof(enc->rec), iv,
+            sizeof(iv), tag, sizeof(tag), NULL, 0);
+#else
+        memcpy(out, enc->rec, sizeof(out));
+        (void)tag;
+#endif
+        enc->latency += bench_now() - enc->posted;
+        __atomic_store_n(&enc->done, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* Hand a record to an encrypt thread of the benchmark. */
+static void bench_post(benchEnc* enc)
+{
+    if (enc->mode == HANDOFF_CONDVAR) {
+        pthread_mutex_lock(&enc->mutex);
+        enc->pending = 1;
+        pthread_cond_signal(&enc->cond);
+        pthread_mutex_unlock(&enc->mutex);
+    }
+    else {
+        doorbell_ring(&enc->bell);
+    }
+}
+
+/* Hand BENCH_RECORDS records round robin to a number of encrypt threads.
+ *
+ * Like wolfSSL's buffers, a thread gets its next record only once it has
+ * finished the last.
+ *
+ * mode     HANDOFF_* way of handing over records.
+ * threads  Number of encrypt threads.
+ * rps      Records per second.
+ * lat      Average time from handing over to encrypted in microseconds.
+ * returns 0 on success and 1 on error.
+ */
+static int bench_run(int mode, int threads, double* rps, double* lat)
+{
+    benchEnc* enc = (benchEnc*)calloc(threads, sizeof(benchEnc));
+    pthread_t tid[8];
+    byte key[16];
+    double start;
+    double latency = 0;
+    int i;
+
+    if (enc == NULL) {
+        return 1;
+    }
+    memset(key, 1, sizeof(key));
+    for (i = 0; i < threads; i++) {
+        enc[i].mode = mode;
+        enc[i].bell.spins = (mode == HANDOFF_SPIN) ? BENCH_SPINS : 0;
+        enc[i].done = 1;
+        pthread_mutex_init(&enc[i].mutex, NULL);
+        pthread_cond_init(&enc[i].cond, NULL);
+#ifdef HAVE_AESGCM
+        wc_AesInit(&enc[i].aes, NULL, INVALID_DEVID);
+        wc_AesGcmSetKey(&enc[i].aes, key, sizeof(key));
+#endif
+        pthread_create(&tid[i], NULL, bench_encrypt, &enc[i]);
+    }
+
+    start = bench_now();
+    for (i = 0; i < BENCH_RECORDS; i++) {
+        benchEnc* e = &enc[i % threads];
+        /* Wait for the thread's buffer to be free */
+        while (!__atomic_load_n(&e->done, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+        e->done = 0;
+        e->rec[0] = (byte)i;
+        e->posted = bench_now();
+        bench_post(e);
+    }
+    for (i = 0; i < threads; i++) {
+        while (!__atomic_load_n(&enc[i].done, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+    }
+    *rps = BENCH_RECORDS / ((bench_now() - start) / 1e9);
+
+    for (i = 0; i < threads; i++) {
+        pthread_mutex_lock(&enc[i].mutex);
+        __atomic_store_n(&enc[i].stop, 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&enc[i].mutex);
+        bench_post(&enc[i]);
+        pthread_join(tid[i], NULL);
+        latency += enc[i].latency;
+        pthread_mutex_destroy(&enc[i].mutex);
+        pthread_cond_destroy(&enc[i].cond);
+#ifdef HAVE_AESGCM
+        wc_AesFree(&enc[i].aes);
+#endif
+    }
+    *lat = latency / BENCH_RECORDS / 1000;
+    free(enc);
+    return 0;
+}
+
+/* Benchmark handing small records to 1, 2, 4 and 8 encrypt threads with a
+ * mutex and condition variable against the futex doorbell.
+ *
+ * returns 0 on success and 1 on error.
+ */
+static int bench_handoff(void)
+{
+    static const char* names[] = { "mutex+cond", "futex", "futex+spin" };
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads;
+    int mode;
+
+    printf("%-12s %8s %14s %12s\n", "hand off", "threads", "records/sec",
+        "latency us");
+    for (mode = HANDOFF_CONDVAR; mode <= HANDOFF_SPIN; mode++) {
+        for (threads = 1; threads <= 8; threads *= 2) {
+            double rps;
+            double lat;
+            /* Spinning threads starve the producer without a core each. */
+            if (mode == HANDOFF_SPIN && threads + 1 > cpus) {
+                printf("%-12s %8d %14s %12s\n", names[mode], threads,
+                    "-", "-");
+                continue;
+            }
+            if (bench_run(mode, threads, &rps, &lat) != 0) {
+                printf("Benchmark failed.\n");
+                return 1;
+            }
+            printf("%-12s %8d %14.0f %12.2f\n", names[mode], threads, rps, lat);
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char** argv)
 {
     /* Loc short for "location" */
@@ -238,12 +517,25 @@ int main(int argc, char** argv)
     threadArgs    args;
     pthread_t     threadidReader;
     pthread_t     threadidWriter;
+    int           i;
 #ifdef WOLFSSL_THREADED_CRYPT
     pthread_t     threadidEnc;
-    int           i;
     encArgs       encArg[WOLFSSL_THREADED_CRYPT_CNT];
 #endif
 
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) {
+            return bench_handoff();
+        }
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            encSpins = atoi(argv[++i]);
+        }
+        else {
+            printf("usage: %s [-s <spins>] [-b]\n", argv[0]);
+            return 1;
+        }
+    }
+
     /* "./config --enable-debug" and uncomment next line for debugging */
     /* wolfSSL_Debugging_ON(); */
 
@@ -277,11 +569,9 @@ int main(int argc, char** argv)
 #ifdef WOLFSSL_THREADED_CRYPT
     /* Setup encryption threads. */
     for (i = 0; i < WOLFSSL_THREADED_CRYPT_CNT; i++) {
+        memset(&encArg[i], 0, sizeof(encArg[i]));
         encArg[i].idx = i;
-        encArg[i].ssl = NULL;
-        pthread_mutex_init(&encArg[i].mutex, NULL);
-        pthread_cond_init(&encArg[i].cond, NULL);
-        pthread_mutex_init(&encArg[i].mutex_ssl, NULL);
+        encArg[i].bell.spins = encSpins;
         pthread_create(&threadidEnc, NULL, thread_do_encrypt, &encArg[i]);
     }
 #endif
@@ -371,9 +661,7 @@ int main(int argc, char** argv)
 #ifdef WOLFSSL_THREADED_CRYPT
         /* Setup encryption threads. */
         for (i = 0; i < WOLFSSL_THREADED_CRYPT_CNT; i++) {
-            pthread_mutex_lock(&encArg[i].mutex_ssl);
-            encArg[i].ssl = ssl;
-            pthread_mutex_unlock(&encArg[i].mutex_ssl);
+            enc_set_ssl(&encArg[i], ssl);
             wolfSSL_AsyncEncryptSetSignal(ssl, i, thread_enc_signal,
                 &encArg[i]);
         }
@@ -399,9 +687,7 @@ int main(int argc, char** argv)
 #ifdef WOLFSSL_THREADED_CRYPT
         /* Setup encryption threads. */
         for (i = 0; i < WOLFSSL_THREADED_CRYPT_CNT; i++) {
-            pthread_mutex_lock(&encArg[i].mutex_ssl);
-            encArg[i].ssl = NULL;
-            pthread_mutex_unlock(&encArg[i].mutex_ssl);
+            enc_set_ssl(&encArg[i], NULL);
         }
 #endif
         wolfSSL_free(ssl);
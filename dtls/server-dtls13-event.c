@@ -45,9 +45,11 @@
 #include <wolfssl/ssl.h>
 #include <wolfssl/error-ssl.h>
 #include <wolfssl/wolfcrypt/random.h>
+#include <wolfssl/wolfcrypt/hmac.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <time.h>
 
 /* Requires libevent-devel */
 #include <event2/event.h>
@@ -60,6 +62,14 @@
 #define CONN_TIMEOUT 10             /* How long we wait for peer data before
                                      * closing the connection */
 
+/* What the ClientHello pre-filter needs to know about the wire format */
+#define DTLS_RECORD_HDR_SZ 13       /* type, version, epoch, seq, length */
+#define DTLS_HS_HDR_SZ     12       /* type, length, seq, frag offset, frag length */
+#define DTLS_CT_HANDSHAKE  22
+#define DTLS_CLIENT_HELLO  1
+#define TLSX_COOKIE        44
+#define COOKIE_MAC_SZ      32       /* wolfSSL MACs HRR cookies with HMAC-SHA256 */
+
 typedef struct conn_ctx {
     struct conn_ctx* next;
     WOLFSSL* ssl;
@@ -74,6 +84,8 @@ WOLFSSL*      pendingSSL = NULL;
 int           listenfd = INVALID_SOCKET;   /* Initialize our socket */
 conn_ctx* active = NULL;
 struct event* newConnEvent = NULL;
+unsigned long probesDropped = 0;    /* Datagrams the pre-filter dropped */
+unsigned long probesPassed = 0;     /* Datagrams given to pendingSSL */
 
 static void sig_handler(const int sig);
 static void free_resources(void);
@@ -84,6 +96,9 @@ static int hsDoneCb(WOLFSSL* ssl, void*);
 static int newPendingSSL(void);
 static int newFD(void);
 static void conn_ctx_free(conn_ctx* connCtx);
+static int chPreFilter(const byte* msg, int sz, const struct sockaddr* peer,
+                       socklen_t peerSz);
+static int benchFlood(void);
 
 int main(int argc, char** argv)
 {
@@ -128,6 +143,13 @@ int main(int argc, char** argv)
         goto cleanup;
     }
 
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        /* Time spoofed ClientHello floods instead of running the server */
+        if (benchFlood())
+            exitVal = 0;
+        goto cleanup;
+    }
+
     listenfd = newFD();
     if (listenfd == INVALID_SOCKET)
         goto cleanup;
@@ -294,10 +316,27 @@ static void newConn(evutil_socket_t fd, short events, void* arg)
     int                err;
     /* Store pointer because pendingSSL can be modified in chGoodCb */
     WOLFSSL*           ssl = pendingSSL;
+    byte               msg[MAXLINE];
+    ssize_t            msgSz;
+    struct sockaddr_storage peer;
+    socklen_t          peerSz = sizeof(peer);
 
     (void)events;
     (void)arg;
 
+    /* Look at the datagram before pendingSSL reads it. Anything that can't be
+     * a ClientHello we would answer, or that carries a cookie we didn't make,
+     * is dropped here without touching a WOLFSSL. */
+    msgSz = recvfrom(fd, msg, sizeof(msg), MSG_PEEK, (struct sockaddr*)&peer,
+                     &peerSz);
+    if (msgSz >= 0 && msgSz < (ssize_t)sizeof(msg) &&
+            !chPreFilter(msg, (int)msgSz, (struct sockaddr*)&peer, peerSz)) {
+        (void)recv(fd, msg, sizeof(msg), 0);
+        probesDropped++;
+        return;
+    }
+    probesPassed++;
+
     ret = wolfSSL_accept(ssl);
     if (ret != WOLFSSL_SUCCESS) {
         err = wolfSSL_get_error(ssl, 0);
@@ -312,6 +351,382 @@ static void newConn(evutil_socket_t fd, short events, void* arg)
     }
 }
 
+static word32 chU16(const byte* p)
+{
+    return ((word32)p[0] << 8) | p[1];
+}
+
+static word32 chU24(const byte* p)
+{
+    return ((word32)p[0] << 16) | ((word32)p[1] << 8) | p[2];
+}
+
+#if !defined(USE_DTLS12) && defined(WOLFSSL_SEND_HRR_COOKIE) && \
+    !defined(NO_HMAC) && !defined(NO_SHA256)
+/* Check the MAC at the end of an HRR cookie the way wolfSSL does.
+ *
+ * wolfSSL makes the cookie as data | HMAC-SHA256(secret, data [| peer]).
+ * Versions that tie the cookie to the peer MAC the peer's address after the
+ * data, older ones don't, so both forms are accepted. A cookie made for one
+ * address still never matches for another with the former.
+ *
+ * cookie  The cookie from the ClientHello extension.
+ * sz      Length of the cookie.
+ * peer    Address the ClientHello came from.
+ * peerSz  Length of the address.
+ * returns 1 when the MAC matches, or can't be checked, and 0 otherwise.
+ */
+static int cookieMacOk(const byte* cookie, word32 sz, const struct sockaddr* peer,
+                       socklen_t peerSz)
+{
+    Hmac hmac;
+    byte mac[COOKIE_MAC_SZ];
+    const byte* theirMac = cookie + sz - COOKIE_MAC_SZ;
+    int tiePeer;
+    int ret;
+    int i;
+
+    if (sz <= COOKIE_MAC_SZ)
+        return 0;
+
+    for (tiePeer = 1; tiePeer >= 0; tiePeer--) {
+        byte diff = 0;
+
+        if (wc_HmacInit(&hmac, NULL, INVALID_DEVID) != 0)
+            return 1;
+        ret = wc_HmacSetKey(&hmac, WC_SHA256, cookieSecret, sizeof(cookieSecret));
+        if (ret == 0)
+            ret = wc_HmacUpdate(&hmac, cookie, sz - COOKIE_MAC_SZ);
+        if (ret == 0 && tiePeer)
+            ret = wc_HmacUpdate(&hmac, (const byte*)peer, peerSz);
+        if (ret == 0)
+            ret = wc_HmacFinal(&hmac, mac);
+        wc_HmacFree(&hmac);
+        /* Let wolfSSL decide when we couldn't work it out */
+        if (ret != 0)
+            return 1;
+
+        /* Constant time compare */
+        for (i = 0; i < COOKIE_MAC_SZ; i++)
+            diff |= mac[i] ^ theirMac[i];
+        if (diff == 0)
+            return 1;
+    }
+    return 0;
+}
+#endif
+
+/* Decide whether a datagram on the listening socket is worth giving to
+ * pendingSSL. Only the record and handshake headers, the fixed ClientHello
+ * fields and the extension list are parsed - no WOLFSSL is involved.
+ *
+ * Dropped: anything that isn't an epoch 0 handshake record holding a
+ * ClientHello, lengths that don't add up, and ClientHellos with a cookie
+ * extension whose MAC doesn't match our cookie secret. Passed: the first
+ * ClientHello without a cookie, which wolfSSL answers statelessly with an
+ * HRR, fragmented ClientHellos and ClientHellos with a valid cookie.
+ *
+ * msg     The datagram.
+ * sz      Length of the datagram.
+ * peer    Address the datagram came from.
+ * peerSz  Length of the address.
+ * returns 1 to pass the datagram to pendingSSL and 0 to drop it.
+ */
+static int chPreFilter(const byte* msg, int sz, const struct sockaddr* peer,
+                       socklen_t peerSz)
+{
+    const byte* p;
+    const byte* end;
+    word32 recSz;
+    word32 hsSz;
+    word32 fragOff;
+    word32 fragSz;
+    word32 len;
+
+    if (sz < DTLS_RECORD_HDR_SZ + DTLS_HS_HDR_SZ)
+        return 0;
+    /* Handshake record, DTLS major version, epoch 0 */
+    if (msg[0] != DTLS_CT_HANDSHAKE || msg[1] != 0xfe || msg[3] != 0 ||
+            msg[4] != 0)
+        return 0;
+    recSz = chU16(msg + 11);
+    if (recSz > (word32)sz - DTLS_RECORD_HDR_SZ || recSz < DTLS_HS_HDR_SZ)
+        return 0;
+
+    p = msg + DTLS_RECORD_HDR_SZ;
+    if (p[0] != DTLS_CLIENT_HELLO)
+        return 0;
+    hsSz = chU24(p + 1);
+    fragOff = chU24(p + 6);
+    fragSz = chU24(p + 9);
+    if (fragSz > recSz - DTLS_HS_HDR_SZ || fragOff + fragSz > hsSz)
+        return 0;
+    /* Leave reassembly to wolfSSL */
+    if (fragOff != 0 || fragSz != hsSz)
+        return 1;
+    p += DTLS_HS_HDR_SZ;
+    end = p + fragSz;
+
+    /* legacy_version, random and legacy_session_id length */
+    if (end - p < 2 + 32 + 1)
+        return 0;
+    p += 2 + 32;
+    len = *p++;
+    /* legacy_session_id and legacy_cookie length */
+    if ((word32)(end - p) < len + 1)
+        return 0;
+    p += len;
+    len = *p++;
+    /* legacy_cookie and cipher_suites length */
+    if ((word32)(end - p) < len + 2)
+        return 0;
+    p += len;
+    len = chU16(p);
+    p += 2;
+    /* cipher_suites and compression_methods length */
+    if ((word32)(end - p) < len + 1)
+        return 0;
+    p += len;
+    len = *p++;
+    if ((word32)(end - p) < len)
+        return 0;
+    p += len;
+    /* No extensions - not DTLS 1.3. Let wolfSSL answer it. */
+    if (p == end)
+        return 1;
+    if (end - p < 2)
+        return 0;
+    len = chU16(p);
+    p += 2;
+    if ((word32)(end - p) < len)
+        return 0;
+    end = p + len;
+
+    while (end - p >= 4) {
+        word32 type = chU16(p);
+        word32 extSz = chU16(p + 2);
+        p += 4;
+        if ((word32)(end - p) < extSz)
+            return 0;
+        if (type == TLSX_COOKIE) {
+            if (extSz < 2 || chU16(p) != extSz - 2)
+                return 0;
+#if !defined(USE_DTLS12) && defined(WOLFSSL_SEND_HRR_COOKIE) && \
+    !defined(NO_HMAC) && !defined(NO_SHA256)
+            return cookieMacOk(p + 2, extSz - 2, peer, peerSz);
+#else
+            (void)peer;
+            (void)peerSz;
+            return 1;
+#endif
+        }
+        p += extSz;
+    }
+    /* First ClientHello - wolfSSL answers with an HRR holding a cookie */
+    return 1;
+}
+
+/* Feeds the same datagram to pendingSSL over and over for benchFlood */
+typedef struct bench_io {
+    const byte* msg;
+    int         sz;
+    int         read;
+} bench_io;
+
+static int benchRecv(WOLFSSL* ssl, char* buf, int sz, void* arg)
+{
+    bench_io* io = (bench_io*)arg;
+
+    (void)ssl;
+    if (io->read)
+        return WOLFSSL_CBIO_ERR_WANT_READ;
+    if (sz > io->sz)
+        sz = io->sz;
+    memcpy(buf, io->msg, sz);
+    io->read = 1;
+    return sz;
+}
+
+static int benchSend(WOLFSSL* ssl, char* buf, int sz, void* arg)
+{
+    (void)ssl;
+    (void)buf;
+    (void)arg;
+    return sz;
+}
+
+static double benchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Make a DTLS 1.3 ClientHello like a flood would send: X25519 key share and,
+ * when asked, a cookie extension of random bytes shaped like wolfSSL's.
+ *
+ * out        Buffer for the datagram.
+ * withCookie Add a forged cookie extension when set.
+ * rng        Random number generator.
+ * returns length of the datagram, or 0 on error.
+ */
+static int benchHello(byte* out, int withCookie, WC_RNG* rng)
+{
+    /* supported_versions, supported_groups, signature_algorithms and the
+     * start of key_share */
+    static const byte exts[] = {
+        0x00, 0x2b, 0x00, 0x03, 0x02, 0xfe, 0xfc,
+        0x00, 0x0a, 0x00, 0x04, 0x00, 0x02, 0x00, 0x1d,
+        0x00, 0x0d, 0x00, 0x04, 0x00, 0x02, 0x08, 0x04,
+        0x00, 0x33, 0x00, 0x26, 0x00, 0x24, 0x00, 0x1d, 0x00, 0x20
+    };
+    /* hash length | hash | cipher suite | group | MAC */
+    const int cookieSz = 1 + 32 + 2 + 2 + COOKIE_MAC_SZ;
+    byte* p = out + DTLS_RECORD_HDR_SZ + DTLS_HS_HDR_SZ;
+    byte* extStart;
+    int hsSz;
+
+    memset(out, 0, DTLS_RECORD_HDR_SZ + DTLS_HS_HDR_SZ);
+    /* legacy_version and random */
+    *p++ = 0xfe;
+    *p++ = 0xfd;
+    if (wc_RNG_GenerateBlock(rng, p, 32) != 0)
+        return 0;
+    p += 32;
+    /* legacy_session_id and legacy_cookie */
+    *p++ = 0;
+    *p++ = 0;
+    /* TLS_AES_128_GCM_SHA256 and null compression */
+    *p++ = 0x00; *p++ = 0x02; *p++ = 0x13; *p++ = 0x01;
+    *p++ = 0x01; *p++ = 0x00;
+
+    extStart = p;
+    p += 2;
+    memcpy(p, exts, sizeof(exts));
+    p += sizeof(exts);
+    if (wc_RNG_GenerateBlock(rng, p, 32) != 0)
+        return 0;
+    p += 32;
+    if (withCookie) {
+        *p++ = 0x00; *p++ = TLSX_COOKIE;
+        *p++ = 0x00; *p++ = (byte)(cookieSz + 2);
+        *p++ = 0x00; *p++ = (byte)cookieSz;
+        if (wc_RNG_GenerateBlock(rng, p, cookieSz) != 0)
+            return 0;
+        p[0] = 32;
+        p += cookieSz;
+    }
+    extStart[0] = (byte)((p - extStart - 2) >> 8);
+    extStart[1] = (byte)(p - extStart - 2);
+
+    hsSz = (int)(p - out) - DTLS_RECORD_HDR_SZ - DTLS_HS_HDR_SZ;
+    out[0] = DTLS_CT_HANDSHAKE;
+    out[1] = 0xfe;
+    out[2] = 0xfd;
+    out[11] = (byte)((hsSz + DTLS_HS_HDR_SZ) >> 8);
+    out[12] = (byte)(hsSz + DTLS_HS_HDR_SZ);
+    p = out + DTLS_RECORD_HDR_SZ;
+    p[0] = DTLS_CLIENT_HELLO;
+    p[1] = p[9] = (byte)(hsSz >> 16);
+    p[2] = p[10] = (byte)(hsSz >> 8);
+    p[3] = p[11] = (byte)hsSz;
+    return (int)(hsSz + DTLS_RECORD_HDR_SZ + DTLS_HS_HDR_SZ);
+}
+
+/* Time how long a spoofed ClientHello with a forged cookie costs when dropped
+ * by the pre-filter and when given to pendingSSL as before, and what the
+ * pre-filter adds to a first ClientHello it passes.
+ *
+ * returns 1 on success and 0 on error.
+ */
+static int benchFlood(void)
+{
+    const int probes = 100000;
+    const int sslProbes = 10000;
+    byte forged[512];
+    byte first[512];
+    int forgedSz;
+    int firstSz;
+    struct sockaddr_in peer;
+    bench_io io;
+    WC_RNG rng;
+    double start;
+    double filterNs;
+    double passNs;
+    double sslNs;
+    int dropped = 0;
+    int i;
+
+    if (wc_InitRng(&rng) != 0) {
+        fprintf(stderr, "wc_InitRng error.\n");
+        return 0;
+    }
+    forgedSz = benchHello(forged, 1, &rng);
+    firstSz = benchHello(first, 0, &rng);
+    wc_FreeRng(&rng);
+    if (forgedSz == 0 || firstSz == 0 || !newPendingSSL()) {
+        fprintf(stderr, "benchmark setup error.\n");
+        return 0;
+    }
+
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_addr.s_addr = htonl(0xc0000201);
+    peer.sin_port = htons(40000);
+
+    start = benchNow();
+    for (i = 0; i < probes; i++)
+        dropped += !chPreFilter(forged, forgedSz, (struct sockaddr*)&peer,
+                                sizeof(peer));
+    filterNs = (benchNow() - start) / probes;
+
+    start = benchNow();
+    for (i = 0; i < probes; i++)
+        dropped += !chPreFilter(first, firstSz, (struct sockaddr*)&peer,
+                                sizeof(peer));
+    passNs = (benchNow() - start) / probes;
+
+    /* The path without the pre-filter: pendingSSL parses every probe */
+    memset(&io, 0, sizeof(io));
+    io.msg = forged;
+    io.sz = forgedSz;
+    start = benchNow();
+    for (i = 0; i < sslProbes; i++) {
+        WOLFSSL* ssl = pendingSSL;
+        int ret;
+
+        wolfSSL_SSLSetIORecv(ssl, benchRecv);
+        wolfSSL_SSLSetIOSend(ssl, benchSend);
+        wolfSSL_SetIOReadCtx(ssl, &io);
+        wolfSSL_SetIOWriteCtx(ssl, &io);
+        if (wolfSSL_dtls_set_peer(ssl, &peer, sizeof(peer)) != WOLFSSL_SUCCESS) {
+            fprintf(stderr, "wolfSSL_dtls_set_peer error.\n");
+            return 0;
+        }
+        io.read = 0;
+        ret = wolfSSL_accept(ssl);
+        if (ret != WOLFSSL_SUCCESS &&
+                wolfSSL_get_error(ssl, ret) != WOLFSSL_ERROR_WANT_READ) {
+            /* The probe broke the pending object - the server would need a
+             * new one */
+            wolfSSL_free(ssl);
+            pendingSSL = NULL;
+            if (!newPendingSSL())
+                return 0;
+        }
+    }
+    sslNs = (benchNow() - start) / sslProbes;
+
+    printf("%-36s %10s\n", "probe", "ns/probe");
+    printf("%-36s %10.0f\n", "forged cookie, pre-filter drop", filterNs);
+    printf("%-36s %10.0f\n", "forged cookie, pendingSSL", sslNs);
+    printf("%-36s %10.0f\n", "first ClientHello, pre-filter pass", passNs);
+    if (dropped != probes)
+        fprintf(stderr, "pre-filter dropped %d of %d forged probes\n",
+                dropped, probes);
+    return 1;
+}
+
 static void setHsTimeout(WOLFSSL* ssl, struct timeval *tv)
 {
     int timeout = wolfSSL_dtls_get_current_timeout(ssl);
@@ -545,6 +960,8 @@ static void conn_ctx_free(conn_ctx* connCtx)
 static void sig_handler(const int sig)
 {
     printf("Received signal %d. Cleaning up.\n", sig);
+    printf("Pre-filter dropped %lu and passed %lu datagrams\n", probesDropped,
+           probesPassed);
     free_resources();
     wolfSSL_Cleanup();
     exit(0);
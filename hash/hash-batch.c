@@ -0,0 +1,776 @@
+/* hash-batch.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfSSL.
+ *
+ * wolfSSL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+/* Batch hashing of many small independent messages with SHA-256 or
+ * SHA3-256.
+ *
+ * A single hash can't be spread across SIMD lanes as each block depends on
+ * the one before it, but independent messages can: each lane of a vector
+ * register holds the state of a different message. SHA-256 uses 32-bit lanes
+ * and SHA3-256 64-bit lanes, so AVX-512F hashes 16 or 8 messages at once and
+ * AVX2 8 or 4. When a message ends its lane is given the next one, so
+ * messages of different lengths keep every lane busy.
+ *
+ * The rounds are written once with GCC vector extensions and compiled for
+ * both instruction sets. The one that runs is picked when the program
+ * starts. Without either, or on other CPUs, the messages are hashed one at a
+ * time with wolfCrypt.
+ *
+ * The benchmark compares messages per second of the batch API against a loop
+ * of wolfCrypt one-shot hashes for batch sizes 1 to 1024.
+ */
+
+#ifndef WOLFSSL_USER_SETTINGS
+#include <wolfssl/options.h>
+#endif
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/wolfcrypt/hash.h>
+#include <wolfssl/wolfcrypt/error-crypt.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define HAVE_BATCH_SIMD
+#endif
+
+#define BATCH_MAX        1024
+#define BENCH_POOL       4096      /* messages hashed in each timing loop */
+#define BENCH_TIME_NS    200000000 /* time spent on each measurement */
+
+#define SHA256_BLOCK     64
+#define SHA3_256_RATE    136
+#define BATCH_DIGEST_SZ  32
+
+typedef enum {
+    BATCH_ONESHOT,
+    BATCH_AVX2,
+    BATCH_AVX512
+} batch_impl;
+
+static const char* batch_impl_name[] = { "one-shot", "avx2", "avx512" };
+
+typedef enum {
+    BATCH_SHA256,
+    BATCH_SHA3_256
+} batch_hash;
+
+void usage(void)
+{
+    printf("./hash-batch [-a <SHA256|SHA3-256>] [-s <size,size,...>] "
+           "[-b <max batch>]\n");
+    printf("./hash-batch -t\n");
+    printf("  -a  hash to benchmark, default both\n");
+    printf("  -s  message sizes in bytes, default 64,256,512\n");
+    printf("  -b  largest batch size, default %d\n", BATCH_MAX);
+    printf("  -t  check the batch digests against wolfCrypt one-shot\n");
+    exit(-99);
+}
+
+#ifdef HAVE_BATCH_SIMD
+typedef word32 vec32x16 __attribute__((vector_size(64)));
+typedef word32 vec32x8 __attribute__((vector_size(32)));
+typedef word64 vec64x8 __attribute__((vector_size(64)));
+typedef word64 vec64x4 __attribute__((vector_size(32)));
+
+/* A message being hashed in a lane. The whole blocks are read in place and
+ * the end of the message is copied out with the padding added. */
+typedef struct {
+    const byte* data;
+    word32 full;      /* whole blocks in the message */
+    word32 blocks;    /* blocks with the padding */
+    word32 block;     /* next block to hash */
+    word32 idx;       /* the message's place in the batch */
+    int busy;
+    byte tail[SHA3_256_RATE];  /* up to two SHA-256 or one SHA3-256 block */
+} hash_lane;
+
+static word32 load_be32(const byte* p)
+{
+    return ((word32)p[0] << 24) | ((word32)p[1] << 16) |
+           ((word32)p[2] << 8) | p[3];
+}
+
+static void store_be32(byte* p, word32 v)
+{
+    p[0] = (byte)(v >> 24);
+    p[1] = (byte)(v >> 16);
+    p[2] = (byte)(v >> 8);
+    p[3] = (byte)v;
+}
+
+static word64 load_le64(const byte* p)
+{
+    word64 v = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void store_le64(byte* p, word64 v)
+{
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        p[i] = (byte)v;
+        v >>= 8;
+    }
+}
+
+static const word32 sha256_h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static const word32 sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const word64 keccak_rc[24] = {
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808aULL,
+    0x8000000080008000ULL, 0x000000000000808bULL, 0x0000000080000001ULL,
+    0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008aULL,
+    0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000aULL,
+    0x000000008000808bULL, 0x800000000000008bULL, 0x8000000000008089ULL,
+    0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
+    0x000000000000800aULL, 0x800000008000000aULL, 0x8000000080008081ULL,
+    0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL
+};
+
+/* rotation and destination of each lane in the rho and pi steps */
+static const int keccak_rotc[24] = {
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14,
+    27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44
+};
+static const int keccak_piln[24] = {
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4,
+    15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1
+};
+
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+/* One SHA-256 block on every lane of s with the message words in w */
+#define SHA256_COMPRESS(vec, s, w)                                           \
+    do {                                                                     \
+        vec a_ = s[0], b_ = s[1], c_ = s[2], d_ = s[3];                      \
+        vec e_ = s[4], f_ = s[5], g_ = s[6], h_ = s[7];                      \
+        vec t1_, t2_, x_, y_;                                                \
+        int t_;                                                              \
+        for (t_ = 0; t_ < 64; t_++) {                                        \
+            if (t_ >= 16) {                                                  \
+                x_ = w[(t_ - 15) & 15];                                      \
+                y_ = w[(t_ - 2) & 15];                                       \
+                w[t_ & 15] += (ROTR32(x_, 7) ^ ROTR32(x_, 18) ^ (x_ >> 3)) + \
+                    w[(t_ - 7) & 15] +                                       \
+                    (ROTR32(y_, 17) ^ ROTR32(y_, 19) ^ (y_ >> 10));          \
+            }                                                                \
+            t1_ = h_ + (ROTR32(e_, 6) ^ ROTR32(e_, 11) ^ ROTR32(e_, 25)) +   \
+                  ((e_ & f_) ^ (~e_ & g_)) + sha256_k[t_] + w[t_ & 15];      \
+            t2_ = (ROTR32(a_, 2) ^ ROTR32(a_, 13) ^ ROTR32(a_, 22)) +        \
+                  ((a_ & b_) ^ (a_ & c_) ^ (b_ & c_));                       \
+            h_ = g_; g_ = f_; f_ = e_; e_ = d_ + t1_;                        \
+            d_ = c_; c_ = b_; b_ = a_; a_ = t1_ + t2_;                       \
+        }                                                                    \
+        s[0] += a_; s[1] += b_; s[2] += c_; s[3] += d_;                      \
+        s[4] += e_; s[5] += f_; s[6] += g_; s[7] += h_;                      \
+    } while (0)
+
+/* Keccak-f[1600] on every lane of st */
+#define KECCAK_F1600(vec, st)                                                \
+    do {                                                                     \
+        vec bc_[5];                                                          \
+        vec tmp_;                                                            \
+        int i_, j_, r_;                                                      \
+        for (r_ = 0; r_ < 24; r_++) {                                        \
+            /* theta */                                                      \
+            for (i_ = 0; i_ < 5; i_++)                                       \
+                bc_[i_] = st[i_] ^ st[i_ + 5] ^ st[i_ + 10] ^ st[i_ + 15] ^  \
+                          st[i_ + 20];                                       \
+            for (i_ = 0; i_ < 5; i_++) {                                     \
+                tmp_ = bc_[(i_ + 4) % 5] ^ ROTL64(bc_[(i_ + 1) % 5], 1);     \
+                for (j_ = 0; j_ < 25; j_ += 5)                               \
+                    st[j_ + i_] ^= tmp_;                                     \
+            }                                                                \
+            /* rho and pi */                                                 \
+            tmp_ = st[1];                                                    \
+            for (i_ = 0; i_ < 24; i_++) {                                    \
+                j_ = keccak_piln[i_];                                        \
+                bc_[0] = st[j_];                                             \
+                st[j_] = ROTL64(tmp_, keccak_rotc[i_]);                      \
+                tmp_ = bc_[0];                                               \
+            }                                                                \
+            /* chi */                                                        \
+            for (j_ = 0; j_ < 25; j_ += 5) {                                 \
+                for (i_ = 0; i_ < 5; i_++)                                   \
+                    bc_[i_] = st[j_ + i_];                                   \
+                for (i_ = 0; i_ < 5; i_++)                                   \
+                    st[j_ + i_] ^= ~bc_[(i_ + 1) % 5] & bc_[(i_ + 2) % 5];   \
+            }                                                                \
+            /* iota */                                                       \
+            st[0] ^= keccak_rc[r_];                                          \
+        }                                                                    \
+    } while (0)
+
+static const byte* lane_block(const hash_lane* lane, word32 blockSz)
+{
+    if (lane->block >= lane->blocks)
+        return lane->tail;
+    if (lane->block < lane->full)
+        return lane->data + lane->block * blockSz;
+    return lane->tail + (lane->block - lane->full) * blockSz;
+}
+
+static void sha256_lane_init(hash_lane* lane, const byte* msg, word32 len,
+                             word32 idx)
+{
+    word32 rem = len % SHA256_BLOCK;
+    word32 tailBlocks = rem + 9 <= SHA256_BLOCK ? 1 : 2;
+    word64 bits = (word64)len * 8;
+    byte* end;
+    int i;
+
+    lane->data = msg;
+    lane->full = len / SHA256_BLOCK;
+    lane->blocks = lane->full + tailBlocks;
+    lane->block = 0;
+    lane->idx = idx;
+    lane->busy = 1;
+    memset(lane->tail, 0, sizeof(lane->tail));
+    if (rem > 0)
+        memcpy(lane->tail, msg + lane->full * SHA256_BLOCK, rem);
+    lane->tail[rem] = 0x80;
+    end = lane->tail + tailBlocks * SHA256_BLOCK;
+    for (i = 1; i <= 8; i++) {
+        end[-i] = (byte)bits;
+        bits >>= 8;
+    }
+}
+
+static void sha3_lane_init(hash_lane* lane, const byte* msg, word32 len,
+                           word32 idx)
+{
+    word32 rem = len % SHA3_256_RATE;
+
+    lane->data = msg;
+    lane->full = len / SHA3_256_RATE;
+    lane->blocks = lane->full + 1;
+    lane->block = 0;
+    lane->idx = idx;
+    lane->busy = 1;
+    memset(lane->tail, 0, sizeof(lane->tail));
+    if (rem > 0)
+        memcpy(lane->tail, msg + lane->full * SHA3_256_RATE, rem);
+    lane->tail[rem] ^= 0x06;
+    lane->tail[SHA3_256_RATE - 1] ^= 0x80;
+}
+
+/* Hand out the digests of finished messages, give idle lanes the next
+ * messages and load the next block of each lane. The state and message words
+ * are laid out as in the vector registers: word i of lane l is at
+ * i * lanes + l. Returns the number of busy lanes. */
+static int sha256_lanes_next(hash_lane* lane, int lanes, word32* state,
+                             word32* w, const byte* const* msg,
+                             const word32* len, word32 n, word32* next,
+                             byte* digest)
+{
+    const byte* p;
+    int busy = 0;
+    int i, l;
+
+    for (l = 0; l < lanes; l++) {
+        if (lane[l].busy && lane[l].block == lane[l].blocks) {
+            for (i = 0; i < 8; i++)
+                store_be32(digest + lane[l].idx * BATCH_DIGEST_SZ + i * 4,
+                           state[i * lanes + l]);
+            lane[l].busy = 0;
+        }
+        if (!lane[l].busy && *next < n) {
+            sha256_lane_init(&lane[l], msg[*next], len[*next], *next);
+            (*next)++;
+            for (i = 0; i < 8; i++)
+                state[i * lanes + l] = sha256_h0[i];
+        }
+        p = lane_block(&lane[l], SHA256_BLOCK);
+        for (i = 0; i < 16; i++)
+            w[i * lanes + l] = load_be32(p + i * 4);
+        lane[l].block += lane[l].busy;
+        busy += lane[l].busy;
+    }
+    return busy;
+}
+
+/* As sha256_lanes_next but the block is absorbed into the state */
+static int sha3_lanes_next(hash_lane* lane, int lanes, word64* state,
+                           const byte* const* msg, const word32* len,
+                           word32 n, word32* next, byte* digest)
+{
+    const byte* p;
+    int busy = 0;
+    int i, l;
+
+    for (l = 0; l < lanes; l++) {
+        if (lane[l].busy && lane[l].block == lane[l].blocks) {
+            for (i = 0; i < BATCH_DIGEST_SZ / 8; i++)
+                store_le64(digest + lane[l].idx * BATCH_DIGEST_SZ + i * 8,
+                           state[i * lanes + l]);
+            lane[l].busy = 0;
+        }
+        if (!lane[l].busy && *next < n) {
+            sha3_lane_init(&lane[l], msg[*next], len[*next], *next);
+            (*next)++;
+            for (i = 0; i < 25; i++)
+                state[i * lanes + l] = 0;
+        }
+        if (lane[l].busy) {
+            p = lane_block(&lane[l], SHA3_256_RATE);
+            for (i = 0; i < SHA3_256_RATE / 8; i++)
+                state[i * lanes + l] ^= load_le64(p + i * 8);
+            lane[l].block++;
+            busy++;
+        }
+    }
+    return busy;
+}
+
+__attribute__((target("avx512f")))
+static void sha256_batch_avx512(const byte* const* msg, const word32* len,
+                                word32 n, byte* digest)
+{
+    hash_lane lane[16];
+    word32 state[8][16];
+    word32 w[16][16];
+    vec32x16 sv[8];
+    vec32x16 wv[16];
+    word32 next = 0;
+
+    memset(lane, 0, sizeof(lane));
+    memset(state, 0, sizeof(state));
+    while (sha256_lanes_next(lane, 16, state[0], w[0], msg, len, n, &next,
+                             digest) > 0) {
+        memcpy(sv, state, sizeof(sv));
+        memcpy(wv, w, sizeof(wv));
+        SHA256_COMPRESS(vec32x16, sv, wv);
+        memcpy(state, sv, sizeof(sv));
+    }
+}
+
+__attribute__((target("avx2")))
+static void sha256_batch_avx2(const byte* const* msg, const word32* len,
+                              word32 n, byte* digest)
+{
+    hash_lane lane[8];
+    word32 state[8][8];
+    word32 w[16][8];
+    vec32x8 sv[8];
+    vec32x8 wv[16];
+    word32 next = 0;
+
+    memset(lane, 0, sizeof(lane));
+    memset(state, 0, sizeof(state));
+    while (sha256_lanes_next(lane, 8, state[0], w[0], msg, len, n, &next,
+                             digest) > 0) {
+        memcpy(sv, state, sizeof(sv));
+        memcpy(wv, w, sizeof(wv));
+        SHA256_COMPRESS(vec32x8, sv, wv);
+        memcpy(state, sv, sizeof(sv));
+    }
+}
+
+__attribute__((target("avx512f")))
+static void sha3_256_batch_avx512(const byte* const* msg, const word32* len,
+                                  word32 n, byte* digest)
+{
+    hash_lane lane[8];
+    word64 state[25][8];
+    vec64x8 sv[25];
+    word32 next = 0;
+
+    memset(lane, 0, sizeof(lane));
+    memset(state, 0, sizeof(state));
+    while (sha3_lanes_next(lane, 8, state[0], msg, len, n, &next,
+                           digest) > 0) {
+        memcpy(sv, state, sizeof(sv));
+        KECCAK_F1600(vec64x8, sv);
+        memcpy(state, sv, sizeof(sv));
+    }
+}
+
+__attribute__((target("avx2")))
+static void sha3_256_batch_avx2(const byte* const* msg, const word32* len,
+                                word32 n, byte* digest)
+{
+    hash_lane lane[4];
+    word64 state[25][4];
+    vec64x4 sv[25];
+    word32 next = 0;
+
+    memset(lane, 0, sizeof(lane));
+    memset(state, 0, sizeof(state));
+    while (sha3_lanes_next(lane, 4, state[0], msg, len, n, &next,
+                           digest) > 0) {
+        memcpy(sv, state, sizeof(sv));
+        KECCAK_F1600(vec64x4, sv);
+        memcpy(state, sv, sizeof(sv));
+    }
+}
+#endif /* HAVE_BATCH_SIMD */
+
+static int batch_impl_supported(batch_impl impl)
+{
+#ifdef HAVE_BATCH_SIMD
+    __builtin_cpu_init();
+    if (impl == BATCH_AVX512)
+        return __builtin_cpu_supports("avx512f");
+    if (impl == BATCH_AVX2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    return impl == BATCH_ONESHOT;
+}
+
+static batch_impl batch_best_impl(void)
+{
+    if (batch_impl_supported(BATCH_AVX512))
+        return BATCH_AVX512;
+    if (batch_impl_supported(BATCH_AVX2))
+        return BATCH_AVX2;
+    return BATCH_ONESHOT;
+}
+
+/* Hash n messages with SHA-256. The digests are put one after another in
+ * digest. */
+int sha256_batch(batch_impl impl, const byte* const* msg, const word32* len,
+                 word32 n, byte* digest)
+{
+    int ret = 0;
+    word32 i;
+
+    switch (impl) {
+#ifdef HAVE_BATCH_SIMD
+        case BATCH_AVX512:
+            sha256_batch_avx512(msg, len, n, digest);
+            break;
+        case BATCH_AVX2:
+            sha256_batch_avx2(msg, len, n, digest);
+            break;
+#endif
+        default:
+#ifndef NO_SHA256
+            for (i = 0; ret == 0 && i < n; i++)
+                ret = wc_Sha256Hash(msg[i], len[i],
+                                    digest + i * BATCH_DIGEST_SZ);
+#else
+            (void)i;
+            ret = NOT_COMPILED_IN;
+#endif
+            break;
+    }
+    return ret;
+}
+
+/* Hash n messages with SHA3-256. The digests are put one after another in
+ * digest. */
+int sha3_256_batch(batch_impl impl, const byte* const* msg, const word32* len,
+                   word32 n, byte* digest)
+{
+    int ret = 0;
+    word32 i;
+
+    switch (impl) {
+#ifdef HAVE_BATCH_SIMD
+        case BATCH_AVX512:
+            sha3_256_batch_avx512(msg, len, n, digest);
+            break;
+        case BATCH_AVX2:
+            sha3_256_batch_avx2(msg, len, n, digest);
+            break;
+#endif
+        default:
+#ifdef WOLFSSL_SHA3
+            for (i = 0; ret == 0 && i < n; i++)
+                ret = wc_Sha3_256Hash(msg[i], len[i],
+                                      digest + i * BATCH_DIGEST_SZ);
+#else
+            (void)i;
+            ret = NOT_COMPILED_IN;
+#endif
+            break;
+    }
+    return ret;
+}
+
+static int hash_batch(batch_hash hash, batch_impl impl,
+                      const byte* const* msg, const word32* len, word32 n,
+                      byte* digest)
+{
+    if (hash == BATCH_SHA3_256)
+        return sha3_256_batch(impl, msg, len, n, digest);
+    return sha256_batch(impl, msg, len, n, digest);
+}
+
+static int hash_supported(batch_hash hash)
+{
+    if (hash == BATCH_SHA3_256) {
+#ifdef WOLFSSL_SHA3
+        return 1;
+#endif
+    }
+    else {
+#ifndef NO_SHA256
+        return 1;
+#endif
+    }
+    return 0;
+}
+
+static const char* hash_name(batch_hash hash)
+{
+    return hash == BATCH_SHA3_256 ? "SHA3-256" : "SHA256";
+}
+
+static word64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (word64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Fill a buffer with data that doesn't depend on the platform */
+static void fill_data(byte* data, word32 sz)
+{
+    word32 x = 0x12345678;
+    word32 i;
+
+    for (i = 0; i < sz; i++) {
+        x = x * 1103515245 + 12345;
+        data[i] = (byte)(x >> 16);
+    }
+}
+
+/* Check the batch digests against one-shot for messages of many lengths,
+ * batch sizes and each implementation the CPU has. Skipped when the CPU has
+ * none. */
+static int batch_test(void)
+{
+    static const word32 batches[] = { 1, 3, 16, 17, 100, 333 };
+    const byte* msg[333];
+    word32 len[333];
+    byte expect[333 * BATCH_DIGEST_SZ];
+    byte digest[333 * BATCH_DIGEST_SZ];
+    byte* data;
+    word32 off = 0;
+    word32 i;
+    int hash, impl, k;
+    int tested = 0;
+    int ret = 0;
+
+    data = (byte*)malloc(333 * 600);
+    if (data == NULL)
+        return MEMORY_E;
+    fill_data(data, 333 * 600);
+    /* lengths around every block and padding boundary */
+    for (i = 0; i < 333; i++) {
+        len[i] = (i * 7 + i / 3) % 600;
+        msg[i] = data + off;
+        off += len[i];
+        if (off > 333 * 600 - 600)
+            off = 0;
+    }
+
+    for (hash = BATCH_SHA256; ret == 0 && hash <= BATCH_SHA3_256; hash++) {
+        if (!hash_supported((batch_hash)hash))
+            continue;
+        for (impl = BATCH_AVX2; impl <= BATCH_AVX512; impl++) {
+            if (!batch_impl_supported((batch_impl)impl))
+                continue;
+            for (k = 0; ret == 0 && k < (int)(sizeof(batches) /
+                                              sizeof(batches[0])); k++) {
+                ret = hash_batch((batch_hash)hash, BATCH_ONESHOT, msg, len,
+                                 batches[k], expect);
+                if (ret == 0)
+                    ret = hash_batch((batch_hash)hash, (batch_impl)impl, msg,
+                                     len, batches[k], digest);
+                if (ret == 0 && memcmp(expect, digest,
+                                       batches[k] * BATCH_DIGEST_SZ) != 0) {
+                    printf("Fail: %s %s batch of %u\n",
+                           hash_name((batch_hash)hash),
+                           batch_impl_name[impl], batches[k]);
+                    ret = -1;
+                }
+            }
+            if (ret == 0)
+                printf("%s %s: digests match one-shot\n",
+                       hash_name((batch_hash)hash), batch_impl_name[impl]);
+            tested++;
+        }
+    }
+    if (ret == 0 && tested == 0)
+        printf("Skipped: No batch implementation to test on this CPU.\n");
+    else if (ret == 0)
+        printf("Pass: The batch digests are identical.\n");
+    free(data);
+    return ret;
+}
+
+/* Messages per second hashing a pool of messages in batches */
+static double batch_bench(batch_hash hash, batch_impl impl,
+                          const byte* const* msg, const word32* len,
+                          word32 batch, byte* digest)
+{
+    word64 start = now_ns();
+    word64 elapsed;
+    word64 count = 0;
+    word32 i;
+
+    do {
+        for (i = 0; i + batch <= BENCH_POOL; i += batch) {
+            if (hash_batch(hash, impl, msg + i, len + i, batch, digest) != 0)
+                return 0;
+        }
+        count += i;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_TIME_NS);
+
+    return count * 1e9 / elapsed;
+}
+
+static int bench_size(batch_hash hash, word32 sz, word32 maxBatch)
+{
+    const byte* msg[BENCH_POOL];
+    word32 len[BENCH_POOL];
+    byte* data;
+    byte* digest;
+    double oneshot;
+    double rate;
+    word32 batch;
+    word32 i;
+    int impl;
+
+    data = (byte*)malloc((size_t)BENCH_POOL * sz + 1);
+    digest = (byte*)malloc((size_t)maxBatch * BATCH_DIGEST_SZ);
+    if (data == NULL || digest == NULL) {
+        free(data);
+        free(digest);
+        return MEMORY_E;
+    }
+    fill_data(data, BENCH_POOL * sz + 1);
+    for (i = 0; i < BENCH_POOL; i++) {
+        msg[i] = data + (size_t)i * sz;
+        len[i] = sz;
+    }
+
+    printf("%s, %u byte messages (messages/sec)\n", hash_name(hash), sz);
+    printf("%6s %12s", "batch", batch_impl_name[BATCH_ONESHOT]);
+    for (impl = BATCH_AVX2; impl <= BATCH_AVX512; impl++) {
+        if (batch_impl_supported((batch_impl)impl))
+            printf(" %12s %7s", batch_impl_name[impl], "speedup");
+    }
+    printf("\n");
+
+    for (batch = 1; batch <= maxBatch; batch *= 2) {
+        oneshot = batch_bench(hash, BATCH_ONESHOT, msg, len, batch, digest);
+        printf("%6u %12.0f", batch, oneshot);
+        for (impl = BATCH_AVX2; impl <= BATCH_AVX512; impl++) {
+            if (!batch_impl_supported((batch_impl)impl))
+                continue;
+            rate = batch_bench(hash, (batch_impl)impl, msg, len, batch,
+                               digest);
+            printf(" %12.0f %6.2fx", rate, oneshot > 0 ? rate / oneshot : 0);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+    printf("\n");
+
+    free(digest);
+    free(data);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int ret = 0;
+    word32 sizes[16] = { 64, 256, 512 };
+    int numSizes = 3;
+    word32 maxBatch = BATCH_MAX;
+    int hashes[2] = { 1, 1 };
+    char* tok;
+    int hash;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "a:s:b:th")) != -1) {
+        switch (opt) {
+            case 'a':
+                hashes[BATCH_SHA256] = strcmp(optarg, "SHA256") == 0;
+                hashes[BATCH_SHA3_256] = strcmp(optarg, "SHA3-256") == 0;
+                if (!hashes[BATCH_SHA256] && !hashes[BATCH_SHA3_256])
+                    usage();
+                break;
+            case 's':
+                numSizes = 0;
+                for (tok = strtok(optarg, ","); tok != NULL && numSizes < 16;
+                     tok = strtok(NULL, ","))
+                    sizes[numSizes++] = (word32)strtoul(tok, NULL, 0);
+                break;
+            case 'b':
+                maxBatch = (word32)strtoul(optarg, NULL, 0);
+                if (maxBatch == 0 || maxBatch > BENCH_POOL)
+                    usage();
+                break;
+            case 't':
+                return batch_test();
+            default:
+                usage();
+        }
+    }
+
+    printf("Batch implementation: %s\n", batch_impl_name[batch_best_impl()]);
+    for (hash = BATCH_SHA256; ret == 0 && hash <= BATCH_SHA3_256; hash++) {
+        if (!hashes[hash])
+            continue;
+        if (!hash_supported((batch_hash)hash)) {
+            printf("Please enable %s in wolfCrypt\n",
+                   hash_name((batch_hash)hash));
+            continue;
+        }
+        for (i = 0; ret == 0 && i < numSizes; i++)
+            ret = bench_size((batch_hash)hash, sizes[i], maxBatch);
+    }
+    return ret;
+}
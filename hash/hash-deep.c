@@ -0,0 +1,780 @@
+/* hash-deep.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfSSL.
+ *
+ * wolfSSL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+/* Hashes many files and directories at once, in the style of hashdeep.
+ *
+ * The files are shared out to a pool of threads. Each thread reads a file
+ * into a large aligned buffer (or maps it with -m) and feeds every
+ * algorithm one cache-sized slice at a time, so the data only comes from
+ * memory once however many digests are computed. The output is a hashdeep
+ * manifest that -c checks again later, one entry at a time.
+ */
+
+#ifndef WOLFSSL_USER_SETTINGS
+#include <wolfssl/options.h>
+#endif
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/ssl.h>
+#include <wolfssl/wolfcrypt/hash.h>
+#include <wolfssl/wolfcrypt/error-crypt.h>
+#if defined(HAVE_BLAKE2B) || defined(HAVE_BLAKE2S)
+#include <wolfssl/wolfcrypt/blake2.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef BUF_SIZE
+/* Size of each thread's read buffer */
+#define BUF_SIZE (1 << 20)
+#endif
+#ifndef SLICE_SIZE
+/* Bytes given to each algorithm in turn - small enough to stay in cache */
+#define SLICE_SIZE (32 * 1024)
+#endif
+#define MAX_ALGS     8
+#define MAX_THREADS  64
+#define DEFAULT_ALGS "SHA256,SHA3-256,SHA512,BLAKE2B"
+
+#ifndef NO_HASH_WRAPPERS
+enum wc_HashType hash_type_from_string(char* name)
+{
+    if (strcmp(name, "MD5") == 0) {
+        return WC_HASH_TYPE_MD5;
+    }
+    else if (strcmp(name, "SHA") == 0 || strcmp(name, "SHA1") == 0) {
+        return WC_HASH_TYPE_SHA;
+    }
+    else if (strcmp(name, "SHA224") == 0) {
+        return WC_HASH_TYPE_SHA224;
+    }
+    else if (strcmp(name, "SHA256") == 0) {
+        return WC_HASH_TYPE_SHA256;
+    }
+    else if (strcmp(name, "SHA384") == 0) {
+        return WC_HASH_TYPE_SHA384;
+    }
+    else if (strcmp(name, "SHA512") == 0) {
+        return WC_HASH_TYPE_SHA512;
+    }
+    else if (strcmp(name, "SHA3-224") == 0) {
+        return WC_HASH_TYPE_SHA3_224;
+    }
+    else if (strcmp(name, "SHA3-256") == 0) {
+        return WC_HASH_TYPE_SHA3_256;
+    }
+    else if (strcmp(name, "SHA3-384") == 0) {
+        return WC_HASH_TYPE_SHA3_384;
+    }
+    else if (strcmp(name, "SHA3-512") == 0) {
+        return WC_HASH_TYPE_SHA3_512;
+    }
+    else if (strcmp(name, "BLAKE2B") == 0) {
+        return WC_HASH_TYPE_BLAKE2B;
+    }
+    else if (strcmp(name, "BLAKE2S") == 0) {
+        return WC_HASH_TYPE_BLAKE2S;
+    }
+#ifdef WOLFSSL_SM3
+    else if (strcmp(name, "SM3") == 0) {
+        return WC_HASH_TYPE_SM3;
+    }
+#endif
+    else {
+        return WC_HASH_TYPE_NONE;
+    }
+}
+
+void print_wolfssl_error(const char* msg, int err)
+{
+#ifndef NO_ERROR_STRINGS
+    fprintf(stderr, "%s: %s (%d)\n", msg, wc_GetErrorString(err), err);
+#else
+    fprintf(stderr, "%s: %d\n", msg, err);
+#endif
+}
+
+void usage(void)
+{
+    printf("./hash-deep [-a <alg,...>] [-j <threads>] [-m] <file or dir>...\n");
+    printf("./hash-deep -c <manifest> [-j <threads>] [-m] [file or dir]...\n");
+    printf("  -a  algorithms, default " DEFAULT_ALGS " (those built in)\n");
+    printf("  -j  threads, default one per CPU\n");
+    printf("  -m  map the files instead of reading them\n");
+    printf("  -c  verify the files in a manifest, or only those under the\n");
+    printf("      given files and directories\n");
+    exit(-99);
+}
+
+/* A file to hash and, when verifying, the digests it should have */
+typedef struct {
+    char* path;
+    off_t size;
+    int   ret;      /* 0 when hashed, otherwise why not */
+    int   done;
+    off_t expectSize;
+    byte  digest[MAX_ALGS][WC_MAX_DIGEST_SIZE];
+    byte  expect[MAX_ALGS][WC_MAX_DIGEST_SIZE];
+} file_entry;
+
+/* One algorithm's state - the hash wrapper doesn't handle BLAKE2 */
+typedef union {
+    wc_HashAlg hash;
+#ifdef HAVE_BLAKE2B
+    Blake2b blake2b;
+#endif
+#ifdef HAVE_BLAKE2S
+    Blake2s blake2s;
+#endif
+} hash_state;
+
+typedef struct {
+    file_entry* files;
+    int numFiles;
+    int maxFiles;
+    enum wc_HashType algs[MAX_ALGS];
+    int numAlgs;
+    int useMmap;
+    int verify;
+    int next;       /* next file to hash, taken atomically */
+    int printNext;  /* next file to report - files are reported in order */
+    pthread_mutex_t lock;
+    unsigned long long bytes;
+    int failed;
+} hash_job;
+
+static int add_file(hash_job* job, const char* path)
+{
+    file_entry* e;
+
+    if (job->numFiles == job->maxFiles) {
+        int n = job->maxFiles ? job->maxFiles * 2 : 256;
+        e = (file_entry*)realloc(job->files, n * sizeof(*e));
+        if (e == NULL)
+            return MEMORY_E;
+        job->files = e;
+        job->maxFiles = n;
+    }
+    e = &job->files[job->numFiles];
+    memset(e, 0, sizeof(*e));
+    e->path = strdup(path);
+    if (e->path == NULL)
+        return MEMORY_E;
+    job->numFiles++;
+    return 0;
+}
+
+/* Add a regular file, or every regular file below a directory. Symbolic
+ * links are not followed so that a directory loop can't hang the walk. */
+static int add_path(hash_job* job, const char* path)
+{
+    struct stat st;
+    struct dirent* d;
+    DIR* dir;
+    char* sub;
+    int ret = 0;
+
+    if (lstat(path, &st) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (S_ISREG(st.st_mode))
+        return add_file(job, path);
+    if (!S_ISDIR(st.st_mode))
+        return 0;
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    while (ret == 0 && (d = readdir(dir)) != NULL) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            continue;
+        sub = (char*)malloc(strlen(path) + strlen(d->d_name) + 2);
+        if (sub == NULL) {
+            ret = MEMORY_E;
+            break;
+        }
+        sprintf(sub, "%s%s%s", path,
+                path[strlen(path) - 1] == '/' ? "" : "/", d->d_name);
+        ret = add_path(job, sub);
+        free(sub);
+    }
+    closedir(dir);
+    return ret;
+}
+
+static int cmp_path(const void* a, const void* b)
+{
+    return strcmp(((const file_entry*)a)->path, ((const file_entry*)b)->path);
+}
+
+static int hash_digest_size(enum wc_HashType type)
+{
+    switch (type) {
+#ifdef HAVE_BLAKE2B
+        case WC_HASH_TYPE_BLAKE2B:
+            return BLAKE2B_OUTBYTES;
+#endif
+#ifdef HAVE_BLAKE2S
+        case WC_HASH_TYPE_BLAKE2S:
+            return BLAKE2S_OUTBYTES;
+#endif
+        default:
+            return wc_HashGetDigestSize(type);
+    }
+}
+
+static int hash_init(hash_state* st, enum wc_HashType type)
+{
+    switch (type) {
+#ifdef HAVE_BLAKE2B
+        case WC_HASH_TYPE_BLAKE2B:
+            return wc_InitBlake2b(&st->blake2b, BLAKE2B_OUTBYTES);
+#endif
+#ifdef HAVE_BLAKE2S
+        case WC_HASH_TYPE_BLAKE2S:
+            return wc_InitBlake2s(&st->blake2s, BLAKE2S_OUTBYTES);
+#endif
+        default:
+            return wc_HashInit(&st->hash, type);
+    }
+}
+
+static int hash_update(hash_state* st, enum wc_HashType type,
+                       const byte* data, word32 len)
+{
+    switch (type) {
+#ifdef HAVE_BLAKE2B
+        case WC_HASH_TYPE_BLAKE2B:
+            return wc_Blake2bUpdate(&st->blake2b, data, len);
+#endif
+#ifdef HAVE_BLAKE2S
+        case WC_HASH_TYPE_BLAKE2S:
+            return wc_Blake2sUpdate(&st->blake2s, data, len);
+#endif
+        default:
+            return wc_HashUpdate(&st->hash, type, data, len);
+    }
+}
+
+static int hash_final(hash_state* st, enum wc_HashType type, byte* digest)
+{
+    switch (type) {
+#ifdef HAVE_BLAKE2B
+        case WC_HASH_TYPE_BLAKE2B:
+            return wc_Blake2bFinal(&st->blake2b, digest, BLAKE2B_OUTBYTES);
+#endif
+#ifdef HAVE_BLAKE2S
+        case WC_HASH_TYPE_BLAKE2S:
+            return wc_Blake2sFinal(&st->blake2s, digest, BLAKE2S_OUTBYTES);
+#endif
+        default:
+            return wc_HashFinal(&st->hash, type, digest);
+    }
+}
+
+static void hash_free(hash_state* st, enum wc_HashType type)
+{
+    /* BLAKE2 has nothing to free */
+    if (type != WC_HASH_TYPE_BLAKE2B && type != WC_HASH_TYPE_BLAKE2S)
+        wc_HashFree(&st->hash, type);
+}
+
+/* An algorithm is available when it can be set up, not only named */
+static int hash_available(enum wc_HashType type)
+{
+    hash_state st;
+
+    if (hash_digest_size(type) <= 0 || hash_init(&st, type) != 0)
+        return 0;
+    hash_free(&st, type);
+    return 1;
+}
+
+/* Give each slice of the data to every algorithm before moving on */
+static int hash_update_all(hash_job* job, hash_state* st,
+                           const byte* data, size_t len)
+{
+    size_t off;
+    word32 n;
+    int i;
+    int ret = 0;
+
+    for (off = 0; ret == 0 && off < len; off += n) {
+        n = (len - off < SLICE_SIZE) ? (word32)(len - off) : SLICE_SIZE;
+        for (i = 0; ret == 0 && i < job->numAlgs; i++)
+            ret = hash_update(&st[i], job->algs[i], data + off, n);
+    }
+    if (ret != 0)
+        print_wolfssl_error("Failed to update the hash", ret);
+    return ret;
+}
+
+static int hash_file(hash_job* job, file_entry* e, byte* buf)
+{
+    hash_state hashSt[MAX_ALGS];
+    struct stat st;
+    ssize_t n;
+    int fd;
+    int inited = 0;
+    int ret = 0;
+    int i;
+
+    fd = open(e->path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        ret = -errno;
+        if (fd != -1)
+            close(fd);
+        return ret;
+    }
+    e->size = st.st_size;
+
+    for (; ret == 0 && inited < job->numAlgs; inited++) {
+        ret = hash_init(&hashSt[inited], job->algs[inited]);
+        if (ret != 0) {
+            print_wolfssl_error("Failed to initialize hash structure", ret);
+            break;
+        }
+    }
+
+    if (ret == 0 && job->useMmap && e->size > 0) {
+        byte* map = (byte*)mmap(NULL, e->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            ret = -errno;
+        }
+        else {
+            madvise(map, e->size, MADV_SEQUENTIAL);
+            ret = hash_update_all(job, hashSt, map, e->size);
+            munmap(map, e->size);
+        }
+    }
+    else if (ret == 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        while ((n = read(fd, buf, BUF_SIZE)) != 0) {
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                ret = -errno;
+                break;
+            }
+            ret = hash_update_all(job, hashSt, buf, n);
+            if (ret != 0)
+                break;
+        }
+    }
+
+    for (i = 0; i < inited; i++) {
+        if (ret == 0) {
+            ret = hash_final(&hashSt[i], job->algs[i], e->digest[i]);
+            if (ret != 0)
+                print_wolfssl_error("Failed to generate hash", ret);
+        }
+        hash_free(&hashSt[i], job->algs[i]);
+    }
+    close(fd);
+    return ret;
+}
+
+static void print_hex(const byte* data, int sz)
+{
+    int i;
+
+    for (i = 0; i < sz; i++)
+        printf("%02x", data[i]);
+}
+
+static const char* alg_name(enum wc_HashType type)
+{
+    switch (type) {
+        case WC_HASH_TYPE_MD5:      return "md5";
+        case WC_HASH_TYPE_SHA:      return "sha1";
+        case WC_HASH_TYPE_SHA224:   return "sha224";
+        case WC_HASH_TYPE_SHA256:   return "sha256";
+        case WC_HASH_TYPE_SHA384:   return "sha384";
+        case WC_HASH_TYPE_SHA512:   return "sha512";
+        case WC_HASH_TYPE_SHA3_224: return "sha3-224";
+        case WC_HASH_TYPE_SHA3_256: return "sha3-256";
+        case WC_HASH_TYPE_SHA3_384: return "sha3-384";
+        case WC_HASH_TYPE_SHA3_512: return "sha3-512";
+        case WC_HASH_TYPE_BLAKE2B:  return "blake2b";
+        case WC_HASH_TYPE_BLAKE2S:  return "blake2s";
+        default:                    return "unknown";
+    }
+}
+
+/* Print a manifest line, or the result of checking the file against it */
+static void report_file(hash_job* job, file_entry* e)
+{
+    int i;
+
+    if (!job->verify) {
+        if (e->ret != 0) {
+            fprintf(stderr, "%s: %s\n", e->path,
+                    e->ret < 0 && e->ret > -4096 ? strerror(-e->ret) :
+                    "hash failed");
+            job->failed++;
+            return;
+        }
+        printf("%lld,", (long long)e->size);
+        for (i = 0; i < job->numAlgs; i++) {
+            print_hex(e->digest[i], hash_digest_size(job->algs[i]));
+            printf(",");
+        }
+        printf("%s\n", e->path);
+        return;
+    }
+
+    if (e->ret == -ENOENT) {
+        printf("%s: MISSING\n", e->path);
+        job->failed++;
+        return;
+    }
+    if (e->ret != 0) {
+        printf("%s: FAILED (%s)\n", e->path,
+               e->ret < 0 && e->ret > -4096 ? strerror(-e->ret) :
+               "hash failed");
+        job->failed++;
+        return;
+    }
+    if (e->size != e->expectSize) {
+        printf("%s: FAILED (size)\n", e->path);
+        job->failed++;
+        return;
+    }
+    for (i = 0; i < job->numAlgs; i++) {
+        if (memcmp(e->digest[i], e->expect[i],
+                   hash_digest_size(job->algs[i])) != 0) {
+            printf("%s: FAILED (%s)\n", e->path, alg_name(job->algs[i]));
+            job->failed++;
+            return;
+        }
+    }
+    printf("%s: OK\n", e->path);
+}
+
+static void* hash_worker(void* arg)
+{
+    hash_job* job = (hash_job*)arg;
+    byte* buf = NULL;
+    int idx;
+
+    /* Page aligned so the kernel can copy into it a page at a time */
+    if (!job->useMmap && posix_memalign((void**)&buf, 4096, BUF_SIZE) != 0) {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return NULL;
+    }
+
+    while ((idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+           job->numFiles) {
+        file_entry* e = &job->files[idx];
+
+        /* A size mismatch fails without reading the file */
+        if (job->verify) {
+            struct stat st;
+            if (stat(e->path, &st) != 0)
+                e->ret = -errno;
+            else if (st.st_size != e->expectSize)
+                e->size = st.st_size;
+            else
+                e->ret = hash_file(job, e, buf);
+        }
+        else {
+            e->ret = hash_file(job, e, buf);
+        }
+
+        /* Report in order as soon as the earlier files are done */
+        pthread_mutex_lock(&job->lock);
+        e->done = 1;
+        if (e->ret == 0 && (!job->verify || e->size == e->expectSize))
+            job->bytes += e->size;
+        while (job->printNext < job->numFiles &&
+               job->files[job->printNext].done) {
+            report_file(job, &job->files[job->printNext]);
+            job->printNext++;
+        }
+        pthread_mutex_unlock(&job->lock);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static int set_algs(hash_job* job, char* list, int quiet)
+{
+    char* name;
+    char* save = NULL;
+    char* p;
+    enum wc_HashType type;
+
+    for (name = strtok_r(list, ",", &save); name != NULL;
+         name = strtok_r(NULL, ",", &save)) {
+        for (p = name; *p != '\0'; p++)
+            *p = (char)toupper((unsigned char)*p);
+        type = hash_type_from_string(name);
+        if (type == WC_HASH_TYPE_NONE || !hash_available(type)) {
+            if (quiet) {
+                fprintf(stderr, "%s not built in - skipped\n", name);
+                continue;
+            }
+            fprintf(stderr, "ERROR: hash algorithm %s not available\n", name);
+            return -1;
+        }
+        if (job->numAlgs == MAX_ALGS) {
+            fprintf(stderr, "ERROR: too many hash algorithms\n");
+            return -1;
+        }
+        job->algs[job->numAlgs++] = type;
+    }
+    if (job->numAlgs == 0) {
+        fprintf(stderr, "ERROR: no hash algorithm\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int hex_to_bin(const char* hex, size_t hexLen, byte* out, int sz)
+{
+    int i;
+    unsigned int v;
+
+    if (hexLen != (size_t)sz * 2)
+        return -1;
+    for (i = 0; i < sz; i++) {
+        if (sscanf(hex + i * 2, "%2x", &v) != 1)
+            return -1;
+        out[i] = (byte)v;
+    }
+    return 0;
+}
+
+/* Is the path one of the given files or inside one of the given
+ * directories? Everything is selected when none are given. */
+static int selected(const char* path, char** only, int numOnly)
+{
+    int i;
+
+    if (numOnly == 0)
+        return 1;
+    for (i = 0; i < numOnly; i++) {
+        size_t len = strlen(only[i]);
+        while (len > 1 && only[i][len - 1] == '/')
+            len--;
+        if (strncmp(path, only[i], len) == 0 &&
+            (path[len] == '\0' || path[len] == '/'))
+            return 1;
+    }
+    return 0;
+}
+
+/* Read a manifest written by this tool - or by hashdeep with algorithms
+ * that wolfCrypt has. Only the entries for the selected files are kept. */
+static int read_manifest(hash_job* job, const char* name, char** only,
+                         int numOnly)
+{
+    char line[8192];
+    FILE* f;
+    int ret = 0;
+    int lineNo = 0;
+
+    f = fopen(name, "r");
+    if (f == NULL) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    while (ret == 0 && fgets(line, sizeof(line), f) != NULL) {
+        char* field;
+        char* comma;
+        file_entry* e;
+        int i;
+
+        lineNo++;
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strncmp(line, "%%%% size,", 10) == 0) {
+            /* the columns: size, one per algorithm, then the file name */
+            char* end = strrchr(line, ',');
+            if (end == NULL || strcmp(end, ",filename") != 0) {
+                ret = -1;
+                break;
+            }
+            *end = '\0';
+            ret = set_algs(job, line + 10, 0);
+            continue;
+        }
+        if (line[0] == '%' || line[0] == '#' || line[0] == '\0')
+            continue;
+        if (job->numAlgs == 0) {
+            fprintf(stderr, "%s: no header before line %d\n", name, lineNo);
+            ret = -1;
+            break;
+        }
+
+        /* the file name is last and may itself contain commas */
+        field = line;
+        comma = strchr(field, ',');
+        for (i = 0; comma != NULL && i < job->numAlgs; i++)
+            comma = strchr(comma + 1, ',');
+        if (comma == NULL) {
+            fprintf(stderr, "%s: bad line %d\n", name, lineNo);
+            ret = -1;
+            break;
+        }
+        if (!selected(comma + 1, only, numOnly))
+            continue;
+        ret = add_file(job, comma + 1);
+        if (ret != 0)
+            break;
+        e = &job->files[job->numFiles - 1];
+        e->expectSize = (off_t)strtoll(field, &field, 10);
+        for (i = 0; ret == 0 && i < job->numAlgs; i++) {
+            char* hex = field + 1;
+            field = strchr(hex, ',');
+            ret = hex_to_bin(hex, field - hex, e->expect[i],
+                             hash_digest_size(job->algs[i]));
+        }
+        if (ret != 0)
+            fprintf(stderr, "%s: bad digest on line %d\n", name, lineNo);
+    }
+    fclose(f);
+    return ret;
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    int ret = -1;
+#ifndef NO_HASH_WRAPPERS
+    hash_job job;
+    pthread_t tid[MAX_THREADS];
+    char algList[] = DEFAULT_ALGS;
+    char* algs = NULL;
+    char* manifest = NULL;
+    char cwd[PATH_MAX];
+    struct timespec start, end;
+    double secs;
+    int threads = 0;
+    int started;
+    int opt;
+    int i;
+
+    memset(&job, 0, sizeof(job));
+    pthread_mutex_init(&job.lock, NULL);
+
+    while ((opt = getopt(argc, argv, "a:c:j:mh")) != -1) {
+        switch (opt) {
+            case 'a':
+                algs = optarg;
+                break;
+            case 'c':
+                manifest = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'm':
+                job.useMmap = 1;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (manifest == NULL && optind == argc)
+        usage();
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    if (manifest != NULL) {
+        job.verify = 1;
+        ret = read_manifest(&job, manifest, argv + optind, argc - optind);
+    }
+    else {
+        /* The default algorithms are those this wolfCrypt has */
+        ret = set_algs(&job, algs != NULL ? algs : algList, algs == NULL);
+        for (i = optind; ret == 0 && i < argc; i++)
+            ret = add_path(&job, argv[i]);
+        if (ret == 0) {
+            qsort(job.files, job.numFiles, sizeof(*job.files), cmp_path);
+            printf("%%%%%%%% HASHDEEP-1.0\n");
+            printf("%%%%%%%% size,");
+            for (i = 0; i < job.numAlgs; i++)
+                printf("%s,", alg_name(job.algs[i]));
+            printf("filename\n");
+            if (getcwd(cwd, sizeof(cwd)) != NULL)
+                printf("## Invoked from: %s\n", cwd);
+            printf("## $");
+            for (i = 0; i < argc; i++)
+                printf(" %s", argv[i]);
+            printf("\n##\n");
+        }
+    }
+    if (ret != 0) {
+        printf("ERROR: Hash operation failed\n");
+        goto exit;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (threads > job.numFiles)
+        threads = job.numFiles > 0 ? job.numFiles : 1;
+    /* This thread is one of the workers */
+    for (started = 0; started < threads - 1; started++) {
+        if (pthread_create(&tid[started], NULL, hash_worker, &job) != 0)
+            break;
+    }
+    hash_worker(&job);
+    for (i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%d files, %llu bytes, %d threads, %.3f s, %.1f MB/s\n",
+            job.numFiles, job.bytes, threads, secs,
+            secs > 0 ? job.bytes / secs / 1e6 : 0);
+    if (job.verify)
+        fprintf(stderr, "%d of %d files failed verification\n", job.failed,
+                job.numFiles);
+    ret = job.failed ? 1 : 0;
+
+exit:
+    for (i = 0; i < job.numFiles; i++)
+        free(job.files[i].path);
+    free(job.files);
+    pthread_mutex_destroy(&job.lock);
+#else
+    printf("Please remove NO_HASH_WRAPPERS from wolfCrypt configuration\n");
+#endif
+    return ret;
+}
@@ -0,0 +1,691 @@
+/* sha256-merkle.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfSSL.
+ *
+ * wolfSSL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335, USA
+ */
+
+/* SHA-256 Merkle tree hash of a file.
+ *
+ * The file is cut into leaves of a fixed size that are hashed in parallel:
+ *   leaf = SHA-256(0x00 | leaf data)
+ *   node = SHA-256(0x01 | left | right)
+ * An odd node at the end of a level moves up a level unchanged. The prefixes
+ * keep a leaf from being passed off as a node.
+ *
+ * The tree file holds every level, so a byte range of the file can be
+ * checked against the root by hashing only the leaves of the range and
+ * reading one sibling per level at each end. Checking every leaf of a
+ * partial download tells where to resume it.
+ */
+
+#ifndef WOLFSSL_USER_SETTINGS
+#include <wolfssl/options.h>
+#endif
+#include <wolfssl/wolfcrypt/settings.h>
+#include <wolfssl/ssl.h>
+#include <wolfssl/wolfcrypt/sha256.h>
+#include <wolfssl/wolfcrypt/error-crypt.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef LEAF_SIZE
+#define LEAF_SIZE (1 << 20)
+#endif
+#define MAX_THREADS 64
+#define MAX_LEVELS  64
+
+#define TREE_MAGIC       "WOLFMRK1"
+/* magic | leaf size (4) | reserved (4) | file size (8) | leaf count (8) */
+#define TREE_HEADER_SIZE 32
+#define HASH_SZ          WC_SHA256_DIGEST_SIZE
+
+#ifndef NO_SHA256
+void usage(void)
+{
+    printf("./sha256-merkle [-l <leaf size>] [-j <threads>] [-o <tree file>] "
+           "<file>\n");
+    printf("./sha256-merkle -t <tree file> [-R <root>] [-r <off>:<len>] "
+           "[-j <threads>] <file>\n");
+    printf("  -l  leaf size in bytes, default %d\n", LEAF_SIZE);
+    printf("  -j  threads, default one per CPU\n");
+    printf("  -o  write the tree to a file\n");
+    printf("  -t  verify the file against a tree file: only the range given\n");
+    printf("      with -r, or every leaf to find where to resume a download\n");
+    printf("  -R  root hash to trust, default the root in the tree file\n");
+    exit(-99);
+}
+
+/* The shape of the tree - the number of nodes on each level */
+typedef struct {
+    word32 leafSz;
+    word64 fileSz;
+    int    levels;
+    word64 count[MAX_LEVELS];
+    word64 start[MAX_LEVELS];  /* index of a level's first node in the file */
+    word64 nodes;
+} merkle_tree;
+
+static word64 leaf_count(word32 leafSz, word64 fileSz)
+{
+    /* an empty file has one empty leaf */
+    if (fileSz == 0)
+        return 1;
+    return fileSz / leafSz + (fileSz % leafSz != 0);
+}
+
+/* Returns -1 when the tree has too many levels or nodes to be held */
+static int tree_shape(merkle_tree* tree, word32 leafSz, word64 fileSz)
+{
+    word64 n;
+
+    tree->leafSz = leafSz;
+    tree->fileSz = fileSz;
+    tree->levels = 0;
+    tree->nodes = 0;
+    n = leaf_count(leafSz, fileSz);
+    for (;;) {
+        if (tree->levels == MAX_LEVELS ||
+            n > SIZE_MAX / HASH_SZ - tree->nodes)
+            return -1;
+        tree->count[tree->levels] = n;
+        tree->start[tree->levels] = tree->nodes;
+        tree->nodes += n;
+        tree->levels++;
+        if (n == 1)
+            break;
+        n = (n + 1) / 2;
+    }
+    return 0;
+}
+
+static word64 leaf_len(const merkle_tree* tree, word64 leaf)
+{
+    word64 off = leaf * tree->leafSz;
+
+    if (off + tree->leafSz > tree->fileSz)
+        return tree->fileSz - off;
+    return tree->leafSz;
+}
+
+static int hash_node(wc_Sha256* sha256, const byte* left, const byte* right,
+                     byte* out)
+{
+    byte prefix = 0x01;
+    int ret;
+
+    ret = wc_InitSha256(sha256);
+    if (ret == 0)
+        ret = wc_Sha256Update(sha256, &prefix, 1);
+    if (ret == 0)
+        ret = wc_Sha256Update(sha256, left, HASH_SZ);
+    if (ret == 0)
+        ret = wc_Sha256Update(sha256, right, HASH_SZ);
+    if (ret == 0)
+        ret = wc_Sha256Final(sha256, out);
+    wc_Sha256Free(sha256);
+    return ret;
+}
+
+/* Hash the next level up of count nodes into out. out may be in, or just
+ * after it, as the levels are combined in place. */
+static int hash_level(const byte* in, word64 count, byte* out)
+{
+    wc_Sha256 sha256;
+    word64 i;
+    int ret = 0;
+
+    for (i = 0; ret == 0 && i + 1 < count; i += 2)
+        ret = hash_node(&sha256, in + i * HASH_SZ, in + (i + 1) * HASH_SZ,
+                        out + (i / 2) * HASH_SZ);
+    if (ret == 0 && (count & 1))
+        memmove(out + (count / 2) * HASH_SZ, in + (count - 1) * HASH_SZ,
+                HASH_SZ);
+    return ret;
+}
+
+/* Leaves hashed by a pool of threads. When check is set, the hashes are
+ * compared with the expected ones instead of being stored. */
+typedef struct {
+    const merkle_tree* tree;
+    int fd;
+    word64 fileSz;        /* bytes of the file present */
+    word64 first;
+    word64 end;
+    word64 next;          /* next leaf to hash, taken atomically */
+    byte* hashes;         /* hash of leaf first + i */
+    const byte* expect;   /* expected hash of leaf first + i, when checking */
+    byte* bad;            /* leaf first + i is missing or wrong */
+    int ret;
+} leaf_job;
+
+static int hash_leaf(leaf_job* job, wc_Sha256* sha256, byte* buf,
+                     word64 leaf, byte* out)
+{
+    byte prefix = 0x00;
+    word64 len = leaf_len(job->tree, leaf);
+    off_t off = (off_t)(leaf * job->tree->leafSz);
+    word64 done = 0;
+    ssize_t n;
+    int ret;
+
+    /* not downloaded yet */
+    if (off + len > job->fileSz)
+        return BUFFER_E;
+
+    ret = wc_InitSha256(sha256);
+    if (ret == 0)
+        ret = wc_Sha256Update(sha256, &prefix, 1);
+    while (ret == 0 && done < len) {
+        n = pread(job->fd, buf, len - done, off + done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            ret = -1;
+            break;
+        }
+        ret = wc_Sha256Update(sha256, buf, (word32)n);
+        done += n;
+    }
+    if (ret == 0)
+        ret = wc_Sha256Final(sha256, out);
+    wc_Sha256Free(sha256);
+    return ret;
+}
+
+static void* leaf_worker(void* arg)
+{
+    leaf_job* job = (leaf_job*)arg;
+    wc_Sha256 sha256;
+    byte hash[HASH_SZ];
+    byte* buf;
+    word64 leaf;
+    int ret = 0;
+
+    buf = (byte*)malloc(job->tree->leafSz);
+    if (buf == NULL) {
+        job->ret = MEMORY_E;
+        return NULL;
+    }
+    while ((leaf = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+           job->end) {
+        word64 i = leaf - job->first;
+
+        ret = hash_leaf(job, &sha256, buf, leaf,
+                        job->hashes ? job->hashes + i * HASH_SZ : hash);
+        if (job->bad != NULL) {
+            /* a missing or wrong leaf is a result, not an error */
+            job->bad[i] = ret != 0 ||
+                memcmp(hash, job->expect + i * HASH_SZ, HASH_SZ) != 0;
+            ret = 0;
+        }
+        else if (ret != 0) {
+            job->ret = ret;
+            break;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static int run_leaves(leaf_job* job, int threads)
+{
+    pthread_t tid[MAX_THREADS];
+    int started;
+    int i;
+
+    job->next = job->first;
+    if ((word64)threads > job->end - job->first)
+        threads = (int)(job->end - job->first);
+    /* This thread is one of the workers */
+    for (started = 0; started < threads - 1; started++) {
+        if (pthread_create(&tid[started], NULL, leaf_worker, job) != 0)
+            break;
+    }
+    leaf_worker(job);
+    for (i = 0; i < started; i++)
+        pthread_join(tid[i], NULL);
+    return job->ret;
+}
+
+static void print_hash(const char* label, const byte* hash)
+{
+    int i;
+
+    printf("%s", label);
+    for (i = 0; i < HASH_SZ; i++)
+        printf("%02x", hash[i]);
+    printf("\n");
+}
+
+static int hex_to_hash(const char* hex, byte* hash)
+{
+    unsigned int v;
+    int i;
+
+    if (strlen(hex) != HASH_SZ * 2)
+        return -1;
+    for (i = 0; i < HASH_SZ; i++) {
+        if (sscanf(hex + i * 2, "%2x", &v) != 1)
+            return -1;
+        hash[i] = (byte)v;
+    }
+    return 0;
+}
+
+static void put_be(byte* out, word64 val, int len)
+{
+    while (len-- > 0) {
+        out[len] = (byte)val;
+        val >>= 8;
+    }
+}
+
+static word64 get_be(const byte* in, int len)
+{
+    word64 val = 0;
+    int i;
+
+    for (i = 0; i < len; i++)
+        val = (val << 8) | in[i];
+    return val;
+}
+
+static int read_node(int treeFd, const merkle_tree* tree, int level,
+                     word64 idx, byte* out)
+{
+    off_t off = TREE_HEADER_SIZE + (tree->start[level] + idx) * HASH_SZ;
+
+    if (pread(treeFd, out, HASH_SZ, off) != HASH_SZ) {
+        printf("ERROR: tree file is too short\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Hash the whole file and write the levels to the tree file */
+static int build_tree(int fd, word32 leafSz, int threads, const char* out)
+{
+    merkle_tree tree;
+    leaf_job job;
+    struct stat st;
+    byte header[TREE_HEADER_SIZE];
+    byte* nodes;
+    FILE* treeFile = NULL;
+    int level;
+    int ret;
+
+    if (fstat(fd, &st) != 0) {
+        printf("ERROR: Unable to stat file\n");
+        return -1;
+    }
+    if (tree_shape(&tree, leafSz, (word64)st.st_size) != 0) {
+        printf("ERROR: file has too many leaves\n");
+        return BAD_FUNC_ARG;
+    }
+    nodes = NULL;
+    if (tree.nodes <= SIZE_MAX / HASH_SZ)
+        nodes = (byte*)malloc((size_t)tree.nodes * HASH_SZ);
+    if (nodes == NULL) {
+        printf("ERROR: out of memory\n");
+        return MEMORY_E;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.tree = &tree;
+    job.fd = fd;
+    job.fileSz = tree.fileSz;
+    job.end = tree.count[0];
+    job.hashes = nodes;
+    ret = run_leaves(&job, threads);
+    for (level = 1; ret == 0 && level < tree.levels; level++)
+        ret = hash_level(nodes + tree.start[level - 1] * HASH_SZ,
+                         tree.count[level - 1],
+                         nodes + tree.start[level] * HASH_SZ);
+    if (ret != 0) {
+        printf("ERROR: Hash operation failed\n");
+        free(nodes);
+        return ret;
+    }
+
+    printf("Leaf size %u, %llu leaves, %llu bytes\n", leafSz,
+           (unsigned long long)tree.count[0], (unsigned long long)tree.fileSz);
+    print_hash("Root hash is: ", nodes + (tree.nodes - 1) * HASH_SZ);
+
+    if (out != NULL) {
+        memset(header, 0, sizeof(header));
+        memcpy(header, TREE_MAGIC, 8);
+        put_be(header + 8, leafSz, 4);
+        put_be(header + 16, tree.fileSz, 8);
+        put_be(header + 24, tree.count[0], 8);
+        treeFile = fopen(out, "wb");
+        if (treeFile == NULL ||
+            fwrite(header, 1, sizeof(header), treeFile) != sizeof(header) ||
+            fwrite(nodes, HASH_SZ, tree.nodes, treeFile) != tree.nodes) {
+            printf("ERROR: Unable to write tree file %s\n", out);
+            ret = -1;
+        }
+        if (treeFile != NULL && fclose(treeFile) != 0)
+            ret = -1;
+    }
+    free(nodes);
+    return ret;
+}
+
+/* Check a byte range against the root. Only the leaves of the range are
+ * read from the file, and one sibling at each end of every level from the
+ * tree file. */
+static int verify_range(int fd, int treeFd, const merkle_tree* tree,
+                        const byte* root, word64 off, word64 len, int threads)
+{
+    leaf_job job;
+    struct stat st;
+    byte* hashes;
+    byte* h;
+    word64 lo;
+    word64 hi;
+    int level;
+    int ret;
+
+    if (len == 0 || off >= tree->fileSz || len > tree->fileSz - off) {
+        printf("ERROR: range is outside of the file\n");
+        return BAD_FUNC_ARG;
+    }
+    if (fstat(fd, &st) != 0)
+        return -1;
+    lo = off / tree->leafSz;
+    hi = (off + len - 1) / tree->leafSz;
+
+    /* room for the range's leaves and a sibling on each side */
+    hashes = NULL;
+    if (hi - lo + 3 <= SIZE_MAX / HASH_SZ)
+        hashes = (byte*)malloc((size_t)(hi - lo + 3) * HASH_SZ);
+    if (hashes == NULL)
+        return MEMORY_E;
+    h = hashes + HASH_SZ;
+
+    memset(&job, 0, sizeof(job));
+    job.tree = tree;
+    job.fd = fd;
+    job.fileSz = (word64)st.st_size;
+    job.first = lo;
+    job.end = hi + 1;
+    job.hashes = h;
+    ret = run_leaves(&job, threads);
+    if (ret == BUFFER_E)
+        printf("ERROR: the range isn't all in the file yet\n");
+
+    for (level = 0; ret == 0 && tree->count[level] > 1; level++) {
+        /* pair the ends up with their siblings */
+        if (lo & 1) {
+            h -= HASH_SZ;
+            lo--;
+            ret = read_node(treeFd, tree, level, lo, h);
+        }
+        if (ret == 0 && !(hi & 1) && hi + 1 < tree->count[level]) {
+            hi++;
+            ret = read_node(treeFd, tree, level, hi, h + (hi - lo) * HASH_SZ);
+        }
+        if (ret == 0)
+            ret = hash_level(h, hi - lo + 1, hashes + HASH_SZ);
+        h = hashes + HASH_SZ;
+        lo /= 2;
+        hi /= 2;
+    }
+
+    if (ret == 0) {
+        if (memcmp(h, root, HASH_SZ) != 0) {
+            printf("FAILED: bytes %llu to %llu don't match the root\n",
+                   (unsigned long long)off,
+                   (unsigned long long)(off + len - 1));
+            ret = 1;
+        }
+        else {
+            printf("OK: bytes %llu to %llu match the root\n",
+                   (unsigned long long)off,
+                   (unsigned long long)(off + len - 1));
+        }
+    }
+    free(hashes);
+    return ret;
+}
+
+/* Check every leaf present in a possibly partial file and tell where to
+ * resume. The leaf hashes of the tree file are checked against the root
+ * first so that they can be trusted on their own. */
+static int verify_leaves(int fd, int treeFd, const merkle_tree* tree,
+                         const byte* root, int threads)
+{
+    leaf_job job;
+    struct stat st;
+    byte* nodes;
+    byte* bad = NULL;
+    word64 n = tree->count[0];
+    word64 i;
+    word64 good = 0;
+    word64 resume = n;
+    int level;
+    int ret = 0;
+
+    if (tree->nodes > SIZE_MAX / HASH_SZ)
+        return MEMORY_E;
+    nodes = (byte*)malloc((size_t)tree->nodes * HASH_SZ);
+    if (nodes == NULL)
+        return MEMORY_E;
+    if (pread(treeFd, nodes, (size_t)n * HASH_SZ, TREE_HEADER_SIZE) !=
+        (ssize_t)(n * HASH_SZ)) {
+        printf("ERROR: tree file is too short\n");
+        ret = -1;
+    }
+    for (level = 1; ret == 0 && level < tree->levels; level++)
+        ret = hash_level(nodes + tree->start[level - 1] * HASH_SZ,
+                         tree->count[level - 1],
+                         nodes + tree->start[level] * HASH_SZ);
+    if (ret == 0 &&
+        memcmp(nodes + (tree->nodes - 1) * HASH_SZ, root, HASH_SZ) != 0) {
+        printf("FAILED: the tree file doesn't match the root\n");
+        ret = 1;
+    }
+
+    if (ret == 0) {
+        bad = (byte*)calloc(n, 1);
+        if (bad == NULL || fstat(fd, &st) != 0)
+            ret = -1;
+    }
+    if (ret == 0) {
+        memset(&job, 0, sizeof(job));
+        job.tree = tree;
+        job.fd = fd;
+        job.fileSz = (word64)st.st_size;
+        job.end = n;
+        job.expect = nodes;
+        job.bad = bad;
+        ret = run_leaves(&job, threads);
+    }
+    if (ret == 0) {
+        for (i = 0; i < n; i++) {
+            if (!bad[i])
+                good++;
+            else if (resume == n)
+                resume = i;
+        }
+        printf("%llu of %llu leaves are good\n", (unsigned long long)good,
+               (unsigned long long)n);
+        if (resume == n) {
+            printf("OK: the file is complete\n");
+        }
+        else {
+            printf("Resume from byte %llu\n",
+                   (unsigned long long)(resume * tree->leafSz));
+            ret = 1;
+        }
+    }
+    free(bad);
+    free(nodes);
+    return ret;
+}
+
+static int read_tree_header(int treeFd, merkle_tree* tree, byte* root)
+{
+    byte header[TREE_HEADER_SIZE];
+    struct stat st;
+    word32 leafSz;
+    word64 fileSz;
+    word64 leaves;
+    word64 maxNodes;
+
+    if (fstat(treeFd, &st) != 0 || st.st_size < TREE_HEADER_SIZE + HASH_SZ) {
+        printf("ERROR: not a tree file\n");
+        return -1;
+    }
+    maxNodes = ((word64)st.st_size - TREE_HEADER_SIZE) / HASH_SZ;
+    if (pread(treeFd, header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header, TREE_MAGIC, 8) != 0) {
+        printf("ERROR: not a tree file\n");
+        return -1;
+    }
+    leafSz = (word32)get_be(header + 8, 4);
+    if (leafSz == 0) {
+        printf("ERROR: bad leaf size in tree file\n");
+        return -1;
+    }
+    fileSz = get_be(header + 16, 8);
+    leaves = get_be(header + 24, 8);
+    /* the sizes in the header can't be trusted to be in bounds: every node
+     * must be in the tree file */
+    if (leaves != leaf_count(leafSz, fileSz) || leaves > maxNodes ||
+        tree_shape(tree, leafSz, fileSz) != 0 || tree->nodes > maxNodes) {
+        printf("ERROR: bad leaf count in tree file\n");
+        return -1;
+    }
+    return read_node(treeFd, tree, tree->levels - 1, 0, root);
+}
+#endif
+
+int main(int argc, char** argv)
+{
+    int ret = -1;
+#ifndef NO_SHA256
+    merkle_tree tree;
+    byte root[HASH_SZ];
+    byte treeRoot[HASH_SZ];
+    char* fName = NULL;
+    char* treeName = NULL;
+    char* outName = NULL;
+    char* rootHex = NULL;
+    char* range = NULL;
+    char* end;
+    word32 leafSz = LEAF_SIZE;
+    word64 off = 0;
+    word64 len = 0;
+    int threads = 0;
+    int fd;
+    int treeFd = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:j:o:t:R:r:h")) != -1) {
+        switch (opt) {
+            case 'l':
+                leafSz = (word32)strtoul(optarg, NULL, 0);
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'o':
+                outName = optarg;
+                break;
+            case 't':
+                treeName = optarg;
+                break;
+            case 'R':
+                rootHex = optarg;
+                break;
+            case 'r':
+                range = optarg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc - 1 || leafSz == 0 || (range != NULL && !treeName))
+        usage();
+    fName = argv[optind];
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    if (range != NULL) {
+        off = strtoull(range, &end, 0);
+        if (*end != ':')
+            usage();
+        len = strtoull(end + 1, NULL, 0);
+    }
+
+    printf("Hash input file %s\n", fName);
+    fd = open(fName, O_RDONLY);
+    if (fd == -1) {
+        printf("ERROR: Unable to open file\n");
+        return -1;
+    }
+
+    if (treeName == NULL) {
+        ret = build_tree(fd, leafSz, threads, outName);
+        close(fd);
+        return ret;
+    }
+
+    treeFd = open(treeName, O_RDONLY);
+    if (treeFd == -1) {
+        printf("ERROR: Unable to open tree file\n");
+        close(fd);
+        return -1;
+    }
+    ret = read_tree_header(treeFd, &tree, treeRoot);
+    if (ret == 0) {
+        /* Without a trusted root this only checks the file against the
+         * tree file */
+        if (rootHex == NULL) {
+            memcpy(root, treeRoot, HASH_SZ);
+            print_hash("Root hash from the tree file: ", root);
+        }
+        else if (hex_to_hash(rootHex, root) != 0) {
+            printf("ERROR: root must be %d hex bytes\n", HASH_SZ);
+            ret = BAD_FUNC_ARG;
+        }
+    }
+    if (ret == 0 && range != NULL)
+        ret = verify_range(fd, treeFd, &tree, root, off, len, threads);
+    else if (ret == 0)
+        ret = verify_leaves(fd, treeFd, &tree, root, threads);
+
+    close(treeFd);
+    close(fd);
+#else
+    printf("Please enable sha256 (--enable-sha256) in wolfCrypt\n");
+#endif
+    return ret;
+}
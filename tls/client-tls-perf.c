@@ -21,8 +21,10 @@
  *
  * This is an example of a TCP Client that uses non blocking input and output to
  * handle a large number of connections.
+ * Connections can be split across threads, each with its own epoll set.
 */
 
+#include <pthread.h>
 #include <sys/epoll.h>
 
 #include <wolfssl/options.h>
@@ -43,9 +45,17 @@
 #define MAX_BYTES        -1
 /* The maximum number of connections to perform in this run. */
 #define MAX_CONNECTIONS  100
+/* The number of EPOLL events to process at one time. */
+#define EPOLL_NUM_EVENTS 10
+/* The default number of threads. */
+#define NUM_THREADS      1
+/* The number of linear sub-buckets per power of two in a histogram. */
+#define LATENCY_SUB_BUCKETS  8
+/* The number of buckets in a latency histogram - over an hour in us. */
+#define LATENCY_NUM_BUCKETS  256
 
 /* The command line options. */
-#define OPTIONS          "?p:v:l:c:k:A:rn:N:R:W:B:"
+#define OPTIONS          "?p:v:l:c:k:A:rn:N:R:W:B:L:o:F:t:"
 
 /* The default client certificate. */
 #define CLI_CERT         "../certs/client-cert.pem"
@@ -56,7 +66,22 @@
 
 
 /* The states of the SSL connection. */
-typedef enum SSLState { INIT, CONNECT, WRITE, READ_WAIT, READ, CLOSE } SSLState;
+typedef enum SSLState { INIT, CONNECT, WRITE, READ, CLOSE } SSLState;
+
+/* The formats of the results file. */
+typedef enum OutFormat { OUT_JSON, OUT_CSV } OutFormat;
+
+/* Histogram of latencies in microseconds.
+ * Buckets are a power of two wide with linear sub-buckets within.
+ */
+typedef struct Latency {
+    /* Count of samples in each bucket. */
+    word32 bucket[LATENCY_NUM_BUCKETS];
+    /* Number of samples. */
+    word32 count;
+    /* Largest sample seen in microseconds. */
+    word32 max;
+} Latency;
 
 /* Data for each active connection. */
 typedef struct SSLConn {
@@ -70,6 +95,10 @@ typedef struct SSLConn {
     SSLState state;
     /* Last error from connect/read/write. */
     int err;
+    /* Time the connection was due to start. */
+    double start;
+    /* Time the current request was started. */
+    double reqStart;
 } SSLConn;
 
 /* The information about SSL/TLS connections. */
@@ -80,6 +109,14 @@ typedef struct SSLConnCtx {
     int numConns;
     /* Count of currently active connections. */
     int cnt;
+    /* Stack of indices of connections that aren't active. */
+    int* idle;
+    /* Number of connections that aren't active. */
+    int numIdle;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Number of connections with asynchronous operations outstanding. */
+    int numAsync;
+#endif
 
     /* Resume the session on subsequent connections. */
     int resume;
@@ -123,8 +160,38 @@ typedef struct SSLConnCtx {
     double writeTime;
     /* Total time handling connections. */
     double totalTime;
+
+    /* Rate to start connections at - open-loop. 0 when closed-loop. */
+    double rate;
+    /* Time the next connection is due to start when open-loop. */
+    double nextStart;
+    /* Number of connections started later than due - no free connection. */
+    int numLate;
+
+    /* Latency of full handshakes from when the connection was due. */
+    Latency connLat;
+    /* Latency of resumed handshakes from when the connection was due. */
+    Latency resumeLat;
+    /* Latency of a write of a request to read of the response. */
+    Latency rttLat;
 } SSLConn_CTX;
 
+/* The data for a thread of connections. */
+typedef struct ThreadData {
+    /* The thread identifier. */
+    pthread_t thread_id;
+    /* The SSL/TLS context of the thread. */
+    WOLFSSL_CTX* ctx;
+    /* The connections of the thread. */
+    SSLConn_CTX* sslConnCtx;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* The device identifier of the thread. */
+    int devId;
+#endif
+    /* Print the cipher suite of the first connection. */
+    int printCipher;
+} ThreadData;
+
 
 static void SSLConn_Free(SSLConn_CTX* ctx);
 
@@ -133,10 +200,19 @@ static void SSLConn_Free(SSLConn_CTX* ctx);
 int myoptind = 0;
 /* The current command line option. */
 char* myoptarg = NULL;
-#ifdef WOLFSSL_ASYNC_CRYPT
-/* Global device identifier. */
-static int devId = INVALID_DEVID;
-#endif
+
+/* The port to connect to. */
+static word16       port          = DEFAULT_PORT;
+/* The protocol version. */
+static int          version       = SERVER_DEFAULT_VERSION;
+/* The list of ciphers, as a string, to negotiate. */
+static char*        cipherList    = NULL;
+/* The client certificate for client authentication. */
+static char*        ourCert       = CLI_CERT;
+/* The client private key for client authentication. */
+static char*        ourKey        = CLI_KEY;
+/* The CA certificate for server authentication. */
+static char*        verifyCert    = CA_CERT;
 
 
 /* Get the wolfSSL client method function for the specified version.
@@ -182,6 +258,115 @@ static wolfSSL_method_func SSL_GetMethod(int version)
 }
 
 
+/* Get the index of the histogram bucket for a latency.
+ *
+ * us  The latency in microseconds.
+ * returns the index of the bucket.
+ */
+static int Latency_Index(word32 us)
+{
+    int e = 0;
+    int idx;
+
+    /* Find the power of two that leaves the top bits as the sub-bucket. */
+    while ((us >> e) >= 2 * LATENCY_SUB_BUCKETS)
+        e++;
+    idx = e * LATENCY_SUB_BUCKETS + (int)(us >> e);
+    if (idx >= LATENCY_NUM_BUCKETS)
+        idx = LATENCY_NUM_BUCKETS - 1;
+
+    return idx;
+}
+
+/* Get the largest latency that is counted in a histogram bucket.
+ *
+ * idx  The index of the bucket.
+ * returns the upper bound of the bucket in microseconds.
+ */
+static word32 Latency_Value(int idx)
+{
+    int e;
+
+    if (idx < 2 * LATENCY_SUB_BUCKETS)
+        return (word32)idx;
+    e = idx / LATENCY_SUB_BUCKETS - 1;
+    return (((word32)(idx % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS) + 1)
+            << e) - 1;
+}
+
+/* Add a latency to a histogram.
+ *
+ * latency  The histogram.
+ * secs     The latency in seconds.
+ */
+static void Latency_Add(Latency* latency, double secs)
+{
+    word32 us = (secs <= 0) ? 0 : (word32)(secs * 1000000);
+
+    latency->bucket[Latency_Index(us)]++;
+    latency->count++;
+    if (us > latency->max)
+        latency->max = us;
+}
+
+/* Add the samples of one histogram into another.
+ *
+ * to    The histogram to add into.
+ * from  The histogram to add.
+ */
+static void Latency_Merge(Latency* to, const Latency* from)
+{
+    int i;
+
+    for (i = 0; i < LATENCY_NUM_BUCKETS; i++)
+        to->bucket[i] += from->bucket[i];
+    to->count += from->count;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+/* Get the latency at a percentile of the samples.
+ *
+ * latency  The histogram.
+ * pct      The percentile - 0.0 to 100.0.
+ * returns the latency in microseconds.
+ */
+static word32 Latency_Percentile(const Latency* latency, double pct)
+{
+    int    i;
+    word32 seen = 0;
+    word32 want = (word32)(latency->count * pct / 100);
+
+    if (want == 0)
+        want = 1;
+    for (i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        seen += latency->bucket[i];
+        if (seen >= want)
+            return min(Latency_Value(i), latency->max);
+    }
+
+    return latency->max;
+}
+
+/* Print the percentiles of a latency histogram.
+ *
+ * name     The name of the operation.
+ * latency  The histogram.
+ */
+static void Latency_Print(const char* name, const Latency* latency)
+{
+    if (latency->count == 0)
+        return;
+
+    fprintf(stderr, "\t%-18s: p50 %u us, p99 %u us, p99.9 %u us, max %u us\n",
+            name,
+            Latency_Percentile(latency, 50),
+            Latency_Percentile(latency, 99),
+            Latency_Percentile(latency, 99.9),
+            latency->max);
+}
+
+
 /* Write data to a server.
  *
  * ssl         The wolfSSL object.
@@ -376,13 +561,21 @@ static SSLConn_CTX* SSLConn_New(int numConns, int bufferLen, int replyLen,
         SSLConn_Free(ctx);
         return NULL;
     }
+    /* All connections start idle - first connection on top. */
+    ctx->idle = (int*)malloc(ctx->numConns * sizeof(*ctx->idle));
+    if (ctx->idle == NULL) {
+        SSLConn_Free(ctx);
+        return NULL;
+    }
     for (i = 0; i < ctx->numConns; i++) {
         ctx->sslConn[i].sockfd = -1;
         ctx->sslConn[i].ssl = NULL;
         ctx->sslConn[i].session = NULL;
         ctx->sslConn[i].state = INIT;
         ctx->sslConn[i].err = 0;
+        ctx->idle[ctx->numConns - 1 - i] = i;
     }
+    ctx->numIdle = ctx->numConns;
 
     /* Create a buffer for server data. */
     ctx->buffer = (char*)malloc(bufferLen);
@@ -424,6 +617,9 @@ static void SSLConn_Free(SSLConn_CTX* ctx)
             free(ctx->sslConn);
     }
 
+    if (ctx->idle != NULL)
+        free(ctx->idle);
+
     if (ctx->buffer != NULL)
         free(ctx->buffer);
 
@@ -453,6 +649,7 @@ static void SSLConn_Close(SSLConn_CTX* ctx, SSLConn* sslConn)
     sslConn->sockfd = -1;
 
     sslConn->state = INIT;
+    ctx->idle[ctx->numIdle++] = (int)(sslConn - ctx->sslConn);
 
     ctx->cnt--;
 }
@@ -476,15 +673,17 @@ static int SSLConn_Done(SSLConn_CTX* ctx) {
  * sslCtx   The SSL/TLS context.
  * sockfd   The socket for communicating with the server.
  * sslConn  The SSL connection.
+ * start    The time the connection was due to start.
  * returns EXIT_SUCCESS if a new connection connected or EXIT_FAILURE otherwise.
  */
 static int SSLConn_Connect(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx, int sockfd,
-                           SSLConn* sslConn)
+                           SSLConn* sslConn, double start)
 {
     ctx->numCreated++;
 
     /* Setup connection. */
     sslConn->sockfd = sockfd;
+    sslConn->start = start;
     if ((sslConn->ssl = wolfSSL_new(sslCtx)) == NULL) {
         fprintf(stderr, "wolfSSL_new error.\n");
         return EXIT_FAILURE;
@@ -492,41 +691,41 @@ static int SSLConn_Connect(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx, int sockfd,
     sslConn->state = CONNECT;
     /* Set the socket to communicate over. */
     wolfSSL_set_fd(sslConn->ssl, sslConn->sockfd);
+    ctx->cnt++;
 
     return EXIT_SUCCESS;
 }
 
-/* Select on the socket and wait.
+/* Checks whether a new connection is to be started now.
+ * When open-loop, connections are started at the rate regardless of how long
+ * previous connections are taking. A connection that can't start when due,
+ * because all concurrent connections are busy, keeps the time it was due so
+ * that the wait is included in its latency.
  *
- * socketfd  The socket to select on.
- * to_sec    The length of time that select waits for.
- * returns TEST_SELECT when the select times out, -1 on select error, 0 when
- * there is an error on the socket and 1 on success.
+ * ctx    The SSL/TLS connection data.
+ * start  The time the connection was due to start.
+ * returns 1 when a connection is to be started and 0 otherwise.
  */
-static int TCP_Select(SOCKET_T socketfd, int to_sec)
+static int SSLConn_Due(SSLConn_CTX* ctx, double* start)
 {
-    fd_set recvfds, errfds;
-    SOCKET_T nfds = socketfd + 1;
-    struct timeval timeout = { (to_sec > 0) ? to_sec : 0, 0};
-    int result;
+    double now = current_time(0);
 
-    FD_ZERO(&recvfds);
-    FD_SET(socketfd, &recvfds);
-    FD_ZERO(&errfds);
-    FD_SET(socketfd, &errfds);
+    if (ctx->rate <= 0) {
+        *start = now;
+        return 1;
+    }
 
-    result = select(nfds, &recvfds, NULL, &errfds, &timeout);
+    if (ctx->nextStart == 0)
+        ctx->nextStart = now;
+    if (now < ctx->nextStart)
+        return 0;
 
-    if (result == 0)
-        return -1;
-    else if (result > 0) {
-        if (FD_ISSET(socketfd, &recvfds))
-            return 1;
-        else if(FD_ISSET(socketfd, &errfds))
-            return 0;
-    }
+    if (now - ctx->nextStart > 1 / ctx->rate)
+        ctx->numLate++;
+    *start = ctx->nextStart;
+    ctx->nextStart += 1 / ctx->rate;
 
-    return TEST_SELECT_FAIL;
+    return 1;
 }
 
 /* Read/write from/to server at the specified socket.
@@ -555,6 +754,13 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
             }
 
             if (ret == 1) {
+                double now = current_time(0);
+
+                if (wolfSSL_session_reused(sslConn->ssl))
+                    Latency_Add(&ctx->resumeLat, now - sslConn->start);
+                else
+                    Latency_Add(&ctx->connLat, now - sslConn->start);
+                sslConn->reqStart = now;
                 sslConn->state = WRITE;
             }
             break;
@@ -577,15 +783,9 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
             }
 
             if (ret == 1)
-                sslConn->state = READ_WAIT;
+                sslConn->state = READ;
             break;
 
-        case READ_WAIT:
-            ret = TCP_Select(sslConn->sockfd, 0);
-            if (ret != 1)
-                break;
-            sslConn->state = READ;
-
         case READ:
             len = ctx->bufferLen;
             if (ctx->maxBytes > 0) {
@@ -604,6 +804,10 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
             }
 
             if (ret == 1) {
+                double now = current_time(0);
+
+                Latency_Add(&ctx->rttLat, now - sslConn->reqStart);
+                sslConn->reqStart = now;
                 if (ctx->maxConnections > 0)
                     sslConn->state = CLOSE;
                 else
@@ -616,6 +820,108 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
     return EXIT_SUCCESS;
 }
 
+/* Move a connection on until it has to wait for the server.
+ * Closes the connection when it is done.
+ *
+ * threadData  The data for the thread.
+ * sslConn     The SSL connection.
+ */
+static void SSLConn_Run(ThreadData* threadData, SSLConn* sslConn)
+{
+    SSLConn_CTX* ctx = threadData->sslConnCtx;
+    SSLState     state;
+
+    /* Edge triggered - continue while states are completed. */
+    do {
+        state = sslConn->state;
+        if (SSLConn_ReadWrite(ctx, sslConn) == EXIT_FAILURE) {
+            if (ctx->maxConnections > 0)
+                sslConn->state = CLOSE;
+        }
+    }
+    while (sslConn->state != state && sslConn->state != CLOSE);
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+    if (sslConn->err == 4)
+        ctx->numAsync++;
+#endif
+
+    /* Perform close if in CLOSE state. */
+    if (sslConn->state == CLOSE) {
+        if (threadData->printCipher && ctx->numConnections == 0) {
+            WOLFSSL_CIPHER* cipher;
+            cipher = wolfSSL_get_current_cipher(sslConn->ssl);
+            printf("SSL cipher suite is %s\n",
+                   wolfSSL_CIPHER_get_name(cipher));
+        }
+        SSLConn_Close(ctx, sslConn);
+    }
+}
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+/* Poll the connections that are waiting on asynchronous operations.
+ *
+ * threadData  The data for the thread.
+ */
+static void SSLConn_AsyncPoll(ThreadData* threadData)
+{
+    SSLConn_CTX* ctx = threadData->sslConnCtx;
+    SSLConn*     sslConn;
+    int          i;
+    int          ret;
+    double       start;
+
+    for (i = 0; i < ctx->numConns && ctx->numAsync > 0; i++) {
+        sslConn = &ctx->sslConn[i];
+        if (sslConn->err != 4)
+            continue;
+
+        start = current_time(1);
+        ret = wolfSSL_AsyncPoll(sslConn->ssl, WOLF_POLL_FLAG_CHECK_HW);
+        ctx->asyncTime += current_time(0) - start;
+        if (ret < 0) {
+            printf("ERROR: failed in async polling\n");
+            exit(EXIT_FAILURE);
+        }
+        if (ret == 0)
+            continue;
+
+        ctx->numAsync--;
+        sslConn->err = 0;
+        SSLConn_Run(threadData, sslConn);
+    }
+}
+#endif
+
+/* Add the statistics of a thread's connections into the totals.
+ *
+ * total  The SSL/TLS connection data to add into.
+ * ctx    The SSL/TLS connection data of a thread.
+ */
+static void SSLConn_Merge(SSLConn_CTX* total, const SSLConn_CTX* ctx)
+{
+    total->numCreated += ctx->numCreated;
+    total->numConnections += ctx->numConnections;
+    total->numResumed += ctx->numResumed;
+    total->totalReadBytes += ctx->totalReadBytes;
+    total->totalWriteBytes += ctx->totalWriteBytes;
+    total->connTime += ctx->connTime;
+    total->resumeTime += ctx->resumeTime;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    total->asyncTime += ctx->asyncTime;
+#endif
+    total->readTime += ctx->readTime;
+    total->writeTime += ctx->writeTime;
+    /* Threads run at the same time. */
+    if (ctx->totalTime > total->totalTime)
+        total->totalTime = ctx->totalTime;
+    total->rate += ctx->rate;
+    total->numLate += ctx->numLate;
+    Latency_Merge(&total->connLat, &ctx->connLat);
+    Latency_Merge(&total->resumeLat, &ctx->resumeLat);
+    Latency_Merge(&total->rttLat, &ctx->rttLat);
+}
+
 /* Print the connection statistics.
  *
  * ctx  The SSL/TLS connection data.
@@ -663,21 +969,136 @@ static void SSLConn_PrintStats(SSLConn_CTX* ctx)
             ctx->totalReadBytes / ctx->readTime / 1024 / 1024,
             ctx->writeTime * 1000,
             ctx->totalWriteBytes / ctx->writeTime / 1024 / 1024 );
+    if (ctx->rate > 0) {
+        fprintf(stderr,
+                "\tTarget rate       : %9.3f conns/s\n"
+                "\tLate starts       : %9d\n",
+                ctx->rate,
+                ctx->numLate);
+    }
+    Latency_Print("Connect Latency", &ctx->connLat);
+    Latency_Print("Resume Latency", &ctx->resumeLat);
+    Latency_Print("Round Trip", &ctx->rttLat);
+}
+
+/* Write the percentiles of a latency histogram as a JSON object member.
+ *
+ * fp       The file to write to.
+ * name     The name of the member.
+ * latency  The histogram.
+ * last     Whether this is the last member of the object.
+ */
+static void Latency_WriteJson(FILE* fp, const char* name,
+                              const Latency* latency, int last)
+{
+    fprintf(fp, "  \"%s\": { \"count\": %u, \"p50_us\": %u, \"p90_us\": %u, "
+                "\"p99_us\": %u, \"p99.9_us\": %u, \"max_us\": %u }%s\n",
+            name, latency->count,
+            Latency_Percentile(latency, 50),
+            Latency_Percentile(latency, 90),
+            Latency_Percentile(latency, 99),
+            Latency_Percentile(latency, 99.9),
+            latency->max,
+            last ? "" : ",");
+}
+
+/* Write the percentiles of a latency histogram as CSV columns.
+ *
+ * fp       The file to write to.
+ * latency  The histogram.
+ */
+static void Latency_WriteCsv(FILE* fp, const Latency* latency)
+{
+    fprintf(fp, ",%u,%u,%u,%u,%u,%u", latency->count,
+            Latency_Percentile(latency, 50),
+            Latency_Percentile(latency, 90),
+            Latency_Percentile(latency, 99),
+            Latency_Percentile(latency, 99.9),
+            latency->max);
+}
+
+/* Write the results of the run to a file for regression tracking.
+ * JSON overwrites the file. CSV appends a row, with a header line when the
+ * file is new, so that runs can be collected in one file.
+ *
+ * ctx     The SSL/TLS connection data.
+ * file    The name of the file to write to.
+ * format  The format of the file.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int SSLConn_WriteResults(SSLConn_CTX* ctx, const char* file,
+                                OutFormat format)
+{
+    FILE*       fp;
+    int         i;
+    const char* names[3] = { "connect", "resume", "rtt" };
+
+    fp = fopen(file, (format == OUT_CSV) ? "a" : "w");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: failed to open %s\n", file);
+        return EXIT_FAILURE;
+    }
+
+    if (format == OUT_JSON) {
+        fprintf(fp, "{\n"
+                    "  \"bytes\": %d,\n"
+                    "  \"conns\": %d,\n"
+                    "  \"resumed\": %d,\n"
+                    "  \"total_ms\": %.3f,\n"
+                    "  \"tps\": %.3f,\n"
+                    "  \"target_rate\": %.3f,\n"
+                    "  \"late\": %d,\n"
+                    "  \"read_bytes\": %d,\n"
+                    "  \"write_bytes\": %d,\n",
+                ctx->replyLen, ctx->numConnections, ctx->numResumed,
+                ctx->totalTime * 1000, ctx->numConnections / ctx->totalTime,
+                ctx->rate, ctx->numLate, ctx->totalReadBytes,
+                ctx->totalWriteBytes);
+        Latency_WriteJson(fp, names[0], &ctx->connLat, 0);
+        Latency_WriteJson(fp, names[1], &ctx->resumeLat, 0);
+        Latency_WriteJson(fp, names[2], &ctx->rttLat, 1);
+        fprintf(fp, "}\n");
+    }
+    else {
+        /* Header only at start of file. */
+        if (ftell(fp) == 0) {
+            fprintf(fp, "bytes,conns,resumed,total_ms,tps,target_rate,late,"
+                        "read_bytes,write_bytes");
+            for (i = 0; i < 3; i++) {
+                fprintf(fp, ",%s_count,%s_p50_us,%s_p90_us,%s_p99_us,"
+                            "%s_p99.9_us,%s_max_us", names[i], names[i],
+                        names[i], names[i], names[i], names[i]);
+            }
+            fprintf(fp, "\n");
+        }
+        fprintf(fp, "%d,%d,%d,%.3f,%.3f,%.3f,%d,%d,%d",
+                ctx->replyLen, ctx->numConnections, ctx->numResumed,
+                ctx->totalTime * 1000, ctx->numConnections / ctx->totalTime,
+                ctx->rate, ctx->numLate, ctx->totalReadBytes,
+                ctx->totalWriteBytes);
+        Latency_WriteCsv(fp, &ctx->connLat);
+        Latency_WriteCsv(fp, &ctx->resumeLat);
+        Latency_WriteCsv(fp, &ctx->rttLat);
+        fprintf(fp, "\n");
+    }
+
+    fclose(fp);
+    return EXIT_SUCCESS;
 }
 
-/* Initialize the wolfSSL library and create a wolfSSL context.
+/* Create a wolfSSL context for a thread.
  *
+ * threadData  The data for the thread.
  * version     The protocol version.
  * cert        The client certificate for client authentication.
  * key         The client private key for client authentication.
  * verifyCert  The CA certificate for server authentication.
  * cipherList  The list of ciphers, as a string, to negotiate.
- * wolfsslCtx  The new wolfSSL context object.
  * returns EXIT_SUCCESS when a wolfSSL context object is created and
  * EXIT_FAILURE otherwise.
  */
-static int WolfSSLCtx_Init(int version, char* cert, char* key, char* verifyCert,
-                           char* cipherList, WOLFSSL_CTX** wolfsslCtx)
+static int WolfSSLCtx_Init(ThreadData* threadData, int version, char* cert,
+                           char* key, char* verifyCert, char* cipherList)
 {
     WOLFSSL_CTX* ctx;
     wolfSSL_method_func method = NULL;
@@ -693,11 +1114,16 @@ static int WolfSSLCtx_Init(int version, char* cert, char* key, char* verifyCert,
     }
 
 #ifdef WOLFSSL_ASYNC_CRYPT
-    if (wolfAsync_DevOpen(&devId) != 0) {
+#ifndef WC_NO_ASYNC_THREADING
+    if (wolfAsync_DevOpenThread(&threadData->devId, &threadData->thread_id) < 0)
+#else
+    if (wolfAsync_DevOpen(&threadData->devId) < 0)
+#endif
+    {
         fprintf(stderr, "Async device open failed\nRunning without async\n");
     }
 
-    wolfSSL_CTX_UseAsync(ctx, devId);
+    wolfSSL_CTX_UseAsync(ctx, threadData->devId);
 #endif
 
     if (cipherList) {
@@ -722,19 +1148,20 @@ static int WolfSSLCtx_Init(int version, char* cert, char* key, char* verifyCert,
         return EXIT_FAILURE;
     }
 
-    *wolfsslCtx = ctx;
+    threadData->ctx = ctx;
     return EXIT_SUCCESS;
 }
 
-/* Cleanup the wolfSSL context and wolfSSL library.
+/* Cleanup the wolfSSL context of a thread.
  *
- * ctx  The wolfSSL context object.
+ * threadData  The data for the thread.
  */
-static void WolfSSLCtx_Final(WOLFSSL_CTX* ctx)
+static void WolfSSLCtx_Final(ThreadData* threadData)
 {
-    wolfSSL_CTX_free(ctx);
+    wolfSSL_CTX_free(threadData->ctx);
+    threadData->ctx = NULL;
 #ifdef WOLFSSL_ASYNC_CRYPT
-    wolfAsync_DevClose(&devId);
+    wolfAsync_DevClose(&threadData->devId);
 #endif
 }
 
@@ -778,6 +1205,126 @@ static int CreateSocketConnect(int port, socklen_t* socketfd)
     return EXIT_SUCCESS;
 }
 
+/* Handle the connections of a thread until done.
+ * Each thread has its own wolfSSL context and epoll set.
+ *
+ * data  The data for the thread.
+ * returns NULL.
+ */
+static void* ThreadHandler(void* data)
+{
+    ThreadData*        threadData = (ThreadData*)data;
+    SSLConn_CTX*       ctx = threadData->sslConnCtx;
+    SSLConn*           sslConn;
+    socklen_t          socketfd;
+    int                efd;
+    int                n;
+    int                i;
+    int                timeout;
+    double             start;
+    struct epoll_event event;
+    struct epoll_event events[EPOLL_NUM_EVENTS];
+
+    /* Initialize wolfSSL and create a context object. */
+    if (WolfSSLCtx_Init(threadData, version, ourCert, ourKey, verifyCert,
+                        cipherList) == EXIT_FAILURE) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* Create an EPOLL file descriptor. */
+    efd = epoll_create1(0);
+    if (efd == -1) {
+        fprintf(stderr, "ERROR: failed to create epoll\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ctx->totalTime = current_time(1);
+
+    /* Keep handling connections until all done. */
+    while (!SSLConn_Done(ctx)) {
+        /* Create TCP connection and connect on idle entries. */
+        while (ctx->numIdle > 0 &&
+               ((ctx->maxConnections <= 0) ||
+                (ctx->numCreated < ctx->maxConnections)) &&
+               SSLConn_Due(ctx, &start)) {
+            sslConn = &ctx->sslConn[ctx->idle[--ctx->numIdle]];
+
+            if (CreateSocketConnect(port, &socketfd) == EXIT_FAILURE) {
+                printf("ERROR: failed to connect to server\n");
+                exit(EXIT_FAILURE);
+            }
+            if (SSLConn_Connect(ctx, threadData->ctx, socketfd, sslConn,
+                                start) == EXIT_FAILURE) {
+                exit(EXIT_FAILURE);
+            }
+
+            /* Set EPOLL to check for events on the new socket. */
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.ptr = sslConn;
+            if (epoll_ctl(efd, EPOLL_CTL_ADD, socketfd, &event) == -1) {
+                fprintf(stderr, "ERROR: failed add event to epoll\n");
+                exit(EXIT_FAILURE);
+            }
+
+            SSLConn_Run(threadData, sslConn);
+        }
+
+        /* Wake up when the next open-loop connection is due. */
+        timeout = -1;
+        if (ctx->rate > 0 && ctx->numIdle > 0 &&
+                ctx->numCreated < ctx->maxConnections) {
+            timeout = (int)((ctx->nextStart - current_time(0)) * 1000);
+            if (timeout < 0)
+                timeout = 0;
+        }
+#ifdef WOLFSSL_ASYNC_CRYPT
+        if (ctx->numAsync > 0)
+            timeout = 0;
+#endif
+
+        /* Wait for events. */
+        n = epoll_wait(efd, events, EPOLL_NUM_EVENTS, timeout);
+        /* Process all returned events. */
+        for (i = 0; i < n; i++) {
+            sslConn = (SSLConn*)events[i].data.ptr;
+
+            /* Closed while handling an earlier event. */
+            if (sslConn->state == INIT)
+                continue;
+#ifdef WOLFSSL_ASYNC_CRYPT
+            /* Continued when asynchronous operation completes. */
+            if (sslConn->err == 4)
+                continue;
+#endif
+            SSLConn_Run(threadData, sslConn);
+        }
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+        if (ctx->numAsync > 0)
+            SSLConn_AsyncPoll(threadData);
+#endif
+    }
+
+    ctx->totalTime = current_time(0) - ctx->totalTime;
+
+    close(efd);
+
+    return NULL;
+}
+
+/* Get the share of a total for a thread.
+ *
+ * total       The total to share out.
+ * numThreads  The number of threads sharing.
+ * idx         The index of the thread.
+ * returns the thread's share of the total.
+ */
+static int ThreadShare(int total, int numThreads, int idx)
+{
+    return total / numThreads + (idx < total % numThreads);
+}
+
 /* Display the usage for the program.
  */
 static void Usage(void)
@@ -798,6 +1345,10 @@ static void Usage(void)
     printf("-R <num>    <num> bytes read from client\n");
     printf("-W <num>    <num> bytes written to client\n");
     printf("-B <num>    Benchmark <num> written bytes\n");
+    printf("-L <num>    Open-loop: start <num> connections per second\n");
+    printf("-o <file>   Write results to file\n");
+    printf("-F <fmt>    Format of results file: json or csv, default json\n");
+    printf("-t <num>    Number of threads, default %d\n", NUM_THREADS);
 }
 
 /* Main entry point for the program.
@@ -808,22 +1359,19 @@ static void Usage(void)
  */
 int main(int argc, char* argv[])
 {
-    socklen_t    socketfd = -1;
     int          ch;
-    WOLFSSL_CTX* ctx = NULL;
-    SSLConn_CTX* sslConnCtx;
-    word16       port = wolfSSLPort;
+    SSLConn_CTX  total;
+    ThreadData*  threadData;
     int          resumeSession = 0;
-    char*        cipherList = NULL;
-    char*        ourCert       = CLI_CERT;
-    char*        ourKey        = CLI_KEY;
-    char*        verifyCert    = CA_CERT;
-    int          version       = SERVER_DEFAULT_VERSION;
     int          numConns      = SSL_NUM_CONN;
     int          numBytesRead  = NUM_READ_BYTES;
     int          numBytesWrite = NUM_WRITE_BYTES;
     int          maxBytes      = MAX_BYTES;
     int          maxConns      = MAX_CONNECTIONS;
+    double       rate          = 0;
+    char*        outFile       = NULL;
+    OutFormat    outFormat     = OUT_JSON;
+    int          numThreads    = NUM_THREADS;
     int          i;
 
     /* Parse the command line arguments. */
@@ -920,6 +1468,41 @@ int main(int argc, char* argv[])
                 maxConns = 0;
                 break;
 
+            /* Start connections at a rate - open-loop. */
+            case 'L':
+                rate = atof(myoptarg);
+                if (rate <= 0) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
+            /* File to write results to. */
+            case 'o':
+                outFile = myoptarg;
+                break;
+
+            /* Format of results file. */
+            case 'F':
+                if (strcmp(myoptarg, "json") == 0)
+                    outFormat = OUT_JSON;
+                else if (strcmp(myoptarg, "csv") == 0)
+                    outFormat = OUT_CSV;
+                else {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
+            /* Number of threads. */
+            case 't':
+                numThreads = atoi(myoptarg);
+                if (numThreads <= 0) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
             /* Unrecognized command line argument. */
             default:
                 Usage();
@@ -927,6 +1510,18 @@ int main(int argc, char* argv[])
         }
     }
 
+    /* Each open-loop connection makes one request. */
+    if (rate > 0 && maxConns <= 0) {
+        fprintf(stderr, "ERROR: open-loop needs number of connections (-n)\n");
+        exit(MY_EX_USAGE);
+    }
+
+    /* Each thread needs at least one connection. */
+    if (numThreads > numConns ||
+            (maxConns > 0 && numThreads > maxConns)) {
+        fprintf(stderr, "ERROR: more threads than connections\n");
+        exit(MY_EX_USAGE);
+    }
 
 #ifdef DEBUG_WOLFSSL
     wolfSSL_Debugging_ON();
@@ -935,80 +1530,60 @@ int main(int argc, char* argv[])
     /* Initialize wolfSSL */
     wolfSSL_Init();
 
-    /* Initialize wolfSSL and create a context object. */
-    if (WolfSSLCtx_Init(version, ourCert, ourKey, verifyCert, cipherList, &ctx)
-            == EXIT_FAILURE)
-        exit(EXIT_FAILURE);
-
-    /* Create SSL/TLS connection data object. */
-    sslConnCtx = SSLConn_New(numConns, numBytesRead, numBytesWrite,
-                             maxConns, maxBytes, resumeSession);
-    if (sslConnCtx == NULL)
+    threadData = (ThreadData*)calloc(numThreads, sizeof(*threadData));
+    if (threadData == NULL)
         exit(EXIT_FAILURE);
 
-    /* Keep handling connections until all done. */
-    for (i = 0; !SSLConn_Done(sslConnCtx); i = (i + 1) % numConns) {
-        SSLConn* sslConn = &sslConnCtx->sslConn[i];
-
-        /* Perform close if in CLOSE state. */
-        if (sslConn->state == CLOSE) {
-            if (sslConnCtx->numConnections == 0) {
-                WOLFSSL_CIPHER* cipher;
-                cipher = wolfSSL_get_current_cipher(sslConn->ssl);
-                printf("SSL cipher suite is %s\n",
-                       wolfSSL_CIPHER_get_name(cipher));
-            }
-            SSLConn_Close(sslConnCtx, sslConn);
-        }
-
-        /* Create TCP connection and connect if in INIT state. */
-        if ((sslConn->state == INIT) &&
-            ((sslConnCtx->maxConnections <= 0) ||
-             (sslConnCtx->numCreated < sslConnCtx->maxConnections))) {
-            if (CreateSocketConnect(port, &socketfd) == EXIT_FAILURE) {
-                printf("ERROR: failed to connect to server\n");
-                exit(EXIT_FAILURE);
-            }
-
-            SSLConn_Connect(sslConnCtx, ctx, socketfd, sslConn);
-        }
-
+    /* Split the connections, bytes and rate across the threads. */
+    for (i = 0; i < numThreads; i++) {
+        SSLConn_CTX* sslConnCtx;
+
+        sslConnCtx = SSLConn_New(ThreadShare(numConns, numThreads, i),
+                                 numBytesRead, numBytesWrite,
+                                 (maxConns > 0) ?
+                                     ThreadShare(maxConns, numThreads, i) :
+                                     maxConns,
+                                 (maxBytes > 0) ?
+                                     ThreadShare(maxBytes, numThreads, i) :
+                                     maxBytes,
+                                 resumeSession);
+        if (sslConnCtx == NULL)
+            exit(EXIT_FAILURE);
+        sslConnCtx->rate = rate / numThreads;
+
+        threadData[i].sslConnCtx = sslConnCtx;
 #ifdef WOLFSSL_ASYNC_CRYPT
-        if (sslConn->err == 4) {
-            int ret;
-            double start;
-
-            start = current_time(1);
-            ret = wolfSSL_AsyncPoll(sslConn->ssl, WOLF_POLL_FLAG_CHECK_HW);
-            sslConnCtx->asyncTime += current_time(0) - start;
-            if (ret < 0) {
-                printf("ERROR: failed in async polling\n");
-                break;
-            }
-            if (ret == 0)
-                continue;
-        }
-        sslConn->err = 0;
+        threadData[i].devId = INVALID_DEVID;
 #endif
+        threadData[i].printCipher = (i == 0);
+    }
 
-        /* Handle other SSL states. */
-        if (sslConnCtx->totalTime == 0)
-            sslConnCtx->totalTime = current_time(1);
-        if (SSLConn_ReadWrite(sslConnCtx, sslConn) == EXIT_FAILURE) {
-            if (sslConnCtx->maxConnections > 0)
-                sslConn->state = CLOSE;
+    for (i = 0; i < numThreads; i++) {
+        if (pthread_create(&threadData[i].thread_id, NULL, ThreadHandler,
+                           &threadData[i]) != 0) {
+            fprintf(stderr, "ERROR: failed to create thread\n");
+            exit(EXIT_FAILURE);
         }
     }
 
-    sslConnCtx->totalTime = current_time(0) - sslConnCtx->totalTime;
+    /* Merge the statistics of the threads when they are done. */
+    memset(&total, 0, sizeof(total));
+    total.replyLen = numBytesWrite;
+    total.resume = resumeSession;
+    for (i = 0; i < numThreads; i++) {
+        pthread_join(threadData[i].thread_id, NULL);
 
-    SSLConn_PrintStats(sslConnCtx);
-    SSLConn_Free(sslConnCtx);
+        SSLConn_Merge(&total, threadData[i].sslConnCtx);
+        SSLConn_Free(threadData[i].sslConnCtx);
+        WolfSSLCtx_Final(&threadData[i]);
+    }
+    free(threadData);
 
-    WolfSSLCtx_Final(ctx);
+    SSLConn_PrintStats(&total);
+    if (outFile != NULL)
+        SSLConn_WriteResults(&total, outFile, outFormat);
 
     wolfSSL_Cleanup();
 
     exit(EXIT_SUCCESS);
 }
-
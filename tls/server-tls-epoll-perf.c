@@ -24,12 +24,26 @@
 */
 
 #include <sys/epoll.h>
+#include <sys/resource.h>
 
 #include <wolfssl/options.h>
 #include <wolfssl/ssl.h>
 
 #include <wolfssl/test.h>
 
+#ifdef ATOMIC_USER
+    /* Traffic keys are available to install into kernel TLS. */
+    #include <sys/sendfile.h>
+    #include <linux/tls.h>
+
+    #ifndef SOL_TLS
+        #define SOL_TLS 282
+    #endif
+    #ifndef TCP_ULP
+        #define TCP_ULP 31
+    #endif
+#endif
+
 
 /* Default port to listen on. */
 #define DEFAULT_PORT     11111
@@ -49,9 +63,24 @@
 #define NUM_CLIENTS      100
 /* The number of wolfSSL events to accept and process at one time. */
 #define MAX_WOLF_EVENTS  10
+/* The size of a CPU cache line in bytes. */
+#define CACHE_LINE_SZ    64
+/* The initial size of a connection's queue of data waiting to be sent. */
+#define WRITE_QUEUE_SZ   16384
+/* The default number of queued bytes at which a connection stops being
+ * served. */
+#define WRITE_HIGH_WATER (256 * 1024)
+/* The default number of queued bytes at which a connection is served again. */
+#define WRITE_LOW_WATER  (64 * 1024)
+/* The kernel encrypts the data written to the socket. */
+#define KTLS_TX          0x01
+/* The kernel decrypts the data read from the socket. */
+#define KTLS_RX          0x02
+/* The TLS record content type of application data. */
+#define TLS_APP_DATA     23
 
 /* The command line options. */
-#define OPTIONS          "?p:v:al:c:k:A:n:N:R:W:B:"
+#define OPTIONS          "?p:v:al:c:k:A:n:N:R:W:B:PKH:L:"
 
 /* The default server certificate. */
 #define SVR_CERT "../certs/server-cert.pem"
@@ -63,6 +92,18 @@
 /* The states of the SSL connection. */
 typedef enum SSLState { ACCEPT, READ, WRITE, CLOSED } SSLState;
 
+/* Queue of encrypted data waiting for the socket to be writable. */
+typedef struct WriteQueue {
+    /* Buffer holding the queued data. */
+    char* data;
+    /* Size of the buffer. */
+    int size;
+    /* Offset of the first byte not yet sent. */
+    int start;
+    /* Offset after the last byte queued. */
+    int end;
+} WriteQueue;
+
 /* Type for the SSL connection data. */
 typedef struct SSLConn SSLConn;
 
@@ -72,8 +113,30 @@ struct SSLConn {
     int sockfd;
     /* The wolfSSL object to perform TLS communications. */
     WOLFSSL* ssl;
+    /* Buffer to read client data into - from arena when pooled. */
+    char* buffer;
     /* The current state of the SSL/TLS connection. */
     SSLState state;
+    /* Directions that kernel TLS handles - KTLS_TX and KTLS_RX. */
+    int ktls;
+    /* Kernel TLS is enabled once the handshake messages queued are sent. */
+    int ktlsPending;
+    /* Number of bytes of the reply sent with sendfile. */
+    off_t replyOff;
+    /* Length of the reply being sent with sendfile - 0 when none is. */
+    off_t replySz;
+    /* Encrypted data that the socket would not take yet. */
+    WriteQueue outQ;
+    /* The EPOLL file descriptor the socket is registered with. */
+    int efd;
+    /* EPOLLOUT is armed for the socket. */
+    int watchWrite;
+    /* Not served until the queue drains to the low watermark. */
+    int blocked;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* An asynchronous operation is outstanding. */
+    int pending;
+#endif
     /* Previous SSL connection data object. */
     SSLConn* prev;
     /* Next SSL connection data object. */
@@ -86,22 +149,47 @@ typedef struct SSLConn_CTX {
     SSLConn* sslConn;
     /* Free list. */
     SSLConn* freeSSLConn;
+    /* Slab of connections with wolfSSL objects when pooling. */
+    SSLConn* slab;
+    /* Arena that the read buffers of the slab's connections are in. */
+    char* arena;
+    /* Stack of unused connections in slab. */
+    SSLConn* freeSlab;
+    /* The SSL/TLS context the slab's wolfSSL objects were created with. */
+    WOLFSSL_CTX* slabCtx;
     /* Maximum number of active connections. */
     int numConns;
     /* Count of currently active connections. */
     int cnt;
     /* Accepting new connections. */
     int accepting;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Number of connections with an asynchronous operation outstanding. */
+    int asyncPending;
+#endif
 
     /* Size of the client data buffer. */
     int bufferLen;
     /* Number of bytes to write. */
     int replyLen;
+    /* File holding the reply - sent with sendfile when kernel TLS is used.
+     * -1 when not using kernel TLS. */
+    int replyFd;
+    /* Number of queued bytes at which a connection stops being served. */
+    int highWater;
+    /* Number of queued bytes at which a connection is served again. */
+    int lowWater;
 
     /* Number of connections handled. */
     int numConnections;
     /* Number of resumed connections handled. */
     int numResumed;
+    /* Number of connections that kernel TLS was used for. */
+    int numKtls;
+    /* Number of times a connection reached the high watermark. */
+    int numBlocked;
+    /* Maximum number of bytes queued for a connection. */
+    int maxQueued;
     /* Maximum number of connections to perform. */
     int maxConnections;
 
@@ -126,12 +214,18 @@ typedef struct SSLConn_CTX {
     double writeTime;
     /* Total time handling connections. */
     double totalTime;
+    /* Total CPU time - user and system - handling connections. */
+    double cpuTime;
 } SSLConn_CTX;
 
 
 static void SSLConn_Free(SSLConn_CTX* ctx);
 static void SSLConn_Close(SSLConn_CTX* ctx, SSLConn* sslConn);
 static void SSLConn_FreeSSLConn(SSLConn_CTX* ctx);
+static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn);
+#ifdef WOLFSSL_ASYNC_CRYPT
+static void SSLConn_AsyncDone(SSLConn_CTX* ctx, SSLConn* sslConn);
+#endif
 
 
 /* The index of the command line option. */
@@ -143,7 +237,11 @@ char* myoptarg = NULL;
 static int devId = INVALID_DEVID;
 #endif
 /* The data to reply with. */
-static char reply[NUM_WRITE_BYTES];
+static char* reply = NULL;
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+/* The index of the connection in the wolfSSL object's ex-data. */
+static int sslConnExDataIdx = -1;
+#endif
 
 
 /* Get the wolfSSL server method function for the specified version.
@@ -342,6 +440,12 @@ static SSLConn_CTX* SSLConn_New(int numConns, int bufferLen, int replyLen,
     ctx->maxConnections = maxConns;
     ctx->maxBytes = maxBytes;
     ctx->sslConn = NULL;
+    ctx->replyFd = -1;
+    ctx->highWater = WRITE_HIGH_WATER;
+    ctx->lowWater = WRITE_LOW_WATER;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    ctx->asyncPending = 0;
+#endif
 
 
 
@@ -354,6 +458,8 @@ static SSLConn_CTX* SSLConn_New(int numConns, int bufferLen, int replyLen,
  */
 static void SSLConn_Free(SSLConn_CTX* ctx)
 {
+    int i;
+
     if (ctx == NULL)
         return;
 
@@ -361,9 +467,131 @@ static void SSLConn_Free(SSLConn_CTX* ctx)
         SSLConn_Close(ctx, ctx->sslConn);
     SSLConn_FreeSSLConn(ctx);
 
+    if (ctx->slab != NULL) {
+        for (i = 0; i < ctx->numConns; i++) {
+            wolfSSL_free(ctx->slab[i].ssl);
+            free(ctx->slab[i].outQ.data);
+        }
+        free(ctx->slab);
+    }
+    free(ctx->arena);
+    if (ctx->replyFd != -1)
+        close(ctx->replyFd);
+
     free(ctx);
 }
 
+/* Create a slab of connections with wolfSSL objects that are reused.
+ * The read buffers of the connections are carved from one arena.
+ *
+ * ctx     The SSL/TLS connection data.
+ * sslCtx  The SSL/TLS context.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int SSLConn_SlabInit(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx)
+{
+    int    i;
+    size_t bufSz;
+
+    /* Keep each connection's buffer on its own cache lines. */
+    bufSz = (ctx->bufferLen + CACHE_LINE_SZ - 1) & ~(CACHE_LINE_SZ - 1);
+
+    ctx->slab = (SSLConn*)calloc(ctx->numConns, sizeof(*ctx->slab));
+    if (ctx->slab == NULL)
+        return EXIT_FAILURE;
+    if (posix_memalign((void**)&ctx->arena, CACHE_LINE_SZ,
+                       ctx->numConns * bufSz) != 0) {
+        ctx->arena = NULL;
+        return EXIT_FAILURE;
+    }
+    ctx->slabCtx = sslCtx;
+
+    /* Create all wolfSSL objects now and put all connections on the stack. */
+    for (i = ctx->numConns - 1; i >= 0; i--) {
+        SSLConn* conn = &ctx->slab[i];
+
+        if ((conn->ssl = wolfSSL_new(sslCtx)) == NULL) {
+            fprintf(stderr, "wolfSSL_new error.\n");
+            return EXIT_FAILURE;
+        }
+        conn->sockfd = -1;
+        conn->buffer = ctx->arena + i * bufSz;
+        conn->next = ctx->freeSlab;
+        ctx->freeSlab = conn;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Get an unused connection object.
+ * Taken from the slab, with its wolfSSL object, when pooling. Otherwise
+ * allocated without one - it is created once a client has been accepted.
+ *
+ * ctx  The SSL/TLS connection data.
+ * returns a connection object or NULL on error.
+ */
+static SSLConn* SSLConn_Get(SSLConn_CTX* ctx)
+{
+    SSLConn* conn;
+
+    if (ctx->slab != NULL) {
+        conn = ctx->freeSlab;
+        if (conn == NULL)
+            return NULL;
+        /* Replace a wolfSSL object that couldn't be created when put back. */
+        if (conn->ssl == NULL &&
+                (conn->ssl = wolfSSL_new(ctx->slabCtx)) == NULL) {
+            fprintf(stderr, "wolfSSL_new error.\n");
+            return NULL;
+        }
+        ctx->freeSlab = conn->next;
+        return conn;
+    }
+
+    conn = malloc(sizeof(*conn));
+    if (conn == NULL)
+        return NULL;
+    conn->ssl = NULL;
+    conn->buffer = NULL;
+    memset(&conn->outQ, 0, sizeof(conn->outQ));
+
+    return conn;
+}
+
+/* Put back a connection object that is no longer used.
+ * The wolfSSL object is reset and the connection returned to the slab when
+ * pooling, otherwise both are freed.
+ *
+ * ctx   The SSL/TLS connection data.
+ * conn  The connection object.
+ */
+static void SSLConn_Put(SSLConn_CTX* ctx, SSLConn* conn)
+{
+    if (ctx->slab == NULL) {
+        wolfSSL_free(conn->ssl);
+        free(conn->outQ.data);
+        free(conn);
+        return;
+    }
+
+    /* Keep the queue's buffer for the next connection. */
+    conn->outQ.start = 0;
+    conn->outQ.end = 0;
+
+#ifdef OPENSSL_EXTRA
+    if (wolfSSL_clear(conn->ssl) != WOLFSSL_SUCCESS)
+#endif
+    {
+        /* Can't reset the object for another connection - replace it.
+         * When that fails, it is created again when the connection is next
+         * taken from the slab. */
+        wolfSSL_free(conn->ssl);
+        conn->ssl = wolfSSL_new(ctx->slabCtx);
+    }
+    conn->next = ctx->freeSlab;
+    ctx->freeSlab = conn;
+}
+
 /* Close an active connection.
  *
  * ctx      The SSL/TLS connection data.
@@ -384,6 +612,8 @@ static void SSLConn_Close(SSLConn_CTX* ctx, SSLConn* sslConn)
 
     if (wolfSSL_session_reused(sslConn->ssl))
         ctx->numResumed++;
+    if (sslConn->ktls)
+        ctx->numKtls++;
     ctx->numConnections++;
 
     sslConn->state = CLOSED;
@@ -400,11 +630,11 @@ static void SSLConn_Close(SSLConn_CTX* ctx, SSLConn* sslConn)
     sslConn->next = ctx->freeSSLConn;
     sslConn->prev = NULL;
     ctx->freeSSLConn = sslConn;
-
-    ctx->cnt--;
 }
 
 /* Free the SSL/TLS connections that are closed.
+ * The count of active connections only drops here, when the connection
+ * objects are back in the slab and can be used by new connections.
  *
  * ctx  The connection data.
  */
@@ -417,18 +647,83 @@ static void SSLConn_FreeSSLConn(SSLConn_CTX* ctx)
     while (sslConn != NULL) {
         SSLConn* next = sslConn->next;
 
-        wolfSSL_free(sslConn->ssl);
+#ifdef WOLFSSL_ASYNC_CRYPT
+        /* Clear out any events. */
+        SSLConn_AsyncDone(ctx, sslConn);
+        while (wolfSSL_AsyncPoll(sslConn->ssl, WOLF_POLL_FLAG_CHECK_HW) == 1)
+             ;
+#endif
         close(sslConn->sockfd);
-        free(sslConn);
+        sslConn->sockfd = -1;
+        SSLConn_Put(ctx, sslConn);
+        ctx->cnt--;
 
         sslConn = next;
     }
 }
 
+#ifdef WOLFSSL_ASYNC_CRYPT
+/* Mark a connection as having an asynchronous operation outstanding.
+ * The event loop polls for completions, instead of waiting for events, while
+ * any connection is waiting.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ */
+static void SSLConn_AsyncPending(SSLConn_CTX* ctx, SSLConn* sslConn)
+{
+    if (sslConn->pending)
+        return;
+
+    sslConn->pending = 1;
+    ctx->asyncPending++;
+}
+
+/* Mark a connection as having no asynchronous operation outstanding.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ */
+static void SSLConn_AsyncDone(SSLConn_CTX* ctx, SSLConn* sslConn)
+{
+    if (!sslConn->pending)
+        return;
+
+    sslConn->pending = 0;
+    ctx->asyncPending--;
+}
+
+/* Find the connection that an asynchronous event completed for.
+ *
+ * ctx    The SSL/TLS connection data.
+ * event  The completed event.
+ * returns the SSL connection data object or NULL when not found.
+ */
+static SSLConn* SSLConn_FromEvent(SSLConn_CTX* ctx, WOLF_EVENT* event)
+{
+#ifdef HAVE_EX_DATA
+    (void)ctx;
+
+    return (SSLConn*)wolfSSL_get_ex_data((WOLFSSL*)event->context,
+                                         sslConnExDataIdx);
+#else
+    SSLConn* sslConn;
+
+    /* No ex-data - search the active connections. */
+    for (sslConn = ctx->sslConn; sslConn != NULL; sslConn = sslConn->next) {
+        if (sslConn->ssl == event->context)
+            break;
+    }
+
+    return sslConn;
+#endif
+}
+#endif
+
 /* Checks whether this run is done i.e. maximum number of connections or bytes
  * have been server.
  *
- * ctx  The SSL/TLS connection data.
+ * ctx      The SSL/TLS connection data.
  * returns 1 if the run is done or 0 otherwise.
  */
 static int SSLConn_Done(SSLConn_CTX* ctx) {
@@ -459,31 +754,48 @@ static int SSLConn_Accept(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx,
         return EXIT_FAILURE;
     }
 
-    conn = malloc(sizeof(*conn));
+    conn = SSLConn_Get(ctx);
     if (conn == NULL)
         return EXIT_FAILURE;
 
     /* Accept the client connection. */
     conn->sockfd = accept(sockfd, (struct sockaddr *)&clientAddr, &size);
     if (conn->sockfd == -1) {
-        free(conn);
+        SSLConn_Put(ctx, conn);
         fprintf(stderr, "ERROR: failed to accept\n");
         return EXIT_FAILURE;
     }
     /* Set the new socket to be non-blocking. */
     fcntl(conn->sockfd, F_SETFL, O_NONBLOCK);
 
-    /* Setup SSL/TLS connection. */
-    if ((conn->ssl = wolfSSL_new(sslCtx)) == NULL) {
+    /* Setup SSL/TLS connection - already done when pooling. */
+    if (conn->ssl == NULL && (conn->ssl = wolfSSL_new(sslCtx)) == NULL) {
         close(conn->sockfd);
-        free(conn);
+        SSLConn_Put(ctx, conn);
         fprintf(stderr, "wolfSSL_new error.\n");
         return EXIT_FAILURE;
     }
+
     /* Set the socket to communicate over into the wolfSSL object. */
     wolfSSL_set_fd(conn->ssl, conn->sockfd);
+    /* Encrypted data is sent, or queued, by the connection. */
+    wolfSSL_SetIOWriteCtx(conn->ssl, conn);
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+    /* Find the connection directly from the wolfSSL object of an event. */
+    wolfSSL_set_ex_data(conn->ssl, sslConnExDataIdx, conn);
+#endif
 
     conn->state = ACCEPT;
+    conn->ktls = 0;
+    conn->ktlsPending = 0;
+    conn->replyOff = 0;
+    conn->replySz = 0;
+    conn->efd = -1;
+    conn->watchWrite = 0;
+    conn->blocked = 0;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    conn->pending = 0;
+#endif
     conn->next = ctx->sslConn;
     conn->prev = NULL;
     if (ctx->sslConn != NULL)
@@ -497,6 +809,297 @@ static int SSLConn_Accept(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx,
     return EXIT_SUCCESS;
 }
 
+/* Get the number of bytes in the write queue.
+ *
+ * q  The write queue.
+ * returns the number of bytes waiting to be sent.
+ */
+static int WriteQueue_Len(WriteQueue* q)
+{
+    return q->end - q->start;
+}
+
+/* Add data to the end of the write queue, growing it as required.
+ *
+ * q     The write queue.
+ * data  The data to queue.
+ * len   The length of the data.
+ * returns 0 on success and -1 when memory allocation fails.
+ */
+static int WriteQueue_Add(WriteQueue* q, const char* data, int len)
+{
+    char* p;
+    int   size;
+
+    if (q->end + len > q->size) {
+        /* Move the unsent data to the front before growing. */
+        if (q->start > 0) {
+            memmove(q->data, q->data + q->start, q->end - q->start);
+            q->end -= q->start;
+            q->start = 0;
+        }
+        if (q->end + len > q->size) {
+            size = (q->size == 0) ? WRITE_QUEUE_SZ : q->size;
+            while (size < q->end + len)
+                size *= 2;
+            p = (char*)realloc(q->data, size);
+            if (p == NULL)
+                return -1;
+            q->data = p;
+            q->size = size;
+        }
+    }
+
+    memcpy(q->data + q->end, data, len);
+    q->end += len;
+
+    return 0;
+}
+
+/* Arm or disarm EPOLLOUT for the connection's socket.
+ * Only armed while there is data queued so that writable sockets don't wake
+ * the event loop.
+ *
+ * sslConn  The SSL connection data object.
+ * on       1 to wait for the socket to be writable and 0 otherwise.
+ */
+static void SSLConn_WatchWrite(SSLConn* sslConn, int on)
+{
+    struct epoll_event event;
+
+    if (sslConn->watchWrite == on || sslConn->efd == -1)
+        return;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLET | (on ? EPOLLOUT : 0);
+    event.data.ptr = sslConn;
+    if (epoll_ctl(sslConn->efd, EPOLL_CTL_MOD, sslConn->sockfd, &event) == -1) {
+        fprintf(stderr, "ERROR: failed to modify epoll event\n");
+        return;
+    }
+    sslConn->watchWrite = on;
+}
+
+/* Send callback for wolfSSL.
+ * Encrypted data the socket won't take is queued, rather than returning want
+ * write, so that a slow reader never stalls the event loop.
+ *
+ * ssl    The wolfSSL object.
+ * buf    The encrypted data to send.
+ * sz     The length of the data.
+ * ioCtx  The SSL connection data object.
+ * returns the number of bytes sent or queued, or a wolfSSL I/O error.
+ */
+static int SSLConn_IOSend(WOLFSSL* ssl, char* buf, int sz, void* ioCtx)
+{
+    SSLConn* sslConn = (SSLConn*)ioCtx;
+    ssize_t  sent = 0;
+
+    (void)ssl;
+
+    /* Send directly only when nothing is queued to keep the data in order. */
+    if (WriteQueue_Len(&sslConn->outQ) == 0) {
+        sent = send(sslConn->sockfd, buf, sz, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EPIPE || errno == ECONNRESET)
+                return WOLFSSL_CBIO_ERR_CONN_CLOSE;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return WOLFSSL_CBIO_ERR_GENERAL;
+            sent = 0;
+        }
+        if (sent == sz)
+            return sz;
+    }
+
+    if (WriteQueue_Add(&sslConn->outQ, buf + sent, sz - (int)sent) != 0)
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    SSLConn_WatchWrite(sslConn, 1);
+
+    return sz;
+}
+
+#ifdef ATOMIC_USER
+/* Install the traffic keys of one direction into kernel TLS.
+ * Only TLS 1.2 with AES-GCM is supported. After the handshake exactly one
+ * record, Finished, has been protected in each direction so the next record
+ * sequence number is 1.
+ *
+ * ssl     The wolfSSL object that has completed the handshake.
+ * sockfd  The socket of the connection.
+ * dir     The direction - TLS_TX or TLS_RX.
+ * returns 0 on success and -1 otherwise.
+ */
+static int Ktls_SetKeys(WOLFSSL* ssl, int sockfd, int dir)
+{
+    union {
+        struct tls12_crypto_info_aes_gcm_128 gcm128;
+        struct tls12_crypto_info_aes_gcm_256 gcm256;
+    } info;
+    socklen_t            len;
+    const unsigned char* key;
+    const unsigned char* iv;
+    unsigned char        seq[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    int                  ret;
+
+    if (dir == TLS_TX) {
+        key = wolfSSL_GetServerWriteKey(ssl);
+        iv = wolfSSL_GetServerWriteIV(ssl);
+    }
+    else {
+        key = wolfSSL_GetClientWriteKey(ssl);
+        iv = wolfSSL_GetClientWriteIV(ssl);
+    }
+    if (key == NULL || iv == NULL)
+        return -1;
+
+    memset(&info, 0, sizeof(info));
+    switch (wolfSSL_GetKeySize(ssl)) {
+        case TLS_CIPHER_AES_GCM_128_KEY_SIZE:
+            info.gcm128.info.version = TLS_1_2_VERSION;
+            info.gcm128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+            memcpy(info.gcm128.key, key, TLS_CIPHER_AES_GCM_128_KEY_SIZE);
+            memcpy(info.gcm128.salt, iv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+            memcpy(info.gcm128.iv, seq, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+            memcpy(info.gcm128.rec_seq, seq,
+                   TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+            len = sizeof(info.gcm128);
+            break;
+        case TLS_CIPHER_AES_GCM_256_KEY_SIZE:
+            info.gcm256.info.version = TLS_1_2_VERSION;
+            info.gcm256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+            memcpy(info.gcm256.key, key, TLS_CIPHER_AES_GCM_256_KEY_SIZE);
+            memcpy(info.gcm256.salt, iv, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+            memcpy(info.gcm256.iv, seq, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+            memcpy(info.gcm256.rec_seq, seq,
+                   TLS_CIPHER_AES_GCM_256_REC_SEQ_SIZE);
+            len = sizeof(info.gcm256);
+            break;
+        default:
+            return -1;
+    }
+
+    ret = setsockopt(sockfd, SOL_TLS, dir, &info, len);
+    memset(&info, 0, sizeof(info));
+
+    return ret;
+}
+
+/* Hand the encryption of the connection over to kernel TLS.
+ * Connections that cannot use kernel TLS continue to use wolfSSL. Reads
+ * continue to use wolfSSL when the kernel can only encrypt.
+ *
+ * sslConn  The SSL connection data object that has completed the handshake.
+ */
+static void SSLConn_KtlsEnable(SSLConn* sslConn)
+{
+    WOLFSSL* ssl = sslConn->ssl;
+
+    if (wolfSSL_GetVersion(ssl) != WOLFSSL_TLSV1_2 ||
+            wolfSSL_GetBulkCipher(ssl) != wolfssl_aes_gcm) {
+        return;
+    }
+
+    if (setsockopt(sslConn->sockfd, SOL_TCP, TCP_ULP, "tls",
+                   sizeof("tls")) < 0) {
+        return;
+    }
+    if (Ktls_SetKeys(ssl, sslConn->sockfd, TLS_TX) < 0)
+        return;
+    sslConn->ktls = KTLS_TX;
+    /* Records wolfSSL has already read, e.g. application data sent right
+     * behind the client's Finished, would be lost to the kernel - keep
+     * reading with wolfSSL. */
+    if (wolfSSL_has_pending(ssl))
+        return;
+    if (Ktls_SetKeys(ssl, sslConn->sockfd, TLS_RX) == 0)
+        sslConn->ktls |= KTLS_RX;
+}
+
+/* Read data from a client through kernel TLS.
+ * A record that isn't application data, e.g. a close_notify alert, ends the
+ * connection.
+ *
+ * sslConn     The SSL connection data object.
+ * buffer      The buffer to place client data into.
+ * len         The length of the buffer.
+ * totalBytes  The total number of bytes read from clients.
+ * readTime    The amount of time spent reading data from client.
+ * returns 0 on failure, 1 on success and 2 on want read.
+ */
+static int Ktls_Read(SSLConn* sslConn, char* buffer, int len, int* totalBytes,
+                     double* readTime)
+{
+    char            cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr* cmsg;
+    ssize_t         ret;
+    double          start;
+
+    iov.iov_base = buffer;
+    iov.iov_len = len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    start = current_time(1);
+    ret = recvmsg(sslConn->sockfd, &msg, 0);
+    *readTime += current_time(0) - start;
+    if (ret < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 2 : 0;
+    if (ret == 0)
+        return 0;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_TLS &&
+            cmsg->cmsg_type == TLS_GET_RECORD_TYPE &&
+            *(unsigned char*)CMSG_DATA(cmsg) != TLS_APP_DATA) {
+        return 0;
+    }
+
+    *totalBytes += (int)ret;
+    return 1;
+}
+
+/* Write the reply to a client from the file with sendfile - encrypted by
+ * kernel TLS without copying the data into user space.
+ * The length of a reply is fixed when it starts and later calls continue it.
+ *
+ * sslConn     The SSL connection data object.
+ * replyFd     The file holding the reply.
+ * replyLen    The length of the data to send to the client.
+ * totalBytes  The total number of bytes sent to clients.
+ * writeTime   The amount of time spent writing data to client.
+ * returns 0 on failure, 1 on success and 3 on want write.
+ */
+static int Ktls_Write(SSLConn* sslConn, int replyFd, int replyLen,
+                      int* totalBytes, double* writeTime)
+{
+    ssize_t ret;
+    double  start;
+
+    if (sslConn->replySz == 0)
+        sslConn->replySz = replyLen;
+
+    start = current_time(1);
+    ret = sendfile(sslConn->sockfd, replyFd, &sslConn->replyOff,
+                   sslConn->replySz - sslConn->replyOff);
+    *writeTime += current_time(0) - start;
+    if (ret < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 3 : 0;
+
+    *totalBytes += (int)ret;
+    if (sslConn->replyOff < sslConn->replySz)
+        return 3;
+
+    sslConn->replyOff = 0;
+    sslConn->replySz = 0;
+    return 1;
+}
+#endif
+
 /* Read/write from/to client at the specified socket.
  *
  * ctx      The SSL/TLS connection data.
@@ -505,7 +1108,7 @@ static int SSLConn_Accept(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx,
  */
 static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
 {
-    int ret;
+    int ret = 0;
     int len;
 
     switch (sslConn->state) {
@@ -520,12 +1123,41 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
 
             if (ret == 1) {
                 sslConn->state = READ;
+#ifdef ATOMIC_USER
+                /* Queued handshake records are already encrypted - the
+                 * kernel would encrypt them again. */
+                if (ctx->replyFd != -1) {
+                    if (WriteQueue_Len(&sslConn->outQ) == 0)
+                        SSLConn_KtlsEnable(sslConn);
+                    else
+                        sslConn->ktlsPending = 1;
+                }
+#endif
             }
             break;
 
         case READ:
             {
-                char buffer[NUM_READ_BYTES];
+                char  stackBuffer[NUM_READ_BYTES];
+                char* buffer = stackBuffer;
+
+                /* wolfSSL mustn't protect any records before kernel TLS
+                 * takes over. */
+                if (sslConn->ktlsPending)
+                    break;
+                /* Stop taking requests until the client reads the replies. */
+                if (sslConn->blocked ||
+                        WriteQueue_Len(&sslConn->outQ) >= ctx->highWater) {
+                    if (!sslConn->blocked) {
+                        sslConn->blocked = 1;
+                        ctx->numBlocked++;
+                    }
+                    break;
+                }
+
+                /* Use the connection's buffer from the arena when pooled. */
+                if (sslConn->buffer != NULL)
+                    buffer = sslConn->buffer;
 
                 len = ctx->bufferLen;
                 if (ctx->maxBytes > 0) {
@@ -535,6 +1167,13 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
                     break;
 
                 /* Read application data. */
+#ifdef ATOMIC_USER
+                if (sslConn->ktls & KTLS_RX) {
+                    ret = Ktls_Read(sslConn, buffer, len,
+                                    &ctx->totalReadBytes, &ctx->readTime);
+                }
+                else
+#endif
                 ret = SSL_Read(sslConn->ssl, buffer, len, &ctx->totalReadBytes,
                                &ctx->readTime);
                 if (ret == 0) {
@@ -552,10 +1191,18 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
             if (ctx->maxBytes > 0) {
                 len = min(len, ctx->maxBytes - ctx->totalWriteBytes);
             }
-            if (len == 0)
+            /* A reply already started with sendfile is finished. */
+            if (len == 0 && sslConn->replySz == 0)
                 break;
 
             /* Write application data. */
+#ifdef ATOMIC_USER
+            if (sslConn->ktls & KTLS_TX) {
+                ret = Ktls_Write(sslConn, ctx->replyFd, len,
+                                 &ctx->totalWriteBytes, &ctx->writeTime);
+            }
+            else
+#endif
             ret = SSL_Write(sslConn->ssl, reply, len, &ctx->totalWriteBytes,
                             &ctx->writeTime);
             if (ret == 0) {
@@ -563,6 +1210,11 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
                 SSLConn_Close(ctx, sslConn);
                 return EXIT_FAILURE;
             }
+            if (WriteQueue_Len(&sslConn->outQ) > ctx->maxQueued)
+                ctx->maxQueued = WriteQueue_Len(&sslConn->outQ);
+            /* Continue sending the reply when the socket is writable. */
+            if (ret == 3)
+                SSLConn_WatchWrite(sslConn, 1);
 
             if (ret == 1)
                 sslConn->state = READ;
@@ -572,12 +1224,103 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
             break;
     }
 
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Wake up the event loop to poll for the completion. */
+    if (ret == 4)
+        SSLConn_AsyncPending(ctx, sslConn);
+#endif
+
     return EXIT_SUCCESS;
 }
 
+/* Send the queued data now that the socket is writable.
+ * EPOLLOUT is disarmed once the queue is empty. The connection is served
+ * again once the queue has drained to the low watermark.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ */
+static void SSLConn_Flush(SSLConn_CTX* ctx, SSLConn* sslConn)
+{
+    WriteQueue* q = &sslConn->outQ;
+    ssize_t     sent;
+
+    if (sslConn->state == CLOSED)
+        return;
+
+    while (q->start < q->end) {
+        sent = send(sslConn->sockfd, q->data + q->start, q->end - q->start,
+                    MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            SSLConn_Close(ctx, sslConn);
+            return;
+        }
+        q->start += (int)sent;
+    }
+    if (q->start == q->end) {
+        q->start = 0;
+        q->end = 0;
+        SSLConn_WatchWrite(sslConn, 0);
+    }
+
+#ifdef ATOMIC_USER
+    /* The handshake has been sent - hand over to kernel TLS and serve any
+     * request that arrived meanwhile. */
+    if (sslConn->ktlsPending && WriteQueue_Len(q) == 0) {
+        sslConn->ktlsPending = 0;
+        SSLConn_KtlsEnable(sslConn);
+        SSLConn_ReadWrite(ctx, sslConn);
+        return;
+    }
+#endif
+
+    /* Continue a blocked connection or a reply that didn't complete. */
+    if (WriteQueue_Len(q) <= ctx->lowWater &&
+            (sslConn->blocked || sslConn->state == WRITE)) {
+        sslConn->blocked = 0;
+        SSLConn_ReadWrite(ctx, sslConn);
+    }
+}
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+/* Poll for completed asynchronous operations and continue the connections.
+ *
+ * ctx     The SSL/TLS connection data.
+ * sslCtx  The SSL/TLS context.
+ */
+static void SSLConn_AsyncPoll(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx)
+{
+    int         i;
+    int         n;
+    double      start;
+    WOLF_EVENT* wolfEvents[MAX_WOLF_EVENTS];
+    SSLConn*    sslConn;
+
+    do {
+        start = current_time(1);
+        if (wolfSSL_CTX_AsyncPoll(sslCtx, wolfEvents, MAX_WOLF_EVENTS,
+                                  WOLF_POLL_FLAG_CHECK_HW, &n) < 0) {
+            n = 0;
+        }
+        ctx->asyncTime += current_time(0) - start;
+
+        for (i = 0; i < n; i++) {
+            sslConn = SSLConn_FromEvent(ctx, wolfEvents[i]);
+            if (sslConn == NULL)
+                continue;
+
+            SSLConn_AsyncDone(ctx, sslConn);
+            SSLConn_ReadWrite(ctx, sslConn);
+        }
+    } while (n > 0);
+}
+#endif
+
 /* Print the connection statistics.
  *
- * ctx  The SSL/TLS connection data.
+ * ctx      The SSL/TLS connection data.
  */
 static void SSLConn_PrintStats(SSLConn_CTX* ctx)
 {
@@ -622,6 +1365,22 @@ static void SSLConn_PrintStats(SSLConn_CTX* ctx)
             ctx->totalReadBytes / ctx->readTime / 1024 / 1024,
             ctx->writeTime * 1000,
             ctx->totalWriteBytes / ctx->writeTime / 1024 / 1024 );
+    fprintf(stderr,
+            "\tWrite Blocked     : %9d times\n"
+            "\tMax Write Queue   : %9d bytes\n",
+            ctx->numBlocked, ctx->maxQueued);
+    fprintf(stderr,
+            "\tCPU               : %9.3f ms (%9.3f %%)\n"
+            "\tCPU per Gbit      : %9.3f ms\n",
+            ctx->cpuTime * 1000,
+            ctx->cpuTime * 100 / ctx->totalTime,
+            ctx->totalWriteBytes == 0 ? 0 : ctx->cpuTime * 1000 /
+                ((double)ctx->totalWriteBytes * 8 / 1000000000));
+    if (ctx->replyFd != -1) {
+        fprintf(stderr,
+                "\tKernel TLS Conns  : %9d of %d\n",
+                ctx->numKtls, ctx->numConnections);
+    }
 }
 
 
@@ -697,6 +1456,9 @@ static int WolfSSLCtx_Init(int version, int allowDowngrade, char* cert,
     SetDHCtx(ctx);
 #endif
 
+    /* Queue encrypted data when the socket isn't writable. */
+    wolfSSL_CTX_SetIOSend(ctx, SSLConn_IOSend);
+
     *wolfsslCtx = ctx;
     return EXIT_SUCCESS;
 }
@@ -713,6 +1475,50 @@ static void WolfSSLCtx_Final(WOLFSSL_CTX* ctx)
 #endif
 }
 
+/* Get the CPU time, user and system, used by the process.
+ *
+ * returns the CPU time in seconds.
+ */
+static double CpuTime(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
+#ifdef ATOMIC_USER
+/* Create an unlinked file holding the reply to send with sendfile.
+ *
+ * reply     The data to reply with.
+ * replyLen  The length of the reply.
+ * returns the file descriptor or -1 on error.
+ */
+static int ReplyFile(char* reply, int replyLen)
+{
+    FILE* file;
+    int   fd;
+
+    file = tmpfile();
+    if (file == NULL)
+        return -1;
+    if (fwrite(reply, 1, replyLen, file) != (size_t)replyLen ||
+            fflush(file) != 0) {
+        fclose(file);
+        return -1;
+    }
+
+    /* Keep a descriptor of its own as the stream is closed. */
+    fd = dup(fileno(file));
+    fclose(file);
+
+    return fd;
+}
+#endif
+
 /* Create a random reply.
  *
  * reply     The buffer to put the random data into.
@@ -808,6 +1614,14 @@ static void Usage(void)
     printf("-R <num>    <num> bytes read from client\n");
     printf("-W <num>    <num> bytes written to client\n");
     printf("-B <num>    Benchmark <num> written bytes\n");
+    printf("-P          Pool connections and wolfSSL objects\n");
+    printf("-H <num>    Stop serving a client with <num> bytes queued, default %d\n",
+                                 WRITE_HIGH_WATER);
+    printf("-L <num>    Serve a client again at <num> bytes queued, default %d\n",
+                                 WRITE_LOW_WATER);
+#ifdef ATOMIC_USER
+    printf("-K          Use kernel TLS and sendfile after handshake (TLS 1.2 AES-GCM)\n");
+#endif
 }
 
 /* Main entry point for the program.
@@ -840,8 +1654,11 @@ int main(int argc, char* argv[])
     int                 maxBytes      = MAX_BYTES;
     int                 maxConns      = MAX_CONNECTIONS;
     int                 numClients    = NUM_CLIENTS;
+    int                 usePool       = 0;
+    int                 useKtls       = 0;
+    int                 highWater     = WRITE_HIGH_WATER;
+    int                 lowWater      = WRITE_LOW_WATER;
 #ifdef WOLFSSL_ASYNC_CRYPT
-    WOLF_EVENT*         wolfEvents[MAX_WOLF_EVENTS];
 #endif
 
     /* Parse the command line arguments. */
@@ -936,6 +1753,34 @@ int main(int argc, char* argv[])
                 maxConns = 0;
                 break;
 
+            /* Pool connections and wolfSSL objects. */
+            case 'P':
+                usePool = 1;
+                break;
+
+            /* Use kernel TLS and sendfile after the handshake. */
+            case 'K':
+                useKtls = 1;
+                break;
+
+            /* Number of queued bytes to stop serving a client at. */
+            case 'H':
+                highWater = atoi(myoptarg);
+                if (highWater <= 0) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
+            /* Number of queued bytes to serve a client again at. */
+            case 'L':
+                lowWater = atoi(myoptarg);
+                if (lowWater < 0) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
             /* Unrecognized command line argument. */
             default:
                 Usage();
@@ -943,6 +1788,11 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (lowWater > highWater) {
+        fprintf(stderr, "ERROR: low watermark above high watermark\n");
+        exit(MY_EX_USAGE);
+    }
+
     /* Allocate space for EPOLL events to be stored. */
     events = (struct epoll_event*)malloc(EPOLL_NUM_EVENTS * sizeof(*events));
     if (events == NULL)
@@ -955,18 +1805,50 @@ int main(int argc, char* argv[])
     /* Initialize wolfSSL */
     wolfSSL_Init();
 
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+    /* Reserve an ex-data index to store the connection against. */
+    sslConnExDataIdx = wolfSSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    if (sslConnExDataIdx < 0) {
+        fprintf(stderr, "ERROR: failed to get ex-data index\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
     /* Initialize wolfSSL and create a context object. */
     if (WolfSSLCtx_Init(version, allowDowngrade, ourCert, ourKey, verifyCert, cipherList, &ctx)
             == -1)
         exit(EXIT_FAILURE);
 
-    RandomReply(reply, sizeof(reply));
+    reply = (char*)malloc(numBytesWrite);
+    if (reply == NULL)
+        exit(EXIT_FAILURE);
+    RandomReply(reply, numBytesWrite);
 
     /* Create SSL/TLS connection data object. */
     sslConnCtx = SSLConn_New(numConns, numBytesRead, numBytesWrite,
                               maxConns, maxBytes);
     if (sslConnCtx == NULL)
         exit(EXIT_FAILURE);
+    sslConnCtx->highWater = highWater;
+    sslConnCtx->lowWater = lowWater;
+
+    if (useKtls) {
+#ifdef ATOMIC_USER
+        sslConnCtx->replyFd = ReplyFile(reply, numBytesWrite);
+        if (sslConnCtx->replyFd == -1) {
+            fprintf(stderr, "ERROR: failed to create reply file\n");
+            exit(EXIT_FAILURE);
+        }
+#else
+        fprintf(stderr, "Kernel TLS not used - needs ATOMIC_USER\n");
+#endif
+    }
+
+    /* Create all connections and wolfSSL objects up front. */
+    if (usePool && SSLConn_SlabInit(sslConnCtx, ctx) != EXIT_SUCCESS) {
+        fprintf(stderr, "ERROR: failed to create connection pool\n");
+        exit(EXIT_FAILURE);
+    }
 
     /* Create a socket and listen for a client. */
     if (CreateSocketListen(port, numClients, &socketfd) == EXIT_FAILURE)
@@ -994,40 +1876,19 @@ int main(int argc, char* argv[])
     while (!SSLConn_Done(sslConnCtx)) {
         int n;
         int i;
+        int timeout = -1;
 
 #ifdef WOLFSSL_ASYNC_CRYPT
-        do {
-            double start = current_time(1);
-            ret = wolfSSL_CTX_AsyncPoll(ctx, wolfEvents, MAX_WOLF_EVENTS,
-                                        WOLF_POLL_FLAG_CHECK_HW, &n);
-            sslConnCtx->asyncTime += current_time(0) - start;
-            for (i = 0; i < n; i++) {
-                SSLConn* sslConn = sslConnCtx->sslConn;
-
-                while (sslConn != NULL) {
-                    if (sslConn->ssl != wolfEvents[i]->context) {
-                        sslConn = sslConn->next;
-                        continue;
-                    }
-
-                    SSLConn_ReadWrite(sslConnCtx, sslConn);
-                    break;
-                }
-            }
-        } while (n > 0);
+        /* Don't wait when polling for completions. */
+        if (sslConnCtx->asyncPending > 0)
+            timeout = 0;
 #endif
-
-#ifdef WOLFSSL_ASYNC_CRYPT
-        /* Look for events. */
-        n = epoll_wait(efd, events, EPOLL_NUM_EVENTS, 0);
-#else
         /* Wait for events. */
-        n = epoll_wait(efd, events, EPOLL_NUM_EVENTS, -1);
-#endif
+        n = epoll_wait(efd, events, EPOLL_NUM_EVENTS, timeout);
         /* Process all returned events. */
         for (i = 0; i < n; i++) {
             /* Error event on socket. */
-            if (!(events[i].events & EPOLLIN)) {
+            if (!(events[i].events & (EPOLLIN | EPOLLOUT))) {
                 if (events[i].data.ptr == NULL) {
                     /* Not a client, therefore the listening connection. */
                     close(socketfd);
@@ -1055,6 +1916,7 @@ int main(int argc, char* argv[])
                         fprintf(stderr, "ERROR: failed add event to epoll\n");
                         exit(EXIT_FAILURE);
                     }
+                    sslConn->efd = efd;
                 }
 
                 if (sslConnCtx->cnt == sslConnCtx->numConns) {
@@ -1068,12 +1930,24 @@ int main(int argc, char* argv[])
                 }
             }
             else {
-                if (sslConnCtx->totalTime == 0)
+                if (sslConnCtx->totalTime == 0) {
                     sslConnCtx->totalTime = current_time(1);
-                SSLConn_ReadWrite(sslConnCtx, events[i].data.ptr);
+                    sslConnCtx->cpuTime = CpuTime();
+                }
+                /* Send queued data before serving more of the client. */
+                if (events[i].events & EPOLLOUT)
+                    SSLConn_Flush(sslConnCtx, events[i].data.ptr);
+                if (events[i].events & EPOLLIN)
+                    SSLConn_ReadWrite(sslConnCtx, events[i].data.ptr);
             }
         }
 
+#ifdef WOLFSSL_ASYNC_CRYPT
+        /* Continue the connections whose asynchronous operations completed. */
+        if (sslConnCtx->asyncPending > 0)
+            SSLConn_AsyncPoll(sslConnCtx, ctx);
+#endif
+
         SSLConn_FreeSSLConn(sslConnCtx);
 
         /* Accept more connections again up to the maximum concurrent. */
@@ -1089,6 +1963,7 @@ int main(int argc, char* argv[])
     }
 
     sslConnCtx->totalTime = current_time(0) - sslConnCtx->totalTime;
+    sslConnCtx->cpuTime = CpuTime() - sslConnCtx->cpuTime;
 
     if (socketfd != -1)
         close(socketfd);
@@ -1098,6 +1973,7 @@ int main(int argc, char* argv[])
     SSLConn_Free(sslConnCtx);
 
     WolfSSLCtx_Final(ctx);
+    free(reply);
 
     wolfSSL_Cleanup();
 
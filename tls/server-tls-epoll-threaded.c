@@ -23,10 +23,20 @@
  * handle a large number of connections in multiple threads.
 */
 
+/* Needed for setting the CPU affinity of threads. */
+#ifndef _GNU_SOURCE
+    #define _GNU_SOURCE
+#endif
+#include <sched.h>
 #include <sys/epoll.h>
+#include <linux/filter.h>
 
 #include <wolfssl/options.h>
 #include <wolfssl/ssl.h>
+#ifdef HAVE_SESSION_TICKET
+    #include <wolfssl/wolfcrypt/hmac.h>
+    #include <wolfssl/wolfcrypt/aes.h>
+#endif
 
 #include <wolfssl/test.h>
 
@@ -51,9 +61,34 @@
 #define NUM_CLIENTS      100
 /* The number of wolfSSL events to accept and process at one time. */
 #define MAX_WOLF_EVENTS  10
+/* The size of a CPU cache line in bytes. */
+#define CACHE_LINE_SZ    64
+/* The number of linear sub-buckets per power of two in a histogram. */
+#define LATENCY_SUB_BUCKETS  8
+/* The number of buckets in a latency histogram - over an hour in us. */
+#define LATENCY_NUM_BUCKETS  256
+/* The initial size of a connection's queue of data waiting to be sent. */
+#define WRITE_QUEUE_SZ       16384
+/* The default number of queued bytes at which a connection stops being
+ * served. */
+#define WRITE_HIGH_WATER     (256 * 1024)
+/* The default number of queued bytes at which a connection is served again. */
+#define WRITE_LOW_WATER      (64 * 1024)
+/* The number of shards of the shared session cache - power of 2. */
+#define SESS_CACHE_SHARDS    16
+/* The number of rows in each shard of the shared session cache. */
+#define SESS_CACHE_ROWS      256
+/* The number of sessions in each row of the shared session cache. */
+#define SESS_CACHE_WAYS      4
+/* The maximum size of a session id. */
+#define SESS_ID_SZ           32
+/* The default number of seconds a session ticket key encrypts tickets for. */
+#define TICKET_KEY_PERIOD    3600
+/* The size of the secret that session ticket keys are derived from. */
+#define TICKET_SECRET_SZ     32
 
 /* The command line options. */
-#define OPTIONS          "?p:v:al:c:k:A:t:n:N:R:W:B:"
+#define OPTIONS          "?p:v:al:c:k:A:t:n:N:R:W:B:sSPCK:T:H:L:"
 
 /* The default server certificate. */
 #define SVR_CERT "../certs/server-cert.pem"
@@ -65,6 +100,18 @@
 /* The states of the SSL connection. */
 typedef enum SSLState { ACCEPT, READ, WRITE, CLOSED } SSLState;
 
+/* Queue of encrypted data waiting for the socket to be writable. */
+typedef struct WriteQueue {
+    /* Buffer holding the queued data. */
+    char* data;
+    /* Size of the buffer. */
+    int size;
+    /* Offset of the first byte not yet sent. */
+    int start;
+    /* Offset after the last byte queued. */
+    int end;
+} WriteQueue;
+
 /* Type for the SSL connection data. */
 typedef struct SSLConn SSLConn;
 
@@ -74,14 +121,120 @@ struct SSLConn {
     int sockfd;
     /* The wolfSSL object to perform TLS communications. */
     WOLFSSL* ssl;
+    /* Buffer to read client data into - from arena when pooled. */
+    char* buffer;
     /* The current state of the SSL/TLS connection. */
     SSLState state;
+    /* Time the TCP connection was accepted. */
+    double start;
+    /* Encrypted data that the socket would not take yet. */
+    WriteQueue outQ;
+    /* The EPOLL file descriptor of the thread the socket is registered with. */
+    int efd;
+    /* EPOLLOUT is armed for the socket. */
+    int watchWrite;
+    /* Not served until the queue drains to the low watermark. */
+    int blocked;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* An asynchronous operation is outstanding. */
+    int pending;
+#endif
     /* Previous SSL connection data object. */
     SSLConn* prev;
     /* Next SSL connection data object. */
     SSLConn* next;
 };
 
+/* Histogram of latencies in microseconds.
+ * Buckets are a power of two wide with linear sub-buckets within.
+ */
+typedef struct Latency {
+    /* Count of samples in each bucket. */
+    word32 bucket[LATENCY_NUM_BUCKETS];
+    /* Number of samples. */
+    word32 count;
+    /* Largest sample seen in microseconds. */
+    word32 max;
+} Latency;
+
+#ifdef HAVE_EXT_CACHE
+/* A session in the shared session cache. */
+typedef struct SessEntry {
+    /* The session id. */
+    byte id[SESS_ID_SZ];
+    /* The length of the session id. */
+    int idLen;
+    /* The session encoded to DER. NULL when entry not used. */
+    byte* der;
+    /* The length of the encoded session. */
+    int derLen;
+    /* Shard's store count when stored - oldest is replaced. */
+    word32 stored;
+} SessEntry;
+
+/* A shard of the shared session cache with its own lock. */
+typedef struct SessShard {
+    /* Lock for the sessions of the shard. */
+    pthread_mutex_t lock;
+    /* Count of sessions stored in shard. */
+    word32 numStored;
+    /* Rows of sessions - row chosen by hash of session id. */
+    SessEntry entry[SESS_CACHE_ROWS][SESS_CACHE_WAYS];
+} __attribute__((aligned(CACHE_LINE_SZ))) SessShard;
+
+/* The session cache shared by the threads. */
+typedef struct SessCache {
+    /* The shards - chosen by hash of session id. */
+    SessShard shard[SESS_CACHE_SHARDS];
+    /* Number of lookups - updated atomically. */
+    int lookups;
+    /* Number of lookups that found the session - updated atomically. */
+    int hits;
+} SessCache;
+#endif
+
+/* Statistics of a thread.
+ * Only updated by the owning thread and merged when printing.
+ * Aligned to a cache line so that threads don't share lines.
+ */
+typedef struct ThreadStats {
+    /* Number of connections handled by this thread. */
+    int numConnections;
+    /* Number of resumed connections handled by this thread. */
+    int numResumed;
+    /* Number of times a connection reached the high watermark. */
+    int numBlocked;
+    /* Maximum number of bytes queued for a connection. */
+    int maxQueued;
+
+    /* Number of bytes read by this thread. */
+    int totalReadBytes;
+    /* Number of bytes written by this thread. */
+    int totalWriteBytes;
+
+    /* Time handling accepts in this thread. */
+    double acceptTime;
+    /* Time handling accepts in this thread - resumed connections. */
+    double resumeTime;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Time handling asynchronous operations in this thread. */
+    double asyncTime;
+#endif
+    /* Time handling reading in this thread. */
+    double readTime;
+    /* Time handling writing in this thread. */
+    double writeTime;
+    /* Time this thread spent handling connections. */
+    double totalTime;
+
+    /* Time from TCP accept to handshake complete. */
+    Latency handshake;
+    /* Time of each read call. */
+    Latency read;
+    /* Time of each write call. */
+    Latency write;
+} __attribute__((aligned(CACHE_LINE_SZ))) ThreadStats;
+
 /* SSL connection data for a thread. */
 typedef struct ThreadData {
     /* The SSL/TLS context for all connections in thread. */
@@ -92,13 +245,34 @@ typedef struct ThreadData {
     SSLConn *sslConn;
     /* Free list. */
     SSLConn *freeSSLConn;
+    /* Slab of connections with wolfSSL objects when pooling. */
+    SSLConn *slab;
+    /* Arena that the read buffers of the slab's connections are in. */
+    char *arena;
+    /* Stack of unused connections in slab. */
+    SSLConn *freeSlab;
     /* The number of active SSL connections.  */
     int cnt;
     /* Accepting new connections. */
     int accepting;
+    /* The socket listening on for new connections. */
+    socklen_t socketfd;
+    /* The CPU to run on or -1 when not pinned. */
+    int cpu;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Number of connections with an asynchronous operation outstanding. */
+    int asyncPending;
+#endif
 
     /* The thread id for the handler. */
     pthread_t thread_id;
+#ifdef HAVE_SESSION_TICKET
+    /* Random number generator for session ticket IVs. */
+    WC_RNG rng;
+#endif
+
+    /* Statistics of connections handled by this thread. */
+    ThreadStats stats;
 } ThreadData;
 
 /* The information about SSL/TLS connections. */
@@ -115,32 +289,18 @@ typedef struct SSLConn_CTX {
     /* Number of bytes to write. */
     int replyLen;
 
-    /* Number of connections handled. */
-    int numConnections;
-    /* Number of resumed connections handled. */
-    int numResumed;
     /* Maximum number of connections to perform. */
     int maxConnections;
-
-    /* Total number of bytes read. */
-    int totalReadBytes;
-    /* Total number of bytes written. */
-    int totalWriteBytes;
     /* Maximum number of bytes to read/write. */
     int maxBytes;
 
-    /* Total time handling accepts. */
-    double acceptTime;
-    /* Total time handling accepts - resumed connections. */
-    double resumeTime;
-#ifdef WOLFSSL_ASYNC_CRYPT
-    /* Total time handling asynchronous operations. */
-    double asyncTime;
-#endif
-    /* Total time handling reading. */
-    double readTime;
-    /* Total time handling writing. */
-    double writeTime;
+    /* Number of connections closed - updated atomically to check done. */
+    int doneConnections;
+    /* Number of bytes read - updated atomically only when maxBytes used. */
+    int doneReadBytes;
+    /* Number of bytes written - updated atomically only when maxBytes used. */
+    int doneWriteBytes;
+
     /* Total time handling connections. */
     double totalTime;
 } SSLConn_CTX;
@@ -150,7 +310,13 @@ static void SSLConn_Free(SSLConn_CTX* ctx);
 static void SSLConn_Close(SSLConn_CTX* ctx, ThreadData* threadData,
     SSLConn* sslConn);
 static void SSLConn_FreeSSLConn(ThreadData* threadData);
+static void SSLConn_SlabFree(SSLConn_CTX* ctx, ThreadData* threadData);
 static void WolfSSLCtx_Final(ThreadData* threadData);
+static int SSLConn_ReadWrite(SSLConn_CTX* ctx, ThreadData* threadData,
+                             SSLConn* sslConn);
+#ifdef WOLFSSL_ASYNC_CRYPT
+static void SSLConn_AsyncDone(ThreadData* threadData, SSLConn* sslConn);
+#endif
 
 
 /* The index of the command line option. */
@@ -162,7 +328,7 @@ static char reply[NUM_WRITE_BYTES];
 
 /* Global SSL/TLS connection data context. */
 static SSLConn_CTX* sslConnCtx   = NULL;
-/* Mutex for using connection count.  */
+/* Mutex for setting the start time.  */
 static pthread_mutex_t sslConnMutex = PTHREAD_MUTEX_INITIALIZER;
 /* The port to listen on. */
 static word16       port          = DEFAULT_PORT;
@@ -192,6 +358,34 @@ static int          numBytesWrite = NUM_WRITE_BYTES;
 static int          maxBytes      = MAX_BYTES;
 /* The maximum number of connections accept in a run. */
 static int          maxConns      = MAX_CONNECTIONS;
+/* Create a listener per thread up front and pin threads to CPUs. */
+static int          sharded       = 0;
+/* Steer new connections to the listener of the receiving CPU. */
+static int          steerByCpu    = 0;
+/* Pool connections and wolfSSL objects. */
+static int          usePool       = 0;
+/* Number of queued bytes at which a connection stops being served. */
+static int          highWater     = WRITE_HIGH_WATER;
+/* Number of queued bytes at which a connection is served again. */
+static int          lowWater      = WRITE_LOW_WATER;
+/* Share sessions and session ticket keys between threads. */
+static int          sharedSessions = 0;
+/* The number of seconds a session ticket key encrypts tickets for. */
+static int          ticketPeriod  = TICKET_KEY_PERIOD;
+/* File with the secret that session ticket keys are derived from. */
+static char*        ticketSecretFile = NULL;
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+/* The index of the connection in the wolfSSL object's ex-data. */
+static int          sslConnExDataIdx = -1;
+#endif
+#ifdef HAVE_EXT_CACHE
+/* The session cache shared by all threads. */
+static SessCache*   sessCache     = NULL;
+#endif
+#ifdef HAVE_SESSION_TICKET
+/* The secret that session ticket keys are derived from. */
+static byte         ticketSecret[TICKET_SECRET_SZ];
+#endif
 
 
 /* Get the wolfSSL server method function for the specified version.
@@ -237,6 +431,489 @@ static wolfSSL_method_func SSL_GetMethod(int version, int allowDowngrade)
 }
 
 
+/* Get the index of the histogram bucket for a latency.
+ *
+ * us  The latency in microseconds.
+ * returns the index of the bucket.
+ */
+static int Latency_Index(word32 us)
+{
+    int e = 0;
+    int idx;
+
+    /* Find the power of two that leaves the top bits as the sub-bucket. */
+    while ((us >> e) >= 2 * LATENCY_SUB_BUCKETS)
+        e++;
+    idx = e * LATENCY_SUB_BUCKETS + (int)(us >> e);
+    if (idx >= LATENCY_NUM_BUCKETS)
+        idx = LATENCY_NUM_BUCKETS - 1;
+
+    return idx;
+}
+
+/* Get the largest latency that is counted in a histogram bucket.
+ *
+ * idx  The index of the bucket.
+ * returns the upper bound of the bucket in microseconds.
+ */
+static word32 Latency_Value(int idx)
+{
+    int e;
+
+    if (idx < 2 * LATENCY_SUB_BUCKETS)
+        return (word32)idx;
+    e = idx / LATENCY_SUB_BUCKETS - 1;
+    return (((word32)(idx % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS) + 1)
+            << e) - 1;
+}
+
+/* Add a latency to a histogram.
+ *
+ * latency  The histogram.
+ * secs     The latency in seconds.
+ */
+static void Latency_Add(Latency* latency, double secs)
+{
+    word32 us = (secs <= 0) ? 0 : (word32)(secs * 1000000);
+
+    latency->bucket[Latency_Index(us)]++;
+    latency->count++;
+    if (us > latency->max)
+        latency->max = us;
+}
+
+/* Add the samples of one histogram into another.
+ *
+ * to    The histogram to add into.
+ * from  The histogram to add.
+ */
+static void Latency_Merge(Latency* to, const Latency* from)
+{
+    int i;
+
+    for (i = 0; i < LATENCY_NUM_BUCKETS; i++)
+        to->bucket[i] += from->bucket[i];
+    to->count += from->count;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+/* Get the latency at a percentile of the samples.
+ *
+ * latency  The histogram.
+ * pct      The percentile - 0.0 to 100.0.
+ * returns the latency in microseconds.
+ */
+static word32 Latency_Percentile(const Latency* latency, double pct)
+{
+    int    i;
+    word32 seen = 0;
+    word32 want = (word32)(latency->count * pct / 100);
+
+    if (want == 0)
+        want = 1;
+    for (i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        seen += latency->bucket[i];
+        if (seen >= want)
+            return min(Latency_Value(i), latency->max);
+    }
+
+    return latency->max;
+}
+
+/* Print the percentiles of a latency histogram.
+ *
+ * name     The name of the operation.
+ * latency  The histogram.
+ */
+static void Latency_Print(const char* name, const Latency* latency)
+{
+    if (latency->count == 0)
+        return;
+
+    fprintf(stderr, "\t%-18s: p50 %u us, p99 %u us, p99.9 %u us, max %u us\n",
+            name,
+            Latency_Percentile(latency, 50),
+            Latency_Percentile(latency, 99),
+            Latency_Percentile(latency, 99.9),
+            latency->max);
+}
+
+
+#ifdef HAVE_EXT_CACHE
+/* Hash a session id to choose the shard and row.
+ *
+ * id     The session id.
+ * idLen  The length of the session id.
+ * returns the hash - FNV-1a.
+ */
+static word32 SessCache_Hash(const byte* id, int idLen)
+{
+    word32 hash = 2166136261U;
+    int    i;
+
+    for (i = 0; i < idLen; i++) {
+        hash ^= id[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/* Find the row of the shared session cache for a session id and lock its
+ * shard.
+ *
+ * cache  The shared session cache.
+ * id     The session id.
+ * idLen  The length of the session id.
+ * shard  The shard that is locked.
+ * returns the row of entries.
+ */
+static SessEntry* SessCache_Lock(SessCache* cache, const byte* id, int idLen,
+                                 SessShard** shard)
+{
+    word32 hash = SessCache_Hash(id, idLen);
+
+    *shard = &cache->shard[hash & (SESS_CACHE_SHARDS - 1)];
+    pthread_mutex_lock(&(*shard)->lock);
+
+    return (*shard)->entry[(hash / SESS_CACHE_SHARDS) % SESS_CACHE_ROWS];
+}
+
+/* Create the session cache shared by all threads.
+ *
+ * returns the shared session cache or NULL on error.
+ */
+static SessCache* SessCache_New(void)
+{
+    SessCache* cache;
+    int        i;
+
+    if (posix_memalign((void**)&cache, CACHE_LINE_SZ, sizeof(*cache)) != 0)
+        return NULL;
+    memset(cache, 0, sizeof(*cache));
+    for (i = 0; i < SESS_CACHE_SHARDS; i++)
+        pthread_mutex_init(&cache->shard[i].lock, NULL);
+
+    return cache;
+}
+
+/* Free the session cache shared by all threads.
+ *
+ * cache  The shared session cache.
+ */
+static void SessCache_Free(SessCache* cache)
+{
+    int i, r, w;
+
+    if (cache == NULL)
+        return;
+
+    for (i = 0; i < SESS_CACHE_SHARDS; i++) {
+        for (r = 0; r < SESS_CACHE_ROWS; r++) {
+            for (w = 0; w < SESS_CACHE_WAYS; w++)
+                free(cache->shard[i].entry[r][w].der);
+        }
+        pthread_mutex_destroy(&cache->shard[i].lock);
+    }
+    free(cache);
+}
+
+/* Callback to store a new session in the shared session cache.
+ * The session is encoded so that any thread's context can decode it.
+ *
+ * ssl      The wolfSSL object.
+ * session  The new session.
+ * returns 0 as the session object is not kept.
+ */
+static int SessCache_NewCb(WOLFSSL* ssl, WOLFSSL_SESSION* session)
+{
+    const byte*  id;
+    unsigned int idLen;
+    byte*        der;
+    byte*        p;
+    int          derLen;
+    SessShard*   shard;
+    SessEntry*   row;
+    SessEntry*   entry;
+    int          w;
+
+    (void)ssl;
+
+    id = wolfSSL_SESSION_get_id(session, &idLen);
+    if (id == NULL || idLen == 0 || idLen > SESS_ID_SZ)
+        return 0;
+
+    derLen = wolfSSL_i2d_SSL_SESSION(session, NULL);
+    if (derLen <= 0)
+        return 0;
+    der = (byte*)malloc(derLen);
+    if (der == NULL)
+        return 0;
+    p = der;
+    if (wolfSSL_i2d_SSL_SESSION(session, &p) != derLen) {
+        free(der);
+        return 0;
+    }
+
+    /* Replace the same session, an unused entry or the oldest in the row. */
+    row = SessCache_Lock(sessCache, id, idLen, &shard);
+    entry = &row[0];
+    for (w = 0; w < SESS_CACHE_WAYS; w++) {
+        if (row[w].der != NULL && row[w].idLen == (int)idLen &&
+                memcmp(row[w].id, id, idLen) == 0) {
+            entry = &row[w];
+            break;
+        }
+        if (row[w].der == NULL ||
+                (entry->der != NULL && row[w].stored < entry->stored)) {
+            entry = &row[w];
+        }
+    }
+    free(entry->der);
+    memcpy(entry->id, id, idLen);
+    entry->idLen = idLen;
+    entry->der = der;
+    entry->derLen = derLen;
+    entry->stored = ++shard->numStored;
+    pthread_mutex_unlock(&shard->lock);
+
+    return 0;
+}
+
+/* Callback to get a session from the shared session cache.
+ *
+ * ssl    The wolfSSL object.
+ * id     The session id.
+ * idLen  The length of the session id.
+ * ref    Set to 0 as wolfSSL is to free the session returned.
+ * returns a new session object or NULL when not found.
+ */
+static WOLFSSL_SESSION* SessCache_GetCb(WOLFSSL* ssl, const unsigned char* id,
+                                        int idLen, int* ref)
+{
+    WOLFSSL_SESSION* session = NULL;
+    const byte*      p;
+    SessShard*       shard;
+    SessEntry*       row;
+    int              w;
+
+    (void)ssl;
+
+    *ref = 0;
+    if (idLen <= 0 || idLen > SESS_ID_SZ)
+        return NULL;
+
+    __atomic_fetch_add(&sessCache->lookups, 1, __ATOMIC_RELAXED);
+    row = SessCache_Lock(sessCache, id, idLen, &shard);
+    for (w = 0; w < SESS_CACHE_WAYS; w++) {
+        if (row[w].der != NULL && row[w].idLen == idLen &&
+                memcmp(row[w].id, id, idLen) == 0) {
+            p = row[w].der;
+            session = wolfSSL_d2i_SSL_SESSION(NULL, &p, row[w].derLen);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if (session != NULL)
+        __atomic_fetch_add(&sessCache->hits, 1, __ATOMIC_RELAXED);
+    return session;
+}
+
+/* Callback to remove a session from the shared session cache.
+ *
+ * ctx      The wolfSSL context.
+ * session  The session to remove.
+ */
+static void SessCache_RemoveCb(WOLFSSL_CTX* ctx, WOLFSSL_SESSION* session)
+{
+    const byte*  id;
+    unsigned int idLen;
+    SessShard*   shard;
+    SessEntry*   row;
+    int          w;
+
+    (void)ctx;
+
+    id = wolfSSL_SESSION_get_id(session, &idLen);
+    if (id == NULL || idLen == 0 || idLen > SESS_ID_SZ)
+        return;
+
+    row = SessCache_Lock(sessCache, id, idLen, &shard);
+    for (w = 0; w < SESS_CACHE_WAYS; w++) {
+        if (row[w].der != NULL && row[w].idLen == (int)idLen &&
+                memcmp(row[w].id, id, idLen) == 0) {
+            free(row[w].der);
+            row[w].der = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+#endif
+
+#ifdef HAVE_SESSION_TICKET
+/* Set up the secret that session ticket keys are derived from.
+ * Servers that use the same secret file can decrypt each other's tickets.
+ *
+ * file  The file to read the secret from. NULL for a random secret.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int TicketKey_Init(const char* file)
+{
+    FILE*  fp;
+    WC_RNG rng;
+    int    ret;
+
+    if (file != NULL) {
+        fp = fopen(file, "rb");
+        if (fp == NULL) {
+            fprintf(stderr, "ERROR: failed to open %s\n", file);
+            return EXIT_FAILURE;
+        }
+        ret = (int)fread(ticketSecret, 1, TICKET_SECRET_SZ, fp);
+        fclose(fp);
+        if (ret != TICKET_SECRET_SZ) {
+            fprintf(stderr, "ERROR: %s must have %d bytes of secret\n", file,
+                    TICKET_SECRET_SZ);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (wc_InitRng(&rng) != 0)
+        return EXIT_FAILURE;
+    ret = wc_RNG_GenerateBlock(&rng, ticketSecret, TICKET_SECRET_SZ);
+    wc_FreeRng(&rng);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Derive the name and key of the session ticket key for a period.
+ * Keys rotate each period without any coordination between threads or
+ * processes.
+ *
+ * period  The index of the period of time.
+ * name    The name of the key to put in tickets.
+ * key     The AES-256 key.
+ * returns 0 on success and non-zero otherwise.
+ */
+static int TicketKey_Derive(word32 period, byte* name, byte* key)
+{
+    Hmac hmac;
+    byte periodBuf[4];
+    byte out[WC_SHA256_DIGEST_SIZE];
+    int  ret;
+
+    periodBuf[0] = (byte)(period >> 24);
+    periodBuf[1] = (byte)(period >> 16);
+    periodBuf[2] = (byte)(period >>  8);
+    periodBuf[3] = (byte)(period      );
+
+    ret = wc_HmacInit(&hmac, NULL, INVALID_DEVID);
+    if (ret != 0)
+        return ret;
+    ret = wc_HmacSetKey(&hmac, WC_SHA256, ticketSecret, TICKET_SECRET_SZ);
+    if (ret == 0)
+        ret = wc_HmacUpdate(&hmac, (const byte*)"name", 4);
+    if (ret == 0)
+        ret = wc_HmacUpdate(&hmac, periodBuf, sizeof(periodBuf));
+    if (ret == 0)
+        ret = wc_HmacFinal(&hmac, out);
+    if (ret == 0) {
+        memcpy(name, out, WOLFSSL_TICKET_NAME_SZ);
+        ret = wc_HmacUpdate(&hmac, (const byte*)"key", 3);
+    }
+    if (ret == 0)
+        ret = wc_HmacUpdate(&hmac, periodBuf, sizeof(periodBuf));
+    if (ret == 0)
+        ret = wc_HmacFinal(&hmac, key);
+    wc_HmacFree(&hmac);
+
+    return ret;
+}
+
+/* Callback to encrypt and decrypt session tickets with the shared keys.
+ * Tickets are encrypted with the key of the current period. Tickets of the
+ * previous period are accepted and a new ticket issued.
+ *
+ * ssl      The wolfSSL object.
+ * keyName  The name of the key used.
+ * iv       The IV used.
+ * mac      The authentication tag.
+ * enc      1 when encrypting and 0 when decrypting.
+ * ticket   The ticket to encrypt/decrypt in place.
+ * inLen    The length of the ticket.
+ * outLen   The length of the encrypted/decrypted ticket.
+ * userCtx  The data of the thread.
+ * returns WOLFSSL_TICKET_RET_OK on success, WOLFSSL_TICKET_RET_CREATE when
+ * a new ticket is to be issued, WOLFSSL_TICKET_RET_REJECT when the ticket is
+ * not valid and WOLFSSL_TICKET_RET_FATAL on error.
+ */
+static int TicketKey_EncCb(WOLFSSL* ssl, byte keyName[WOLFSSL_TICKET_NAME_SZ],
+    byte iv[WOLFSSL_TICKET_IV_SZ], byte mac[WOLFSSL_TICKET_MAC_SZ], int enc,
+    byte* ticket, int inLen, int* outLen, void* userCtx)
+{
+    ThreadData* threadData = (ThreadData*)userCtx;
+    word32      period = (word32)(time(NULL) / ticketPeriod);
+    byte        name[WOLFSSL_TICKET_NAME_SZ];
+    byte        key[AES_256_KEY_SIZE];
+    Aes         aes;
+    int         ret = WOLFSSL_TICKET_RET_REJECT;
+    int         i;
+
+    (void)ssl;
+
+    if (wc_AesInit(&aes, NULL, INVALID_DEVID) != 0)
+        return WOLFSSL_TICKET_RET_FATAL;
+
+    if (enc) {
+        ret = WOLFSSL_TICKET_RET_FATAL;
+        if (TicketKey_Derive(period, name, key) == 0 &&
+                wc_RNG_GenerateBlock(&threadData->rng, iv,
+                                     WOLFSSL_TICKET_IV_SZ) == 0 &&
+                wc_AesGcmSetKey(&aes, key, sizeof(key)) == 0) {
+            memcpy(keyName, name, WOLFSSL_TICKET_NAME_SZ);
+            memset(mac, 0, WOLFSSL_TICKET_MAC_SZ);
+            if (wc_AesGcmEncrypt(&aes, ticket, ticket, inLen, iv,
+                                 GCM_NONCE_MID_SZ, mac, AES_BLOCK_SIZE,
+                                 keyName, WOLFSSL_TICKET_NAME_SZ) == 0) {
+                *outLen = inLen;
+                ret = WOLFSSL_TICKET_RET_OK;
+            }
+        }
+    }
+    else {
+        /* Find key of current or previous period by name. */
+        for (i = 0; i < 2; i++) {
+            if (TicketKey_Derive(period - i, name, key) != 0) {
+                ret = WOLFSSL_TICKET_RET_FATAL;
+                break;
+            }
+            if (memcmp(name, keyName, WOLFSSL_TICKET_NAME_SZ) != 0)
+                continue;
+
+            if (wc_AesGcmSetKey(&aes, key, sizeof(key)) == 0 &&
+                    wc_AesGcmDecrypt(&aes, ticket, ticket, inLen, iv,
+                                     GCM_NONCE_MID_SZ, mac, AES_BLOCK_SIZE,
+                                     keyName, WOLFSSL_TICKET_NAME_SZ) == 0) {
+                *outLen = inLen;
+                ret = (i == 0) ? WOLFSSL_TICKET_RET_OK :
+                                 WOLFSSL_TICKET_RET_CREATE;
+            }
+            break;
+        }
+    }
+
+    wc_AesFree(&aes);
+    memset(key, 0, sizeof(key));
+
+    return ret;
+}
+#endif
+
+
 /* Write data to a client.
  *
  * ssl         The wolfSSL object.
@@ -244,10 +921,11 @@ static wolfSSL_method_func SSL_GetMethod(int version, int allowDowngrade)
  * replyLen    The length of the data to send to the client.
  * totalBytes  The total number of bytes sent to clients.
  * writeTime   The amount of time spent writing data to client.
+ * latency     The histogram of write times.
  * returns 0 on failure, 1 on success, 2 on want read and 3 on want write.
  */
 static int SSL_Write(WOLFSSL* ssl, char* reply, int replyLen, int* totalBytes,
-                     double* writeTime)
+                     double* writeTime, Latency* latency)
 {
     int  rwret = 0;
     int  error;
@@ -257,20 +935,17 @@ static int SSL_Write(WOLFSSL* ssl, char* reply, int replyLen, int* totalBytes,
     rwret = wolfSSL_write(ssl, reply, replyLen);
     diff = current_time(0) - start;
 
-    pthread_mutex_lock(&sslConnMutex);
+    /* Statistics are per thread - no locking required. */
     *writeTime += diff;
-    pthread_mutex_unlock(&sslConnMutex);
+    Latency_Add(latency, diff);
 
     if (rwret == 0) {
         fprintf(stderr, "The client has closed the connection - write!\n");
         return 0;
     }
 
-    if (rwret > 0) {
-        pthread_mutex_lock(&sslConnMutex);
+    if (rwret > 0)
         *totalBytes += rwret;
-        pthread_mutex_unlock(&sslConnMutex);
-    }
     if (rwret == replyLen)
         return 1;
 
@@ -296,10 +971,11 @@ static int SSL_Write(WOLFSSL* ssl, char* reply, int replyLen, int* totalBytes,
  * len         The length of the buffer.
  * totalBytes  The total number of bytes read from clients.
  * readTime    The amount of time spent reading data from client.
+ * latency     The histogram of read times.
  * returns 0 on failure, 1 on success, 2 on want read and 3 on want write.
  */
 static int SSL_Read(WOLFSSL* ssl, char* buffer, int len, int* totalBytes,
-                    double* readTime)
+                    double* readTime, Latency* latency)
 {
     int  rwret = 0;
     int  error;
@@ -309,11 +985,11 @@ static int SSL_Read(WOLFSSL* ssl, char* buffer, int len, int* totalBytes,
     rwret = wolfSSL_read(ssl, buffer, len);
     diff = current_time(0) - start;
 
-    pthread_mutex_lock(&sslConnMutex);
+    /* Statistics are per thread - no locking required. */
     *readTime += diff;
+    Latency_Add(latency, diff);
     if (rwret > 0)
         *totalBytes += rwret;
-    pthread_mutex_unlock(&sslConnMutex);
 
     if (rwret == 0) {
         return 0;
@@ -345,19 +1021,16 @@ static int SSL_Accept(WOLFSSL* ssl, double* acceptTime, double* resumeTime)
 {
     int ret;
     int error;
-    double start, diff;
+    double start;
 
     /* Accept the connection. */
     start = current_time(1);
     ret = wolfSSL_accept(ssl);
-    diff = current_time(0) - start;
-
-    pthread_mutex_lock(&sslConnMutex);
+    /* Statistics are per thread - no locking required. */
     if (!wolfSSL_session_reused(ssl))
-        *acceptTime += diff;
+        *acceptTime += current_time(0) - start;
     else
-        *resumeTime += diff;
-    pthread_mutex_unlock(&sslConnMutex);
+        *resumeTime += current_time(0) - start;
 
     if (ret == 0) {
         fprintf(stderr, "The client has closed the connection - accept!\n");
@@ -411,13 +1084,16 @@ static SSLConn_CTX* SSLConn_New(int numThreads, int numConns, int bufferLen,
     ctx->maxConnections = maxConns;
     ctx->maxBytes = maxBytes;
 
-    /* Pre-allocate the SSL connection data. */
-    ctx->threadData = (ThreadData*)malloc(ctx->numThreads *
-                                          sizeof(*ctx->threadData));
-    if (ctx->threadData == NULL) {
+    /* Pre-allocate the SSL connection data.
+     * Cache line aligned so that each thread's statistics are on their own
+     * cache lines. */
+    if (posix_memalign((void**)&ctx->threadData, CACHE_LINE_SZ,
+                       ctx->numThreads * sizeof(*ctx->threadData)) != 0) {
+        ctx->threadData = NULL;
         SSLConn_Free(ctx);
         return NULL;
     }
+    memset(ctx->threadData, 0, ctx->numThreads * sizeof(*ctx->threadData));
     for (i = 0; i < ctx->numThreads; i++) {
         threadData = &ctx->threadData[i];
 
@@ -426,6 +1102,11 @@ static SSLConn_CTX* SSLConn_New(int numThreads, int numConns, int bufferLen,
         threadData->sslConn = NULL;
         threadData->freeSSLConn = NULL;
         threadData->cnt = 0;
+        threadData->socketfd = -1;
+        threadData->cpu = -1;
+#ifdef WOLFSSL_ASYNC_CRYPT
+        threadData->asyncPending = 0;
+#endif
         threadData->thread_id = 0;
     }
 
@@ -444,12 +1125,13 @@ static void SSLConn_Free(SSLConn_CTX* ctx)
     if (ctx == NULL)
         return;
 
-    for (i = 0; i < ctx->numThreads; i++) {
+    for (i = 0; ctx->threadData != NULL && i < ctx->numThreads; i++) {
         threadData = &ctx->threadData[i];
 
         while (threadData->sslConn != NULL)
             SSLConn_Close(ctx, threadData, threadData->sslConn);
         SSLConn_FreeSSLConn(threadData);
+        SSLConn_SlabFree(ctx, threadData);
         WolfSSLCtx_Final(threadData);
     }
     free(ctx->threadData);
@@ -458,6 +1140,139 @@ static void SSLConn_Free(SSLConn_CTX* ctx)
     free(ctx);
 }
 
+/* Create a slab of connections with wolfSSL objects that are reused.
+ * The read buffers of the connections are carved from one arena.
+ *
+ * ctx         The SSL/TLS connection data.
+ * threadData  The SSL/TLS connection data for the thread.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int SSLConn_SlabInit(SSLConn_CTX* ctx, ThreadData* threadData)
+{
+    int    i;
+    size_t bufSz;
+
+    /* Keep each connection's buffer on its own cache lines. */
+    bufSz = (ctx->bufferLen + CACHE_LINE_SZ - 1) & ~(CACHE_LINE_SZ - 1);
+
+    threadData->slab = (SSLConn*)calloc(ctx->numConns,
+                                        sizeof(*threadData->slab));
+    if (threadData->slab == NULL)
+        return EXIT_FAILURE;
+    if (posix_memalign((void**)&threadData->arena, CACHE_LINE_SZ,
+                       ctx->numConns * bufSz) != 0) {
+        threadData->arena = NULL;
+        return EXIT_FAILURE;
+    }
+
+    /* Create all wolfSSL objects now and put all connections on the stack. */
+    for (i = ctx->numConns - 1; i >= 0; i--) {
+        SSLConn* conn = &threadData->slab[i];
+
+        if ((conn->ssl = wolfSSL_new(threadData->ctx)) == NULL) {
+            fprintf(stderr, "wolfSSL_new error.\n");
+            return EXIT_FAILURE;
+        }
+        conn->sockfd = -1;
+        conn->buffer = threadData->arena + i * bufSz;
+        conn->next = threadData->freeSlab;
+        threadData->freeSlab = conn;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* Free the slab of connections and their wolfSSL objects.
+ *
+ * ctx         The SSL/TLS connection data.
+ * threadData  The SSL/TLS connection data for the thread.
+ */
+static void SSLConn_SlabFree(SSLConn_CTX* ctx, ThreadData* threadData)
+{
+    int i;
+
+    if (threadData->slab != NULL) {
+        for (i = 0; i < ctx->numConns; i++) {
+            wolfSSL_free(threadData->slab[i].ssl);
+            free(threadData->slab[i].outQ.data);
+        }
+        free(threadData->slab);
+        threadData->slab = NULL;
+    }
+    free(threadData->arena);
+    threadData->arena = NULL;
+    threadData->freeSlab = NULL;
+}
+
+/* Get an unused connection object.
+ * Taken from the slab, with its wolfSSL object, when pooling. Otherwise
+ * allocated without one - it is created once a client has been accepted.
+ *
+ * threadData  The SSL/TLS connection data for the thread.
+ * returns a connection object or NULL on error.
+ */
+static SSLConn* SSLConn_Get(ThreadData* threadData)
+{
+    SSLConn* conn;
+
+    if (threadData->slab != NULL) {
+        conn = threadData->freeSlab;
+        if (conn == NULL)
+            return NULL;
+        /* Replace a wolfSSL object that couldn't be created when put back. */
+        if (conn->ssl == NULL &&
+                (conn->ssl = wolfSSL_new(threadData->ctx)) == NULL) {
+            fprintf(stderr, "wolfSSL_new error.\n");
+            return NULL;
+        }
+        threadData->freeSlab = conn->next;
+        return conn;
+    }
+
+    conn = malloc(sizeof(*conn));
+    if (conn == NULL)
+        return NULL;
+    conn->ssl = NULL;
+    conn->buffer = NULL;
+    memset(&conn->outQ, 0, sizeof(conn->outQ));
+
+    return conn;
+}
+
+/* Put back a connection object that is no longer used.
+ * The wolfSSL object is reset and the connection returned to the slab when
+ * pooling, otherwise both are freed.
+ *
+ * threadData  The SSL/TLS connection data for the thread.
+ * conn        The connection object.
+ */
+static void SSLConn_Put(ThreadData* threadData, SSLConn* conn)
+{
+    if (threadData->slab == NULL) {
+        wolfSSL_free(conn->ssl);
+        free(conn->outQ.data);
+        free(conn);
+        return;
+    }
+
+    /* Keep the queue's buffer for the next connection. */
+    conn->outQ.start = 0;
+    conn->outQ.end = 0;
+
+#ifdef OPENSSL_EXTRA
+    if (wolfSSL_clear(conn->ssl) != WOLFSSL_SUCCESS)
+#endif
+    {
+        /* Can't reset the object for another connection - replace it.
+         * When that fails, it is created again when the connection is next
+         * taken from the slab. */
+        wolfSSL_free(conn->ssl);
+        conn->ssl = wolfSSL_new(threadData->ctx);
+    }
+    conn->next = threadData->freeSlab;
+    threadData->freeSlab = conn;
+}
+
 /* Close an active connection.
  *
  * ctx         The SSL/TLS connection data.
@@ -472,12 +1287,12 @@ static void SSLConn_Close(SSLConn_CTX* ctx, ThreadData* threadData,
     if (sslConn->state == CLOSED)
         return;
 
-    pthread_mutex_lock(&sslConnMutex);
-    ret = (ctx->numConnections == 0);
-    ctx->numConnections++;
+    /* Only the count used to check for done is shared between threads. */
+    ret = (__atomic_fetch_add(&ctx->doneConnections, 1, __ATOMIC_RELAXED)
+           == 0);
+    threadData->stats.numConnections++;
     if (wolfSSL_session_reused(sslConn->ssl))
-        ctx->numResumed++;
-    pthread_mutex_unlock(&sslConnMutex);
+        threadData->stats.numResumed++;
 
     if (ret) {
         WOLFSSL_CIPHER* cipher;
@@ -499,36 +1314,96 @@ static void SSLConn_Close(SSLConn_CTX* ctx, ThreadData* threadData,
     sslConn->next = threadData->freeSSLConn;
     sslConn->prev = NULL;
     threadData->freeSSLConn = sslConn;
+}
+
+/* Free the SSL/TLS connections that are closed.
+ * The count of active connections only drops here, when the connection
+ * objects are back in the slab and can be used by new connections.
+ *
+ * threadData  The SSL/TLS connection data for the thread.
+ */
+static void SSLConn_FreeSSLConn(ThreadData* threadData)
+{
+    SSLConn* sslConn = threadData->freeSSLConn;
+
+    threadData->freeSSLConn = NULL;
+
+    while (sslConn != NULL) {
+        SSLConn* next = sslConn->next;
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+        /* Clear out any events. */
+        SSLConn_AsyncDone(threadData, sslConn);
+        while (wolfSSL_AsyncPoll(sslConn->ssl, WOLF_POLL_FLAG_CHECK_HW) == 1)
+             ;
+#endif
+        close(sslConn->sockfd);
+        sslConn->sockfd = -1;
+        SSLConn_Put(threadData, sslConn);
+        threadData->cnt--;
+
+        sslConn = next;
+    }
+}
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+/* Mark a connection as having an asynchronous operation outstanding.
+ * The event loop polls for completions, instead of waiting for events, while
+ * any connection is waiting.
+ *
+ * threadData  The SSL/TLS connection data for the thread.
+ * sslConn     The SSL connection data object.
+ */
+static void SSLConn_AsyncPending(ThreadData* threadData, SSLConn* sslConn)
+{
+    if (sslConn->pending)
+        return;
+
+    sslConn->pending = 1;
+    threadData->asyncPending++;
+}
+
+/* Mark a connection as having no asynchronous operation outstanding.
+ *
+ * threadData  The SSL/TLS connection data for the thread.
+ * sslConn     The SSL connection data object.
+ */
+static void SSLConn_AsyncDone(ThreadData* threadData, SSLConn* sslConn)
+{
+    if (!sslConn->pending)
+        return;
 
-    threadData->cnt--;
+    sslConn->pending = 0;
+    threadData->asyncPending--;
 }
 
-/* Free the SSL/TLS connections that are closed.
+/* Find the connection that an asynchronous event completed for.
  *
  * threadData  The SSL/TLS connection data for the thread.
+ * event       The completed event.
+ * returns the SSL connection data object or NULL when not found.
  */
-static void SSLConn_FreeSSLConn(ThreadData* threadData)
+static SSLConn* SSLConn_FromEvent(ThreadData* threadData, WOLF_EVENT* event)
 {
-    SSLConn* sslConn = threadData->freeSSLConn;
+#ifdef HAVE_EX_DATA
+    (void)threadData;
 
-    threadData->freeSSLConn = NULL;
+    return (SSLConn*)wolfSSL_get_ex_data((WOLFSSL*)event->context,
+                                         sslConnExDataIdx);
+#else
+    SSLConn* sslConn;
 
-    while (sslConn != NULL) {
-        SSLConn* next = sslConn->next;
+    /* No ex-data - search the active connections. */
+    for (sslConn = threadData->sslConn; sslConn != NULL;
+                                                 sslConn = sslConn->next) {
+        if (sslConn->ssl == event->context)
+            break;
+    }
 
-#ifdef WOLFSSL_ASYNC_CRYPT
-        /* Clear out any events. */
-        while (wolfSSL_AsyncPoll(sslConn->ssl, WOLF_POLL_FLAG_CHECK_HW) == 1)
-             ;
+    return sslConn;
 #endif
-        wolfSSL_free(sslConn->ssl);
-        sslConn->ssl = NULL;
-        close(sslConn->sockfd);
-        free(sslConn);
-
-        sslConn = next;
-    }
 }
+#endif
 
 /* Checks whether this run is done i.e. maximum number of connections or bytes
  * have been server.
@@ -537,18 +1412,14 @@ static void SSLConn_FreeSSLConn(ThreadData* threadData)
  * returns 1 if the run is done or 0 otherwise.
  */
 static int SSLConn_Done(SSLConn_CTX* ctx) {
-    int ret;
-
-    pthread_mutex_lock(&sslConnMutex);
-    if (ctx->maxConnections > 0)
-        ret = (ctx->numConnections >= ctx->maxConnections);
-    else {
-        ret = (ctx->totalWriteBytes >= ctx->maxBytes) &&
-              (ctx->totalReadBytes >= ctx->maxBytes);
+    if (ctx->maxConnections > 0) {
+        return (__atomic_load_n(&ctx->doneConnections, __ATOMIC_RELAXED)
+                >= ctx->maxConnections);
     }
-    pthread_mutex_unlock(&sslConnMutex);
-
-    return ret;
+    return (__atomic_load_n(&ctx->doneWriteBytes, __ATOMIC_RELAXED)
+                >= ctx->maxBytes) &&
+           (__atomic_load_n(&ctx->doneReadBytes, __ATOMIC_RELAXED)
+                >= ctx->maxBytes);
 }
 
 /* Accepts a new connection.
@@ -567,31 +1438,45 @@ static int SSLConn_Accept(ThreadData* threadData, WOLFSSL_CTX* sslCtx,
     socklen_t          size = sizeof(clientAddr);
     SSLConn*           conn;
 
-    conn = malloc(sizeof(*conn));
+    conn = SSLConn_Get(threadData);
     if (conn == NULL)
         return EXIT_FAILURE;
 
     /* Accept the client connection. */
     conn->sockfd = accept(sockfd, (struct sockaddr *)&clientAddr, &size);
     if (conn->sockfd == -1) {
-        free(conn);
+        SSLConn_Put(threadData, conn);
         fprintf(stderr, "ERROR: failed to accept\n");
         return EXIT_FAILURE;
     }
     /* Set the new socket to be non-blocking. */
     fcntl(conn->sockfd, F_SETFL, O_NONBLOCK);
 
-    /* Setup SSL/TLS connection. */
-    if ((conn->ssl = wolfSSL_new(sslCtx)) == NULL) {
+    /* Setup SSL/TLS connection - already done when pooling. */
+    if (conn->ssl == NULL && (conn->ssl = wolfSSL_new(sslCtx)) == NULL) {
         close(conn->sockfd);
-        free(conn);
+        SSLConn_Put(threadData, conn);
         fprintf(stderr, "wolfSSL_new error.\n");
         return EXIT_FAILURE;
     }
+
     /* Set the socket to communicate over into the wolfSSL object. */
     wolfSSL_set_fd(conn->ssl, conn->sockfd);
+    /* Encrypted data is sent, or queued, by the connection. */
+    wolfSSL_SetIOWriteCtx(conn->ssl, conn);
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+    /* Find the connection directly from the wolfSSL object of an event. */
+    wolfSSL_set_ex_data(conn->ssl, sslConnExDataIdx, conn);
+#endif
 
     conn->state = ACCEPT;
+    conn->start = current_time(1);
+    conn->efd = -1;
+    conn->watchWrite = 0;
+    conn->blocked = 0;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    conn->pending = 0;
+#endif
     conn->next = threadData->sslConn;
     conn->prev = NULL;
     if (threadData->sslConn != NULL)
@@ -604,6 +1489,115 @@ static int SSLConn_Accept(ThreadData* threadData, WOLFSSL_CTX* sslCtx,
     return EXIT_SUCCESS;
 }
 
+/* Get the number of bytes in the write queue.
+ *
+ * q  The write queue.
+ * returns the number of bytes waiting to be sent.
+ */
+static int WriteQueue_Len(WriteQueue* q)
+{
+    return q->end - q->start;
+}
+
+/* Add data to the end of the write queue, growing it as required.
+ *
+ * q     The write queue.
+ * data  The data to queue.
+ * len   The length of the data.
+ * returns 0 on success and -1 when memory allocation fails.
+ */
+static int WriteQueue_Add(WriteQueue* q, const char* data, int len)
+{
+    char* p;
+    int   size;
+
+    if (q->end + len > q->size) {
+        /* Move the unsent data to the front before growing. */
+        if (q->start > 0) {
+            memmove(q->data, q->data + q->start, q->end - q->start);
+            q->end -= q->start;
+            q->start = 0;
+        }
+        if (q->end + len > q->size) {
+            size = (q->size == 0) ? WRITE_QUEUE_SZ : q->size;
+            while (size < q->end + len)
+                size *= 2;
+            p = (char*)realloc(q->data, size);
+            if (p == NULL)
+                return -1;
+            q->data = p;
+            q->size = size;
+        }
+    }
+
+    memcpy(q->data + q->end, data, len);
+    q->end += len;
+
+    return 0;
+}
+
+/* Arm or disarm EPOLLOUT for the connection's socket.
+ * Only armed while there is data queued so that writable sockets don't wake
+ * the thread.
+ *
+ * sslConn  The SSL connection data object.
+ * on       1 to wait for the socket to be writable and 0 otherwise.
+ */
+static void SSLConn_WatchWrite(SSLConn* sslConn, int on)
+{
+    struct epoll_event event;
+
+    if (sslConn->watchWrite == on || sslConn->efd == -1)
+        return;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLET | (on ? EPOLLOUT : 0);
+    event.data.ptr = sslConn;
+    if (epoll_ctl(sslConn->efd, EPOLL_CTL_MOD, sslConn->sockfd, &event) == -1) {
+        fprintf(stderr, "ERROR: failed to modify epoll event\n");
+        return;
+    }
+    sslConn->watchWrite = on;
+}
+
+/* Send callback for wolfSSL.
+ * Encrypted data the socket won't take is queued, rather than returning want
+ * write, so that a slow reader never stalls the thread's other connections.
+ *
+ * ssl    The wolfSSL object.
+ * buf    The encrypted data to send.
+ * sz     The length of the data.
+ * ioCtx  The SSL connection data object.
+ * returns the number of bytes sent or queued, or a wolfSSL I/O error.
+ */
+static int SSLConn_IOSend(WOLFSSL* ssl, char* buf, int sz, void* ioCtx)
+{
+    SSLConn* sslConn = (SSLConn*)ioCtx;
+    ssize_t  sent = 0;
+
+    (void)ssl;
+
+    /* Send directly only when nothing is queued to keep the data in order. */
+    if (WriteQueue_Len(&sslConn->outQ) == 0) {
+        sent = send(sslConn->sockfd, buf, sz, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EPIPE || errno == ECONNRESET)
+                return WOLFSSL_CBIO_ERR_CONN_CLOSE;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return WOLFSSL_CBIO_ERR_GENERAL;
+            sent = 0;
+        }
+        if (sent == sz)
+            return sz;
+    }
+
+    if (WriteQueue_Add(&sslConn->outQ, buf + sent, sz - (int)sent) != 0)
+        return WOLFSSL_CBIO_ERR_GENERAL;
+    SSLConn_WatchWrite(sslConn, 1);
+
+    return sz;
+}
+
 /* Read/write from/to client at the specified socket.
  *
  * ctx         The SSL/TLS connection data.
@@ -614,37 +1608,67 @@ static int SSLConn_Accept(ThreadData* threadData, WOLFSSL_CTX* sslCtx,
 static int SSLConn_ReadWrite(SSLConn_CTX* ctx, ThreadData* threadData,
                              SSLConn* sslConn)
 {
-    int ret;
+    int ret = 0;
     int len;
+    int bytes;
+    ThreadStats* stats = &threadData->stats;
 
     /* Perform TLS handshake if in accept state. */
     switch (sslConn->state) {
         case ACCEPT:
-            ret = SSL_Accept(sslConn->ssl, &ctx->acceptTime, &ctx->resumeTime);
+            ret = SSL_Accept(sslConn->ssl, &stats->acceptTime,
+                             &stats->resumeTime);
             if (ret == 0) {
                 printf("ERROR: Accept failed\n");
                 SSLConn_Close(ctx, threadData, sslConn);
                 return EXIT_FAILURE;
             }
 
-            if (ret == 1)
+            if (ret == 1) {
+                Latency_Add(&stats->handshake,
+                            current_time(0) - sslConn->start);
                 sslConn->state = READ;
+            }
             break;
 
         case READ:
             {
-                char buffer[NUM_READ_BYTES];
+                char  stackBuffer[NUM_READ_BYTES];
+                char* buffer = stackBuffer;
+
+                /* Stop taking requests until the client reads the replies. */
+                if (sslConn->blocked ||
+                        WriteQueue_Len(&sslConn->outQ) >= highWater) {
+                    if (!sslConn->blocked) {
+                        sslConn->blocked = 1;
+                        stats->numBlocked++;
+                    }
+                    break;
+                }
+
+                /* Use the connection's buffer from the arena when pooled. */
+                if (sslConn->buffer != NULL)
+                    buffer = sslConn->buffer;
 
                 len = ctx->bufferLen;
                 if (ctx->maxBytes > 0) {
-                    len = min(len, ctx->maxBytes - ctx->totalReadBytes);
+                    len = min(len, ctx->maxBytes -
+                        __atomic_load_n(&ctx->doneReadBytes, __ATOMIC_RELAXED));
                 }
-                if (len == 0)
+                if (len <= 0)
                     break;
 
                 /* Read application data. */
-                ret = SSL_Read(sslConn->ssl, buffer, len, &ctx->totalReadBytes,
-                               &ctx->readTime);
+                bytes = stats->totalReadBytes;
+                ret = SSL_Read(sslConn->ssl, buffer, len,
+                               &stats->totalReadBytes, &stats->readTime,
+                               &stats->read);
+                /* Shared count only needed when limiting bytes. */
+                if (ctx->maxBytes > 0) {
+                    __atomic_add_fetch(&ctx->doneReadBytes,
+                                       stats->totalReadBytes - bytes,
+                                       __ATOMIC_RELAXED);
+                }
                 if (ret == 0) {
                     SSLConn_Close(ctx, threadData, sslConn);
                     return EXIT_FAILURE;
@@ -658,19 +1682,29 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, ThreadData* threadData,
         case WRITE:
             len = ctx->replyLen;
             if (ctx->maxBytes > 0) {
-                len = min(len, ctx->maxBytes - ctx->totalWriteBytes);
+                len = min(len, ctx->maxBytes -
+                    __atomic_load_n(&ctx->doneWriteBytes, __ATOMIC_RELAXED));
             }
-            if (len == 0)
+            if (len <= 0)
                 break;
 
             /* Write application data. */
-            ret = SSL_Write(sslConn->ssl, reply, len, &ctx->totalWriteBytes,
-                            &ctx->writeTime);
+            bytes = stats->totalWriteBytes;
+            ret = SSL_Write(sslConn->ssl, reply, len, &stats->totalWriteBytes,
+                            &stats->writeTime, &stats->write);
+            /* Shared count only needed when limiting bytes. */
+            if (ctx->maxBytes > 0) {
+                __atomic_add_fetch(&ctx->doneWriteBytes,
+                                   stats->totalWriteBytes - bytes,
+                                   __ATOMIC_RELAXED);
+            }
             if (ret == 0) {
                 printf("ERROR: Write failed\n");
                 SSLConn_Close(ctx, threadData, sslConn);
                 return EXIT_FAILURE;
             }
+            if (WriteQueue_Len(&sslConn->outQ) > stats->maxQueued)
+                stats->maxQueued = WriteQueue_Len(&sslConn->outQ);
 
             if (ret == 1)
                 sslConn->state = READ;
@@ -680,15 +1714,139 @@ static int SSLConn_ReadWrite(SSLConn_CTX* ctx, ThreadData* threadData,
             break;
     }
 
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Wake up the event loop to poll for the completion. */
+    if (ret == 4)
+        SSLConn_AsyncPending(threadData, sslConn);
+#endif
+
     return EXIT_SUCCESS;
 }
 
+/* Send the queued data now that the socket is writable.
+ * EPOLLOUT is disarmed once the queue is empty. The connection is served
+ * again once the queue has drained to the low watermark.
+ *
+ * ctx         The SSL/TLS connection data.
+ * threadData  The SSL connection data for a thread.
+ * sslConn     The SSL connection data object.
+ */
+static void SSLConn_Flush(SSLConn_CTX* ctx, ThreadData* threadData,
+                          SSLConn* sslConn)
+{
+    WriteQueue* q = &sslConn->outQ;
+    ssize_t     sent;
+
+    if (sslConn->state == CLOSED)
+        return;
+
+    while (q->start < q->end) {
+        sent = send(sslConn->sockfd, q->data + q->start, q->end - q->start,
+                    MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            SSLConn_Close(ctx, threadData, sslConn);
+            return;
+        }
+        q->start += (int)sent;
+    }
+    if (q->start == q->end) {
+        q->start = 0;
+        q->end = 0;
+        SSLConn_WatchWrite(sslConn, 0);
+    }
+
+    /* Continue a blocked connection or a reply that didn't complete. */
+    if (WriteQueue_Len(q) <= lowWater &&
+            (sslConn->blocked || sslConn->state == WRITE)) {
+        sslConn->blocked = 0;
+        SSLConn_ReadWrite(ctx, threadData, sslConn);
+    }
+}
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+/* Poll for completed asynchronous operations and continue the connections.
+ *
+ * ctx         The SSL/TLS connection data.
+ * threadData  The SSL/TLS connection data for the thread.
+ */
+static void SSLConn_AsyncPoll(SSLConn_CTX* ctx, ThreadData* threadData)
+{
+    int         i;
+    int         n;
+    double      start;
+    WOLF_EVENT* wolfEvents[MAX_WOLF_EVENTS];
+    SSLConn*    sslConn;
+
+    do {
+        start = current_time(1);
+        if (wolfSSL_CTX_AsyncPoll(threadData->ctx, wolfEvents, MAX_WOLF_EVENTS,
+                                  WOLF_POLL_FLAG_CHECK_HW, &n) < 0) {
+            n = 0;
+        }
+        threadData->stats.asyncTime += current_time(0) - start;
+
+        for (i = 0; i < n; i++) {
+            sslConn = SSLConn_FromEvent(threadData, wolfEvents[i]);
+            if (sslConn == NULL)
+                continue;
+
+            SSLConn_AsyncDone(threadData, sslConn);
+            SSLConn_ReadWrite(ctx, threadData, sslConn);
+        }
+    } while (n > 0);
+}
+#endif
+
+/* Merge the statistics of all threads.
+ * Only called once the threads have finished.
+ *
+ * ctx    The SSL/TLS connection data.
+ * total  The statistics of all threads.
+ */
+static void SSLConn_MergeStats(SSLConn_CTX* ctx, ThreadStats* total)
+{
+    int i;
+
+    memset(total, 0, sizeof(*total));
+    for (i = 0; i < ctx->numThreads; i++) {
+        ThreadStats* stats = &ctx->threadData[i].stats;
+
+        total->numConnections  += stats->numConnections;
+        total->numResumed      += stats->numResumed;
+        total->numBlocked      += stats->numBlocked;
+        if (stats->maxQueued > total->maxQueued)
+            total->maxQueued = stats->maxQueued;
+        total->totalReadBytes  += stats->totalReadBytes;
+        total->totalWriteBytes += stats->totalWriteBytes;
+        total->acceptTime      += stats->acceptTime;
+        total->resumeTime      += stats->resumeTime;
+#ifdef WOLFSSL_ASYNC_CRYPT
+        total->asyncTime       += stats->asyncTime;
+#endif
+        total->readTime        += stats->readTime;
+        total->writeTime       += stats->writeTime;
+        Latency_Merge(&total->handshake, &stats->handshake);
+        Latency_Merge(&total->read, &stats->read);
+        Latency_Merge(&total->write, &stats->write);
+    }
+    total->totalTime = ctx->totalTime;
+}
+
 /* Print the connection statistics.
  *
  * ctx  The SSL/TLS connection data.
  */
 static void SSLConn_PrintStats(SSLConn_CTX* ctx)
 {
+    int i;
+    ThreadData* threadData;
+    ThreadStats total;
+    ThreadStats* stats = &total;
+
+    SSLConn_MergeStats(ctx, &total);
+
     fprintf(stderr, "wolfSSL Server Benchmark %d bytes\n"
             "\tNum Conns         : %9d\n"
             "\tTotal             : %9.3f ms\n"
@@ -697,39 +1855,68 @@ static void SSLConn_PrintStats(SSLConn_CTX* ctx)
             "\tAccept            : %9.3f ms\n"
             "\tAccept Avg        : %9.3f ms\n",
             ctx->replyLen,
-            ctx->numConnections - ctx->numResumed,
-            ctx->totalTime * 1000,
-            ctx->totalTime * 1000 / ctx->numConnections,
-            ctx->numConnections / ctx->totalTime,
-            ctx->acceptTime * 1000,
-            ctx->acceptTime * 1000 / (ctx->numConnections - ctx->numResumed));
-    if (ctx->numResumed > 0) {
+            stats->numConnections - stats->numResumed,
+            stats->totalTime * 1000,
+            stats->totalTime * 1000 / stats->numConnections,
+            stats->numConnections / stats->totalTime,
+            stats->acceptTime * 1000,
+            stats->acceptTime * 1000 /
+                (stats->numConnections - stats->numResumed));
+    if (stats->numResumed > 0) {
         fprintf(stderr,
                 "\tResumed Conns     : %9d\n"
                 "\tResume            : %9.3f ms\n"
                 "\tResume Avg        : %9.3f ms\n",
-                ctx->numResumed,
-                ctx->resumeTime * 1000,
-                ctx->resumeTime * 1000 / ctx->numResumed);
+                stats->numResumed,
+                stats->resumeTime * 1000,
+                stats->resumeTime * 1000 / stats->numResumed);
     }
 #ifdef WOLFSSL_ASYNC_CRYPT
     fprintf(stderr,
             "\tAsync             : %9.3f ms\n"
             "\tAsync Avg         : %9.3f ms\n",
-            ctx->asyncTime * 1000,
-            ctx->asyncTime * 1000 / ctx->numConnections);
+            stats->asyncTime * 1000,
+            stats->asyncTime * 1000 / stats->numConnections);
 #endif
     fprintf(stderr,
             "\tTotal Read bytes  : %9d bytes\n"
             "\tTotal Write bytes : %9d bytes\n"
             "\tRead              : %9.3f ms (%9.3f MBps)\n"
             "\tWrite             : %9.3f ms (%9.3f MBps)\n",
-            ctx->totalReadBytes,
-            ctx->totalWriteBytes,
-            ctx->readTime * 1000,
-            ctx->totalReadBytes / ctx->readTime / 1024 / 1024,
-            ctx->writeTime * 1000,
-            ctx->totalWriteBytes / ctx->writeTime / 1024 / 1024 );
+            stats->totalReadBytes,
+            stats->totalWriteBytes,
+            stats->readTime * 1000,
+            stats->totalReadBytes / stats->readTime / 1024 / 1024,
+            stats->writeTime * 1000,
+            stats->totalWriteBytes / stats->writeTime / 1024 / 1024 );
+    fprintf(stderr,
+            "\tWrite Blocked     : %9d times\n"
+            "\tMax Write Queue   : %9d bytes\n",
+            stats->numBlocked, stats->maxQueued);
+    Latency_Print("Handshake Latency", &stats->handshake);
+    Latency_Print("Read Latency", &stats->read);
+    Latency_Print("Write Latency", &stats->write);
+#ifdef HAVE_EXT_CACHE
+    if (sessCache != NULL) {
+        fprintf(stderr, "\tSession Cache     : %9d hits of %d lookups\n",
+                sessCache->hits, sessCache->lookups);
+    }
+#endif
+
+    /* Show how evenly the connections were spread over the threads. */
+    fprintf(stderr, "\tThread   CPU     Conns       t/s  Accept Avg\n");
+    for (i = 0; i < ctx->numThreads; i++) {
+        int full;
+
+        threadData = &ctx->threadData[i];
+        stats = &threadData->stats;
+        full = stats->numConnections - stats->numResumed;
+        fprintf(stderr, "\t%6d %5d %9d %9.3f %8.3f ms\n", i,
+                threadData->cpu, stats->numConnections,
+                stats->totalTime > 0 ?
+                    stats->numConnections / stats->totalTime : 0,
+                full > 0 ? stats->acceptTime * 1000 / full : 0);
+    }
 }
 
 
@@ -809,6 +1996,32 @@ static int WolfSSLCtx_Init(ThreadData* threadData, int version, int allowDowngra
     SetDHCtx(threadData->ctx);
 #endif
 
+    /* Queue encrypted data when the socket isn't writable. */
+    wolfSSL_CTX_SetIOSend(threadData->ctx, SSLConn_IOSend);
+
+#ifdef HAVE_EXT_CACHE
+    if (sessCache != NULL) {
+        /* Sessions of all threads are kept in the one shared cache. */
+        wolfSSL_CTX_set_session_cache_mode(threadData->ctx,
+            WOLFSSL_SESS_CACHE_SERVER | WOLFSSL_SESS_CACHE_NO_INTERNAL);
+        wolfSSL_CTX_sess_set_new_cb(threadData->ctx, SessCache_NewCb);
+        wolfSSL_CTX_sess_set_get_cb(threadData->ctx, SessCache_GetCb);
+        wolfSSL_CTX_sess_set_remove_cb(threadData->ctx, SessCache_RemoveCb);
+    }
+#endif
+#ifdef HAVE_SESSION_TICKET
+    if (sharedSessions) {
+        /* Tickets are encrypted with keys shared by all threads. */
+        if (wc_InitRng(&threadData->rng) != 0) {
+            fprintf(stderr, "ERROR: failed to initialize random\n");
+            WolfSSLCtx_Final(threadData);
+            return(EXIT_FAILURE);
+        }
+        wolfSSL_CTX_set_TicketEncCb(threadData->ctx, TicketKey_EncCb);
+        wolfSSL_CTX_set_TicketEncCtx(threadData->ctx, threadData);
+    }
+#endif
+
     return EXIT_SUCCESS;
 }
 
@@ -820,6 +2033,10 @@ static void WolfSSLCtx_Final(ThreadData* threadData)
 {
     wolfSSL_CTX_free(threadData->ctx);
     threadData->ctx = NULL;
+#ifdef HAVE_SESSION_TICKET
+    if (sharedSessions)
+        wc_FreeRng(&threadData->rng);
+#endif
 
 #ifdef WOLFSSL_ASYNC_CRYPT
     wolfAsync_DevClose(&threadData->devId);
@@ -876,6 +2093,90 @@ static int CreateSocketListen(int port, int numClients, socklen_t* socketfd) {
     return EXIT_SUCCESS;
 }
 
+/* Attach a classic BPF program to the SO_REUSEPORT group of listeners that
+ * selects the listener of the thread pinned to the CPU that received the
+ * connection request. The program is a table generated from the CPUs the
+ * threads are pinned to, so CPU ids need not be contiguous. Requests received
+ * on any other CPU are spread over all listeners.
+ * The listeners must have been added to the group in thread order and each
+ * thread pinned to a different CPU.
+ *
+ * socketfd    A socket in the SO_REUSEPORT group.
+ * threadData  The data of the threads - the CPU each is pinned to.
+ * numThreads  The number of listeners in the group.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int SteerByCpu(socklen_t socketfd, ThreadData* threadData,
+                      int numThreads)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    struct sock_filter* code;
+    struct sock_fprog   prog;
+    int                 n = 0;
+    int                 i;
+    int                 ret = EXIT_SUCCESS;
+
+    if (2 * numThreads + 3 > BPF_MAXINSNS) {
+        fprintf(stderr, "Too many threads to steer by CPU\n");
+        return EXIT_FAILURE;
+    }
+    code = (struct sock_filter*)calloc(2 * numThreads + 3, sizeof(*code));
+    if (code == NULL)
+        return EXIT_FAILURE;
+
+    /* A = CPU that the packet was received on. */
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                                             SKF_AD_OFF + SKF_AD_CPU);
+    for (i = 0; i < numThreads; i++) {
+        /* Return the thread's index when A is the thread's CPU. */
+        code[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                                                 threadData[i].cpu, 0, 1);
+        code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    /* Otherwise return A % number of listeners. */
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_ALU | BPF_MOD | BPF_K,
+                                             numThreads);
+    code[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_A, 0);
+    prog.len = n;
+    prog.filter = code;
+
+    if (setsockopt(socketfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                   sizeof(prog)) < 0) {
+        fprintf(stderr, "setsockopt SO_ATTACH_REUSEPORT_CBPF failed\n");
+        ret = EXIT_FAILURE;
+    }
+    free(code);
+
+    return ret;
+#else
+    (void)socketfd;
+    (void)threadData;
+    (void)numThreads;
+
+    fprintf(stderr, "SO_ATTACH_REUSEPORT_CBPF not supported\n");
+    return EXIT_FAILURE;
+#endif
+}
+
+/* Pin the calling thread to a CPU.
+ *
+ * cpu  The CPU to run on.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int PinToCpu(int cpu)
+{
+    cpu_set_t cpuset;
+
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+        fprintf(stderr, "Failed to pin thread to CPU %d\n", cpu);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
 /* Handles a number of connections for a thread.
  *
  * data  The thread data.
@@ -890,22 +2191,34 @@ static void *ThreadHandler(void *data)
     struct epoll_event* events = NULL;
     ThreadData*         threadData = (ThreadData*)data;
 #ifdef WOLFSSL_ASYNC_CRYPT
-    WOLF_EVENT*         wolfEvents[MAX_WOLF_EVENTS];
 #endif
 
+    /* Run on the CPU that the listener is serving. */
+    if (threadData->cpu >= 0 && PinToCpu(threadData->cpu) != EXIT_SUCCESS)
+        threadData->cpu = -1;
+
     /* Initialize wolfSSL and create a context object. */
     if (WolfSSLCtx_Init(threadData, version, allowDowngrade, ourCert, ourKey, verifyCert, cipherList) == -1) {
         exit(EXIT_FAILURE);
     }
 
+    /* Create all connections and wolfSSL objects up front. */
+    if (usePool && SSLConn_SlabInit(sslConnCtx, threadData) != EXIT_SUCCESS) {
+        fprintf(stderr, "ERROR: failed to create connection pool\n");
+        exit(EXIT_FAILURE);
+    }
+
     /* Allocate space for EPOLL events to be stored. */
     events = (struct epoll_event*)malloc(EPOLL_NUM_EVENTS * sizeof(*events));
     if (events == NULL)
         exit(EXIT_FAILURE);
 
-    /* Create a socket and listen for a client. */
-    if (CreateSocketListen(port, numClients, &socketfd) == EXIT_FAILURE)
+    /* Create a socket and listen for a client unless created up front. */
+    socketfd = threadData->socketfd;
+    if (socketfd == (socklen_t)-1 &&
+            CreateSocketListen(port, numClients, &socketfd) == EXIT_FAILURE)
         exit(EXIT_FAILURE);
+    threadData->socketfd = -1;
 
     /* Create an EPOLL file descriptor. */
     efd = epoll_create1(0);
@@ -929,46 +2242,19 @@ static void *ThreadHandler(void *data)
     while (!SSLConn_Done(sslConnCtx)) {
         int n;
         int i;
+        int timeout = 1;
 
 #ifdef WOLFSSL_ASYNC_CRYPT
-        do {
-            double diff, start = current_time(1);
-            ret = wolfSSL_CTX_AsyncPoll(threadData->ctx, wolfEvents,
-                                        MAX_WOLF_EVENTS,
-                                        WOLF_POLL_FLAG_CHECK_HW, &n);
-            diff = current_time(0) - start;
-            pthread_mutex_lock(&sslConnMutex);
-            sslConnCtx->asyncTime += diff;
-            pthread_mutex_unlock(&sslConnMutex);
-            for (i = 0; i < n; i++) {
-                SSLConn* sslConn = threadData->sslConn;
-
-                while (sslConn != NULL) {
-                    if (sslConn->ssl != wolfEvents[i]->context) {
-                        sslConn = sslConn->next;
-                        continue;
-                    }
-
-                    SSLConn_ReadWrite(sslConnCtx, threadData, sslConn);
-                    break;
-                }
-            }
-        } while (n > 0);
-#endif
-
-        SSLConn_FreeSSLConn(threadData);
-
-#ifdef WOLFSSL_ASYNC_CRYPT
-        /* Look for events. */
-        n = epoll_wait(efd, events, EPOLL_NUM_EVENTS, 0);
-#else
-        /* Wait a second for events. */
-        n = epoll_wait(efd, events, EPOLL_NUM_EVENTS, 1);
+        /* Don't wait when polling for completions. */
+        if (threadData->asyncPending > 0)
+            timeout = 0;
 #endif
+        /* Wait a millisecond for events. */
+        n = epoll_wait(efd, events, EPOLL_NUM_EVENTS, timeout);
         /* Process all returned events. */
         for (i = 0; i < n; i++) {
             /* Error event on socket. */
-            if (!(events[i].events & EPOLLIN)) {
+            if (!(events[i].events & (EPOLLIN | EPOLLOUT))) {
                 if (events[i].data.ptr == NULL) {
                     /* Not a client, therefore the listening connection. */
                     close(socketfd);
@@ -997,6 +2283,7 @@ static void *ThreadHandler(void *data)
                         fprintf(stderr, "ERROR: failed add event to epoll\n");
                         exit(EXIT_FAILURE);
                     }
+                    sslConn->efd = efd;
                 }
 
                 if (threadData->cnt == sslConnCtx->numConns) {
@@ -1016,11 +2303,27 @@ static void *ThreadHandler(void *data)
                         sslConnCtx->totalTime = current_time(1);
                     pthread_mutex_unlock(&sslConnMutex);
                 }
-                ret = SSLConn_ReadWrite(sslConnCtx, threadData,
-                                        events[i].data.ptr);
+                if (threadData->stats.totalTime == 0)
+                    threadData->stats.totalTime = current_time(1);
+                /* Send queued data before serving more of the client. */
+                if (events[i].events & EPOLLOUT)
+                    SSLConn_Flush(sslConnCtx, threadData, events[i].data.ptr);
+                if (events[i].events & EPOLLIN) {
+                    ret = SSLConn_ReadWrite(sslConnCtx, threadData,
+                                            events[i].data.ptr);
+                }
             }
         }
 
+#ifdef WOLFSSL_ASYNC_CRYPT
+        /* Continue the connections whose asynchronous operations completed. */
+        if (threadData->asyncPending > 0)
+            SSLConn_AsyncPoll(sslConnCtx, threadData);
+#endif
+
+        /* Connections closed while handling the events are done with. */
+        SSLConn_FreeSSLConn(threadData);
+
         /* Accept more connections again up to the maximum concurrent. */
         if (!threadData->accepting &&
             threadData->cnt < sslConnCtx->numConns) {
@@ -1033,8 +2336,14 @@ static void *ThreadHandler(void *data)
         }
     }
 
-    if (socketfd != -1)
+    if (threadData->stats.totalTime != 0) {
+        threadData->stats.totalTime = current_time(0) -
+                                      threadData->stats.totalTime;
+    }
+
+    if (socketfd != (socklen_t)-1)
         close(socketfd);
+    close(efd);
     free(events);
 
     return NULL;
@@ -1086,6 +2395,18 @@ static void Usage(void)
     printf("-R <num>    <num> bytes read from client\n");
     printf("-W <num>    <num> bytes written to client\n");
     printf("-B <num>    Benchmark <num> written bytes\n");
+    printf("-s          Listener per thread created in order, threads pinned to CPUs\n");
+    printf("-S          As -s and steer connections to listener of receiving CPU\n");
+    printf("-P          Pool connections and wolfSSL objects\n");
+    printf("-C          Share session cache and ticket keys between threads\n");
+    printf("-K <num>    Rotate shared ticket key every <num> seconds, default %d\n",
+                                 TICKET_KEY_PERIOD);
+    printf("-T <file>   Shared ticket key secret (%d bytes) for all processes\n",
+                                 TICKET_SECRET_SZ);
+    printf("-H <num>    Stop serving a client with <num> bytes queued, default %d\n",
+                                 WRITE_HIGH_WATER);
+    printf("-L <num>    Serve a client again at <num> bytes queued, default %d\n",
+                                 WRITE_LOW_WATER);
 }
 
 /* Main entry point for the program.
@@ -1200,6 +2521,60 @@ int main(int argc, char* argv[])
                 maxConns = 0;
                 break;
 
+            /* SO_REUSEPORT listener per thread, threads pinned to CPUs. */
+            case 's':
+                sharded = 1;
+                break;
+
+            /* As above with connections steered to the receiving CPU. */
+            case 'S':
+                sharded = 1;
+                steerByCpu = 1;
+                break;
+
+            /* Pool connections and wolfSSL objects. */
+            case 'P':
+                usePool = 1;
+                break;
+
+            /* Share session cache and ticket keys between threads. */
+            case 'C':
+                sharedSessions = 1;
+                break;
+
+            /* Period to rotate shared ticket key after. */
+            case 'K':
+                ticketPeriod = atoi(myoptarg);
+                if (ticketPeriod <= 0) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
+            /* File with secret to derive shared ticket keys from. */
+            case 'T':
+                ticketSecretFile = myoptarg;
+                sharedSessions = 1;
+                break;
+
+            /* Number of queued bytes to stop serving a client at. */
+            case 'H':
+                highWater = atoi(myoptarg);
+                if (highWater <= 0) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
+            /* Number of queued bytes to serve a client again at. */
+            case 'L':
+                lowWater = atoi(myoptarg);
+                if (lowWater < 0) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
             /* Unrecognized command line argument. */
             default:
                 Usage();
@@ -1207,6 +2582,11 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (lowWater > highWater) {
+        fprintf(stderr, "ERROR: low watermark above high watermark\n");
+        exit(MY_EX_USAGE);
+    }
+
 #ifdef DEBUG_WOLFSSL
     wolfSSL_Debugging_ON();
 #endif
@@ -1218,14 +2598,88 @@ int main(int argc, char* argv[])
     /* Initialize wolfSSL */
     wolfSSL_Init();
 
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+    /* Reserve an ex-data index to store the connection against. */
+    sslConnExDataIdx = wolfSSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    if (sslConnExDataIdx < 0) {
+        fprintf(stderr, "ERROR: failed to get ex-data index\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
     RandomReply(reply, sizeof(reply));
 
+    if (sharedSessions) {
+#ifdef HAVE_EXT_CACHE
+        sessCache = SessCache_New();
+        if (sessCache == NULL) {
+            fprintf(stderr, "ERROR: failed to create session cache\n");
+            exit(EXIT_FAILURE);
+        }
+#else
+        fprintf(stderr, "Session cache not shared - needs HAVE_EXT_CACHE\n");
+#endif
+#ifdef HAVE_SESSION_TICKET
+        if (TicketKey_Init(ticketSecretFile) != EXIT_SUCCESS)
+            exit(EXIT_FAILURE);
+#else
+        fprintf(stderr, "Ticket keys not shared - needs HAVE_SESSION_TICKET\n");
+#endif
+    }
+
     /* Create SSL/TLS connection data object. */
     sslConnCtx = SSLConn_New(numThreads, numConns, numBytesRead, numBytesWrite,
                              maxConns, maxBytes);
     if (sslConnCtx == NULL)
         exit(EXIT_FAILURE);
 
+    if (sharded) {
+        cpu_set_t cpuset;
+        int*      cpus;
+        int       numCpus = 0;
+
+        /* Pin to the CPUs the process may run on - online and not isolated
+         * away - which need not be numbered contiguously. */
+        cpus = (int*)malloc(CPU_SETSIZE * sizeof(*cpus));
+        if (cpus == NULL)
+            exit(EXIT_FAILURE);
+        if (sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+            for (i = 0; i < CPU_SETSIZE; i++) {
+                if (CPU_ISSET(i, &cpuset))
+                    cpus[numCpus++] = i;
+            }
+        }
+        if (numCpus == 0)
+            cpus[numCpus++] = 0;
+        /* A CPU can only steer to one listener - the threads sharing it
+         * would never be given connections. */
+        if (steerByCpu && numThreads > numCpus) {
+            fprintf(stderr, "ERROR: -S needs no more threads than CPUs (%d)\n",
+                    numCpus);
+            exit(EXIT_FAILURE);
+        }
+
+        /* Listeners join the SO_REUSEPORT group in thread order so that the
+         * index chosen by the steering program is the thread's index. */
+        for (i = 0; i < numThreads; i++) {
+            ThreadData* threadData = &sslConnCtx->threadData[i];
+
+            if (CreateSocketListen(port, numClients, &threadData->socketfd)
+                    == EXIT_FAILURE) {
+                exit(EXIT_FAILURE);
+            }
+            threadData->cpu = cpus[i % numCpus];
+        }
+        free(cpus);
+
+        if (steerByCpu && numThreads > 0 &&
+                SteerByCpu(sslConnCtx->threadData[0].socketfd,
+                           sslConnCtx->threadData, numThreads)
+                    != EXIT_SUCCESS) {
+            fprintf(stderr, "Connections not steered by CPU\n");
+        }
+    }
+
     for (i = 0; i < numThreads; i++) {
         if (pthread_create(&sslConnCtx->threadData[i].thread_id, NULL,
                            ThreadHandler, &sslConnCtx->threadData[i]) < 0) {
@@ -1241,6 +2695,13 @@ int main(int argc, char* argv[])
 
     SSLConn_PrintStats(sslConnCtx);
     SSLConn_Free(sslConnCtx);
+#ifdef HAVE_EXT_CACHE
+    SessCache_Free(sessCache);
+    sessCache = NULL;
+#endif
+#ifdef HAVE_SESSION_TICKET
+    memset(ticketSecret, 0, sizeof(ticketSecret));
+#endif
 
     wolfSSL_Cleanup();
 
@@ -0,0 +1,1949 @@
+/* server-tls-uring-perf.c
+ *
+ * Copyright (C) 2006-2020 wolfSSL Inc.
+ *
+ * This file is part of wolfSSL. (formerly known as CyaSSL)
+ *
+ * wolfSSL is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * wolfSSL is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+ *=============================================================================
+ *
+ * This is an example of a TCP Server that uses io_uring to handle a large
+ * number of connections. Reports performance figures.
+ *
+ * Connections are accepted with a multishot accept. Client data is received
+ * with multishot receives into a ring of buffers provided to the kernel and
+ * handed to wolfSSL through custom I/O callbacks. Data written by wolfSSL is
+ * collected per connection and all sends are submitted together once per
+ * loop.
+ *
+ * Talks to io_uring directly with system calls - liburing is not required.
+ * Needs Linux 6.0 or later for multishot receive.
+*/
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include <wolfssl/options.h>
+#include <wolfssl/ssl.h>
+
+#include <wolfssl/test.h>
+
+
+/* Default port to listen on. */
+#define DEFAULT_PORT     11111
+/* The number of concurrent connections to support. */
+#define SSL_NUM_CONN     15
+/* The number of bytes to read from client. */
+#define NUM_READ_BYTES   16384
+/* The number of bytes to write to client. */
+#define NUM_WRITE_BYTES  16384
+/* The maximum number of bytes to send in a run. */
+#define MAX_BYTES        -1
+/* The maximum number of connections to perform in this run. */
+#define MAX_CONNECTIONS  100
+/* The maximum length of the queue of pending connections. */
+#define NUM_CLIENTS      100
+/* The number of wolfSSL events to accept and process at one time. */
+#define MAX_WOLF_EVENTS  10
+
+/* The number of submission queue entries. */
+#define URING_ENTRIES    256
+/* The minimum number of receive buffers provided to the kernel. */
+#define URING_NUM_BUFS   1024
+/* The maximum number of receive buffers - limit of a buffer ring. */
+#define URING_MAX_BUFS   32768
+/* The number of receive buffers to allow for each connection - enough for a
+ * full TLS record. */
+#define URING_CONN_BUFS  5
+/* The size of each receive buffer. */
+#define URING_BUF_SZ     4096
+/* The identifier of the group of receive buffers. */
+#define URING_BUF_GROUP  0
+/* The number of bytes of TLS data to hold for sending per connection. */
+#define NUM_OUT_BYTES    32768
+
+/* The type of operation in the low bits of the user data. */
+#define URING_OP_RECV    0
+#define URING_OP_SEND    1
+#define URING_OP_MASK    3
+/* User data of operations that aren't for a connection. */
+#define URING_OP_ACCEPT  2
+#define URING_OP_CANCEL  3
+
+/* The command line options. */
+#define OPTIONS          "?p:v:al:c:k:A:n:N:R:W:B:"
+
+/* The default server certificate. */
+#define SVR_CERT "../certs/server-cert.pem"
+/* The default server private key. */
+#define SVR_KEY  "../certs/server-key.pem"
+/* The default certificate/CA file for the client. */
+#define CLI_CERT "../certs/client-cert.pem"
+
+#ifndef __NR_io_uring_setup
+    #define __NR_io_uring_setup     425
+#endif
+#ifndef __NR_io_uring_enter
+    #define __NR_io_uring_enter     426
+#endif
+#ifndef __NR_io_uring_register
+    #define __NR_io_uring_register  427
+#endif
+
+/* The states of the SSL connection. */
+typedef enum SSLState { ACCEPT, READ, WRITE, CLOSED } SSLState;
+
+/* The io_uring instance and the receive buffers provided to it. */
+typedef struct Uring {
+    /* The io_uring file descriptor. */
+    int fd;
+
+    /* The mapped submission queue ring. */
+    void* sqRing;
+    /* The size of the mapped submission queue ring. */
+    size_t sqRingSz;
+    /* The kernel's head of the submission queue. */
+    unsigned* sqHead;
+    /* The tail of the submission queue seen by the kernel. */
+    unsigned* sqKTail;
+    /* The mask to apply to an index into the submission queue. */
+    unsigned sqMask;
+    /* The number of entries in the submission queue. */
+    unsigned sqEntries;
+    /* The array of indices into the submission queue entries. */
+    unsigned* sqArray;
+    /* The submission queue entries. */
+    struct io_uring_sqe* sqes;
+    /* The size of the mapped submission queue entries. */
+    size_t sqesSz;
+    /* The tail of the submission queue - entries not yet seen by kernel. */
+    unsigned sqTail;
+
+    /* The mapped completion queue ring. */
+    void* cqRing;
+    /* The size of the mapped completion queue ring. */
+    size_t cqRingSz;
+    /* The head of the completion queue. */
+    unsigned* cqHead;
+    /* The kernel's tail of the completion queue. */
+    unsigned* cqTail;
+    /* The mask to apply to an index into the completion queue. */
+    unsigned cqMask;
+    /* The completion queue entries. */
+    struct io_uring_cqe* cqes;
+
+    /* The ring of receive buffers provided to the kernel. */
+    struct io_uring_buf_ring* bufRing;
+    /* The size of the mapped ring of receive buffers. */
+    size_t bufRingSz;
+    /* The number of receive buffers - power of 2. */
+    unsigned numBufs;
+    /* The tail of the ring of receive buffers. */
+    unsigned short bufTail;
+    /* Count of buffers given back to the kernel. */
+    long bufReturned;
+    /* The memory of the receive buffers. */
+    char* bufs;
+    /* The number of bytes received into each buffer. */
+    int* bufLen;
+    /* The next buffer of received data in a connection's list. */
+    int* bufNext;
+
+    /* Number of io_uring_enter system calls. */
+    long numEnter;
+} Uring;
+
+/* Type for the SSL connection data. */
+typedef struct SSLConn SSLConn;
+
+/* Type for the information about SSL/TLS connections. */
+typedef struct SSLConn_CTX SSLConn_CTX;
+
+/* Data for each active connection. */
+struct SSLConn {
+    /* The socket reading from and writing to. */
+    int sockfd;
+    /* The wolfSSL object to perform TLS communications. */
+    WOLFSSL* ssl;
+    /* The current state of the SSL/TLS connection. */
+    SSLState state;
+    /* The information about SSL/TLS connections. */
+    SSLConn_CTX* ctx;
+    /* Number of operations submitted and not completed for connection. */
+    int inflight;
+    /* A multishot receive is outstanding. */
+    int recvArmed;
+    /* Client has closed the connection. */
+    int eof;
+
+    /* First buffer of received data not yet read by wolfSSL. -1 when none. */
+    int inHead;
+    /* Last buffer of received data not yet read by wolfSSL. -1 when none. */
+    int inTail;
+    /* Offset into the first buffer of data not yet read. */
+    int inOff;
+
+    /* Number of bytes in the output buffer. */
+    int outLen;
+    /* Number of bytes of output buffer that have been sent. */
+    int outSent;
+    /* A send is outstanding. */
+    int sending;
+    /* Connection is on list of connections with data to send. */
+    int queued;
+    /* wolfSSL wants to write more than there is room for. */
+    int wantWrite;
+    /* Next connection with data to send. */
+    SSLConn* sendNext;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* An asynchronous operation is outstanding. */
+    int pending;
+#endif
+
+    /* Previous SSL connection data object. */
+    SSLConn* prev;
+    /* Next SSL connection data object. */
+    SSLConn* next;
+
+    /* TLS data written by wolfSSL waiting to be sent. */
+    char out[NUM_OUT_BYTES];
+};
+
+/* The information about SSL/TLS connections. */
+struct SSLConn_CTX {
+    /* An array of active connections. */
+    SSLConn* sslConn;
+    /* Free list. */
+    SSLConn* freeSSLConn;
+    /* List of connections with data to send. */
+    SSLConn* sendList;
+    /* The io_uring instance. */
+    Uring ring;
+    /* Maximum number of active connections. */
+    int numConns;
+    /* Count of currently active connections. */
+    int cnt;
+    /* Multishot accept outstanding. */
+    int acceptArmed;
+    /* Accepting new connections - accept not being cancelled. */
+    int accepting;
+    /* Sockets accepted while at the maximum, waiting for a free slot. */
+    int* waitFds;
+    /* Number of sockets waiting for a free slot. */
+    int numWaitFds;
+    /* Number of sockets that fit in the waiting list. */
+    int maxWaitFds;
+    /* A connection ran out of receive buffers. */
+    int starved;
+    /* Count of buffers given back when a connection last ran out. */
+    long starvedReturned;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Number of connections with asynchronous operations outstanding. */
+    int asyncPending;
+#endif
+
+    /* Size of the client data buffer. */
+    int bufferLen;
+    /* Number of bytes to write. */
+    int replyLen;
+
+    /* Number of connections handled. */
+    int numConnections;
+    /* Number of resumed connections handled. */
+    int numResumed;
+    /* Maximum number of connections to perform. */
+    int maxConnections;
+
+    /* Total number of bytes read. */
+    int totalReadBytes;
+    /* Total number of bytes written. */
+    int totalWriteBytes;
+    /* Maximum number of bytes to read/write. */
+    int maxBytes;
+
+    /* Total time handling accept. */
+    double acceptTime;
+    /* Total time handling accept - resumed connections. */
+    double resumeTime;
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Total time handling asynchronous operations. */
+    double asyncTime;
+#endif
+    /* Total time handling reading. */
+    double readTime;
+    /* Total time handling writing. */
+    double writeTime;
+    /* Total time handling connections. */
+    double totalTime;
+};
+
+
+static void SSLConn_Free(SSLConn_CTX* ctx);
+static void SSLConn_Close(SSLConn_CTX* ctx, SSLConn* sslConn);
+static void SSLConn_FreeSSLConn(SSLConn_CTX* ctx, int force);
+
+
+/* The index of the command line option. */
+int   myoptind = 0;
+/* The current command line option. */
+char* myoptarg = NULL;
+#ifdef WOLFSSL_ASYNC_CRYPT
+/* Global device identifier. */
+static int devId = INVALID_DEVID;
+#endif
+/* The data to reply with. */
+static char reply[NUM_WRITE_BYTES];
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+/* The index of the connection in the wolfSSL object's ex-data. */
+static int sslConnExDataIdx = -1;
+#endif
+
+
+/* Create an io_uring instance and map its rings into memory.
+ *
+ * ring     The io_uring data.
+ * entries  The number of submission queue entries.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int Uring_Init(Uring* ring, unsigned entries)
+{
+    struct io_uring_params params;
+    unsigned               i;
+    char*                  p;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+
+    /* Room for multishot completions from all connections. */
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        fprintf(stderr, "ERROR: failed to create io_uring\n");
+        return EXIT_FAILURE;
+    }
+
+    ring->sqRingSz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->sqRing = mmap(NULL, ring->sqRingSz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        ring->sqRing = NULL;
+        fprintf(stderr, "ERROR: failed to map submission queue\n");
+        return EXIT_FAILURE;
+    }
+    p = (char*)ring->sqRing;
+    ring->sqHead = (unsigned*)(p + params.sq_off.head);
+    ring->sqKTail = (unsigned*)(p + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(p + params.sq_off.ring_mask);
+    ring->sqEntries = *(unsigned*)(p + params.sq_off.ring_entries);
+    ring->sqArray = (unsigned*)(p + params.sq_off.array);
+    ring->sqTail = *ring->sqKTail;
+
+    ring->sqesSz = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSz,
+        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+        IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        fprintf(stderr, "ERROR: failed to map submission queue entries\n");
+        return EXIT_FAILURE;
+    }
+    /* Entries are always used in order. */
+    for (i = 0; i < ring->sqEntries; i++)
+        ring->sqArray[i] = i;
+
+    ring->cqRingSz = params.cq_off.cqes +
+                     params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->cqRing = mmap(NULL, ring->cqRingSz, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cqRing == MAP_FAILED) {
+        ring->cqRing = NULL;
+        fprintf(stderr, "ERROR: failed to map completion queue\n");
+        return EXIT_FAILURE;
+    }
+    p = (char*)ring->cqRing;
+    ring->cqHead = (unsigned*)(p + params.cq_off.head);
+    ring->cqTail = (unsigned*)(p + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(p + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(p + params.cq_off.cqes);
+
+    return EXIT_SUCCESS;
+}
+
+/* Give a receive buffer to the kernel to receive into.
+ *
+ * ring  The io_uring data.
+ * bid   The identifier of the buffer.
+ */
+static void Uring_BufReturn(Uring* ring, int bid)
+{
+    struct io_uring_buf* buf;
+
+    buf = &ring->bufRing->bufs[ring->bufTail & (ring->numBufs - 1)];
+    buf->addr = (unsigned long)(ring->bufs + (size_t)bid * URING_BUF_SZ);
+    buf->len = URING_BUF_SZ;
+    buf->bid = (unsigned short)bid;
+    ring->bufTail++;
+    ring->bufReturned++;
+    /* Make buffer visible to kernel. */
+    __atomic_store_n(&ring->bufRing->tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+/* Create the receive buffers and provide them to the kernel.
+ * There are enough buffers for each connection to receive a full TLS record,
+ * up to the maximum that a buffer ring holds.
+ *
+ * ring      The io_uring data.
+ * numConns  The number of concurrent connections.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int Uring_BufInit(Uring* ring, int numConns)
+{
+    struct io_uring_buf_reg reg;
+    unsigned                i;
+
+    ring->numBufs = URING_NUM_BUFS;
+    while (ring->numBufs < (unsigned)numConns * URING_CONN_BUFS &&
+           ring->numBufs < URING_MAX_BUFS) {
+        ring->numBufs *= 2;
+    }
+    if ((unsigned)numConns * URING_CONN_BUFS > ring->numBufs) {
+        printf("Warning: %u receive buffers for %d connections - receives "
+               "will wait for buffers to be given back\n", ring->numBufs,
+               numConns);
+    }
+
+    ring->bufRingSz = ring->numBufs * sizeof(struct io_uring_buf);
+    ring->bufRing = (struct io_uring_buf_ring*)mmap(NULL, ring->bufRingSz,
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->bufRing == MAP_FAILED) {
+        ring->bufRing = NULL;
+        return EXIT_FAILURE;
+    }
+
+    ring->bufs = (char*)malloc((size_t)ring->numBufs * URING_BUF_SZ);
+    ring->bufLen = (int*)malloc(ring->numBufs * sizeof(*ring->bufLen));
+    ring->bufNext = (int*)malloc(ring->numBufs * sizeof(*ring->bufNext));
+    if (ring->bufs == NULL || ring->bufLen == NULL || ring->bufNext == NULL)
+        return EXIT_FAILURE;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->bufRing;
+    reg.ring_entries = ring->numBufs;
+    reg.bgid = URING_BUF_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+        fprintf(stderr, "ERROR: failed to register buffer ring\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < ring->numBufs; i++)
+        Uring_BufReturn(ring, i);
+
+    return EXIT_SUCCESS;
+}
+
+/* Unmap the rings of the io_uring and free the receive buffers.
+ *
+ * ring  The io_uring data.
+ */
+static void Uring_Free(Uring* ring)
+{
+    if (ring->fd != -1)
+        close(ring->fd);
+    if (ring->sqRing != NULL)
+        munmap(ring->sqRing, ring->sqRingSz);
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqesSz);
+    if (ring->cqRing != NULL)
+        munmap(ring->cqRing, ring->cqRingSz);
+    if (ring->bufRing != NULL)
+        munmap(ring->bufRing, ring->bufRingSz);
+    free(ring->bufs);
+    free(ring->bufLen);
+    free(ring->bufNext);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/* Submit the queued entries and, optionally, wait for a completion.
+ *
+ * ring  The io_uring data.
+ * wait  Wait for at least one completion when non-zero.
+ * returns the number of entries submitted or -1 on error.
+ */
+static int Uring_Enter(Uring* ring, int wait)
+{
+    unsigned toSubmit;
+    int      ret;
+
+    /* Make entries visible to kernel. */
+    __atomic_store_n(ring->sqKTail, ring->sqTail, __ATOMIC_RELEASE);
+    toSubmit = ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (toSubmit == 0 && !wait)
+        return 0;
+
+    ring->numEnter++;
+    ret = (int)syscall(__NR_io_uring_enter, ring->fd, toSubmit, wait ? 1 : 0,
+                       wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        fprintf(stderr, "ERROR: io_uring_enter failed (%d)\n", errno);
+        return -1;
+    }
+
+    return ret;
+}
+
+/* Get the next free submission queue entry.
+ * Submits the queued entries when the queue is full.
+ *
+ * ring  The io_uring data.
+ * returns a cleared submission queue entry.
+ */
+static struct io_uring_sqe* Uring_GetSqe(Uring* ring)
+{
+    struct io_uring_sqe* sqe;
+
+    while (ring->sqTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE) >=
+           ring->sqEntries) {
+        if (Uring_Enter(ring, 0) < 0)
+            exit(EXIT_FAILURE);
+    }
+
+    sqe = &ring->sqes[ring->sqTail & ring->sqMask];
+    ring->sqTail++;
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+/* Queue a multishot accept on the listening socket.
+ *
+ * ctx     The SSL/TLS connection data.
+ * sockfd  The socket file descriptor to accept on.
+ */
+static void Uring_Accept(SSLConn_CTX* ctx, int sockfd)
+{
+    struct io_uring_sqe* sqe = Uring_GetSqe(&ctx->ring);
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = sockfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_OP_ACCEPT;
+
+    ctx->acceptArmed = 1;
+    ctx->accepting = 1;
+}
+
+/* Cancel the multishot accept - no room for more connections.
+ * Submitted straight away so that as few connections as possible are
+ * accepted before the cancel takes effect.
+ *
+ * ctx  The SSL/TLS connection data.
+ */
+static void Uring_CancelAccept(SSLConn_CTX* ctx)
+{
+    struct io_uring_sqe* sqe = Uring_GetSqe(&ctx->ring);
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_OP_ACCEPT;
+    sqe->user_data = URING_OP_CANCEL;
+
+    ctx->accepting = 0;
+
+    if (Uring_Enter(&ctx->ring, 0) < 0)
+        exit(EXIT_FAILURE);
+}
+
+/* Queue a multishot receive into the provided buffers for a connection.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ */
+static void Uring_Recv(SSLConn_CTX* ctx, SSLConn* sslConn)
+{
+    struct io_uring_sqe* sqe = Uring_GetSqe(&ctx->ring);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sslConn->sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = (unsigned long)sslConn | URING_OP_RECV;
+
+    sslConn->recvArmed = 1;
+    sslConn->inflight++;
+}
+
+/* Queue a send of the connection's unsent output data.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ */
+static void Uring_Send(SSLConn_CTX* ctx, SSLConn* sslConn)
+{
+    struct io_uring_sqe* sqe = Uring_GetSqe(&ctx->ring);
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sslConn->sockfd;
+    sqe->addr = (unsigned long)(sslConn->out + sslConn->outSent);
+    sqe->len = sslConn->outLen - sslConn->outSent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long)sslConn | URING_OP_SEND;
+
+    sslConn->sending = 1;
+    sslConn->inflight++;
+}
+
+
+/* Get the wolfSSL server method function for the specified version.
+ *
+ * version  Protocol version to use.
+ * returns The server method function or NULL when version not supported.
+ */
+static wolfSSL_method_func SSL_GetMethod(int version, int allowDowngrade)
+{
+    wolfSSL_method_func method = NULL;
+
+    switch (version) {
+#ifndef NO_OLD_TLS
+    #ifdef WOLFSSL_ALLOW_SSLV3
+        case 0:
+            method = wolfSSLv3_server_method_ex;
+            break;
+    #endif
+
+    #ifndef NO_TLS
+        #ifdef WOLFSSL_ALLOW_TLSV10
+        case 1:
+            method = wolfTLSv1_server_method_ex;
+            break;
+        #endif
+
+        #ifndef NO_OLD_TLS
+        case 2:
+            method = wolfTLSv1_1_server_method_ex;
+            break;
+        #endif
+    #endif
+#endif
+
+#ifndef NO_TLS
+        case 3:
+            method = allowDowngrade ? wolfSSLv23_server_method_ex : wolfTLSv1_2_server_method_ex;
+            break;
+#endif
+    }
+
+    return method;
+}
+
+
+/* Write data to a client.
+ *
+ * ssl         The wolfSSL object.
+ * reply       The data to send to the client.
+ * replyLen    The length of the data to send to the client.
+ * totalBytes  The total number of bytes sent to clients.
+ * writeTime   The amount of time spent writing data to client.
+ * returns 0 on failure, 1 on success, 2 on want read and 3 on want write.
+ */
+static int SSL_Write(WOLFSSL* ssl, char* reply, int replyLen, int* totalBytes,
+                     double* writeTime)
+{
+    int  rwret = 0;
+    int  error;
+    double start;
+
+    start = current_time(1);
+    rwret = wolfSSL_write(ssl, reply, replyLen);
+    *writeTime += current_time(0) - start;
+    if (rwret == 0) {
+        fprintf(stderr, "The client has closed the connection - write!\n");
+        return 0;
+    }
+
+    if (rwret > 0)
+        *totalBytes += rwret;
+    if (rwret == replyLen)
+        return 1;
+
+    error = wolfSSL_get_error(ssl, 0);
+    if (error == SSL_ERROR_WANT_READ)
+        return 2;
+    if (error == SSL_ERROR_WANT_WRITE)
+        return 3;
+    if (error == WC_PENDING_E)
+        return 4;
+    if (error == 0)
+        return 1;
+
+    /* Cannot do anything about other errors. */
+    fprintf(stderr, "wolfSSL_write error = %d\n", error);
+    return 0;
+}
+
+/* Reads data from a client.
+ *
+ * ssl         The wolfSSL object.
+ * buffer      The buffer to place client data into.
+ * len         The length of the buffer.
+ * totalBytes  The total number of bytes read from clients.
+ * readTime    The amount of time spent reading data from client.
+ * returns 0 on failure, 1 on success, 2 on want read and 3 on want write.
+ */
+static int SSL_Read(WOLFSSL* ssl, char* buffer, int len, int* totalBytes,
+                    double* readTime)
+{
+    int  rwret = 0;
+    int  error;
+    double start;
+
+    start = current_time(1);
+    rwret = wolfSSL_read(ssl, buffer, len);
+    *readTime += current_time(0) - start;
+    if (rwret == 0) {
+        return 0;
+    }
+
+    if (rwret > 0)
+        *totalBytes += rwret;
+
+    error = wolfSSL_get_error(ssl, 0);
+    if (error == SSL_ERROR_WANT_READ)
+        return 2;
+    if (error == SSL_ERROR_WANT_WRITE)
+        return 3;
+    if (error == WC_PENDING_E)
+        return 4;
+    if (error == 0)
+        return 1;
+
+    /* Cannot do anything about other errors. */
+    fprintf(stderr, "wolfSSL_read error = %d\n", error);
+    return 0;
+}
+
+/* Accept/negotiate a secure connection.
+ *
+ * ssl         The wolfSSL object.
+ * acceptTime  The amount of time spent accepting a client.
+ * resumeTime  The amount of time spent resuming a connection with a client.
+ * returns 0 on failure, 1 on success, 2 on want read and 3 on want write.
+ */
+static int SSL_Accept(WOLFSSL* ssl, double* acceptTime, double* resumeTime)
+{
+    int ret;
+    int error;
+    double start;
+
+    /* Accept the connection. */
+    start = current_time(1);
+    ret = wolfSSL_accept(ssl);
+    if (!wolfSSL_session_reused(ssl))
+        *acceptTime += current_time(0) - start;
+    else
+        *resumeTime += current_time(0) - start;
+    if (ret == 0) {
+        fprintf(stderr, "The client has closed the connection - accept!\n");
+        return 0;
+    }
+
+    if (ret == SSL_SUCCESS)
+        return 1;
+
+    error = wolfSSL_get_error(ssl, 0);
+    if (error == SSL_ERROR_WANT_READ)
+        return 2;
+    if (error == SSL_ERROR_WANT_WRITE)
+        return 3;
+    if (error == WC_PENDING_E)
+        return 4;
+
+    /* Cannot do anything about other errors. */
+    fprintf(stderr, "wolfSSL_accept error = %d (%p)\n", error, ssl);
+    return 0;
+}
+
+/* I/O callback to give wolfSSL data received into the provided buffers.
+ * Buffers are given back to the kernel as soon as they have been read.
+ *
+ * ssl    The wolfSSL object.
+ * buf    The buffer to place data into.
+ * sz     The number of bytes wanted.
+ * ioCtx  The SSL connection data object.
+ * returns the number of bytes read, want read when no data is available or
+ * connection closed when client has closed connection.
+ */
+static int SSLConn_IORecv(WOLFSSL* ssl, char* buf, int sz, void* ioCtx)
+{
+    SSLConn* sslConn = (SSLConn*)ioCtx;
+    Uring*   ring = &sslConn->ctx->ring;
+    int      total = 0;
+    int      bid;
+    int      len;
+
+    (void)ssl;
+
+    while (total < sz && (bid = sslConn->inHead) != -1) {
+        len = ring->bufLen[bid] - sslConn->inOff;
+        if (len > sz - total)
+            len = sz - total;
+        memcpy(buf + total, ring->bufs + (size_t)bid * URING_BUF_SZ +
+                            sslConn->inOff, len);
+        total += len;
+        sslConn->inOff += len;
+
+        /* Give back buffer once all data read. */
+        if (sslConn->inOff == ring->bufLen[bid]) {
+            sslConn->inHead = ring->bufNext[bid];
+            if (sslConn->inHead == -1)
+                sslConn->inTail = -1;
+            sslConn->inOff = 0;
+            Uring_BufReturn(ring, bid);
+        }
+    }
+
+    if (total > 0)
+        return total;
+    if (sslConn->eof)
+        return WOLFSSL_CBIO_ERR_CONN_CLOSE;
+    return WOLFSSL_CBIO_ERR_WANT_READ;
+}
+
+/* I/O callback to take data from wolfSSL to send to client.
+ * Data is copied to the connection's output buffer and sent with the output
+ * of other connections in one submission.
+ *
+ * ssl    The wolfSSL object.
+ * buf    The data to send.
+ * sz     The number of bytes to send.
+ * ioCtx  The SSL connection data object.
+ * returns the number of bytes taken or want write when output buffer is full.
+ */
+static int SSLConn_IOSend(WOLFSSL* ssl, char* buf, int sz, void* ioCtx)
+{
+    SSLConn*     sslConn = (SSLConn*)ioCtx;
+    SSLConn_CTX* ctx = sslConn->ctx;
+    int          len;
+
+    (void)ssl;
+
+    if (sslConn->state == CLOSED)
+        return WOLFSSL_CBIO_ERR_CONN_CLOSE;
+
+    len = NUM_OUT_BYTES - sslConn->outLen;
+    if (len == 0) {
+        /* Try again when send completes. */
+        sslConn->wantWrite = 1;
+        return WOLFSSL_CBIO_ERR_WANT_WRITE;
+    }
+    if (len > sz)
+        len = sz;
+    memcpy(sslConn->out + sslConn->outLen, buf, len);
+    sslConn->outLen += len;
+
+    /* Put on list of connections to send for. */
+    if (!sslConn->queued) {
+        sslConn->queued = 1;
+        sslConn->sendNext = ctx->sendList;
+        ctx->sendList = sslConn;
+    }
+
+    return len;
+}
+
+/* Create a new SSL/TLS connection data object.
+ *
+ * max        The maximum number of concurrent connections.
+ * bufferLen  The number of data bytes to read from client.
+ * replyLen   The number of data bytes to write to client.
+ * maxConns   The number of connections to process this run.
+ *            -1 indicates no maximum.
+ * maxBytes   The number of bytes to send this run.
+ *            -1 indicates no maximum.
+ * returns an allocated and initialized connection data object or NULL on error.
+ */
+static SSLConn_CTX* SSLConn_New(int numConns, int bufferLen, int replyLen,
+                                int maxConns, int maxBytes)
+{
+    SSLConn_CTX* ctx;
+
+    ctx = (SSLConn_CTX*)malloc(sizeof(*ctx));
+    if (ctx == NULL)
+        return NULL;
+    memset(ctx, 0, sizeof(*ctx));
+
+    ctx->numConns = numConns;
+    ctx->bufferLen = bufferLen;
+    ctx->replyLen = replyLen;
+    ctx->maxConnections = maxConns;
+    ctx->maxBytes = maxBytes;
+    ctx->sslConn = NULL;
+
+    if (Uring_Init(&ctx->ring, URING_ENTRIES) != EXIT_SUCCESS ||
+            Uring_BufInit(&ctx->ring, numConns) != EXIT_SUCCESS) {
+        SSLConn_Free(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+/* Free the SSL/TLS connection data.
+ *
+ * ctx  The connection data.
+ */
+static void SSLConn_Free(SSLConn_CTX* ctx)
+{
+    if (ctx == NULL)
+        return;
+
+    while (ctx->sslConn != NULL)
+        SSLConn_Close(ctx, ctx->sslConn);
+    /* Outstanding operations are dropped with the io_uring. */
+    SSLConn_FreeSSLConn(ctx, 1);
+    while (ctx->numWaitFds > 0)
+        close(ctx->waitFds[--ctx->numWaitFds]);
+    free(ctx->waitFds);
+
+    Uring_Free(&ctx->ring);
+
+    free(ctx);
+}
+
+/* Close an active connection.
+ * The connection is freed once all its operations have completed.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ */
+static void SSLConn_Close(SSLConn_CTX* ctx, SSLConn* sslConn)
+{
+    int bid;
+
+    if (sslConn->state == CLOSED)
+        return;
+
+    /* Display cipher suite all connection will use. */
+    if (ctx->numConnections == 0) {
+        WOLFSSL_CIPHER* cipher;
+        cipher = wolfSSL_get_current_cipher(sslConn->ssl);
+        printf("SSL cipher suite is %s\n",
+               wolfSSL_CIPHER_get_name(cipher));
+    }
+
+    if (wolfSSL_session_reused(sslConn->ssl))
+        ctx->numResumed++;
+    ctx->numConnections++;
+
+    sslConn->state = CLOSED;
+
+    /* Take it out of the double-linked list. */
+    if (ctx->sslConn == sslConn)
+        ctx->sslConn = sslConn->next;
+    if (sslConn->next != NULL)
+        sslConn->next->prev = sslConn->prev;
+    if (sslConn->prev != NULL)
+        sslConn->prev->next = sslConn->next;
+
+    /* Put object at head of free list */
+    sslConn->next = ctx->freeSSLConn;
+    sslConn->prev = NULL;
+    ctx->freeSSLConn = sslConn;
+
+    /* Give back buffers of data that won't be read. */
+    while ((bid = sslConn->inHead) != -1) {
+        sslConn->inHead = ctx->ring.bufNext[bid];
+        Uring_BufReturn(&ctx->ring, bid);
+    }
+    sslConn->inTail = -1;
+
+    /* Complete the outstanding receive and send. */
+    shutdown(sslConn->sockfd, SHUT_RDWR);
+
+    ctx->cnt--;
+}
+
+/* Free the SSL/TLS connections that are closed and have no operations
+ * outstanding.
+ *
+ * ctx    The connection data.
+ * force  Free the connections even when operations are outstanding.
+ */
+static void SSLConn_FreeSSLConn(SSLConn_CTX* ctx, int force)
+{
+    SSLConn* sslConn = ctx->freeSSLConn;
+    SSLConn* next;
+
+    ctx->freeSSLConn = NULL;
+
+    for (; sslConn != NULL; sslConn = next) {
+        next = sslConn->next;
+
+        if (sslConn->inflight > 0 && !force) {
+            /* Keep until kernel is finished with it. */
+            sslConn->next = ctx->freeSSLConn;
+            ctx->freeSSLConn = sslConn;
+            continue;
+        }
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+        /* Clear out any events. */
+        if (sslConn->pending)
+            ctx->asyncPending--;
+        while (wolfSSL_AsyncPoll(sslConn->ssl, WOLF_POLL_FLAG_CHECK_HW) == 1)
+             ;
+#endif
+        wolfSSL_free(sslConn->ssl);
+        sslConn->ssl = NULL;
+        close(sslConn->sockfd);
+        free(sslConn);
+    }
+}
+
+/* Checks whether this run is done i.e. maximum number of connections or bytes
+ * have been server.
+ *
+ * ctx  The SSL/TLS connection data.
+ * returns 1 if the run is done or 0 otherwise.
+ */
+static int SSLConn_Done(SSLConn_CTX* ctx) {
+    if (ctx->maxConnections > 0)
+        return (ctx->numConnections >= ctx->maxConnections);
+    return (ctx->totalWriteBytes >= ctx->maxBytes) &&
+           (ctx->totalReadBytes >= ctx->maxBytes);
+}
+
+/* Sets up a newly accepted connection and starts receiving on it.
+ *
+ * ctx     The SSL/TLS connection data.
+ * sslCtx  The SSL/TLS context.
+ * sockfd  The socket file descriptor of the accepted connection.
+ * returns EXIT_SUCCESS if the new connection was set up or EXIT_FAILURE
+ * otherwise.
+ */
+static int SSLConn_Accept(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx, int sockfd)
+{
+    SSLConn* conn;
+
+    if (ctx->cnt == ctx->numConns) {
+        fprintf(stderr, "ERROR: Too many connections!\n");
+        return EXIT_FAILURE;
+    }
+
+    conn = malloc(sizeof(*conn));
+    if (conn == NULL)
+        return EXIT_FAILURE;
+    memset(conn, 0, offsetof(SSLConn, out));
+
+    /* Setup SSL/TLS connection. */
+    if ((conn->ssl = wolfSSL_new(sslCtx)) == NULL) {
+        free(conn);
+        fprintf(stderr, "wolfSSL_new error.\n");
+        return EXIT_FAILURE;
+    }
+    /* Data is passed to and from wolfSSL by the I/O callbacks. */
+    wolfSSL_SetIOReadCtx(conn->ssl, conn);
+    wolfSSL_SetIOWriteCtx(conn->ssl, conn);
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+    /* Find the connection directly from the wolfSSL object of an event. */
+    wolfSSL_set_ex_data(conn->ssl, sslConnExDataIdx, conn);
+#endif
+
+    conn->sockfd = sockfd;
+    conn->ctx = ctx;
+    conn->state = ACCEPT;
+    conn->inHead = -1;
+    conn->inTail = -1;
+    conn->next = ctx->sslConn;
+    conn->prev = NULL;
+    if (ctx->sslConn != NULL)
+        ctx->sslConn->prev = conn;
+
+    ctx->sslConn = conn;
+    ctx->cnt++;
+
+    Uring_Recv(ctx, conn);
+
+    return EXIT_SUCCESS;
+}
+
+/* Keep a socket accepted while at the maximum number of connections until a
+ * connection closes.
+ *
+ * ctx     The SSL/TLS connection data.
+ * sockfd  The socket file descriptor of the accepted connection.
+ * returns EXIT_SUCCESS if the socket is waiting or EXIT_FAILURE otherwise.
+ */
+static int SSLConn_AcceptWait(SSLConn_CTX* ctx, int sockfd)
+{
+    if (ctx->numWaitFds == ctx->maxWaitFds) {
+        int  maxFds = ctx->maxWaitFds == 0 ? 8 : ctx->maxWaitFds * 2;
+        int* fds = (int*)realloc(ctx->waitFds, maxFds * sizeof(*fds));
+        if (fds == NULL)
+            return EXIT_FAILURE;
+        ctx->waitFds = fds;
+        ctx->maxWaitFds = maxFds;
+    }
+    ctx->waitFds[ctx->numWaitFds++] = sockfd;
+
+    return EXIT_SUCCESS;
+}
+
+/* Set up the sockets waiting for a connection to close, oldest first, while
+ * there is room.
+ *
+ * ctx     The SSL/TLS connection data.
+ * sslCtx  The SSL/TLS context.
+ */
+static void SSLConn_AcceptWaiting(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx)
+{
+    int i = 0;
+
+    while (i < ctx->numWaitFds && ctx->cnt < ctx->numConns) {
+        if (SSLConn_Accept(ctx, sslCtx, ctx->waitFds[i]) != EXIT_SUCCESS)
+            close(ctx->waitFds[i]);
+        i++;
+    }
+    ctx->numWaitFds -= i;
+    memmove(ctx->waitFds, ctx->waitFds + i,
+            ctx->numWaitFds * sizeof(*ctx->waitFds));
+}
+
+/* Read/write from/to client at the specified socket.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ * returns EXIT_FAILURE on failure and EXIT_SUCCESS otherwise.
+ */
+static int SSLConn_ReadWrite(SSLConn_CTX* ctx, SSLConn* sslConn)
+{
+    int ret = 0;
+    int len;
+
+    switch (sslConn->state) {
+        case ACCEPT:
+            /* Perform TLS handshake. */
+            ret = SSL_Accept(sslConn->ssl, &ctx->acceptTime, &ctx->resumeTime);
+            if (ret == 0) {
+                printf("ERROR: Accept failed\n");
+                SSLConn_Close(ctx, sslConn);
+                return EXIT_FAILURE;
+            }
+
+            if (ret == 1) {
+                sslConn->state = READ;
+            }
+            break;
+
+        case READ:
+            {
+                char buffer[NUM_READ_BYTES];
+
+                len = ctx->bufferLen;
+                if (ctx->maxBytes > 0) {
+                    len = min(len, ctx->maxBytes - ctx->totalReadBytes);
+                }
+                if (len == 0)
+                    break;
+
+                /* Read application data. */
+                ret = SSL_Read(sslConn->ssl, buffer, len, &ctx->totalReadBytes,
+                               &ctx->readTime);
+                if (ret == 0) {
+                    SSLConn_Close(ctx, sslConn);
+                    return EXIT_FAILURE;
+                }
+
+                if (ret != 1)
+                    break;
+                sslConn->state = WRITE;
+            }
+
+        case WRITE:
+            len = ctx->replyLen;
+            if (ctx->maxBytes > 0) {
+                len = min(len, ctx->maxBytes - ctx->totalWriteBytes);
+            }
+            if (len == 0)
+                break;
+
+            /* Write application data. */
+            ret = SSL_Write(sslConn->ssl, reply, len, &ctx->totalWriteBytes,
+                            &ctx->writeTime);
+            if (ret == 0) {
+                printf("ERROR: Write failed\n");
+                SSLConn_Close(ctx, sslConn);
+                return EXIT_FAILURE;
+            }
+
+            if (ret == 1)
+                sslConn->state = READ;
+            break;
+
+        case CLOSED:
+            break;
+    }
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+    /* Poll for the completion before waiting on io_uring. */
+    if (ret == 4 && !sslConn->pending) {
+        sslConn->pending = 1;
+        ctx->asyncPending++;
+    }
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+/* Process the data received for a connection.
+ * Continues while the connection gets ready to read more of the data already
+ * received, e.g. client data that arrived with the end of the handshake.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ */
+static void SSLConn_Process(SSLConn_CTX* ctx, SSLConn* sslConn)
+{
+    SSLState state;
+
+    do {
+        state = sslConn->state;
+        SSLConn_ReadWrite(ctx, sslConn);
+    }
+    while (sslConn->state != state && sslConn->state == READ &&
+           sslConn->inHead != -1);
+
+    /* Nothing more will be received. */
+    if (sslConn->eof)
+        SSLConn_Close(ctx, sslConn);
+}
+
+/* Handle the completion of a receive on a connection.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ * cqe      The completion queue entry.
+ */
+static void SSLConn_RecvDone(SSLConn_CTX* ctx, SSLConn* sslConn,
+                             struct io_uring_cqe* cqe)
+{
+    Uring* ring = &ctx->ring;
+    int    bid;
+
+    if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+        sslConn->recvArmed = 0;
+        sslConn->inflight--;
+    }
+
+    if (cqe->res > 0) {
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (sslConn->state == CLOSED) {
+            Uring_BufReturn(ring, bid);
+            return;
+        }
+
+        /* Add buffer to end of connection's list of received data. */
+        ring->bufLen[bid] = cqe->res;
+        ring->bufNext[bid] = -1;
+        if (sslConn->inTail == -1)
+            sslConn->inHead = bid;
+        else
+            ring->bufNext[sslConn->inTail] = bid;
+        sslConn->inTail = bid;
+
+        if (ctx->totalTime == 0)
+            ctx->totalTime = current_time(1);
+        SSLConn_Process(ctx, sslConn);
+
+        /* Keep receiving. */
+        if (sslConn->state != CLOSED && !sslConn->recvArmed)
+            Uring_Recv(ctx, sslConn);
+    }
+    else if (cqe->res == -ENOBUFS) {
+        /* Receive again when buffers have been given back. */
+        ctx->starved = 1;
+        ctx->starvedReturned = ring->bufReturned;
+    }
+    else if (sslConn->state != CLOSED) {
+        /* Client closed connection or error. */
+        sslConn->eof = 1;
+        SSLConn_Process(ctx, sslConn);
+    }
+}
+
+/* Handle the completion of a send on a connection.
+ *
+ * ctx      The SSL/TLS connection data.
+ * sslConn  The SSL connection data object.
+ * cqe      The completion queue entry.
+ */
+static void SSLConn_SendDone(SSLConn_CTX* ctx, SSLConn* sslConn,
+                             struct io_uring_cqe* cqe)
+{
+    sslConn->sending = 0;
+    sslConn->inflight--;
+
+    if (sslConn->state == CLOSED)
+        return;
+    if (cqe->res < 0) {
+        fprintf(stderr, "ERROR: failed to send (%d)\n", -cqe->res);
+        SSLConn_Close(ctx, sslConn);
+        return;
+    }
+
+    /* Move any data that is left to send to the front of the buffer. */
+    sslConn->outSent += cqe->res;
+    sslConn->outLen -= sslConn->outSent;
+    memmove(sslConn->out, sslConn->out + sslConn->outSent, sslConn->outLen);
+    sslConn->outSent = 0;
+
+    if (sslConn->outLen > 0 && !sslConn->queued) {
+        sslConn->queued = 1;
+        sslConn->sendNext = ctx->sendList;
+        ctx->sendList = sslConn;
+    }
+
+    /* wolfSSL can now write the rest. */
+    if (sslConn->wantWrite) {
+        sslConn->wantWrite = 0;
+        SSLConn_Process(ctx, sslConn);
+    }
+}
+
+/* Submit a send for each connection that has data to send.
+ * Sends are all made in the next single io_uring_enter call.
+ *
+ * ctx  The SSL/TLS connection data.
+ */
+static void SSLConn_FlushSends(SSLConn_CTX* ctx)
+{
+    SSLConn* sslConn = ctx->sendList;
+    SSLConn* next;
+
+    ctx->sendList = NULL;
+
+    for (; sslConn != NULL; sslConn = next) {
+        next = sslConn->sendNext;
+        sslConn->queued = 0;
+
+        if (sslConn->state == CLOSED)
+            continue;
+        if (sslConn->sending) {
+            /* Sent on completion of outstanding send. */
+            continue;
+        }
+        if (sslConn->outLen > 0)
+            Uring_Send(ctx, sslConn);
+    }
+}
+
+/* Start receiving again on connections that ran out of receive buffers.
+ * A receive is only made for each buffer given back since running out - a
+ * receive made without a buffer fails straight away.
+ *
+ * ctx  The SSL/TLS connection data.
+ */
+static void SSLConn_RecvRestart(SSLConn_CTX* ctx)
+{
+    SSLConn* sslConn;
+    long     avail = ctx->ring.bufReturned - ctx->starvedReturned;
+
+    if (avail == 0)
+        return;
+
+    ctx->starved = 0;
+    for (sslConn = ctx->sslConn; sslConn != NULL; sslConn = sslConn->next) {
+        if (sslConn->recvArmed || sslConn->eof)
+            continue;
+        if (avail == 0) {
+            /* Rest wait for more buffers to be given back. */
+            ctx->starved = 1;
+            ctx->starvedReturned = ctx->ring.bufReturned;
+            break;
+        }
+        Uring_Recv(ctx, sslConn);
+        avail--;
+    }
+}
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+/* Find the connection that an asynchronous event completed for.
+ *
+ * ctx    The SSL/TLS connection data.
+ * event  The completed event.
+ * returns the SSL connection data object or NULL when not found.
+ */
+static SSLConn* SSLConn_FromEvent(SSLConn_CTX* ctx, WOLF_EVENT* event)
+{
+#ifdef HAVE_EX_DATA
+    (void)ctx;
+
+    return (SSLConn*)wolfSSL_get_ex_data((WOLFSSL*)event->context,
+                                         sslConnExDataIdx);
+#else
+    SSLConn* sslConn;
+
+    /* No ex-data - search the active connections. */
+    for (sslConn = ctx->sslConn; sslConn != NULL; sslConn = sslConn->next) {
+        if (sslConn->ssl == event->context)
+            break;
+    }
+
+    return sslConn;
+#endif
+}
+
+/* Poll for completed asynchronous operations and continue the connections.
+ *
+ * ctx     The SSL/TLS connection data.
+ * sslCtx  The SSL/TLS context.
+ */
+static void SSLConn_AsyncPoll(SSLConn_CTX* ctx, WOLFSSL_CTX* sslCtx)
+{
+    int         i;
+    int         n;
+    double      start;
+    WOLF_EVENT* wolfEvents[MAX_WOLF_EVENTS];
+    SSLConn*    sslConn;
+
+    start = current_time(1);
+    if (wolfSSL_CTX_AsyncPoll(sslCtx, wolfEvents, MAX_WOLF_EVENTS,
+                              WOLF_POLL_FLAG_CHECK_HW, &n) < 0) {
+        n = 0;
+    }
+    ctx->asyncTime += current_time(0) - start;
+
+    for (i = 0; i < n; i++) {
+        sslConn = SSLConn_FromEvent(ctx, wolfEvents[i]);
+        if (sslConn == NULL || !sslConn->pending)
+            continue;
+
+        sslConn->pending = 0;
+        ctx->asyncPending--;
+        SSLConn_Process(ctx, sslConn);
+    }
+}
+#endif
+
+/* Print the connection statistics.
+ *
+ * ctx  The SSL/TLS connection data.
+ */
+static void SSLConn_PrintStats(SSLConn_CTX* ctx)
+{
+    fprintf(stderr, "wolfSSL Server Benchmark %d bytes\n"
+            "\tNum Conns         : %9d\n"
+            "\tTotal             : %9.3f ms\n"
+            "\tTotal Avg         : %9.3f ms\n"
+            "\tt/s               : %9.3f\n"
+            "\tAccept            : %9.3f ms\n"
+            "\tAccept Avg        : %9.3f ms\n",
+            ctx->replyLen,
+            ctx->numConnections - ctx->numResumed,
+            ctx->totalTime * 1000,
+            ctx->totalTime * 1000 / ctx->numConnections,
+            ctx->numConnections / ctx->totalTime,
+            ctx->acceptTime * 1000,
+            ctx->acceptTime * 1000 / (ctx->numConnections - ctx->numResumed));
+    if (ctx->numResumed > 0) {
+        fprintf(stderr,
+                "\tResumed Conns     : %9d\n"
+                "\tResume            : %9.3f ms\n"
+                "\tResume Avg        : %9.3f ms\n",
+                ctx->numResumed,
+                ctx->resumeTime * 1000,
+                ctx->resumeTime * 1000 / ctx->numResumed);
+    }
+#ifdef WOLFSSL_ASYNC_CRYPT
+    fprintf(stderr,
+            "\tAsync             : %9.3f ms\n"
+            "\tAsync Avg         : %9.3f ms\n",
+            ctx->asyncTime * 1000,
+            ctx->asyncTime * 1000 / ctx->numConnections);
+#endif
+    fprintf(stderr,
+            "\tTotal Read bytes  : %9d bytes\n"
+            "\tTotal Write bytes : %9d bytes\n"
+            "\tRead              : %9.3f ms (%9.3f MBps)\n"
+            "\tWrite             : %9.3f ms (%9.3f MBps)\n",
+            ctx->totalReadBytes,
+            ctx->totalWriteBytes,
+            ctx->readTime * 1000,
+            ctx->totalReadBytes / ctx->readTime / 1024 / 1024,
+            ctx->writeTime * 1000,
+            ctx->totalWriteBytes / ctx->writeTime / 1024 / 1024 );
+    fprintf(stderr,
+            "\tio_uring_enter    : %9ld\n"
+            "\tio_uring_enter Avg: %9.3f per conn\n",
+            ctx->ring.numEnter,
+            (double)ctx->ring.numEnter / ctx->numConnections);
+}
+
+
+/* Initialize the wolfSSL library and create a wolfSSL context.
+ *
+ * version      The protocol version.
+ * cert         The server's certificate.
+ * key          The server's private key matching the certificate.
+ * verifyCert   The certificate for client authentication.
+ * cipherList   The list of negotiable ciphers.
+ * wolfsslCtx  The new wolfSSL context object.
+ * returns EXIT_SUCCESS when a wolfSSL context object is created and
+ * EXIT_FAILURE otherwise.
+ */
+static int WolfSSLCtx_Init(int version, int allowDowngrade, char* cert,
+    char* key, char* verifyCert, char* cipherList, WOLFSSL_CTX** wolfsslCtx)
+{
+    WOLFSSL_CTX* ctx;
+    wolfSSL_method_func method = NULL;
+
+    method = SSL_GetMethod(version, allowDowngrade);
+    if (method == NULL)
+        return(EXIT_FAILURE);
+
+    /* Create and initialize WOLFSSL_CTX structure */
+    if ((ctx = wolfSSL_CTX_new(method(NULL))) == NULL) {
+        fprintf(stderr, "wolfSSL_CTX_new error.\n");
+        return(EXIT_FAILURE);
+    }
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+    if (wolfAsync_DevOpen(&devId) != 0) {
+        fprintf(stderr, "Async device open failed\nRunning without async\n");
+    }
+
+    wolfSSL_CTX_UseAsync(ctx, devId);
+#endif
+
+    /* Data is received and sent with io_uring. */
+    wolfSSL_CTX_SetIORecv(ctx, SSLConn_IORecv);
+    wolfSSL_CTX_SetIOSend(ctx, SSLConn_IOSend);
+
+    /* Load server certificate into WOLFSSL_CTX */
+    if (wolfSSL_CTX_use_certificate_file(ctx, cert, SSL_FILETYPE_PEM)
+            != SSL_SUCCESS) {
+        fprintf(stderr, "Error loading %s, please check the file.\n", cert);
+        wolfSSL_CTX_free(ctx);
+        return(EXIT_FAILURE);
+    }
+
+    /* Load server key into WOLFSSL_CTX */
+    if (wolfSSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM)
+            != SSL_SUCCESS) {
+        fprintf(stderr, "Error loading %s, please check the file.\n", key);
+        wolfSSL_CTX_free(ctx);
+        return(EXIT_FAILURE);
+    }
+
+    /* Setup client authentication. */
+    wolfSSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, 0);
+    if (wolfSSL_CTX_load_verify_locations(ctx, verifyCert, 0) != SSL_SUCCESS) {
+        fprintf(stderr, "Error loading %s, please check the file.\n",
+                verifyCert);
+        wolfSSL_CTX_free(ctx);
+        return(EXIT_FAILURE);
+    }
+
+    if (cipherList != NULL) {
+        if (wolfSSL_CTX_set_cipher_list(ctx, cipherList) != SSL_SUCCESS) {
+            fprintf(stderr, "Server can't set cipher list.\n");
+            wolfSSL_CTX_free(ctx);
+            return(EXIT_FAILURE);
+        }
+    }
+
+#ifndef NO_DH
+    SetDHCtx(ctx);
+#endif
+
+    *wolfsslCtx = ctx;
+    return EXIT_SUCCESS;
+}
+
+/* Cleanup the wolfSSL context and wolfSSL library.
+ *
+ * ctx  The wolfSSL context object.
+ */
+static void WolfSSLCtx_Final(WOLFSSL_CTX* ctx)
+{
+    wolfSSL_CTX_free(ctx);
+#ifdef WOLFSSL_ASYNC_CRYPT
+    wolfAsync_DevClose(&devId);
+#endif
+}
+
+/* Create a random reply.
+ *
+ * reply     The buffer to put the random data into.
+ * replyLen  The amount of data to generate.
+ */
+static void RandomReply(char* reply, int replyLen)
+{
+    int ret;
+    WC_RNG rng;
+
+    ret = wc_InitRng(&rng);
+    if (ret != 0) {
+        fprintf(stderr, "Error: initialize random\n");
+        exit(EXIT_FAILURE);
+    }
+
+    ret = wc_RNG_GenerateBlock(&rng, (byte*)reply, replyLen);
+    wc_FreeRng(&rng);
+    if (ret != 0) {
+        fprintf(stderr, "Error: initialize random\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/* Create a socket to listen on and wait for first client.
+ *
+ * port        The port to listen on.
+ * numClients  The number of clients for listen to support.
+ * socketfd    The socket file descriptor to accept on.
+ * returns EXIT_SUCCESS on success and EXIT_FAILURE otherwise.
+ */
+static int CreateSocketListen(int port, int numClients, socklen_t* socketfd) {
+    int                 ret;
+    socklen_t           sockfd;
+    struct sockaddr_in  serverAddr = {0};
+    int                 on = 1;
+    socklen_t           len = sizeof(on);
+
+    /* Set the server's address. */
+    memset((char *)&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family      = AF_INET;
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
+    serverAddr.sin_port        = htons(port);
+
+    /* Create a socket to listen on for new connections. */
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == (socklen_t)-1) {
+        fprintf(stderr, "ERROR: failed to create the socket\n");
+        return(EXIT_FAILURE);
+    }
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, len) < 0)
+        fprintf(stderr, "setsockopt SO_REUSEADDR failed\n");
+    if (setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, len) < 0)
+        fprintf(stderr, "setsockopt TCP_NODELAY failed\n");
+
+    if (bind(sockfd, (struct sockaddr *)&serverAddr,
+             sizeof(serverAddr)) < 0) {
+        fprintf(stderr, "ERROR: failed to bind\n");
+        return(EXIT_FAILURE);
+    }
+
+    printf("Waiting for a connection...\n");
+
+    /* Listen for a client to connect. */
+    ret = listen(sockfd, numClients);
+    if (ret == -1) {
+        fprintf(stderr, "ERROR: failed to listen\n");
+        return(EXIT_FAILURE);
+    }
+
+    *socketfd = sockfd;
+    return EXIT_SUCCESS;
+}
+
+/* Display the usage for the program.
+ */
+static void Usage(void)
+{
+    printf("perf " LIBWOLFSSL_VERSION_STRING
+           " (NOTE: All files relative to wolfSSL home dir)\n");
+    printf("-?          Help, print this usage\n");
+    printf("-p <num>    Port to listen on, not 0, default %d\n", wolfSSLPort);
+    printf("-v <num>    SSL version [0-3], SSLv3(0) - TLS1.2(3)), default %d\n",
+                                 SERVER_DEFAULT_VERSION);
+    printf("-a          Allow TLS version downgrade\n");
+    printf("-l <str>    Cipher suite list (: delimited)\n");
+    printf("-c <file>   Certificate file,           default %s\n", SVR_CERT);
+    printf("-k <file>   Key file,                   default %s\n", SVR_KEY);
+    printf("-A <file>   Certificate Authority file, default %s\n", CLI_CERT);
+    printf("-n <num>    Benchmark <num> connections\n");
+    printf("-N <num>    <num> concurrent connections\n");
+    printf("-R <num>    <num> bytes read from client\n");
+    printf("-W <num>    <num> bytes written to client\n");
+    printf("-B <num>    Benchmark <num> written bytes\n");
+}
+
+/* Main entry point for the program.
+ *
+ * argc  The count of command line arguments.
+ * argv  The command line arguments.
+ * returns 0 on success and 1 otherwise.
+ */
+int main(int argc, char* argv[])
+{
+    socklen_t           socketfd = -1;
+    int                 ch;
+    WOLFSSL_CTX*        ctx = NULL;
+    SSLConn_CTX*        sslConnCtx;
+    Uring*              ring;
+    word16              port          = wolfSSLPort;
+    char*               cipherList    = NULL;
+    char*               ourCert       = SVR_CERT;
+    char*               ourKey        = SVR_KEY;
+    char*               verifyCert    = CLI_CERT;
+    int                 version       = SERVER_DEFAULT_VERSION;
+    int                 allowDowngrade= 0;
+    int                 numConns      = SSL_NUM_CONN;
+    int                 numBytesRead  = NUM_READ_BYTES;
+    int                 numBytesWrite = NUM_WRITE_BYTES;
+    int                 maxBytes      = MAX_BYTES;
+    int                 maxConns      = MAX_CONNECTIONS;
+    int                 numClients    = NUM_CLIENTS;
+
+    /* Parse the command line arguments. */
+    while ((ch = mygetopt(argc, argv, OPTIONS)) != -1) {
+        switch (ch) {
+            /* Help with command line options. */
+            case '?':
+                Usage();
+                exit(EXIT_SUCCESS);
+
+            /* Port number to listen on. */
+            case 'p':
+                port = (word16)atoi(myoptarg);
+                break;
+
+            /* Version of SSL/TLS to use. */
+            case 'v':
+                version = atoi(myoptarg);
+                if (version < 0 || version > 3) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+            case 'a':
+                allowDowngrade = 1;
+                break;
+
+            /* List of cipher suites to use. */
+            case 'l':
+                cipherList = myoptarg;
+                break;
+
+            /* File name of server certificate for authentication. */
+            case 'c':
+                ourCert = myoptarg;
+                break;
+
+            /* File name of server private key for authentication. */
+            case 'k':
+                ourKey = myoptarg;
+                break;
+
+            /* File name of client certificate/CA for peer verification. */
+            case 'A':
+                verifyCert = myoptarg;
+                break;
+
+            /* Number of connections to make. */
+            case 'n':
+                maxConns  = atoi(myoptarg);
+                if (maxConns < 0 || maxConns > 1000000) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                maxBytes = 0;
+                break;
+
+            /* Number of conncurrent connections to use. */
+            case 'N':
+                numConns  = atoi(myoptarg);
+                if (numConns < 0 || numConns > 1000000) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
+            /* Number of bytes to read each call. */
+            case 'R':
+                numBytesRead = atoi(myoptarg);
+                if (numBytesRead <= 0 || numBytesRead > NUM_READ_BYTES) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
+            /* Number of bytes to write each call. */
+            case 'W':
+                numBytesWrite = atoi(myoptarg);
+                if (numBytesWrite <= 0 || numBytesWrite > NUM_WRITE_BYTES) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                break;
+
+            /* Maximum number of read and write bytes (separate counts). */
+            case 'B':
+                maxBytes = atoi(myoptarg);
+                if (maxBytes <= 0) {
+                    Usage();
+                    exit(MY_EX_USAGE);
+                }
+                maxConns = 0;
+                break;
+
+            /* Unrecognized command line argument. */
+            default:
+                Usage();
+                exit(MY_EX_USAGE);
+        }
+    }
+
+#ifdef DEBUG_WOLFSSL
+    wolfSSL_Debugging_ON();
+#endif
+
+    /* Initialize wolfSSL */
+    wolfSSL_Init();
+
+#if defined(WOLFSSL_ASYNC_CRYPT) && defined(HAVE_EX_DATA)
+    /* Reserve an ex-data index to store the connection against. */
+    sslConnExDataIdx = wolfSSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    if (sslConnExDataIdx < 0) {
+        fprintf(stderr, "ERROR: failed to get ex-data index\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    /* Initialize wolfSSL and create a context object. */
+    if (WolfSSLCtx_Init(version, allowDowngrade, ourCert, ourKey, verifyCert, cipherList, &ctx)
+            == -1)
+        exit(EXIT_FAILURE);
+
+    RandomReply(reply, sizeof(reply));
+
+    /* Create SSL/TLS connection data object with io_uring. */
+    sslConnCtx = SSLConn_New(numConns, numBytesRead, numBytesWrite,
+                              maxConns, maxBytes);
+    if (sslConnCtx == NULL)
+        exit(EXIT_FAILURE);
+    ring = &sslConnCtx->ring;
+
+    /* Create a socket and listen for a client. */
+    if (CreateSocketListen(port, numClients, &socketfd) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+
+    /* Accept all clients with one submission. */
+    Uring_Accept(sslConnCtx, socketfd);
+
+    /* Keep handling clients until done. */
+    while (!SSLConn_Done(sslConnCtx)) {
+        unsigned             head;
+        struct io_uring_cqe* cqe;
+        SSLConn*             sslConn;
+        int                  wait = 1;
+        int                  ret;
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+        /* Don't block while waiting on asynchronous operations. */
+        if (sslConnCtx->asyncPending > 0)
+            wait = 0;
+#endif
+        /* Submit all queued operations and wait for completions. */
+        if (Uring_Enter(ring, wait) < 0)
+            exit(EXIT_FAILURE);
+
+        /* Process all completions. */
+        head = *ring->cqHead;
+        while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+            cqe = &ring->cqes[head & ring->cqMask];
+
+            if (cqe->user_data == URING_OP_ACCEPT) {
+                if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+                    sslConnCtx->acceptArmed = 0;
+                if (cqe->res >= 0) {
+                    /* Accepted before the cancel took effect - keep until
+                     * there is room rather than resetting the client. */
+                    if (sslConnCtx->cnt == sslConnCtx->numConns) {
+                        ret = SSLConn_AcceptWait(sslConnCtx, cqe->res);
+                    }
+                    else {
+                        ret = SSLConn_Accept(sslConnCtx, ctx, cqe->res);
+                    }
+                    if (ret != EXIT_SUCCESS)
+                        close(cqe->res);
+                    /* Don't accept any more TCP connections. */
+                    if (sslConnCtx->cnt == sslConnCtx->numConns &&
+                            sslConnCtx->accepting) {
+                        Uring_CancelAccept(sslConnCtx);
+                    }
+                }
+                else if (cqe->res != -ECANCELED) {
+                    fprintf(stderr, "ERROR: failed to accept (%d)\n",
+                            -cqe->res);
+                }
+            }
+            else if (cqe->user_data != URING_OP_CANCEL) {
+                sslConn = (SSLConn*)(unsigned long)(cqe->user_data &
+                                                    ~URING_OP_MASK);
+                if ((cqe->user_data & URING_OP_MASK) == URING_OP_RECV)
+                    SSLConn_RecvDone(sslConnCtx, sslConn, cqe);
+                else
+                    SSLConn_SendDone(sslConnCtx, sslConn, cqe);
+            }
+
+            head++;
+            __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+        }
+
+#ifdef WOLFSSL_ASYNC_CRYPT
+        if (sslConnCtx->asyncPending > 0)
+            SSLConn_AsyncPoll(sslConnCtx, ctx);
+#endif
+
+        /* Send the data of all connections in next submission. */
+        SSLConn_FlushSends(sslConnCtx);
+        if (sslConnCtx->starved)
+            SSLConn_RecvRestart(sslConnCtx);
+        SSLConn_FreeSSLConn(sslConnCtx, 0);
+
+        /* Connections accepted while full take the slots freed first. */
+        if (sslConnCtx->numWaitFds > 0)
+            SSLConn_AcceptWaiting(sslConnCtx, ctx);
+
+        /* Accept more connections again up to the maximum concurrent. */
+        if (!sslConnCtx->acceptArmed &&
+            sslConnCtx->cnt < sslConnCtx->numConns) {
+            Uring_Accept(sslConnCtx, socketfd);
+        }
+    }
+
+    sslConnCtx->totalTime = current_time(0) - sslConnCtx->totalTime;
+
+    if (socketfd != (socklen_t)-1)
+        close(socketfd);
+
+    SSLConn_PrintStats(sslConnCtx);
+    SSLConn_Free(sslConnCtx);
+
+    WolfSSLCtx_Final(ctx);
+
+    wolfSSL_Cleanup();
+
+    exit(EXIT_SUCCESS);
+}